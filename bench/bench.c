@@ -0,0 +1,546 @@
+// bench is a load generator for miniredis, or any server speaking RESP. Its
+// threads each drive a share of the connections, keeping a pipeline of
+// requests in flight on every one, and the latency of each request, from
+// the write of its batch to the read of its reply, is counted in a histogram.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../buf.h"
+#include "../histogram.h"
+
+enum {
+  OP_PING,
+  OP_GET,
+  OP_SET,
+  OP_SETEX,
+  OP_DEL,
+  OP_HSET,
+  OP_HGET,
+  OP_LPUSH,
+  OP_LPOP,
+  OP_SADD,
+  OP_ZADD,
+  OP_COUNT,
+};
+
+// Each type has its own keys, so a mix of commands does not fail with
+// WRONGTYPE.
+static const char* op_prefixes[] = {
+    "", "key:", "key:", "key:", "key:", "hash:",
+    "hash:", "list:", "list:", "set:", "zset:",
+};
+
+static const char* op_names[] = {
+    "ping", "get",   "set",  "setex", "del",  "hset",
+    "hget", "lpush", "lpop", "sadd",  "zadd", NULL,
+};
+
+struct options {
+  const char* host;
+  const char* port;
+  int threads;
+  int conns;
+  int pipeline;
+  int64_t requests;
+  double seconds;
+  int64_t keyspace;
+  double zipf;  // skew of the key distribution, 0 for uniform
+  int64_t minsize;
+  int64_t maxsize;
+  int64_t ttl;  // seconds, for setex
+  int weights[OP_COUNT];
+  int totalweight;
+};
+
+// zipf draws ranks from 0 to n-1 with probability proportional to
+// 1/(rank+1)^theta in constant time, as in Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases".
+struct zipf {
+  int64_t n;
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+};
+
+struct conn {
+  int fd;
+  struct buf out;
+  size_t sent;
+  char* in;
+  size_t inlen;
+  size_t incap;
+  int pending;      // replies still expected for the batch
+  uint64_t start;   // write time of the batch, ns
+};
+
+struct worker {
+  pthread_t thread;
+  struct options* opts;
+  struct zipf* zipf;
+  struct conn* conns;
+  int nconns;
+  uint64_t rand;
+  char* value;
+  struct histogram hist;
+  int64_t done;
+  int64_t errors;
+};
+
+static volatile bool stop;
+static int64_t budget;  // requests left to send, shared by the workers
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_next(uint64_t* state) {
+  // xorshift64*
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rand_double(uint64_t* state) {
+  return (double)(rand_next(state) >> 11) / (1ULL << 53);
+}
+
+static void zipf_init(struct zipf* z, int64_t n, double theta) {
+  z->n = n;
+  z->theta = theta;
+  z->alpha = 1 / (1 - theta);
+  z->zetan = 0;
+  for (int64_t i = 1; i <= n; i++) {
+    z->zetan += 1 / pow(i, theta);
+  }
+  double zeta2 = 1 + 1 / pow(2, theta);
+  z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+static int64_t zipf_next(struct zipf* z, uint64_t* state) {
+  double u = rand_double(state);
+  double uz = u * z->zetan;
+  if (uz < 1) {
+    return 0;
+  }
+  if (uz < 1 + pow(0.5, z->theta)) {
+    return 1;
+  }
+  int64_t rank = z->n * pow(z->eta * u - z->eta + 1, z->alpha);
+  return rank < z->n ? rank : z->n - 1;
+}
+
+// next_key picks a key. Zipfian ranks are scrambled so the hot keys are
+// spread over the keyspace rather than clustered at its start.
+static int64_t next_key(struct worker* w) {
+  struct options* opts = w->opts;
+  if (!w->zipf) {
+    return rand_next(&w->rand) % opts->keyspace;
+  }
+  uint64_t rank = zipf_next(w->zipf, &w->rand);
+  return (rank * 0x9E3779B97F4A7C15ULL >> 11) % opts->keyspace;
+}
+
+static bool write_cmd(struct buf* out, int argc, const char** argv,
+                      const size_t* lens) {
+  char hdr[32];
+  int n = snprintf(hdr, sizeof(hdr), "*%d\r\n", argc);
+  if (!buf_append(out, hdr, n)) return false;
+  for (int i = 0; i < argc; i++) {
+    n = snprintf(hdr, sizeof(hdr), "$%zu\r\n", lens[i]);
+    if (!buf_append(out, hdr, n) || !buf_append(out, argv[i], lens[i]) ||
+        !buf_append(out, "\r\n", 2)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// write_request appends a request drawn from the command mix.
+static bool write_request(struct worker* w, struct buf* out) {
+  struct options* opts = w->opts;
+  int pick = rand_next(&w->rand) % opts->totalweight;
+  int op = 0;
+  while (pick >= opts->weights[op]) {
+    pick -= opts->weights[op++];
+  }
+  char key[32], member[32], ttl[32];
+  int64_t k = next_key(w);
+  size_t keylen =
+      snprintf(key, sizeof(key), "%s%" PRId64, op_prefixes[op], k);
+  size_t memberlen = snprintf(member, sizeof(member), "m:%" PRIu64,
+                              rand_next(&w->rand) % 1000);
+  size_t ttllen = snprintf(ttl, sizeof(ttl), "%" PRId64, opts->ttl);
+  size_t vallen = opts->minsize;
+  if (opts->maxsize > opts->minsize) {
+    vallen += rand_next(&w->rand) % (opts->maxsize - opts->minsize + 1);
+  }
+  const char* val = w->value;
+  switch (op) {
+    case OP_PING:
+      return write_cmd(out, 1, (const char*[]){"PING"}, (size_t[]){4});
+    case OP_GET:
+      return write_cmd(out, 2, (const char*[]){"GET", key},
+                       (size_t[]){3, keylen});
+    case OP_SET:
+      return write_cmd(out, 3, (const char*[]){"SET", key, val},
+                       (size_t[]){3, keylen, vallen});
+    case OP_SETEX:
+      return write_cmd(out, 5, (const char*[]){"SET", key, val, "EX", ttl},
+                       (size_t[]){3, keylen, vallen, 2, ttllen});
+    case OP_DEL:
+      return write_cmd(out, 2, (const char*[]){"DEL", key},
+                       (size_t[]){3, keylen});
+    case OP_HSET:
+      return write_cmd(out, 4, (const char*[]){"HSET", key, member, val},
+                       (size_t[]){4, keylen, memberlen, vallen});
+    case OP_HGET:
+      return write_cmd(out, 3, (const char*[]){"HGET", key, member},
+                       (size_t[]){4, keylen, memberlen});
+    case OP_LPUSH:
+      return write_cmd(out, 3, (const char*[]){"LPUSH", key, val},
+                       (size_t[]){5, keylen, vallen});
+    case OP_LPOP:
+      return write_cmd(out, 2, (const char*[]){"LPOP", key},
+                       (size_t[]){4, keylen});
+    case OP_SADD:
+      return write_cmd(out, 3, (const char*[]){"SADD", key, member},
+                       (size_t[]){4, keylen, memberlen});
+    default:
+      return write_cmd(out, 4, (const char*[]){"ZADD", key, "1", member},
+                       (size_t[]){4, keylen, 1, memberlen});
+  }
+}
+
+// reply_len returns the length of the complete reply at the start of data,
+// or 0 if it is incomplete.
+static size_t reply_len(const char* data, size_t len, bool* error) {
+  const char* nl = memchr(data, '\n', len);
+  if (!nl) {
+    return 0;
+  }
+  size_t i = nl - data + 1;
+  long n = strtol(data + 1, NULL, 10);
+  switch (data[0]) {
+    case '-':
+      *error = true;
+      return i;
+    case '$':
+      if (n < 0) return i;
+      return i + n + 2 <= len ? i + n + 2 : 0;
+    case '*':
+      for (long j = 0; j < n; j++) {
+        bool err = false;
+        size_t m = i < len ? reply_len(data + i, len - i, &err) : 0;
+        if (m == 0) return 0;
+        i += m;
+      }
+      return i;
+    default:
+      return i;
+  }
+}
+
+static bool take_batch(int n) {
+  if (stop) {
+    return false;
+  }
+  if (budget < 0) {
+    return true;
+  }
+  pthread_mutex_lock(&budget_lock);
+  bool ok = budget >= n;
+  if (ok) {
+    budget -= n;
+  }
+  pthread_mutex_unlock(&budget_lock);
+  return ok;
+}
+
+// conn_start writes a new batch of requests to the connection. Returns false
+// once there is nothing left to send.
+static bool conn_start(struct worker* w, struct conn* c) {
+  if (!take_batch(w->opts->pipeline)) {
+    return false;
+  }
+  c->out.len = 0;
+  c->sent = 0;
+  for (int i = 0; i < w->opts->pipeline; i++) {
+    if (!write_request(w, &c->out)) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  c->pending = w->opts->pipeline;
+  c->start = now_ns();
+  return true;
+}
+
+static bool conn_read(struct worker* w, struct conn* c) {
+  if (c->incap - c->inlen < 65536) {
+    c->incap = c->incap ? c->incap * 2 : 131072;
+    c->in = realloc(c->in, c->incap);
+    if (!c->in) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  ssize_t n = read(c->fd, c->in + c->inlen, c->incap - c->inlen);
+  if (n <= 0) {
+    if (n == -1 && errno == EAGAIN) return true;
+    fprintf(stderr, "read: %s\n", n ? strerror(errno) : "connection closed");
+    return false;
+  }
+  c->inlen += n;
+  size_t off = 0;
+  uint64_t now = now_ns();
+  while (c->pending > 0 && off < c->inlen) {
+    bool error = false;
+    size_t m = reply_len(c->in + off, c->inlen - off, &error);
+    if (m == 0) break;
+    off += m;
+    c->pending--;
+    w->done++;
+    w->errors += error;
+    histogram_record(&w->hist, now - c->start);
+  }
+  memmove(c->in, c->in + off, c->inlen - off);
+  c->inlen -= off;
+  return true;
+}
+
+static void* worker_main(void* arg) {
+  struct worker* w = arg;
+  struct pollfd* pfds = calloc(w->nconns, sizeof(struct pollfd));
+  int active = 0;
+  for (int i = 0; i < w->nconns; i++) {
+    active += conn_start(w, &w->conns[i]);
+  }
+  while (active > 0) {
+    for (int i = 0; i < w->nconns; i++) {
+      struct conn* c = &w->conns[i];
+      pfds[i].fd = c->pending ? c->fd : -1;
+      pfds[i].events = POLLIN | (c->sent < c->out.len ? POLLOUT : 0);
+    }
+    if (poll(pfds, w->nconns, 100) == -1 && errno != EINTR) {
+      perror("poll");
+      exit(1);
+    }
+    for (int i = 0; i < w->nconns; i++) {
+      struct conn* c = &w->conns[i];
+      if (pfds[i].revents & POLLOUT) {
+        ssize_t n = write(c->fd, c->out.data + c->sent, c->out.len - c->sent);
+        if (n == -1 && errno != EAGAIN) {
+          perror("write");
+          exit(1);
+        }
+        c->sent += n > 0 ? n : 0;
+      }
+      if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        if (!conn_read(w, c)) {
+          exit(1);
+        }
+        if (c->pending == 0) {
+          active -= !conn_start(w, c);
+        }
+      }
+    }
+  }
+  free(pfds);
+  return NULL;
+}
+
+static int dial(struct options* opts) {
+  struct addrinfo hints = {0}, *ai;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(opts->host, opts->port, &hints, &ai);
+  if (err) {
+    fprintf(stderr, "%s: %s\n", opts->host, gai_strerror(err));
+    exit(1);
+  }
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (fd == -1 || connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+    fprintf(stderr, "connect %s:%s: %s\n", opts->host, opts->port,
+            strerror(errno));
+    exit(1);
+  }
+  freeaddrinfo(ai);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+// parse_mix reads a command mix such as "get:80,set:20".
+static bool parse_mix(struct options* opts, const char* str) {
+  memset(opts->weights, 0, sizeof(opts->weights));
+  opts->totalweight = 0;
+  char* copy = strdup(str);
+  char* save;
+  for (char* tok = strtok_r(copy, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    char* colon = strchr(tok, ':');
+    int weight = colon ? atoi(colon + 1) : 1;
+    if (colon) *colon = '\0';
+    int op = 0;
+    while (op_names[op] && strcasecmp(op_names[op], tok) != 0) op++;
+    if (!op_names[op] || weight < 0) {
+      free(copy);
+      return false;
+    }
+    opts->weights[op] += weight;
+    opts->totalweight += weight;
+  }
+  free(copy);
+  return opts->totalweight > 0;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -h host       server host (127.0.0.1)\n"
+          "  -p port       server port (9002)\n"
+          "  -t threads    load generator threads (4)\n"
+          "  -c conns      connections, spread over the threads (50)\n"
+          "  -P pipeline   requests in flight per connection (16)\n"
+          "  -n requests   total requests (1000000)\n"
+          "  -d seconds    run for a duration instead of -n\n"
+          "  -r keyspace   number of distinct keys (1000000)\n"
+          "  -z theta      zipfian key skew in [0, 1), 0 is uniform (0)\n"
+          "  -s size       value size, or min-max for a uniform range (16)\n"
+          "  -e ttl        seconds, for setex (60)\n"
+          "  -m mix        command weights (get:80,set:20), from: ping get "
+          "set\n"
+          "                setex del hset hget lpush lpop sadd zadd\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  struct options opts = {
+      .host = "127.0.0.1",
+      .port = "9002",
+      .threads = 4,
+      .conns = 50,
+      .pipeline = 16,
+      .requests = 1000000,
+      .keyspace = 1000000,
+      .minsize = 16,
+      .maxsize = 16,
+      .ttl = 60,
+  };
+  parse_mix(&opts, "get:80,set:20");
+  int opt;
+  while ((opt = getopt(argc, argv, "h:p:t:c:P:n:d:r:z:s:e:m:")) != -1) {
+    switch (opt) {
+      case 'h': opts.host = optarg; break;
+      case 'p': opts.port = optarg; break;
+      case 't': opts.threads = atoi(optarg); break;
+      case 'c': opts.conns = atoi(optarg); break;
+      case 'P': opts.pipeline = atoi(optarg); break;
+      case 'n': opts.requests = atoll(optarg); break;
+      case 'd': opts.seconds = atof(optarg); break;
+      case 'r': opts.keyspace = atoll(optarg); break;
+      case 'z': opts.zipf = atof(optarg); break;
+      case 'e': opts.ttl = atoll(optarg); break;
+      case 's':
+        if (sscanf(optarg, "%" SCNd64 "-%" SCNd64, &opts.minsize,
+                   &opts.maxsize) == 1) {
+          opts.maxsize = opts.minsize;
+        }
+        break;
+      case 'm':
+        if (!parse_mix(&opts, optarg)) usage(argv[0]);
+        break;
+      default: usage(argv[0]);
+    }
+  }
+  if (opts.threads < 1 || opts.conns < opts.threads || opts.pipeline < 1 ||
+      opts.keyspace < 1 || opts.zipf < 0 || opts.zipf >= 1 ||
+      opts.minsize < 0 || opts.maxsize < opts.minsize) {
+    usage(argv[0]);
+  }
+  budget = opts.seconds > 0 ? -1 : opts.requests;
+
+  struct zipf zipf;
+  if (opts.zipf > 0) {
+    zipf_init(&zipf, opts.keyspace, opts.zipf);
+  }
+  char* value = malloc(opts.maxsize + 1);
+  memset(value, 'x', opts.maxsize);
+  struct worker* workers = calloc(opts.threads, sizeof(struct worker));
+  struct conn* conns = calloc(opts.conns, sizeof(struct conn));
+  if (!value || !workers || !conns) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < opts.conns; i++) {
+    conns[i].fd = dial(&opts);
+  }
+  uint64_t start = now_ns();
+  for (int i = 0, c = 0; i < opts.threads; i++) {
+    struct worker* w = &workers[i];
+    w->opts = &opts;
+    w->zipf = opts.zipf > 0 ? &zipf : NULL;
+    w->value = value;
+    w->rand = start ^ ((uint64_t)(i + 1) * 0x9E3779B97F4A7C15ULL);
+    w->nconns = opts.conns / opts.threads + (i < opts.conns % opts.threads);
+    w->conns = &conns[c];
+    c += w->nconns;
+    pthread_create(&w->thread, NULL, worker_main, w);
+  }
+  if (opts.seconds > 0) {
+    struct timespec ts = {(time_t)opts.seconds,
+                          (long)(fmod(opts.seconds, 1) * 1e9)};
+    nanosleep(&ts, NULL);
+    stop = true;
+  }
+  struct histogram* hist = calloc(1, sizeof(struct histogram));
+  int64_t done = 0, errors = 0;
+  for (int i = 0; i < opts.threads; i++) {
+    struct worker* w = &workers[i];
+    pthread_join(w->thread, NULL);
+    for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+      hist->buckets[j] += w->hist.buckets[j];
+    }
+    hist->count += w->hist.count;
+    hist->max = w->hist.max > hist->max ? w->hist.max : hist->max;
+    done += w->done;
+    errors += w->errors;
+  }
+  double elapsed = (now_ns() - start) / 1e9;
+  printf("%" PRId64 " requests in %.2f s, %d connections, pipeline %d\n",
+         done, elapsed, opts.conns, opts.pipeline);
+  printf("throughput: %.0f requests/s\n", done / elapsed);
+  if (errors) {
+    printf("errors: %" PRId64 "\n", errors);
+  }
+  double ps[] = {50, 90, 99, 99.9, 99.99};
+  printf("latency (ms):");
+  for (size_t i = 0; i < sizeof(ps) / sizeof(double); i++) {
+    printf(" p%g=%.3f", ps[i], histogram_percentile(hist, ps[i]) / 1e6);
+  }
+  printf(" max=%.3f\n", hist->max / 1e6);
+  return 0;
+}
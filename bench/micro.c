@@ -0,0 +1,247 @@
+// micro times the hot paths of the server in isolation: the hashmap, the
+// concurrent keyspace map, the RESP parser and glob matching. The parser is
+// static, so miniredis.c is compiled into this program.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../cmap.h"
+#include "../epoch.h"
+#include "../hashmap.h"
+#include "../match.h"
+#include "../miniredis.c"
+
+#define NKEYS 1000000
+
+struct item {
+  uint64_t key;
+  uint64_t val;
+};
+
+static uint64_t item_hash(const void* item) {
+  return hashmap_xxhash(item, sizeof(uint64_t));
+}
+
+static int item_compare(const void* a, const void* b) {
+  const struct item *ia = a, *ib = b;
+  return ia->key < ib->key ? -1 : ia->key > ib->key;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char* name, uint64_t start, uint64_t ops) {
+  double ns = (double)(now_ns() - start) / ops;
+  printf("%-24s %10" PRIu64 " ops %8.1f ns/op %12.0f ops/s\n", name, ops, ns,
+         1e9 / ns);
+}
+
+// sink keeps the compiler from discarding the results being timed.
+static volatile uint64_t sink;
+
+static bool free_item(void* item, void* udata) {
+  (void)udata;
+  free(item);
+  return true;
+}
+
+static void bench_hashmap(void) {
+  uint64_t* keys = malloc(NKEYS * sizeof(uint64_t));
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  for (int i = 0; i < NKEYS; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    keys[i] = state;
+  }
+  struct hashmap* map = hashmap_new(sizeof(struct item), 0, item_hash,
+                                    item_compare);
+  uint64_t start = now_ns();
+  for (int i = 0; i < NKEYS; i++) {
+    hashmap_set(map, &(struct item){keys[i], i});
+  }
+  report("hashmap_set", start, NKEYS);
+
+  start = now_ns();
+  for (int i = 0; i < NKEYS; i++) {
+    hashmap_set(map, &(struct item){keys[i], i + 1});
+  }
+  report("hashmap_set (replace)", start, NKEYS);
+
+  start = now_ns();
+  uint64_t sum = 0;
+  for (int i = 0; i < NKEYS; i++) {
+    struct item* item = hashmap_get(map, &(struct item){.key = keys[i]});
+    sum += item->val;
+  }
+  report("hashmap_get (hit)", start, NKEYS);
+
+  start = now_ns();
+  for (int i = 0; i < NKEYS; i++) {
+    sum += hashmap_get(map, &(struct item){.key = keys[i] + 1}) != NULL;
+  }
+  report("hashmap_get (miss)", start, NKEYS);
+  sink = sum;
+  hashmap_free(map);
+  free(keys);
+}
+
+struct cmap_bench {
+  struct cmap* map;
+  struct epoch* epoch;
+  uint64_t* keys;
+  atomic_bool stop;
+};
+
+struct cmap_reader {
+  struct cmap_bench* bench;
+  pthread_t thread;
+  uint64_t sum;
+};
+
+#define CMAP_READS 2000000
+
+static void* cmap_read(void* arg) {
+  struct cmap_reader* reader = arg;
+  struct cmap_bench* bench = reader->bench;
+  struct epoch_reader* er = epoch_register(bench->epoch);
+  uint64_t state = (uintptr_t)reader;
+  for (int i = 0; i < CMAP_READS; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    struct item probe = {.key = bench->keys[(state >> 33) % NKEYS]};
+    epoch_enter(er);
+    struct item* item = cmap_get(bench->map, &probe);
+    reader->sum += item->val;
+    epoch_exit(er);
+  }
+  return NULL;
+}
+
+// cmap_write replaces random items until stopped, retiring the old ones.
+static void* cmap_write(void* arg) {
+  struct cmap_bench* bench = arg;
+  uint64_t state = 1;
+  for (uint64_t i = 0; !atomic_load(&bench->stop); i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    struct item* item = malloc(sizeof(struct item));
+    *item = (struct item){bench->keys[(state >> 33) % NKEYS], i};
+    void* prev;
+    if (!cmap_set(bench->map, item, &prev)) {
+      free(item);
+      continue;
+    }
+    epoch_retire(bench->epoch, prev, free);
+    if (i % 1024 == 0) {
+      epoch_collect(bench->epoch);
+    }
+  }
+  return NULL;
+}
+
+// bench_cmap times lock-free lookups from several threads while another
+// thread keeps replacing items.
+static void bench_cmap(void) {
+  struct cmap_bench bench = {.epoch = epoch_new()};
+  bench.map = cmap_new(bench.epoch, item_hash, item_compare);
+  bench.keys = malloc(NKEYS * sizeof(uint64_t));
+  for (int i = 0; i < NKEYS; i++) {
+    bench.keys[i] = (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+    struct item* item = malloc(sizeof(struct item));
+    *item = (struct item){bench.keys[i], i};
+    void* prev;
+    cmap_set(bench.map, item, &prev);
+  }
+  pthread_t writer;
+  pthread_create(&writer, NULL, cmap_write, &bench);
+  struct cmap_reader readers[8];
+  for (int n = 1; n <= 8; n *= 2) {
+    uint64_t start = now_ns();
+    for (int i = 0; i < n; i++) {
+      readers[i] = (struct cmap_reader){.bench = &bench};
+      pthread_create(&readers[i].thread, NULL, cmap_read, &readers[i]);
+    }
+    for (int i = 0; i < n; i++) {
+      pthread_join(readers[i].thread, NULL);
+      sink += readers[i].sum;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "cmap_get x%d +writer", n);
+    report(name, start, (uint64_t)n * CMAP_READS);
+  }
+  atomic_store(&bench.stop, true);
+  pthread_join(writer, NULL);
+  cmap_scan(bench.map, free_item, NULL);
+  cmap_free(bench.map);
+  epoch_free(bench.epoch);
+  free(bench.keys);
+}
+
+static void bench_resp_parse(const char* name, const char* cmd, int iters) {
+  struct miniredis_args args = {0};
+  size_t len = strlen(cmd);
+  char* data = malloc(len);
+  memcpy(data, cmd, len);
+  uint64_t start = now_ns();
+  for (int i = 0; i < iters; i++) {
+    // the parser terminates each argument in place, which leaves the input
+    // parseable again
+    sink = resp_parse(data, len, NULL, &args);
+  }
+  report(name, start, iters);
+  if (sink != len) {
+    fprintf(stderr, "%s: parsed %" PRIu64 " of %zu bytes\n", name, sink, len);
+  }
+  for (int i = 0; i < args.cap; i++) {
+    buf_clear(&args.bufs[i]);
+  }
+  free(args.bufs);
+  free(args.items);
+  free(data);
+}
+
+static void bench_match(const char* pat, const char* str, int iters) {
+  char name[64];
+  snprintf(name, sizeof(name), "match %s", pat);
+  long plen = strlen(pat), slen = strlen(str);
+  uint64_t start = now_ns();
+  uint64_t n = 0;
+  for (int i = 0; i < iters; i++) {
+    n += match(pat, plen, str, slen);
+  }
+  report(name, start, iters);
+  sink = n;
+}
+
+int main(void) {
+  bench_hashmap();
+  bench_cmap();
+  bench_resp_parse("resp_parse GET", "*2\r\n$3\r\nGET\r\n$10\r\nkey:000001\r\n",
+                   10000000);
+  bench_resp_parse("resp_parse SET",
+                   "*3\r\n$3\r\nSET\r\n$10\r\nkey:000001\r\n$16\r\n"
+                   "xxxxxxxxxxxxxxxx\r\n",
+                   10000000);
+  bench_resp_parse("resp_parse MSET x16",
+                   "*33\r\n$4\r\nMSET\r\n"
+                   "$2\r\nk0\r\n$2\r\nv0\r\n$2\r\nk1\r\n$2\r\nv1\r\n"
+                   "$2\r\nk2\r\n$2\r\nv2\r\n$2\r\nk3\r\n$2\r\nv3\r\n"
+                   "$2\r\nk4\r\n$2\r\nv4\r\n$2\r\nk5\r\n$2\r\nv5\r\n"
+                   "$2\r\nk6\r\n$2\r\nv6\r\n$2\r\nk7\r\n$2\r\nv7\r\n"
+                   "$2\r\nk8\r\n$2\r\nv8\r\n$2\r\nk9\r\n$2\r\nv9\r\n"
+                   "$2\r\nka\r\n$2\r\nva\r\n$2\r\nkb\r\n$2\r\nvb\r\n"
+                   "$2\r\nkc\r\n$2\r\nvc\r\n$2\r\nkd\r\n$2\r\nvd\r\n"
+                   "$2\r\nke\r\n$2\r\nve\r\n$2\r\nkf\r\n$2\r\nvf\r\n",
+                   2000000);
+  bench_match("*", "user:1000:session", 10000000);
+  bench_match("user:*", "user:1000:session", 10000000);
+  bench_match("user:*:session", "user:1000:session", 10000000);
+  bench_match("*:*:*:x", "user:1000:session:abcdef", 10000000);
+  bench_match("us?r:1???:*", "user:1000:session", 10000000);
+  return 0;
+}
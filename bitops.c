@@ -0,0 +1,197 @@
+#include "bitops.h"
+
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static uint64_t load64(const unsigned char* p) {
+  uint64_t x;
+  memcpy(&x, p, 8);
+  return x;
+}
+
+static void store64(unsigned char* p, uint64_t x) { memcpy(p, &x, 8); }
+
+#ifdef __AVX2__
+// count32 counts the bits of n bytes, a multiple of 32, by looking up the
+// count of each nibble with a byte shuffle and summing the bytes with SAD.
+static uint64_t count32(const unsigned char* p, size_t n) {
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                       1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  while (i < n) {
+    // byte counters hold up to 8 per block, so 31 blocks fit before the sum
+    __m256i local = _mm256_setzero_si256();
+    for (int k = 0; k < 31 && i < n; k++, i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+      __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+      __m256i hi = _mm256_shuffle_epi8(
+          lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+      local = _mm256_add_epi8(local, _mm256_add_epi8(lo, hi));
+    }
+    acc = _mm256_add_epi64(acc,
+                           _mm256_sad_epu8(local, _mm256_setzero_si256()));
+  }
+  return (uint64_t)_mm256_extract_epi64(acc, 0) +
+         (uint64_t)_mm256_extract_epi64(acc, 1) +
+         (uint64_t)_mm256_extract_epi64(acc, 2) +
+         (uint64_t)_mm256_extract_epi64(acc, 3);
+}
+#else
+static uint64_t count32(const unsigned char* p, size_t n) {
+  uint64_t a = 0, b = 0, c = 0, d = 0;
+  for (size_t i = 0; i < n; i += 32) {
+    a += __builtin_popcountll(load64(p + i));
+    b += __builtin_popcountll(load64(p + i + 8));
+    c += __builtin_popcountll(load64(p + i + 16));
+    d += __builtin_popcountll(load64(p + i + 24));
+  }
+  return a + b + c + d;
+}
+#endif
+
+uint64_t bit_count(const unsigned char* p, size_t len) {
+  size_t n = len & ~(size_t)31;
+  uint64_t count = count32(p, n);
+  for (size_t i = n; i < len; i++) {
+    count += __builtin_popcount(p[i]);
+  }
+  return count;
+}
+
+// bit_pos returns the position of the first bit set to bit, or -1.
+int64_t bit_pos(const unsigned char* p, size_t len, int bit) {
+  unsigned char skip = bit ? 0 : 0xff;
+  size_t i = 0;
+#ifdef __AVX2__
+  __m256i vskip = _mm256_set1_epi8((char)skip);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+    if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vskip)) !=
+        0xffffffff) {
+      break;
+    }
+  }
+#endif
+  uint64_t wskip = bit ? 0 : UINT64_MAX;
+  while (i + 8 <= len && load64(p + i) == wskip) {
+    i += 8;
+  }
+  while (i < len && p[i] == skip) {
+    i++;
+  }
+  if (i == len) {
+    return -1;
+  }
+  unsigned byte = bit ? p[i] : (unsigned char)~p[i];
+  return (int64_t)i * 8 + __builtin_clz(byte) - 24;
+}
+
+#ifdef __AVX2__
+static size_t op32(int op, unsigned char* dst, const unsigned char* src,
+                   size_t len) {
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+    if (op == BITOP_AND) {
+      a = _mm256_and_si256(a, b);
+    } else if (op == BITOP_OR) {
+      a = _mm256_or_si256(a, b);
+    } else {
+      a = _mm256_xor_si256(a, b);
+    }
+    _mm256_storeu_si256((__m256i*)(dst + i), a);
+  }
+  return i;
+}
+#else
+static size_t op32(int op, unsigned char* dst, const unsigned char* src,
+                   size_t len) {
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    for (int k = 0; k < 32; k += 8) {
+      uint64_t a = load64(dst + i + k), b = load64(src + i + k);
+      store64(dst + i + k, op == BITOP_AND  ? a & b
+                           : op == BITOP_OR ? a | b
+                                            : a ^ b);
+    }
+  }
+  return i;
+}
+#endif
+
+// op_block combines len bytes of src into dst.
+static void op_block(int op, unsigned char* dst, const unsigned char* src,
+                     size_t len) {
+  for (size_t i = op32(op, dst, src, len); i < len; i++) {
+    dst[i] = op == BITOP_AND  ? dst[i] & src[i]
+             : op == BITOP_OR ? dst[i] | src[i]
+                              : dst[i] ^ src[i];
+  }
+}
+
+// Sources are combined a block at a time, so that the block of the
+// destination stays in the L1 cache while each source streams through it.
+#define BITOP_BLOCK 16384
+
+// bit_op writes len bytes to dst, the result of the operation on the n
+// sources, which are zero-padded to len. NOT takes a single source.
+void bit_op(int op, unsigned char* dst, size_t len,
+            const unsigned char** srcs, const size_t* lens, int n) {
+  for (size_t off = 0; off < len; off += BITOP_BLOCK) {
+    size_t blen = len - off < BITOP_BLOCK ? len - off : BITOP_BLOCK;
+    unsigned char* d = dst + off;
+    for (int k = 0; k < n; k++) {
+      size_t avail = lens[k] > off ? lens[k] - off : 0;
+      if (avail > blen) avail = blen;
+      if (k == 0) {
+        memcpy(d, srcs[k] + off, avail);
+        memset(d + avail, 0, blen - avail);
+        continue;
+      }
+      op_block(op, d, srcs[k] + off, avail);
+      if (op == BITOP_AND) {
+        memset(d + avail, 0, blen - avail);
+      }
+    }
+    if (op == BITOP_NOT) {
+      size_t i = 0;
+      for (; i + 8 <= blen; i += 8) {
+        store64(d + i, ~load64(d + i));
+      }
+      for (; i < blen; i++) {
+        d[i] = ~d[i];
+      }
+    }
+  }
+}
+
+// bit_get_field returns the unsigned integer of bits bits at the bit offset,
+// reading zeros past len.
+uint64_t bit_get_field(const unsigned char* p, size_t len, uint64_t offset,
+                       int bits) {
+  uint64_t value = 0;
+  for (int i = 0; i < bits; i++) {
+    uint64_t byte = (offset + i) >> 3;
+    int bit = 7 - ((offset + i) & 7);
+    value = (value << 1) | (byte < len ? (p[byte] >> bit) & 1 : 0);
+  }
+  return value;
+}
+
+// bit_set_field writes the low bits bits of value at the bit offset, which
+// must be within the bitmap.
+void bit_set_field(unsigned char* p, uint64_t offset, int bits,
+                   uint64_t value) {
+  for (int i = 0; i < bits; i++) {
+    uint64_t byte = (offset + i) >> 3;
+    int bit = 7 - ((offset + i) & 7);
+    unsigned v = (value >> (bits - 1 - i)) & 1;
+    p[byte] = (p[byte] & ~(1 << bit)) | (v << bit);
+  }
+}
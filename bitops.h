@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernels for bitmaps stored in strings. Bit 0 is the most significant bit
+// of the first byte.
+
+enum {
+  BITOP_AND,
+  BITOP_OR,
+  BITOP_XOR,
+  BITOP_NOT,
+};
+
+uint64_t bit_count(const unsigned char* p, size_t len);
+int64_t bit_pos(const unsigned char* p, size_t len, int bit);
+void bit_op(int op, unsigned char* dst, size_t len,
+            const unsigned char** srcs, const size_t* lens, int n);
+uint64_t bit_get_field(const unsigned char* p, size_t len, uint64_t offset,
+                       int bits);
+void bit_set_field(unsigned char* p, uint64_t offset, int bits,
+                   uint64_t value);
@@ -0,0 +1,374 @@
+#include "blocking.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmdlist.h"
+#include "cmdstream.h"
+#include "dict.h"
+#include "quicklist.h"
+#include "server.h"
+
+// signal_ready marks a key that was pushed to as ready, if clients are
+// blocked on it. Ready keys are served once the current command is done.
+void signal_ready(struct server* server, const char* key, size_t keylen) {
+  if (dict_get(server->blocking, key, keylen)) {
+    dict_set(server->ready, key, keylen, "", 0);
+  }
+}
+
+// argtotimeout parses a timeout in seconds into an absolute deadline, or zero
+// to wait forever.
+static bool argtotimeout(struct miniredis_conn* conn, struct server* server,
+                         struct miniredis_args* args, int index,
+                         double* deadline) {
+  const char* arg = miniredis_args_at(args, index, NULL);
+  char* end;
+  errno = 0;
+  double timeout = strtod(arg, &end);
+  if (errno || end == arg || *end || !isfinite(timeout)) {
+    miniredis_conn_write_error(conn,
+                               "ERR timeout is not a float or out of range");
+    return false;
+  }
+  if (timeout < 0) {
+    miniredis_conn_write_error(conn, "ERR timeout is negative");
+    return false;
+  }
+  *deadline = timeout > 0 ? server->now + timeout : 0;
+  return true;
+}
+
+void bpop_free(struct bpop* bpop) {
+  for (int i = 0; i < bpop->nkeys; i++) {
+    free(bpop->keys[i]);
+  }
+  free(bpop->keys);
+  free(bpop->keylens);
+  free(bpop->dst);
+  free(bpop->ids);
+  free(bpop->group);
+  free(bpop->consumer);
+  free(bpop);
+}
+
+struct waitq* waitq_get(struct server* server, const char* key,
+                        size_t keylen) {
+  struct dict_entry* entry = dict_get(server->blocking, key, keylen);
+  if (!entry) {
+    return NULL;
+  }
+  struct waitq* q;
+  memcpy(&q, dict_entry_val(entry), sizeof(q));
+  return q;
+}
+
+// waitq_remove removes the client from the waitq of the key, and the waitq
+// from the server once empty.
+static void waitq_remove(struct server* server, const char* key, size_t keylen,
+                         struct client* client) {
+  struct waitq* q = waitq_get(server, key, keylen);
+  if (!q) {
+    return;
+  }
+  for (size_t i = 0; i < q->len; i++) {
+    if (q->clients[i] == client) {
+      q->len--;
+      memmove(&q->clients[i], &q->clients[i + 1],
+              (q->len - i) * sizeof(struct client*));
+      break;
+    }
+  }
+  if (q->len == 0) {
+    dict_delete(server->blocking, key, keylen);
+    free(q->clients);
+    free(q);
+  }
+}
+
+static bool waitq_push(struct server* server, const char* key, size_t keylen,
+                       struct client* client) {
+  struct waitq* q = waitq_get(server, key, keylen);
+  if (!q) {
+    q = calloc(1, sizeof(struct waitq));
+    if (!q) {
+      return false;
+    }
+    if (dict_set(server->blocking, key, keylen, (char*)&q, sizeof(q)) == -1) {
+      free(q);
+      return false;
+    }
+  }
+  if (q->len > 0 && q->clients[q->len - 1] == client) {
+    // the key was given twice, and the client is served once for it
+    return true;
+  }
+  if (q->len == q->cap) {
+    size_t cap = q->cap ? q->cap * 2 : 4;
+    struct client** clients = realloc(q->clients, cap * sizeof(*clients));
+    if (!clients) {
+      if (q->len == 0) {
+        waitq_remove(server, key, keylen, client);
+      }
+      return false;
+    }
+    q->clients = clients;
+    q->cap = cap;
+  }
+  q->clients[q->len++] = client;
+  return true;
+}
+
+// client_unblock removes the client from the waitqs of its keys. The caller
+// resumes its connection.
+void client_unblock(struct server* server, struct client* client) {
+  struct bpop* bpop = client->bpop;
+  for (int i = 0; i < bpop->nkeys; i++) {
+    waitq_remove(server, bpop->keys[i], bpop->keylens[i], client);
+  }
+  if (bpop->prev) {
+    bpop->prev->bpop->next = bpop->next;
+  } else {
+    server->blocked = bpop->next;
+  }
+  if (bpop->next) {
+    bpop->next->bpop->prev = bpop->prev;
+  }
+  client->bpop = NULL;
+  bpop_free(bpop);
+}
+
+// client_block blocks the client on the keys at args[first:last+1] until one
+// of them is pushed to or the deadline passes. Returns false when out of
+// memory.
+bool client_block(struct server* server, struct client* client,
+                  struct miniredis_args* args, int first, int last,
+                  struct bpop* bpop) {
+  if (client->exec) {
+    // a transaction can't wait, so it times out at once
+    if (bpop->move) {
+      miniredis_conn_write_null(client->conn);
+    } else {
+      miniredis_conn_write_array(client->conn, -1);
+    }
+    bpop_free(bpop);
+    return true;
+  }
+  int nkeys = last - first + 1;
+  bpop->keys = calloc(nkeys, sizeof(char*));
+  bpop->keylens = calloc(nkeys, sizeof(size_t));
+  if (!bpop->keys || !bpop->keylens) {
+    bpop_free(bpop);
+    return false;
+  }
+  for (int i = 0; i < nkeys; i++) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, first + i, &keylen);
+    bpop->keys[i] = malloc(keylen + 1);
+    if (!bpop->keys[i]) {
+      bpop_free(bpop);
+      return false;
+    }
+    memcpy(bpop->keys[i], key, keylen + 1);
+    bpop->keylens[i] = keylen;
+    bpop->nkeys++;
+  }
+  client->bpop = bpop;
+  bpop->next = server->blocked;
+  if (server->blocked) {
+    server->blocked->bpop->prev = client;
+  }
+  server->blocked = client;
+  for (int i = 0; i < nkeys; i++) {
+    if (!waitq_push(server, bpop->keys[i], bpop->keylens[i], client)) {
+      // only the keys pushed so far are removed
+      bpop->nkeys = i;
+      client_unblock(server, client);
+      return false;
+    }
+  }
+  if (bpop->deadline &&
+      (!server->next_timeout || bpop->deadline < server->next_timeout)) {
+    server->next_timeout = bpop->deadline;
+  }
+  miniredis_conn_block(client->conn);
+  return true;
+}
+
+// bpop_reply pops an element from the head or the tail of the list for BLPOP
+// and BRPOP, and writes it along with its key.
+static void bpop_reply(struct miniredis_conn* conn, struct server* server,
+                       struct pair* pair, bool head) {
+  struct quicklist* ql = pair_obj(pair);
+  struct ql_iter it;
+  ql_index(ql, head ? 0 : -1, &it);
+  size_t len;
+  const char* elem = ql_get(&it, &len);
+  miniredis_conn_write_array(conn, 2);
+  miniredis_conn_write_bulk(conn, pair_key(pair), pair->keylen);
+  miniredis_conn_write_bulk(conn, elem, len);
+  size_t mem = pair_memory(pair);
+  ql_delete_range(ql, head ? 0 : -1, 1);
+  db_modified(server, pair, mem);
+  if (ql->count == 0) {
+    db_remove(server, pair);
+  }
+}
+
+// blocking_pop implements BLPOP and BRPOP.
+static void blocking_pop(struct miniredis_conn* conn,
+                         struct miniredis_args* args, struct server* server,
+                         bool head) {
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  double deadline;
+  if (!argtotimeout(conn, server, args, nargs - 1, &deadline)) {
+    return;
+  }
+  for (int i = 1; i < nargs - 1; i++) {
+    struct pair* pair;
+    if (!lookup_key(conn, server, args, i, TYPE_LIST, &pair)) {
+      return;
+    }
+    if (pair) {
+      bpop_reply(conn, server, pair, head);
+      return;
+    }
+  }
+  struct bpop* bpop = calloc(1, sizeof(struct bpop));
+  if (bpop) {
+    bpop->deadline = deadline;
+    bpop->head = head;
+  }
+  if (!bpop ||
+      !client_block(server, miniredis_conn_udata(conn), args, 1, nargs - 2,
+                    bpop)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  }
+}
+
+// BLPOP key [key ...] timeout
+void cmdBLPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  blocking_pop(conn, args, udata, true);
+}
+
+// BRPOP key [key ...] timeout
+void cmdBRPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  blocking_pop(conn, args, udata, false);
+}
+
+// BLMOVE source destination LEFT|RIGHT LEFT|RIGHT timeout
+void cmdBLMOVE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 6) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool srchead, dsthead;
+  double deadline;
+  if (!parse_where(conn, args, 3, &srchead) ||
+      !parse_where(conn, args, 4, &dsthead) ||
+      !argtotimeout(conn, server, args, 5, &deadline)) {
+    return;
+  }
+  struct pair* src;
+  struct pair* dst;
+  if (!lookup_key(conn, server, args, 1, TYPE_LIST, &src) ||
+      !lookup_key(conn, server, args, 2, TYPE_LIST, &dst)) {
+    return;
+  }
+  size_t dstlen;
+  const char* dstkey = miniredis_args_at(args, 2, &dstlen);
+  if (src) {
+    list_move(conn, server, src, dstkey, dstlen, srchead, dsthead);
+    return;
+  }
+  struct bpop* bpop = calloc(1, sizeof(struct bpop));
+  if (bpop) {
+    bpop->deadline = deadline;
+    bpop->head = srchead;
+    bpop->move = true;
+    bpop->dsthead = dsthead;
+    bpop->dst = malloc(dstlen + 1);
+    if (bpop->dst) {
+      memcpy(bpop->dst, dstkey, dstlen + 1);
+      bpop->dstlen = dstlen;
+    } else {
+      bpop_free(bpop);
+      bpop = NULL;
+    }
+  }
+  if (!bpop ||
+      !client_block(server, miniredis_conn_udata(conn), args, 1, 1, bpop)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  }
+}
+
+// serve_key hands elements of the list at key to the clients blocked on it,
+// for as long as there are both, or entries of the stream at key to its
+// readers.
+static void serve_key(struct server* server, const char* key, size_t keylen) {
+  struct pair* pair = db_get(server, key, keylen);
+  if (pair && pair->type == TYPE_STREAM) {
+    if (waitq_get(server, key, keylen)) {
+      serve_stream(server, key, keylen);
+    }
+    return;
+  }
+  struct waitq* q;
+  while ((q = waitq_get(server, key, keylen))) {
+    pair = db_get(server, key, keylen);
+    if (!pair || pair->type != TYPE_LIST) {
+      return;
+    }
+    // readers of streams wait on the key for it to hold a stream
+    size_t i = 0;
+    while (i < q->len && q->clients[i]->bpop->stream) {
+      i++;
+    }
+    if (i == q->len) {
+      return;
+    }
+    struct client* client = q->clients[i];
+    struct bpop* bpop = client->bpop;
+    if (!bpop->move) {
+      bpop_reply(client->conn, server, pair, bpop->head);
+    } else {
+      struct pair* dst = db_get(server, bpop->dst, bpop->dstlen);
+      if (dst && dst->type != TYPE_LIST) {
+        miniredis_conn_write_error(client->conn, WRONGTYPE_ERR);
+      } else {
+        list_move(client->conn, server, pair, bpop->dst, bpop->dstlen,
+                  bpop->head, bpop->dsthead);
+      }
+    }
+    client_unblock(server, client);
+    miniredis_conn_unblock(client->conn);
+  }
+}
+
+// serve_ready serves the ready keys, including those made ready by BLMOVE
+// clients that are served along the way.
+void serve_ready(struct server* server) {
+  struct buf key = {0};
+  while (dict_count(server->ready) > 0) {
+    size_t i = 0;
+    struct dict_entry* entry;
+    dict_iter(server->ready, &i, &entry);
+    key.len = 0;
+    if (!buf_append(&key, entry->key, entry->keylen)) {
+      break;
+    }
+    dict_delete(server->ready, key.data, key.len);
+    serve_key(server, key.data, key.len);
+  }
+  buf_clear(&key);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "miniredis.h"
+
+// Clients blocked by BLPOP, BRPOP, BLMOVE, XREAD and XREADGROUP wait in a
+// queue for each of their keys. Writes mark the keys with blocked clients as
+// ready, and the ready keys are served once the command that fed them is
+// done, to the clients in the order they blocked.
+
+struct client;
+struct server;
+struct stream_id;
+
+// bpop is the state of a client that waits for one of its keys to be pushed
+// to, or with XREAD and XREADGROUP for new entries in one of its streams.
+struct bpop {
+  struct client* prev;  // server->blocked list
+  struct client* next;
+  double deadline;  // zero to wait forever
+  bool head;        // pop from the head
+  bool move;        // BLMOVE, push the element to dst
+  bool dsthead;
+  char* dst;
+  size_t dstlen;
+  int nkeys;
+  char** keys;
+  size_t* keylens;
+  bool stream;
+  struct stream_id* ids;  // read after, or STREAM_ID_MAX for ">"
+  int64_t count;
+  char* group;  // XREADGROUP
+  size_t grouplen;
+  char* consumer;
+  size_t consumerlen;
+  bool noack;
+};
+
+// waitq is the queue of clients blocked on a key, in arrival order.
+struct waitq {
+  struct client** clients;
+  size_t len;
+  size_t cap;
+};
+
+void signal_ready(struct server* server, const char* key, size_t keylen);
+void bpop_free(struct bpop* bpop);
+struct waitq* waitq_get(struct server* server, const char* key, size_t keylen);
+void client_unblock(struct server* server, struct client* client);
+bool client_block(struct server* server, struct client* client,
+                  struct miniredis_args* args, int first, int last,
+                  struct bpop* bpop);
+void serve_ready(struct server* server);
+void cmdBLPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdBRPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdBLMOVE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
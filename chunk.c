@@ -0,0 +1,173 @@
+#include "chunk.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// chunk_get returns an empty chunk that can hold at least cap bytes.
+// Chunks of CHUNK_SIZE or less are taken from the pool, larger ones are
+// allocated on demand. Returns NULL when out of memory.
+struct chunk* chunk_get(struct chunk_pool* pool, size_t cap) {
+  struct chunk* chunk;
+  if (cap <= CHUNK_SIZE && pool->free) {
+    chunk = pool->free;
+    pool->free = chunk->next;
+    pool->nfree--;
+  } else {
+    cap = cap < CHUNK_SIZE ? CHUNK_SIZE : cap;
+    chunk = malloc(sizeof(struct chunk) + cap);
+    if (!chunk) {
+      return NULL;
+    }
+    chunk->cap = cap;
+  }
+  chunk->next = NULL;
+  chunk->shared = NULL;
+  chunk->start = 0;
+  chunk->len = 0;
+  return chunk;
+}
+
+// chunk_put returns a chunk to the pool. Oversized chunks, and chunks beyond
+// the pool's maxfree, are freed. Chunks referencing a shared buffer release
+// it.
+void chunk_put(struct chunk_pool* pool, struct chunk* chunk) {
+  if (!chunk) return;
+  if (chunk->shared) {
+    chunk_shared_release(chunk->shared);
+    free(chunk);
+    return;
+  }
+  if (chunk->cap != CHUNK_SIZE || pool->nfree >= pool->maxfree) {
+    free(chunk);
+    return;
+  }
+  chunk->next = pool->free;
+  pool->free = chunk;
+  pool->nfree++;
+}
+
+// chunk_pool_clear frees all the chunks held by the pool.
+void chunk_pool_clear(struct chunk_pool* pool) {
+  while (pool->free) {
+    struct chunk* chunk = pool->free;
+    pool->free = chunk->next;
+    free(chunk);
+  }
+  pool->nfree = 0;
+}
+
+// chunk_shared_new copies data to a new shared buffer holding one reference.
+// Returns NULL when out of memory.
+struct chunk_shared* chunk_shared_new(const void* data, size_t len) {
+  struct chunk_shared* shared = malloc(sizeof(struct chunk_shared) + len);
+  if (!shared) {
+    return NULL;
+  }
+  shared->refs = 1;
+  shared->len = len;
+  memcpy(shared->data, data, len);
+  return shared;
+}
+
+// chunk_shared_release drops a reference, freeing the buffer with the last.
+void chunk_shared_release(struct chunk_shared* shared) {
+  if (--shared->refs == 0) {
+    free(shared);
+  }
+}
+
+// chain_append copies data to the end of the chain, borrowing chunks from the
+// pool as needed. Data already in the chain is never moved.
+bool chain_append(struct chain* chain, struct chunk_pool* pool,
+                  const void* data, size_t len) {
+  const char* p = data;
+  while (len > 0) {
+    struct chunk* tail = chain->tail;
+    if (!tail || tail->len == tail->cap) {
+      tail = chunk_get(pool, CHUNK_SIZE);
+      if (!tail) {
+        return false;
+      }
+      if (chain->tail) {
+        chain->tail->next = tail;
+      } else {
+        chain->head = tail;
+      }
+      chain->tail = tail;
+    }
+    size_t n = tail->cap - tail->len;
+    n = n < len ? n : len;
+    memcpy(tail->data + tail->len, p, n);
+    tail->len += n;
+    chain->len += n;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// chain_append_shared adds a reference to the shared buffer to the end of the
+// chain. The chunk holding it is full, so later data goes to a new chunk.
+bool chain_append_shared(struct chain* chain, struct chunk_shared* shared) {
+  struct chunk* chunk = malloc(sizeof(struct chunk));
+  if (!chunk) {
+    return false;
+  }
+  chunk->next = NULL;
+  chunk->start = 0;
+  chunk->len = shared->len;
+  chunk->cap = shared->len;
+  chunk->shared = shared;
+  shared->refs++;
+  if (chain->tail) {
+    chain->tail->next = chunk;
+  } else {
+    chain->head = chunk;
+  }
+  chain->tail = chunk;
+  chain->len += shared->len;
+  return true;
+}
+
+// chain_iov fills iov with the pending data of the chain, for use with
+// writev. Returns the number of entries used.
+int chain_iov(struct chain* chain, struct iovec* iov, int max) {
+  int n = 0;
+  for (struct chunk* c = chain->head; c && n < max; c = c->next) {
+    iov[n].iov_base = (c->shared ? c->shared->data : c->data) + c->start;
+    iov[n].iov_len = c->len - c->start;
+    n++;
+  }
+  return n;
+}
+
+// chain_consume drops n bytes from the front of the chain, returning drained
+// chunks to the pool.
+void chain_consume(struct chain* chain, struct chunk_pool* pool, size_t n) {
+  chain->len -= n;
+  while (n > 0) {
+    struct chunk* head = chain->head;
+    size_t avail = head->len - head->start;
+    if (n < avail) {
+      head->start += n;
+      return;
+    }
+    n -= avail;
+    chain->head = head->next;
+    chunk_put(pool, head);
+  }
+  if (!chain->head) {
+    chain->tail = NULL;
+  }
+}
+
+// chain_clear drops all the data of the chain.
+void chain_clear(struct chain* chain, struct chunk_pool* pool) {
+  while (chain->head) {
+    struct chunk* head = chain->head;
+    chain->head = head->next;
+    chunk_put(pool, head);
+  }
+  chain->tail = NULL;
+  chain->len = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define CHUNK_SIZE 16384
+// CHUNK_MINSHARED is the size below which sharing a buffer costs more, in
+// chunk headers and iovec entries, than copying it to each chain.
+#define CHUNK_MINSHARED 512
+
+// chunk_shared is an immutable buffer referenced by the chunks of many
+// chains, so data sent to many connections is only written once.
+struct chunk_shared {
+  _Atomic size_t refs;  // released by the I/O threads that flush the chains
+  size_t len;
+  char data[];
+};
+
+struct chunk {
+  struct chunk* next;
+  size_t start;
+  size_t len;
+  size_t cap;
+  struct chunk_shared* shared;  // data of the chunk when set
+  char data[];
+};
+
+struct chunk_pool {
+  struct chunk* free;
+  size_t nfree;
+  size_t maxfree;
+};
+
+struct chain {
+  struct chunk* head;
+  struct chunk* tail;
+  size_t len;
+};
+
+struct chunk* chunk_get(struct chunk_pool* pool, size_t cap);
+void chunk_put(struct chunk_pool* pool, struct chunk* chunk);
+void chunk_pool_clear(struct chunk_pool* pool);
+struct chunk_shared* chunk_shared_new(const void* data, size_t len);
+void chunk_shared_release(struct chunk_shared* shared);
+
+bool chain_append(struct chain* chain, struct chunk_pool* pool,
+                  const void* data, size_t len);
+bool chain_append_shared(struct chain* chain, struct chunk_shared* shared);
+int chain_iov(struct chain* chain, struct iovec* iov, int max);
+void chain_consume(struct chain* chain, struct chunk_pool* pool, size_t n);
+void chain_clear(struct chain* chain, struct chunk_pool* pool);
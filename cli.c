@@ -1,43 +1,106 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <malloc.h>
 #include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "blocking.h"
+#include "cluster.h"
+#include "cmap.h"
+#include "cmdbitmap.h"
+#include "cmdhash.h"
+#include "cmdhll.h"
+#include "cmdlist.h"
+#include "cmdmulti.h"
+#include "cmdpubsub.h"
+#include "cmdset.h"
+#include "cmdstream.h"
+#include "cmdzset.h"
+#include "dict.h"
+#include "epoch.h"
 #include "hashmap.h"
+#include "histogram.h"
+#include "intset.h"
+#include "listpack.h"
 #include "match.h"
 #include "miniredis.h"
+#include "pubsub.h"
+#include "quicklist.h"
+#include "server.h"
+#include "stream.h"
+#include "tsc.h"
 
-struct server {
-  uint64_t next_check;
-  struct hashmap* pairs;
-  int64_t now;
-};
+static const char* client_classes[] = {"normal", "pubsub", NULL};
+
+static const char* type_names[] = {"string", "hash", "list",
+                                    "set",    "zset", "stream"};
 
-struct pair {
-  bool hasex;
-  bool onstack;
-  int keylen;
-  int vallen;
+static const char* encoding_names[][2] = {
+    {"raw", "raw"},
+    {"listpack", "hashtable"},
+    {"quicklist", "quicklist"},
+    {"intset", "hashtable"},
+    {"listpack", "skiplist"},
+    {"stream", "stream"},
 };
 
+static const char* latency_events[] = {"command", "event-loop", NULL};
+
+static size_t pair_links_offset(int keylen, int vallen, bool hasex) {
+  size_t off = sizeof(struct pair) + keylen + 1 + vallen + 1;
+  if (hasex) {
+    off += sizeof(double);
+  }
+  return (off + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+}
+
+// pair_new returns a new string pair, with a zero-filled value if val is
+// NULL. Returns NULL when out of memory.
 struct pair* pair_new(const char* key, int keylen, const char* val, int vallen,
-                      double expires) {
+                      double expires, bool inslot) {
   size_t datasz = keylen + 1 + vallen + 1;
   if (expires > 0) {
     datasz += sizeof(double);
   }
+  if (inslot) {
+    datasz = pair_links_offset(keylen, vallen, expires > 0) -
+             sizeof(struct pair) + sizeof(struct slotlinks);
+  }
   struct pair* pair = malloc(sizeof(struct pair) + datasz);
+  if (!pair) {
+    return NULL;
+  }
   pair->onstack = 0;
   pair->hasex = expires > 0 ? 1 : 0;
+  pair->inslot = inslot;
+  pair->type = TYPE_STRING;
+  pair->enc = ENC_COMPACT;
+  pair->lru = 0;
   pair->keylen = keylen;
   pair->vallen = vallen;
   char* data = ((char*)pair) + sizeof(struct pair);
   memcpy(data, key, keylen);
   data[keylen] = '\0';
-  memcpy(data + keylen + 1, val, vallen);
+  if (val) {
+    memcpy(data + keylen + 1, val, vallen);
+  } else {
+    memset(data + keylen + 1, 0, vallen);
+  }
   data[keylen + 1 + vallen] = '\0';
   if (expires > 0) {
     memcpy(data + keylen + 1 + vallen + 1, &expires, sizeof(double));
@@ -49,11 +112,13 @@ struct pair* pair_new(const char* key, int keylen, const char* val, int vallen,
 
 struct pair* pair_new_forkey(const char* key, int keylen, struct pair* spair) {
   if (keylen > 50) {
-    return pair_new(key, keylen, NULL, 0, 0);
+    return pair_new(key, keylen, NULL, 0, 0, false);
   }
   // avoid allocation for small keys
   spair->onstack = 1;
   spair->hasex = 0;
+  spair->inslot = 0;
+  spair->type = TYPE_STRING;
   spair->keylen = keylen;
   spair->vallen = keylen;
   char* data = ((char*)spair) + sizeof(struct pair);
@@ -63,11 +128,6 @@ struct pair* pair_new_forkey(const char* key, int keylen, struct pair* spair) {
   return spair;
 }
 
-void pair_free(struct pair* pair) {
-  if (!pair || pair->onstack) return;
-  free(pair);
-}
-
 const char* pair_key(struct pair* pair) {
   return ((char*)pair) + sizeof(struct pair);
 }
@@ -76,6 +136,84 @@ const char* pair_val(struct pair* pair) {
   return pair_key(pair) + pair->keylen + 1;
 }
 
+// pair_obj returns the object of a pair that does not hold a string.
+void* pair_obj(struct pair* pair) {
+  void* obj;
+  memcpy(&obj, pair_val(pair), sizeof(void*));
+  return obj;
+}
+
+void pair_set_obj(struct pair* pair, void* obj) {
+  memcpy((char*)pair_val(pair), &obj, sizeof(void*));
+}
+
+// obj_memory returns the number of bytes allocated for the object of the
+// pair.
+size_t obj_memory(struct pair* pair) {
+  switch (pair->type) {
+    case TYPE_HASH:
+      if (pair->enc == ENC_COMPACT) {
+        return malloc_usable_size(pair_obj(pair));
+      }
+      return dict_memory(pair_obj(pair));
+    case TYPE_LIST:
+      return ql_memory(pair_obj(pair));
+    case TYPE_SET:
+      if (pair->enc == ENC_COMPACT) {
+        return malloc_usable_size(pair_obj(pair));
+      }
+      return dict_memory(pair_obj(pair));
+    case TYPE_ZSET:
+      if (pair->enc == ENC_COMPACT) {
+        return malloc_usable_size(pair_obj(pair));
+      }
+      return zset_memory(pair_obj(pair));
+    case TYPE_STREAM:
+      return stream_memory(pair_obj(pair));
+  }
+  return 0;
+}
+
+void obj_free(struct pair* pair) {
+  switch (pair->type) {
+    case TYPE_HASH:
+      if (pair->enc == ENC_COMPACT) {
+        lp_free(pair_obj(pair));
+      } else {
+        dict_free(pair_obj(pair));
+      }
+      break;
+    case TYPE_LIST:
+      ql_free(pair_obj(pair));
+      break;
+    case TYPE_SET:
+      if (pair->enc == ENC_COMPACT) {
+        is_free(pair_obj(pair));
+      } else {
+        dict_free(pair_obj(pair));
+      }
+      break;
+    case TYPE_ZSET:
+      if (pair->enc == ENC_COMPACT) {
+        lp_free(pair_obj(pair));
+      } else {
+        zset_free(pair_obj(pair));
+      }
+      break;
+    case TYPE_STREAM:
+      stream_free(pair_obj(pair));
+      break;
+  }
+}
+
+void pair_free(struct pair* pair) {
+  if (!pair || pair->onstack) return;
+  obj_free(pair);
+  free(pair);
+}
+
+void pair_release(void* pair) { pair_free(pair); }
+
 double pair_expire(struct pair* pair) {
   if (!pair->hasex) {
     return 0;
@@ -92,17 +230,512 @@ int64_t pair_ttl(struct pair* pair, struct server* server) {
   if (ttl < 0) {
     return -2;
   }
-  return (int64_t)ttl;
+  return (int64_t)(ttl + 0.5);
+}
+
+// pair_memory returns the number of bytes allocated for the pair and its
+// object.
+size_t pair_memory(struct pair* pair) {
+  return malloc_usable_size(pair) + obj_memory(pair);
+}
+
+struct slotlinks* pair_links(struct pair* pair) {
+  size_t off = pair_links_offset(pair->keylen, pair->vallen, pair->hasex);
+  return (struct slotlinks*)(((char*)pair) + off);
+}
+
+// slot_link adds the pair to the key list of its cluster slot.
+void slot_link(struct server* server, struct pair* pair) {
+  if (!pair->inslot) return;
+  uint16_t slot = cluster_keyslot(pair_key(pair), pair->keylen);
+  struct slotlinks* links = pair_links(pair);
+  links->prev = NULL;
+  links->next = server->slotkeys[slot];
+  if (links->next) {
+    pair_links(links->next)->prev = pair;
+  }
+  server->slotkeys[slot] = pair;
+  server->slotcounts[slot]++;
+}
+
+// slot_unlink removes the pair from the key list of its cluster slot.
+void slot_unlink(struct server* server, struct pair* pair) {
+  if (!pair->inslot) return;
+  uint16_t slot = cluster_keyslot(pair_key(pair), pair->keylen);
+  struct slotlinks* links = pair_links(pair);
+  if (links->prev) {
+    pair_links(links->prev)->next = links->next;
+  } else {
+    server->slotkeys[slot] = links->next;
+  }
+  if (links->next) {
+    pair_links(links->next)->prev = links->prev;
+  }
+  server->slotcounts[slot]--;
+}
+
+#define LFU_INIT_VAL 5
+
+uint64_t server_rand(struct server* server) {
+  // xorshift64*
+  server->rand ^= server->rand >> 12;
+  server->rand ^= server->rand << 25;
+  server->rand ^= server->rand >> 27;
+  return server->rand * 0x2545F4914F6CDD1DULL;
+}
+
+uint32_t lru_clock(struct server* server) {
+  return (uint64_t)server->now & 0xFFFFFF;
+}
+
+uint32_t lfu_minutes(struct server* server) {
+  return (uint64_t)(server->now / 60) & 0xFFFF;
+}
+
+// lfu_decay returns the access counter of the pair, decremented by one for
+// every lfu-decay-time minutes that elapsed since it was last decremented.
+uint8_t lfu_decay(struct server* server, struct pair* pair) {
+  uint32_t elapsed = (lfu_minutes(server) - (pair->lru >> 8)) & 0xFFFF;
+  uint32_t counter = pair->lru & 0xFF;
+  uint32_t periods =
+      server->lfu_decay_time ? elapsed / server->lfu_decay_time : 0;
+  return periods > counter ? 0 : counter - periods;
+}
+
+// pair_touch records an access to the pair for the LRU and LFU policies.
+// The LFU counter is a Morris counter: the more it grows the less likely it is
+// to be incremented, so that 8 bits cover millions of accesses.
+void pair_touch(struct server* server, struct pair* pair) {
+  if (server->maxmemory_policy != MAXMEMORY_ALLKEYS_LFU) {
+    pair->lru = lru_clock(server);
+    return;
+  }
+  uint32_t counter = lfu_decay(server, pair);
+  if (counter < 255) {
+    double r = (double)(server_rand(server) >> 11) / (1ULL << 53);
+    double base = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+    if (r < 1.0 / (base * server->lfu_log_factor + 1)) {
+      counter++;
+    }
+  }
+  pair->lru = (lfu_minutes(server) << 8) | counter;
+}
+
+// watch_bucket returns the bucket holding the WATCH version of the key. Keys
+// sharing a bucket fail each other's transactions, which costs a needless
+// retry but spares writes from looking up the clients watching their key.
+uint32_t watch_bucket(const char* key, size_t keylen) {
+  return hashmap_xxhash(key, keylen) & (WATCH_BUCKETS - 1);
+}
+
+// watch_touch bumps the version of the key, failing the transactions that
+// watch it. Versions are only kept up while clients watch keys.
+void watch_touch(struct server* server, const char* key, size_t keylen) {
+  if (server->watching) {
+    server->versions[watch_bucket(key, keylen)]++;
+  }
+}
+
+uint64_t client_hash(const void* item) {
+  uint64_t id = (*(struct client**)item)->id;
+  return hashmap_xxhash(&id, sizeof(id));
+}
+
+int client_compare(const void* a, const void* b) {
+  uint64_t ida = (*(struct client**)a)->id, idb = (*(struct client**)b)->id;
+  return ida < idb ? -1 : ida > idb;
+}
+
+// client_by_id returns the connected client with the id, or NULL.
+struct client* client_by_id(struct server* server, uint64_t id) {
+  struct client key = {.id = id};
+  struct client* pkey = &key;
+  struct client** client = hashmap_get(server->clients, &pkey);
+  return client ? *client : NULL;
+}
+
+uint64_t tracking_hash(const void* item) {
+  return ((struct tracking_entry*)item)->hash;
+}
+
+int tracking_compare(const void* a, const void* b) {
+  uint64_t ha = ((struct tracking_entry*)a)->hash;
+  uint64_t hb = ((struct tracking_entry*)b)->hash;
+  return ha < hb ? -1 : ha > hb;
+}
+
+// tracking_send sends the invalidation of the key, or of all the keys when
+// key is NULL, to the client or to the client it redirects to. RESP3 clients
+// get an invalidate push, RESP2 clients a message of the
+// __redis__:invalidate channel if they are subscribed to it.
+void tracking_send(struct server* server, struct client* client,
+                   const char* key, size_t keylen) {
+  struct client* target = client;
+  if (client->redirect && !(target = client_by_id(server, client->redirect))) {
+    if (miniredis_conn_proto(client->conn) == 3) {
+      miniredis_conn_write_push(client->conn, 2);
+      miniredis_conn_write_bulk(client->conn, "tracking-redir-broken", -1);
+      miniredis_conn_write_uint(client->conn, client->redirect);
+    }
+    return;
+  }
+  struct miniredis_conn* conn = target->conn;
+  if (miniredis_conn_proto(conn) == 3) {
+    miniredis_conn_write_push(conn, 2);
+    miniredis_conn_write_bulk(conn, "invalidate", -1);
+  } else if (target->channels &&
+             dict_get(target->channels, "__redis__:invalidate", 20)) {
+    miniredis_conn_write_array(conn, 3);
+    miniredis_conn_write_bulk(conn, "message", -1);
+    miniredis_conn_write_bulk(conn, "__redis__:invalidate", 20);
+  } else {
+    return;
+  }
+  if (key) {
+    miniredis_conn_write_array(conn, 1);
+    miniredis_conn_write_bulk(conn, key, keylen);
+  } else {
+    miniredis_conn_write_null(conn);
+  }
+}
+
+// tracking_client returns the client with the id if it still tracks keys in
+// the mode, or NULL. Ids are left behind in the tracking table by clients
+// that went away or turned tracking off.
+struct client* tracking_client(struct server* server, uint64_t id,
+                               bool bcast) {
+  struct client* client = client_by_id(server, id);
+  return client && client->tracking && client->tracking_bcast == bcast
+             ? client
+             : NULL;
+}
+
+// tracking_evict drops random entries until the tracking table has room for
+// one more key. Their key names are not known, so their clients are told to
+// drop all their keys.
+void tracking_evict(struct server* server) {
+  while (server->tracking_table_max_keys > 0 &&
+         hashmap_count(server->tracking) >=
+             (size_t)server->tracking_table_max_keys) {
+    struct tracking_entry* entry =
+        hashmap_probe(server->tracking, server_rand(server));
+    if (!entry) continue;
+    struct tracking_entry victim = *entry;
+    entry = hashmap_delete(server->tracking, &victim);
+    uint64_t* ids = entry->ids;
+    int nids = entry->nids;
+    for (int i = 0; i < nids; i++) {
+      struct client* client = tracking_client(server, ids[i], false);
+      if (client) {
+        tracking_send(server, client, NULL, 0);
+      }
+    }
+    free(ids);
+  }
+}
+
+// tracking_record remembers that the client read the key. Returns false when
+// out of memory.
+bool tracking_record(struct server* server, struct client* client,
+                     const char* key, size_t keylen) {
+  struct tracking_entry probe = {.hash = hashmap_xxhash(key, keylen)};
+  struct tracking_entry* entry = hashmap_get(server->tracking, &probe);
+  if (!entry) {
+    tracking_evict(server);
+    hashmap_set(server->tracking, &probe);
+    if (hashmap_oom(server->tracking)) {
+      return false;
+    }
+    entry = hashmap_get(server->tracking, &probe);
+  }
+  int lo = 0, hi = entry->nids;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (entry->ids[mid] < client->id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < entry->nids && entry->ids[lo] == client->id) {
+    return true;
+  }
+  if (entry->nids == entry->cap) {
+    int cap = entry->cap ? entry->cap * 2 : 1;
+    uint64_t* ids = realloc(entry->ids, cap * sizeof(uint64_t));
+    if (!ids) {
+      return false;
+    }
+    entry->ids = ids;
+    entry->cap = cap;
+  }
+  memmove(entry->ids + lo + 1, entry->ids + lo,
+          (entry->nids - lo) * sizeof(uint64_t));
+  entry->ids[lo] = client->id;
+  entry->nids++;
+  return true;
+}
+
+// tracking_invalidate tells the clients that read the key, and those
+// tracking a prefix of it, that it changed. The key is forgotten until it is
+// read again. Clients with NOLOOP are not told about their own writes.
+void tracking_invalidate(struct server* server, const char* key,
+                         size_t keylen) {
+  if (!server->tracking_clients) {
+    return;
+  }
+  struct tracking_entry probe = {.hash = hashmap_xxhash(key, keylen)};
+  struct tracking_entry* entry = hashmap_delete(server->tracking, &probe);
+  if (entry) {
+    uint64_t* ids = entry->ids;
+    int nids = entry->nids;
+    for (int i = 0; i < nids; i++) {
+      struct client* client = tracking_client(server, ids[i], false);
+      if (client &&
+          !(client->tracking_noloop && client == server->current)) {
+        tracking_send(server, client, key, keylen);
+      }
+    }
+    free(ids);
+  }
+  for (size_t i = 0; i < server->nprefixes; i++) {
+    struct tracking_prefix* prefix = &server->prefixes[i];
+    if (prefix->len > keylen || memcmp(prefix->prefix, key, prefix->len)) {
+      continue;
+    }
+    struct client* client = tracking_client(server, prefix->id, true);
+    if (client && !(client->tracking_noloop && client == server->current)) {
+      tracking_send(server, client, key, keylen);
+    }
+  }
+}
+
+// tracking_flush tells all the tracking clients to drop all their keys, and
+// empties the tracking table.
+void tracking_flush(struct server* server) {
+  if (!server->tracking_clients) {
+    return;
+  }
+  size_t i = 0;
+  void* item;
+  while (hashmap_iter(server->clients, &i, &item)) {
+    struct client* client = *(struct client**)item;
+    if (client->tracking) {
+      tracking_send(server, client, NULL, 0);
+    }
+  }
+  i = 0;
+  while (hashmap_iter(server->tracking, &i, &item)) {
+    free(((struct tracking_entry*)item)->ids);
+  }
+  hashmap_free(server->tracking);
+  server->tracking = hashmap_new(sizeof(struct tracking_entry), 0,
+                                 tracking_hash, tracking_compare);
+}
+
+// tracking_off turns tracking off for the client, dropping its prefixes. Its
+// ids in the tracking table are dropped lazily.
+void tracking_off(struct server* server, struct client* client) {
+  if (!client->tracking) {
+    return;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < server->nprefixes; i++) {
+    struct tracking_prefix* prefix = &server->prefixes[i];
+    if (prefix->id == client->id) {
+      free(prefix->prefix);
+    } else {
+      server->prefixes[n++] = *prefix;
+    }
+  }
+  server->nprefixes = n;
+  client->tracking = false;
+  client->tracking_bcast = false;
+  client->tracking_optin = false;
+  client->tracking_optout = false;
+  client->tracking_noloop = false;
+  client->redirect = 0;
+  server->tracking_clients--;
+}
+
+// db_retire frees a pair removed from the keyspace once no reader of the
+// keyspace on another thread can still be using it.
+void db_retire(struct server* server, struct pair* pair) {
+  epoch_retire(server->epoch, pair, pair_release);
+}
+
+// db_set inserts the pair into the keyspace, retiring any pair that it
+// replaces. Returns false when out of memory, in which case the pair is freed.
+bool db_set(struct server* server, struct pair* pair) {
+  if (server->maxmemory_policy == MAXMEMORY_ALLKEYS_LFU) {
+    pair->lru = (lfu_minutes(server) << 8) | LFU_INIT_VAL;
+  } else {
+    pair->lru = lru_clock(server);
+  }
+  watch_touch(server, pair_key(pair), pair->keylen);
+  tracking_invalidate(server, pair_key(pair), pair->keylen);
+  void* prev;
+  if (!cmap_set(server->pairs, pair, &prev)) {
+    pair_free(pair);
+    return false;
+  }
+  if (prev) {
+    server->used_memory -= pair_memory(prev);
+    slot_unlink(server, prev);
+    db_retire(server, prev);
+  }
+  server->used_memory += pair_memory(pair);
+  slot_link(server, pair);
+  return true;
+}
+
+// db_delete removes the key from the keyspace and returns its pair, which
+// must be retired by the caller. Returns NULL if the key does not exist.
+struct pair* db_delete(struct server* server, const char* key, size_t keylen) {
+  struct pair* spair = alloca_pair();
+  struct pair* pkey = pair_new_forkey(key, keylen, spair);
+  struct pair* pair = cmap_delete(server->pairs, pkey);
+  pair_free(pkey);
+  if (!pair) {
+    return NULL;
+  }
+  watch_touch(server, key, keylen);
+  tracking_invalidate(server, key, keylen);
+  server->used_memory -= pair_memory(pair);
+  slot_unlink(server, pair);
+  return pair;
+}
+
+// db_remove removes the pair from the keyspace and retires it.
+void db_remove(struct server* server, struct pair* pair) {
+  db_retire(server, db_delete(server, pair_key(pair), pair->keylen));
+}
+
+// db_modified accounts for an object that was changed in place, given the
+// memory of its pair before the change.
+void db_modified(struct server* server, struct pair* pair, size_t oldmem) {
+  watch_touch(server, pair_key(pair), pair->keylen);
+  tracking_invalidate(server, pair_key(pair), pair->keylen);
+  server->used_memory += pair_memory(pair);
+  server->used_memory -= oldmem;
+}
+
+// db_get returns the live pair for the key or NULL if the key does not exist
+// or has expired.
+struct pair* db_get(struct server* server, const char* key, size_t keylen) {
+  struct pair* spair = alloca_pair();
+  struct pair* pkey = pair_new_forkey(key, keylen, spair);
+  struct pair* pair = cmap_get(server->pairs, pkey);
+  pair_free(pkey);
+  if (!pair) {
+    return NULL;
+  }
+  if (pair_ttl(pair, server) == -2) {
+    // expired pairs are only removed when replaced or evicted, so tracking
+    // clients are told about the expiry when the key is next looked up
+    tracking_invalidate(server, key, keylen);
+    return NULL;
+  }
+  return pair;
+}
+
+// evpool_idle returns the eviction score of the pair for the current policy.
+// Returns false if the pair may not be evicted.
+bool evpool_idle(struct server* server, struct pair* pair, uint64_t* idle) {
+  if (pair_ttl(pair, server) == -2) {
+    // already expired, always the best candidate
+    *idle = UINT64_MAX;
+    return true;
+  }
+  switch (server->maxmemory_policy) {
+    case MAXMEMORY_ALLKEYS_LRU:
+      *idle = (lru_clock(server) - pair->lru) & 0xFFFFFF;
+      return true;
+    case MAXMEMORY_ALLKEYS_LFU:
+      *idle = 255 - lfu_decay(server, pair);
+      return true;
+    case MAXMEMORY_VOLATILE_TTL:
+      if (!pair->hasex) return false;
+      *idle = UINT64_MAX - (uint64_t)(pair_expire(pair) * 1000);
+      return true;
+  }
+  return false;
+}
+
+// evpool_populate samples random pairs with cmap_probe and adds those that
+// are better candidates than the current ones to the eviction pool, which is
+// kept sorted by ascending idle score.
+void evpool_populate(struct server* server) {
+  struct evpool_entry* pool = server->evpool;
+  int64_t samples = server->maxmemory_samples;
+  for (int64_t n = 0, tries = 0; n < samples && tries < samples * 16;
+       tries++) {
+    struct pair* pair = cmap_probe(server->pairs, server_rand(server));
+    if (!pair) continue;
+    n++;
+    uint64_t idle;
+    if (!evpool_idle(server, pair, &idle)) continue;
+    int k = 0;
+    while (k < EVPOOL_SIZE && pool[k].key && pool[k].idle < idle) k++;
+    if (k == 0 && pool[EVPOOL_SIZE - 1].key) {
+      // worse than every candidate in a full pool
+      continue;
+    }
+    char* key = malloc(pair->keylen);
+    if (!key) return;
+    memcpy(key, pair_key(pair), pair->keylen);
+    if (!pool[EVPOOL_SIZE - 1].key) {
+      // free slot at the end, shift right
+      memmove(pool + k + 1, pool + k,
+              sizeof(struct evpool_entry) * (EVPOOL_SIZE - k - 1));
+    } else {
+      // full, drop the worst candidate and shift left
+      k--;
+      free(pool[0].key);
+      memmove(pool, pool + 1, sizeof(struct evpool_entry) * k);
+    }
+    pool[k] = (struct evpool_entry){.idle = idle, .key = key,
+                                    .keylen = pair->keylen};
+  }
+}
+
+// evict frees keys according to the maxmemory policy until the used memory
+// is within the maxmemory limit. Returns false if that is not possible.
+bool evict(struct server* server) {
+  if (server->maxmemory == 0 ||
+      server->used_memory <= (size_t)server->maxmemory) {
+    return true;
+  }
+  if (server->maxmemory_policy == MAXMEMORY_NOEVICTION) {
+    return false;
+  }
+  struct evpool_entry* pool = server->evpool;
+  while (server->used_memory > (size_t)server->maxmemory) {
+    evpool_populate(server);
+    struct pair* victim = NULL;
+    for (int k = EVPOOL_SIZE - 1; k >= 0 && !victim; k--) {
+      if (!pool[k].key) continue;
+      victim = db_delete(server, pool[k].key, pool[k].keylen);
+      free(pool[k].key);
+      pool[k].key = NULL;
+    }
+    if (!victim) {
+      return false;
+    }
+    db_retire(server, victim);
+    server->evicted_keys++;
+  }
+  return true;
 }
 
 uint64_t key_hash(const void* item) {
-  struct pair* p = *((struct pair**)item);
+  struct pair* p = (struct pair*)item;
   return hashmap_xxhash(pair_key(p), p->keylen);
 }
 
 int key_compare(const void* a, const void* b) {
-  struct pair* pa = *((struct pair**)a);
-  struct pair* pb = *((struct pair**)b);
+  struct pair* pa = (struct pair*)a;
+  struct pair* pb = (struct pair*)b;
   int minkeylen = pa->keylen < pb->keylen ? pa->keylen : pb->keylen;
   int cmp = memcmp(pair_key(pa), pair_key(pb), minkeylen);
   if (cmp == 0) {
@@ -125,17 +758,26 @@ void error(const char* msg, bool fatal, void* udata) {
   fprintf(stderr, "- %s\n", msg);
 }
 
-bool argtoint(struct miniredis_args* args, int index, int64_t* x) {
-  size_t arglen = 0;
-  const char* arg = miniredis_args_at(args, index, &arglen);
-  if (strlen(arg) != arglen) return false;
+// parse_int parses a base 10 64-bit integer that makes up all of str.
+bool parse_int(const char* str, size_t len, int64_t* x) {
+  char buf[32];
+  if (len == 0 || len >= sizeof(buf) || isspace(str[0])) return false;
+  memcpy(buf, str, len);
+  buf[len] = '\0';
   char* end = NULL;
-  long long res = strtoll(arg, &end, 10);
-  if (end != arg + arglen) return false;
+  errno = 0;
+  long long res = strtoll(buf, &end, 10);
+  if (end != buf + len || errno == ERANGE) return false;
   if (x) *x = res;
   return true;
 }
 
+bool argtoint(struct miniredis_args* args, int index, int64_t* x) {
+  size_t arglen = 0;
+  const char* arg = miniredis_args_at(args, index, &arglen);
+  return parse_int(arg, arglen, x);
+}
+
 struct setopts {
   double expire;
   bool nx;
@@ -172,8 +814,7 @@ bool parse_getopts(struct miniredis_conn* conn, struct miniredis_args* args,
         miniredis_conn_write_error(conn, "ERR invalid expire time in set");
         return false;
       }
-      // opts->expire = (ex ? x : x / 1000.0) + server->now;
-      ex = true;
+      opts->expire = (ex ? x : x / 1000.0) + server->now;
     } else if (miniredis_args_eq(args, i, "nx")) {
       if (opts->xx) {
         miniredis_conn_write_error(conn, "ERR syntax error");
@@ -199,14 +840,108 @@ bool parse_getopts(struct miniredis_conn* conn, struct miniredis_args* args,
     size_t keylen;
     const char* key = miniredis_args_at(args, 1, &keylen);
     struct pair* pkey = pair_new_forkey(key, keylen, spair);
-    struct pair** pval = hashmap_get(server->pairs, &pkey);
+    struct pair* pair = cmap_get(server->pairs, pkey);
     pair_free(pkey);
-    pval = pval && pair_ttl(*pval, server) > -2 ? pval : NULL;
-    if ((pval && opts->nx) || (!pval && opts->xx)) {
+    pair = pair && pair_ttl(pair, server) > -2 ? pair : NULL;
+    if ((pair && opts->nx) || (!pair && opts->xx)) {
       miniredis_conn_write_null(conn);
       return false;
     }
-    opts->expire = pval && opts->keepttl ? pair_expire(*pval) : opts->expire;
+    opts->expire = pair && opts->keepttl ? pair_expire(pair) : opts->expire;
+  }
+  return true;
+}
+
+// lookup_key sets *ppair to the live pair of the key at args[index], or to
+// NULL if the key does not exist. If the key holds a value of another type,
+// a WRONGTYPE error is written and false is returned.
+bool lookup_key(struct miniredis_conn* conn, struct server* server,
+                struct miniredis_args* args, int index, int type,
+                struct pair** ppair) {
+  size_t keylen;
+  const char* key = miniredis_args_at(args, index, &keylen);
+  struct pair* pair = db_get(server, key, keylen);
+  if (pair && pair->type != type) {
+    miniredis_conn_write_error(conn, WRONGTYPE_ERR);
+    return false;
+  }
+  if (pair) {
+    pair_touch(server, pair);
+  }
+  *ppair = pair;
+  return true;
+}
+
+// obj_pair_new returns a pair holding an empty object of the type. Returns
+// NULL when out of memory.
+struct pair* obj_pair_new(struct server* server, const char* key,
+                          size_t keylen, int type, double expires) {
+  void* obj = NULL;
+  int enc = ENC_COMPACT;
+  switch (type) {
+    case TYPE_HASH:
+      obj = lp_new();
+      break;
+    case TYPE_LIST:
+      obj = ql_new(server->list_max_listpack_size);
+      enc = ENC_FULL;
+      break;
+    case TYPE_SET:
+      obj = is_new();
+      break;
+    case TYPE_ZSET:
+      obj = lp_new();
+      break;
+    case TYPE_STREAM:
+      obj = stream_new();
+      enc = ENC_FULL;
+      break;
+  }
+  if (!obj) {
+    return NULL;
+  }
+  struct pair* pair = pair_new(key, keylen, (char*)&obj, sizeof(void*),
+                               expires, server->cluster != NULL);
+  if (!pair) {
+    if (type == TYPE_STREAM) {
+      stream_free(obj);
+    } else {
+      free(obj);
+    }
+    return NULL;
+  }
+  pair->type = type;
+  pair->enc = enc;
+  return pair;
+}
+
+// db_create adds a key holding an empty object of the type. Returns NULL when
+// out of memory.
+struct pair* db_create(struct server* server, const char* key, size_t keylen,
+                       int type) {
+  struct pair* pair = obj_pair_new(server, key, keylen, type, 0);
+  if (!pair || !db_set(server, pair)) {
+    return NULL;
+  }
+  return pair;
+}
+
+// lookup_or_create is lookup_key for commands that create the key when it
+// does not exist. An error is written when out of memory.
+bool lookup_or_create(struct miniredis_conn* conn, struct server* server,
+                      struct miniredis_args* args, int index, int type,
+                      struct pair** ppair) {
+  if (!lookup_key(conn, server, args, index, type, ppair)) {
+    return false;
+  }
+  if (!*ppair) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, index, &keylen);
+    *ppair = db_create(server, key, keylen, type);
+    if (!*ppair) {
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return false;
+    }
   }
   return true;
 }
@@ -228,10 +963,11 @@ void cmdSET(struct miniredis_conn* conn, struct miniredis_args* args,
       return;
     }
   }
-  struct pair* pair = pair_new(key, keylen, val, vallen, opts.expire);
-  struct pair** prev = hashmap_set(server->pairs, &pair);
-  if (prev) {
-    pair_free(*prev);
+  struct pair* pair =
+      pair_new(key, keylen, val, vallen, opts.expire, server->cluster != NULL);
+  if (!pair || !db_set(server, pair)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
   }
   miniredis_conn_write_string(conn, "OK");
 }
@@ -244,14 +980,16 @@ void cmdGET(struct miniredis_conn* conn, struct miniredis_args* args,
     miniredis_conn_write_error(conn, "ERR wrong number of arguments");
     return;
   }
-  struct pair* spair = alloca_pair();
   size_t keylen;
   const char* key = miniredis_args_at(args, 1, &keylen);
-  struct pair* pkey = pair_new_forkey(key, keylen, spair);
-  struct pair** pval = hashmap_get(server->pairs, &pkey);
-  pair_free(pkey);
-  if (pval && pair_ttl(*pval, server) > -2) {
-    miniredis_conn_write_bulk(conn, pair_val(*pval), (*pval)->vallen);
+  struct pair* pair = db_get(server, key, keylen);
+  if (pair) {
+    if (pair->type != TYPE_STRING) {
+      miniredis_conn_write_error(conn, WRONGTYPE_ERR);
+      return;
+    }
+    pair_touch(server, pair);
+    miniredis_conn_write_bulk(conn, pair_val(pair), pair->vallen);
   } else {
     miniredis_conn_write_bulk(conn, NULL, 0);
   }
@@ -269,10 +1007,10 @@ void cmdTTL(struct miniredis_conn* conn, struct miniredis_args* args,
   size_t keylen;
   const char* key = miniredis_args_at(args, 1, &keylen);
   struct pair* pkey = pair_new_forkey(key, keylen, spair);
-  struct pair** pval = hashmap_get(server->pairs, &pkey);
+  struct pair* pair = cmap_get(server->pairs, pkey);
   pair_free(pkey);
-  if (pval) {
-    miniredis_conn_write_int(conn, pair_ttl(*pval, server));
+  if (pair) {
+    miniredis_conn_write_int(conn, pair_ttl(pair, server));
   } else {
     miniredis_conn_write_int(conn, -2);
   }
@@ -286,21 +1024,18 @@ void cmdDEL(struct miniredis_conn* conn, struct miniredis_args* args,
     miniredis_conn_write_error(conn, "ERR wrong number of arguments");
     return;
   }
-  struct pair* spair = alloca_pair();
   int ndels = 0;
   int nargs = miniredis_args_count(args);
   for (int i = 1; i < nargs; i++) {
     size_t keylen;
     const char* key = (char*)miniredis_args_at(args, i, &keylen);
-    struct pair* pkey = pair_new_forkey(key, keylen, spair);
-    struct pair** pval = hashmap_delete(server->pairs, &pkey);
-    if (pval) {
-      if (pair_ttl(*pval, server) > -2) {
+    struct pair* pair = db_delete(server, key, keylen);
+    if (pair) {
+      if (pair_ttl(pair, server) > -2) {
         ndels++;
       }
-      pair_free(*pval);
+      db_retire(server, pair);
     }
-    pair_free(pkey);
   }
   miniredis_conn_write_int(conn, ndels);
 }
@@ -313,9 +1048,9 @@ struct keysctx {
   int count;
 };
 
-bool keysiter(const void* item, void* udata) {
+bool keysiter(void* item, void* udata) {
   struct keysctx* ctx = (struct keysctx*)udata;
-  struct pair* pair = *((struct pair**)item);
+  struct pair* pair = item;
   if (pair_ttl(pair, ctx->server) > -2) {
     if (match(ctx->pat, ctx->plen, pair_key(pair), pair->keylen)) {
       miniredis_write_bulk(&ctx->writer, pair_key(pair), pair->keylen);
@@ -335,101 +1070,2853 @@ void cmdKEYS(struct miniredis_conn* conn, struct miniredis_args* args,
   }
   struct keysctx ctx = {.server = server};
   ctx.pat = miniredis_args_at(args, 1, &ctx.plen);
-  hashmap_scan(server->pairs, keysiter, &ctx);
+  cmap_scan(server->pairs, keysiter, &ctx);
   miniredis_conn_write_array(conn, ctx.count);
   miniredis_conn_write_raw(conn, ctx.writer.data, ctx.writer.len);
   buf_clear(&ctx.writer);
 }
 
-// PING [message]
-void cmdPING(struct miniredis_conn* conn, struct miniredis_args* args,
-             void* udata) {
-  (void)udata;
-  if (miniredis_args_count(args) == 1) {
-    miniredis_conn_write_string(conn, "PONG");
-  } else if (miniredis_args_count(args) == 2) {
-    size_t len;
-    const char* arg = miniredis_args_at(args, 1, &len);
-    miniredis_conn_write_bulk(conn, arg, len);
-  } else {
-    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
-  }
+// client_subscriptions returns the number of channels and patterns the client
+// is subscribed to. RESP2 clients with subscriptions are in the subscribed
+// state, where they can only subscribe, unsubscribe and PING.
+size_t client_subscriptions(struct client* client) {
+  return (client->channels ? dict_count(client->channels) : 0) +
+         (client->patterns ? dict_count(client->patterns) : 0);
 }
 
-bool flushiter(const void* item, void* udata) {
-  free(*((struct pair**)item));
-  (void)udata;
+// client_name_valid checks that a client name has no spaces or special
+// characters, writing the error if it has.
+bool client_name_valid(struct miniredis_conn* conn, const char* name,
+                       size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (name[i] <= ' ' || name[i] > '~') {
+      miniredis_conn_write_error(conn, "ERR Client names cannot contain "
+                                       "spaces, newlines or special "
+                                       "characters.");
+      return false;
+    }
+  }
   return true;
 }
 
-// cmdFLUSHDB
-void cmdFLUSHDB(struct miniredis_conn* conn, struct miniredis_args* args,
-                void* udata) {
-  struct server* server = udata;
-  if (miniredis_args_count(args) != 1) {
-    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
-    return;
+// client_setname names the client, or clears its name when the name is
+// empty. Returns false when out of memory, after writing the error.
+bool client_setname(struct miniredis_conn* conn, struct client* client,
+                    const char* name, size_t len) {
+  char* copy = NULL;
+  if (len && !(copy = strndup(name, len))) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return false;
   }
-  hashmap_scan(server->pairs, flushiter, NULL);
-  hashmap_free(server->pairs);
-  server->pairs = hashmap_new(sizeof(struct pair*), 0, key_hash, key_compare);
-  miniredis_conn_write_string(conn, "OK");
+  free(client->name);
+  client->name = copy;
+  return true;
 }
 
-// cmdDBSIZE
-void cmdDBSIZE(struct miniredis_conn* conn, struct miniredis_args* args,
-               void* udata) {
+// HELLO [protover [AUTH username password] [SETNAME clientname]]
+void cmdHELLO(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
   struct server* server = udata;
-  if (miniredis_args_count(args) != 1) {
-    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
-    return;
-  }
-  size_t count = hashmap_count(server->pairs);
-  miniredis_conn_write_uint(conn, count);
-}
-
-void command(struct miniredis_conn* conn, struct miniredis_args* args,
+  struct client* client = miniredis_conn_udata(conn);
+  int nargs = miniredis_args_count(args);
+  int64_t proto = miniredis_conn_proto(conn);
+  if (nargs > 1) {
+    size_t len;
+    const char* arg = miniredis_args_at(args, 1, &len);
+    if (!parse_int(arg, len, &proto)) {
+      miniredis_conn_write_error(
+          conn, "ERR Protocol version is not an integer or out of range");
+      return;
+    }
+    if (proto < 2 || proto > 3) {
+      miniredis_conn_write_error(conn,
+                                 "NOPROTO unsupported protocol version");
+      return;
+    }
+  }
+  const char* name = NULL;
+  size_t namelen = 0;
+  for (int i = 2; i < nargs; i++) {
+    if (miniredis_args_eq(args, i, "auth") && i + 2 < nargs) {
+      // there are no users but the default one, which needs no password
+      if (!miniredis_args_eq(args, i + 1, "default")) {
+        miniredis_conn_write_error(conn, "WRONGPASS invalid username-password "
+                                         "pair or user is disabled.");
+        return;
+      }
+      i += 2;
+    } else if (miniredis_args_eq(args, i, "setname") && i + 1 < nargs) {
+      name = miniredis_args_at(args, ++i, &namelen);
+      if (!client_name_valid(conn, name, namelen)) {
+        return;
+      }
+    } else {
+      char err[128];
+      snprintf(err, sizeof(err), "ERR Syntax error in HELLO option '%.64s'",
+               miniredis_args_at(args, i, NULL));
+      miniredis_conn_write_error(conn, err);
+      return;
+    }
+  }
+  if (name && !client_setname(conn, client, name, namelen)) {
+    return;
+  }
+  miniredis_conn_set_proto(conn, proto);
+  miniredis_conn_write_map(conn, 7);
+  miniredis_conn_write_bulk(conn, "server", -1);
+  miniredis_conn_write_bulk(conn, "redis", -1);
+  miniredis_conn_write_bulk(conn, "version", -1);
+  miniredis_conn_write_bulk(conn, "7.0.0", -1);
+  miniredis_conn_write_bulk(conn, "proto", -1);
+  miniredis_conn_write_int(conn, proto);
+  miniredis_conn_write_bulk(conn, "id", -1);
+  miniredis_conn_write_uint(conn, client->id);
+  miniredis_conn_write_bulk(conn, "mode", -1);
+  miniredis_conn_write_bulk(conn, server->cluster ? "cluster" : "standalone",
+                            -1);
+  miniredis_conn_write_bulk(conn, "role", -1);
+  miniredis_conn_write_bulk(conn, "master", -1);
+  miniredis_conn_write_bulk(conn, "modules", -1);
+  miniredis_conn_write_array(conn, 0);
+}
+
+// tracking_overlap checks that no two of the prefixes, given by their
+// argument positions, are a prefix of one another, writing the error if two
+// are. A write would otherwise be sent twice to the client.
+bool tracking_overlap(struct miniredis_conn* conn,
+                      struct miniredis_args* args, int* prefixes, int n) {
+  for (int i = 0; i < n; i++) {
+    size_t alen;
+    const char* a = miniredis_args_at(args, prefixes[i], &alen);
+    for (int j = 0; j < i; j++) {
+      size_t blen;
+      const char* b = miniredis_args_at(args, prefixes[j], &blen);
+      if (memcmp(a, b, alen < blen ? alen : blen) == 0) {
+        char err[256];
+        snprintf(err, sizeof(err),
+                 "ERR Prefix '%.64s' overlaps with another provided prefix "
+                 "'%.64s'. Prefixes for a single client must not overlap.",
+                 a, b);
+        miniredis_conn_write_error(conn, err);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// clientTRACKING turns tracking on or off for the client.
+// CLIENT TRACKING ON|OFF [REDIRECT id] [PREFIX prefix ...] [BCAST] [OPTIN]
+//                        [OPTOUT] [NOLOOP]
+void clientTRACKING(struct miniredis_conn* conn, struct miniredis_args* args,
+                    struct server* server, struct client* client) {
+  int nargs = miniredis_args_count(args);
+  bool on = miniredis_args_eq(args, 2, "on");
+  struct client opts = {0};
+  int* prefixes = malloc(nargs * sizeof(int));  // argument positions
+  int nprefixes = 0;
+  const char* err = NULL;
+  if (!prefixes) {
+    err = "ERR out of memory";
+  } else if (!on && !miniredis_args_eq(args, 2, "off")) {
+    err = "ERR syntax error";
+  }
+  for (int i = 3; !err && i < nargs; i++) {
+    int64_t id;
+    if (miniredis_args_eq(args, i, "redirect") && i + 1 < nargs) {
+      if (!argtoint(args, ++i, &id) || id < 0) {
+        err = "ERR syntax error";
+      } else {
+        opts.redirect = id;
+      }
+    } else if (miniredis_args_eq(args, i, "prefix") && i + 1 < nargs) {
+      prefixes[nprefixes++] = ++i;
+    } else if (miniredis_args_eq(args, i, "bcast")) {
+      opts.tracking_bcast = true;
+    } else if (miniredis_args_eq(args, i, "optin")) {
+      opts.tracking_optin = true;
+    } else if (miniredis_args_eq(args, i, "optout")) {
+      opts.tracking_optout = true;
+    } else if (miniredis_args_eq(args, i, "noloop")) {
+      opts.tracking_noloop = true;
+    } else {
+      err = "ERR syntax error";
+    }
+  }
+  if (err || !on) {
+    // options are ignored when turning tracking off
+  } else if (nprefixes && !opts.tracking_bcast) {
+    err = "ERR PREFIX option requires BCAST mode to be enabled";
+  } else if (opts.tracking_optin && opts.tracking_optout) {
+    err = "ERR You can't use both OPTIN and OPTOUT";
+  } else if (opts.tracking_bcast &&
+             (opts.tracking_optin || opts.tracking_optout)) {
+    err = "ERR OPTIN and OPTOUT are not compatible with BCAST";
+  } else if (opts.redirect && !client_by_id(server, opts.redirect)) {
+    err = "ERR The client ID you want redirect to does not exist";
+  } else if (tracking_overlap(conn, args, prefixes, nprefixes)) {
+    free(prefixes);
+    return;
+  }
+  // BCAST without prefixes tracks the empty prefix, which every key has
+  int n = opts.tracking_bcast ? (nprefixes ? nprefixes : 1) : 0;
+  if (!err && n) {
+    struct tracking_prefix* grown =
+        realloc(server->prefixes,
+                (server->nprefixes + n) * sizeof(struct tracking_prefix));
+    if (grown) {
+      server->prefixes = grown;
+    } else {
+      err = "ERR out of memory";
+    }
+  }
+  if (err) {
+    miniredis_conn_write_error(conn, err);
+    free(prefixes);
+    return;
+  }
+  tracking_off(server, client);
+  if (on) {
+    client->tracking = true;
+    client->tracking_bcast = opts.tracking_bcast;
+    client->tracking_optin = opts.tracking_optin;
+    client->tracking_optout = opts.tracking_optout;
+    client->tracking_noloop = opts.tracking_noloop;
+    client->redirect = opts.redirect;
+    server->tracking_clients++;
+  }
+  for (int i = 0; i < n; i++) {
+    size_t len = 0;
+    const char* prefix =
+        nprefixes ? miniredis_args_at(args, prefixes[i], &len) : "";
+    char* copy = malloc(len + 1);
+    if (!copy) {
+      tracking_off(server, client);
+      err = "ERR out of memory";
+      break;
+    }
+    memcpy(copy, prefix, len);
+    copy[len] = '\0';
+    server->prefixes[server->nprefixes++] =
+        (struct tracking_prefix){client->id, copy, len};
+  }
+  free(prefixes);
+  if (err) {
+    miniredis_conn_write_error(conn, err);
+  } else {
+    miniredis_conn_write_string(conn, "OK");
+  }
+}
+
+// CLIENT ID | SETNAME name | GETNAME | TRACKING ... | CACHING YES|NO |
+//        GETREDIR
+void cmdCLIENT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  int nargs = miniredis_args_count(args);
+  if (nargs == 2 && miniredis_args_eq(args, 1, "id")) {
+    miniredis_conn_write_uint(conn, client->id);
+  } else if (nargs == 3 && miniredis_args_eq(args, 1, "setname")) {
+    size_t len;
+    const char* name = miniredis_args_at(args, 2, &len);
+    if (client_name_valid(conn, name, len) &&
+        client_setname(conn, client, name, len)) {
+      miniredis_conn_write_string(conn, "OK");
+    }
+  } else if (nargs == 2 && miniredis_args_eq(args, 1, "getname")) {
+    miniredis_conn_write_bulk(conn, client->name, -1);
+  } else if (nargs >= 3 && miniredis_args_eq(args, 1, "tracking")) {
+    clientTRACKING(conn, args, server, client);
+  } else if (nargs == 3 && miniredis_args_eq(args, 1, "caching")) {
+    bool yes = miniredis_args_eq(args, 2, "yes");
+    if (!yes && !miniredis_args_eq(args, 2, "no")) {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+    } else if (!client->tracking ||
+               (yes ? !client->tracking_optin : !client->tracking_optout)) {
+      miniredis_conn_write_error(
+          conn, yes ? "ERR CLIENT CACHING YES is only valid when tracking is "
+                      "enabled in OPTIN mode."
+                    : "ERR CLIENT CACHING NO is only valid when tracking is "
+                      "enabled in OPTOUT mode.");
+    } else {
+      client->caching = true;
+      miniredis_conn_write_string(conn, "OK");
+    }
+  } else if (nargs == 2 && miniredis_args_eq(args, 1, "getredir")) {
+    miniredis_conn_write_int(conn, client->tracking ? (int64_t)client->redirect
+                                                    : -1);
+  } else {
+    miniredis_conn_write_error(conn, "ERR unknown subcommand or wrong number "
+                                     "of arguments for 'client' command");
+  }
+}
+
+// PING [message]
+void cmdPING(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  (void)udata;
+  int argc = miniredis_args_count(args);
+  if (argc > 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  size_t len = 0;
+  const char* arg = argc == 2 ? miniredis_args_at(args, 1, &len) : "";
+  if (client_subscriptions(miniredis_conn_udata(conn)) &&
+      miniredis_conn_proto(conn) == 2) {
+    // subscribed clients get a reply like the messages they receive, which
+    // RESP3 tells apart by their push type
+    miniredis_conn_write_array(conn, 2);
+    miniredis_conn_write_bulk(conn, "pong", -1);
+    miniredis_conn_write_bulk(conn, arg, len);
+  } else if (argc == 1) {
+    miniredis_conn_write_string(conn, "PONG");
+  } else {
+    miniredis_conn_write_bulk(conn, arg, len);
+  }
+}
+
+bool flushiter(void* item, void* udata) {
+  db_retire(udata, item);
+  return true;
+}
+
+void keyspace_release(void* pairs) { cmap_free(pairs); }
+
+// cmdFLUSHDB
+void cmdFLUSHDB(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct cmap* pairs = cmap_new(server->epoch, key_hash, key_compare);
+  if (!pairs) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  cmap_scan(server->pairs, flushiter, server);
+  epoch_retire(server->epoch, server->pairs, keyspace_release);
+  server->pairs = pairs;
+  server->used_memory = 0;
+  for (size_t i = 0; server->watching && i < WATCH_BUCKETS; i++) {
+    server->versions[i]++;
+  }
+  tracking_flush(server);
+  if (server->cluster) {
+    memset(server->slotkeys, 0, CLUSTER_SLOTS * sizeof(struct pair*));
+    memset(server->slotcounts, 0, CLUSTER_SLOTS * sizeof(uint32_t));
+  }
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// cmdDBSIZE
+void cmdDBSIZE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  size_t count = cmap_count(server->pairs);
+  miniredis_conn_write_uint(conn, count);
+}
+
+// ASKING
+void cmdASKING(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!server->cluster) {
+    miniredis_conn_write_error(
+        conn, "ERR This instance has cluster support disabled");
+    return;
+  }
+  struct client* client = miniredis_conn_udata(conn);
+  client->asking = true;
+  miniredis_conn_write_string(conn, "OK");
+}
+
+bool argtoslot(struct miniredis_conn* conn, struct miniredis_args* args,
+               int index, int* slot) {
+  int64_t x;
+  if (!argtoint(args, index, &x) || x < 0 || x >= CLUSTER_SLOTS) {
+    miniredis_conn_write_error(conn, "ERR Invalid or out of range slot");
+    return false;
+  }
+  *slot = x;
+  return true;
+}
+
+struct cluster_node* argtonode(struct miniredis_conn* conn,
+                               struct miniredis_args* args, int index,
+                               struct server* server) {
+  size_t len;
+  const char* id = miniredis_args_at(args, index, &len);
+  struct cluster_node* node = cluster_node_find(server->cluster, id, len);
+  if (!node) {
+    char str[128];
+    snprintf(str, sizeof(str), "ERR I don't know about node %.*s", (int)len,
+             id);
+    miniredis_conn_write_error(conn, str);
+  }
+  return node;
+}
+
+void clusterSETSLOT(struct miniredis_conn* conn, struct miniredis_args* args,
+                    struct server* server) {
+  struct cluster* cluster = server->cluster;
+  int nargs = miniredis_args_count(args);
+  int slot;
+  if (nargs < 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!argtoslot(conn, args, 2, &slot)) {
+    return;
+  }
+  if (miniredis_args_eq(args, 3, "stable") && nargs == 4) {
+    cluster->migrating[slot] = NULL;
+    cluster->importing[slot] = NULL;
+    miniredis_conn_write_string(conn, "OK");
+    return;
+  }
+  if (nargs != 5) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  struct cluster_node* node = argtonode(conn, args, 4, server);
+  if (!node) {
+    return;
+  }
+  if (miniredis_args_eq(args, 3, "migrating")) {
+    if (cluster->slots[slot] != cluster->myself) {
+      miniredis_conn_write_error(conn, "ERR I'm not the owner of hash slot");
+      return;
+    }
+    if (node == cluster->myself) {
+      miniredis_conn_write_error(conn, "ERR Target node is myself");
+      return;
+    }
+    cluster->migrating[slot] = node;
+  } else if (miniredis_args_eq(args, 3, "importing")) {
+    if (cluster->slots[slot] == cluster->myself) {
+      miniredis_conn_write_error(conn,
+                                 "ERR I'm already the owner of hash slot");
+      return;
+    }
+    if (node == cluster->myself) {
+      miniredis_conn_write_error(conn, "ERR Source node is myself");
+      return;
+    }
+    cluster->importing[slot] = node;
+  } else if (miniredis_args_eq(args, 3, "node")) {
+    if (cluster->slots[slot] == cluster->myself && node != cluster->myself &&
+        server->slotcounts[slot] > 0) {
+      miniredis_conn_write_error(
+          conn,
+          "ERR Can't assign hashslot to a different node while I still hold "
+          "keys for this hash slot");
+      return;
+    }
+    if (node != cluster->myself) {
+      cluster->migrating[slot] = NULL;
+    } else {
+      cluster->importing[slot] = NULL;
+    }
+    cluster->slots[slot] = node;
+  } else {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  miniredis_conn_write_string(conn, "OK");
+}
+
+void clusterADDSLOTS(struct miniredis_conn* conn, struct miniredis_args* args,
+                     struct server* server, bool add, bool range) {
+  struct cluster* cluster = server->cluster;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3 || (range && nargs % 2 != 0)) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  // validate everything before changing any slot
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 2; i < nargs; i += range ? 2 : 1) {
+      int start, end;
+      if (!argtoslot(conn, args, i, &start) ||
+          (range && !argtoslot(conn, args, i + 1, &end))) {
+        return;
+      }
+      if (!range) {
+        end = start;
+      }
+      for (int slot = start; slot <= end; slot++) {
+        if (pass == 1) {
+          cluster->slots[slot] = add ? cluster->myself : NULL;
+          cluster->importing[slot] = NULL;
+          cluster->migrating[slot] = NULL;
+        } else if (add && cluster->slots[slot]) {
+          char str[64];
+          snprintf(str, sizeof(str), "ERR Slot %d is already busy", slot);
+          miniredis_conn_write_error(conn, str);
+          return;
+        } else if (!add && !cluster->slots[slot]) {
+          char str[64];
+          snprintf(str, sizeof(str), "ERR Slot %d is already unassigned",
+                   slot);
+          miniredis_conn_write_error(conn, str);
+          return;
+        }
+      }
+    }
+  }
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// CLUSTER subcommand [arg...]
+void cmdCLUSTER(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  struct cluster* cluster = server->cluster;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!cluster) {
+    miniredis_conn_write_error(
+        conn, "ERR This instance has cluster support disabled");
+    return;
+  }
+  struct buf buf = {0};
+  bool ok = true;
+  int slot;
+  if (miniredis_args_eq(args, 1, "info") && nargs == 2) {
+    if ((ok = cluster_write_info(cluster, &buf))) {
+      miniredis_conn_write_bulk(conn, buf.data, buf.len);
+    }
+  } else if (miniredis_args_eq(args, 1, "nodes") && nargs == 2) {
+    if ((ok = cluster_write_nodes(cluster, &buf))) {
+      miniredis_conn_write_bulk(conn, buf.data, buf.len);
+    }
+  } else if (miniredis_args_eq(args, 1, "slots") && nargs == 2) {
+    if ((ok = cluster_write_slots(cluster, &buf))) {
+      miniredis_conn_write_raw(conn, buf.data, buf.len);
+    }
+  } else if (miniredis_args_eq(args, 1, "shards") && nargs == 2) {
+    if ((ok = cluster_write_shards(cluster, &buf))) {
+      miniredis_conn_write_raw(conn, buf.data, buf.len);
+    }
+  } else if (miniredis_args_eq(args, 1, "myid") && nargs == 2) {
+    miniredis_conn_write_bulk(conn, cluster->myself->id, -1);
+  } else if (miniredis_args_eq(args, 1, "keyslot") && nargs == 3) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, 2, &keylen);
+    miniredis_conn_write_int(conn, cluster_keyslot(key, keylen));
+  } else if (miniredis_args_eq(args, 1, "countkeysinslot") && nargs == 3) {
+    if (argtoslot(conn, args, 2, &slot)) {
+      miniredis_conn_write_uint(conn, server->slotcounts[slot]);
+    }
+  } else if (miniredis_args_eq(args, 1, "getkeysinslot") && nargs == 4) {
+    int64_t count;
+    if (!argtoslot(conn, args, 2, &slot)) {
+      return;
+    }
+    if (!argtoint(args, 3, &count) || count < 0) {
+      miniredis_conn_write_error(conn, "ERR Invalid number of keys");
+      return;
+    }
+    int n = 0;
+    struct pair* pair = server->slotkeys[slot];
+    for (; pair && n < count; pair = pair_links(pair)->next) {
+      ok = ok && miniredis_write_bulk(&buf, pair_key(pair), pair->keylen);
+      n++;
+    }
+    if (ok) {
+      miniredis_conn_write_array(conn, n);
+      miniredis_conn_write_raw(conn, buf.data, buf.len);
+    }
+  } else if (miniredis_args_eq(args, 1, "addslots")) {
+    clusterADDSLOTS(conn, args, server, true, false);
+  } else if (miniredis_args_eq(args, 1, "addslotsrange")) {
+    clusterADDSLOTS(conn, args, server, true, true);
+  } else if (miniredis_args_eq(args, 1, "delslots")) {
+    clusterADDSLOTS(conn, args, server, false, false);
+  } else if (miniredis_args_eq(args, 1, "delslotsrange")) {
+    clusterADDSLOTS(conn, args, server, false, true);
+  } else if (miniredis_args_eq(args, 1, "setslot")) {
+    clusterSETSLOT(conn, args, server);
+  } else {
+    miniredis_conn_write_error(conn,
+                               "ERR unknown subcommand or wrong number of "
+                               "arguments for 'cluster' command");
+  }
+  if (!ok) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  }
+  buf_clear(&buf);
+}
+
+// TYPE key
+void cmdTYPE(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  struct pair* pair = db_get(server, key, keylen);
+  miniredis_conn_write_string(conn, pair ? type_names[pair->type] : "none");
+}
+
+// OBJECT ENCODING key
+void cmdOBJECT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3 ||
+      !miniredis_args_eq(args, 1, "encoding")) {
+    miniredis_conn_write_error(conn,
+                               "ERR unknown subcommand or wrong number of "
+                               "arguments for 'object' command");
+    return;
+  }
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 2, &keylen);
+  struct pair* pair = db_get(server, key, keylen);
+  if (!pair) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  miniredis_conn_write_bulk(conn, encoding_names[pair->type][pair->enc], -1);
+}
+
+// elements_append appends to a listpack under construction, freeing it when
+// out of memory.
+unsigned char* elements_append(unsigned char* lp, const char* data,
+                               size_t len) {
+  unsigned char* nlp = lp ? lp_append(lp, data, len) : NULL;
+  if (!nlp) {
+    lp_free(lp);
+  }
+  return nlp;
+}
+
+// elements_append_uint appends the number to the listpack, as a string.
+unsigned char* elements_append_uint(unsigned char* lp, uint64_t x) {
+  char str[24];
+  return elements_append(lp, str, snprintf(str, sizeof(str), "%" PRIu64, x));
+}
+
+unsigned char* elements_append_id(unsigned char* lp, struct stream_id id) {
+  char str[44];
+  return elements_append(lp, str, stream_format_id(str, id));
+}
+
+// stream_elements appends the elements of the stream to the listpack: its
+// last ID, the number of entries ever added and the number of entries, each
+// as its ID, number of fields, and fields and values. Then the number of
+// groups, each as its name, last ID, entries read and number of consumers,
+// each as its name, seen time and number of pending entries, each as its
+// ID, delivery time and delivery count.
+unsigned char* stream_elements(unsigned char* lp, struct stream* s) {
+  lp = elements_append_id(lp, s->last_id);
+  lp = elements_append_uint(lp, s->entries_added);
+  lp = elements_append_uint(lp, s->len);
+  struct stream_iter it;
+  stream_iter_start(&it, s, (struct stream_id){0}, STREAM_ID_MAX, false);
+  struct stream_id id;
+  uint64_t nfields;
+  while (lp && stream_iter_next(&it, &id, &nfields)) {
+    lp = elements_append_id(lp, id);
+    lp = elements_append_uint(lp, nfields);
+    for (uint64_t i = 0; i < nfields; i++) {
+      const char* field;
+      const char* val;
+      size_t flen, vlen;
+      stream_iter_field(&it, &field, &flen, &val, &vlen);
+      lp = elements_append(lp, field, flen);
+      lp = elements_append(lp, val, vlen);
+    }
+  }
+  lp = elements_append_uint(lp, dict_count(s->groups));
+  struct dict_entry* entry;
+  size_t i = 0;
+  while (lp && dict_iter(s->groups, &i, &entry)) {
+    struct stream_group* g;
+    memcpy(&g, dict_entry_val(entry), sizeof(g));
+    lp = elements_append(lp, entry->key, entry->keylen);
+    lp = elements_append_id(lp, g->last_id);
+    lp = elements_append_uint(lp, g->entries_read);
+    lp = elements_append_uint(lp, dict_count(g->consumers));
+    struct dict_entry* centry;
+    size_t j = 0;
+    while (lp && dict_iter(g->consumers, &j, &centry)) {
+      struct stream_consumer* c;
+      memcpy(&c, dict_entry_val(centry), sizeof(c));
+      lp = elements_append(lp, c->name, c->namelen);
+      lp = elements_append_uint(lp, c->seen_time);
+      lp = elements_append_uint(lp, c->pel->count);
+      struct radix_leaf* leaf = c->pel->first;
+      for (; lp && leaf; leaf = leaf->next) {
+        struct stream_nack* nack = leaf->value;
+        lp = elements_append_id(lp, stream_key_id(leaf->key));
+        lp = elements_append_uint(lp, nack->delivery_time);
+        lp = elements_append_uint(lp, nack->delivery_count);
+      }
+    }
+  }
+  return lp;
+}
+
+// obj_elements returns a new listpack with the elements of the object: the
+// fields and values of a hash, the elements of a list or set, the members
+// and scores of a sorted set, or those of stream_elements. Returns NULL when
+// out of memory.
+unsigned char* obj_elements(struct pair* pair) {
+  unsigned char* lp = NULL;
+  const char* data;
+  size_t len;
+  if ((pair->type == TYPE_HASH || pair->type == TYPE_ZSET) &&
+      pair->enc == ENC_COMPACT) {
+    unsigned char* src = pair_obj(pair);
+    lp = malloc(lp_bytes(src));
+    if (lp) {
+      memcpy(lp, src, lp_bytes(src));
+    }
+  } else if (pair->type == TYPE_HASH) {
+    lp = lp_new();
+    struct dict_entry* entry;
+    size_t i = 0;
+    while (lp && dict_iter(pair_obj(pair), &i, &entry)) {
+      lp = elements_append(lp, entry->key, entry->keylen);
+      lp = elements_append(lp, dict_entry_val(entry), entry->vallen);
+    }
+  } else if (pair->type == TYPE_LIST) {
+    lp = lp_new();
+    struct ql_iter it;
+    bool ok = ql_index(pair_obj(pair), 0, &it);
+    for (; lp && ok; ok = ql_next(&it)) {
+      data = ql_get(&it, &len);
+      lp = elements_append(lp, data, len);
+    }
+  } else if (pair->type == TYPE_SET) {
+    lp = lp_new();
+    size_t i = 0;
+    char str[32];
+    while (lp && set_next(pair, &i, &data, &len, str)) {
+      lp = elements_append(lp, data, len);
+    }
+  } else if (pair->type == TYPE_ZSET) {
+    lp = lp_new();
+    struct zset_iter it;
+    zset_seek_rank(pair, 0, false, &it);
+    double score;
+    char str[32];
+    while (lp && zset_iter_get(&it, &data, &len, &score)) {
+      lp = elements_append(lp, data, len);
+      lp = elements_append(lp, str, miniredis_format_double(str, score));
+      zset_iter_next(&it);
+    }
+  } else if (pair->type == TYPE_STREAM) {
+    lp = stream_elements(lp_new(), pair_obj(pair));
+  }
+  return lp;
+}
+
+// obj_load adds the elements of a listpack made by obj_elements to the
+// object. Returns false when out of memory.
+bool obj_load(struct server* server, struct pair* pair, unsigned char* lp) {
+  for (unsigned char* p = lp_first(lp); p; p = lp_next(lp, p)) {
+    size_t len, vlen;
+    const char* data = lp_get(p, &len);
+    switch (pair->type) {
+      case TYPE_HASH: {
+        p = lp_next(lp, p);
+        const char* val = lp_get(p, &vlen);
+        if (hash_set(server, pair, data, len, val, vlen) == -1) {
+          return false;
+        }
+        break;
+      }
+      case TYPE_LIST:
+        if (!ql_push(pair_obj(pair), data, len, false)) {
+          return false;
+        }
+        break;
+      case TYPE_SET:
+        if (set_add(server, pair, data, len) == -1) {
+          return false;
+        }
+        break;
+      case TYPE_ZSET: {
+        p = lp_next(lp, p);
+        const char* str = lp_get(p, &vlen);
+        double score;
+        if (!parse_score(str, vlen, &score) ||
+            zset_set(server, pair, data, len, score) == -1) {
+          return false;
+        }
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+// stream_reader reads the elements of a listpack made by stream_elements,
+// failing once they run out or do not parse.
+struct stream_reader {
+  unsigned char* lp;
+  unsigned char* p;
+  bool ok;
+};
+
+const char* stream_read_str(struct stream_reader* rd, size_t* len) {
+  if (!rd->ok || !rd->p) {
+    rd->ok = false;
+    *len = 0;
+    return "";
+  }
+  const char* str = lp_get(rd->p, len);
+  rd->p = lp_next(rd->lp, rd->p);
+  return str;
+}
+
+uint64_t stream_read_uint(struct stream_reader* rd) {
+  size_t len;
+  const char* str = stream_read_str(rd, &len);
+  int64_t x = 0;
+  if (rd->ok && !parse_int(str, len, &x)) {
+    rd->ok = false;
+  }
+  return x;
+}
+
+struct stream_id stream_read_id(struct stream_reader* rd) {
+  size_t len;
+  const char* str = stream_read_str(rd, &len);
+  struct stream_id id = {0};
+  bool seqgiven;
+  if (rd->ok && !stream_parse_id(str, len, 0, &id, &seqgiven)) {
+    rd->ok = false;
+  }
+  return id;
+}
+
+// stream_load adds the elements of a listpack made by stream_elements to an
+// empty stream. Returns false with err set when they are invalid or out of
+// memory.
+bool stream_load(struct server* server, struct stream* s, unsigned char* lp,
+                 const char** err) {
+  const char* invalid = "ERR DUMP payload version or checksum are wrong";
+  struct stream_reader rd = {lp, lp_first(lp), true};
+  struct stream_id last_id = stream_read_id(&rd);
+  uint64_t entries_added = stream_read_uint(&rd);
+  uint64_t len = stream_read_uint(&rd);
+  const char** fields = NULL;
+  size_t* lens = NULL;
+  for (uint64_t i = 0; rd.ok && i < len; i++) {
+    struct stream_id id = stream_read_id(&rd);
+    uint64_t nfields = stream_read_uint(&rd);
+    if (!rd.ok || nfields > lp_count(lp) ||
+        stream_id_cmp(id, s->last_id) <= 0) {
+      *err = invalid;
+      goto fail;
+    }
+    free(fields);
+    free(lens);
+    fields = malloc((2 * nfields + 1) * sizeof(char*));
+    lens = malloc((2 * nfields + 1) * sizeof(size_t));
+    if (!fields || !lens) {
+      goto fail;
+    }
+    for (uint64_t j = 0; j < 2 * nfields; j++) {
+      fields[j] = stream_read_str(&rd, &lens[j]);
+    }
+    if (!rd.ok) {
+      *err = invalid;
+      goto fail;
+    }
+    if (!stream_append(s, id, fields, lens, nfields,
+                       server->stream_node_max_entries,
+                       server->stream_node_max_bytes)) {
+      goto fail;
+    }
+  }
+  free(fields);
+  free(lens);
+  fields = NULL;
+  lens = NULL;
+  if (stream_id_cmp(last_id, s->last_id) < 0) {
+    rd.ok = false;
+  }
+  s->last_id = last_id;
+  s->entries_added = entries_added;
+  uint64_t ngroups = stream_read_uint(&rd);
+  for (uint64_t i = 0; rd.ok && i < ngroups; i++) {
+    size_t namelen;
+    const char* name = stream_read_str(&rd, &namelen);
+    struct stream_id id = stream_read_id(&rd);
+    int64_t entries_read = stream_read_uint(&rd);
+    uint64_t nconsumers = stream_read_uint(&rd);
+    if (!rd.ok || stream_group_get(s, name, namelen)) {
+      *err = invalid;
+      goto fail;
+    }
+    struct stream_group* g = stream_group_create(s, name, namelen, id);
+    if (!g) {
+      goto fail;
+    }
+    g->entries_read = entries_read;
+    for (uint64_t j = 0; rd.ok && j < nconsumers; j++) {
+      name = stream_read_str(&rd, &namelen);
+      int64_t seen_time = stream_read_uint(&rd);
+      uint64_t npending = stream_read_uint(&rd);
+      if (!rd.ok || stream_consumer_get(g, name, namelen)) {
+        *err = invalid;
+        goto fail;
+      }
+      struct stream_consumer* c =
+          stream_consumer_create(s, g, name, namelen, seen_time);
+      if (!c) {
+        goto fail;
+      }
+      for (uint64_t k = 0; rd.ok && k < npending; k++) {
+        id = stream_read_id(&rd);
+        int64_t delivery_time = stream_read_uint(&rd);
+        uint64_t delivery_count = stream_read_uint(&rd);
+        unsigned char key[RADIX_KEYLEN];
+        stream_id_key(id, key);
+        if (!rd.ok || radix_find(g->pel, key)) {
+          *err = invalid;
+          goto fail;
+        }
+        if (!stream_nack_add(s, g, c, id, delivery_time)) {
+          goto fail;
+        }
+        struct stream_nack* nack = radix_find(g->pel, key)->value;
+        nack->delivery_count = delivery_count;
+      }
+    }
+  }
+  if (!rd.ok || rd.p) {
+    *err = invalid;
+    return false;
+  }
+  return true;
+fail:
+  free(fields);
+  free(lens);
+  return false;
+}
+
+// obj_dump serializes the value of the pair as a type byte followed by the
+// value. Strings are written as is and other types as a listpack of their
+// elements.
+bool obj_dump(struct pair* pair, struct buf* buf) {
+  if (!buf_append_byte(buf, pair->type)) {
+    return false;
+  }
+  if (pair->type == TYPE_STRING) {
+    return buf_append(buf, pair_val(pair), pair->vallen);
+  }
+  unsigned char* lp = obj_elements(pair);
+  bool ok = lp && buf_append(buf, (char*)lp, lp_bytes(lp));
+  lp_free(lp);
+  return ok;
+}
+
+// obj_restore creates a pair from a payload made by obj_dump. Returns NULL
+// with err set when the payload is invalid or out of memory.
+struct pair* obj_restore(struct server* server, const char* key,
+                         size_t keylen, const char* payload, size_t len,
+                         double expires, const char** err) {
+  *err = "ERR DUMP payload version or checksum are wrong";
+  int type = len > 0 ? (unsigned char)payload[0] : -1;
+  if (type == TYPE_STRING) {
+    struct pair* pair = pair_new(key, keylen, payload + 1, len - 1, expires,
+                                 server->cluster != NULL);
+    *err = pair ? NULL : "ERR out of memory";
+    return pair;
+  }
+  unsigned char* elems = (unsigned char*)payload + 1;
+  if (type < TYPE_HASH || type > TYPE_STREAM || !lp_valid(elems, len - 1) ||
+      lp_count(elems) == 0 ||
+      ((type == TYPE_HASH || type == TYPE_ZSET) &&
+       lp_count(elems) % 2 != 0)) {
+    return NULL;
+  }
+  *err = "ERR out of memory";
+  struct pair* pair = obj_pair_new(server, key, keylen, type, expires);
+  if (!pair || !(type == TYPE_STREAM
+                     ? stream_load(server, pair_obj(pair), elems, err)
+                     : obj_load(server, pair, elems))) {
+    pair_free(pair);
+    return NULL;
+  }
+  *err = NULL;
+  return pair;
+}
+
+// RESTORE key ttl payload [REPLACE]
+// The payload is made by obj_dump, as sent by MIGRATE.
+void cmdRESTORE(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4 || nargs > 5) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool replace = false;
+  if (nargs == 5) {
+    if (!miniredis_args_eq(args, 4, "replace")) {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+    replace = true;
+  }
+  int64_t ttl;
+  if (!argtoint(args, 2, &ttl) || ttl < 0) {
+    miniredis_conn_write_error(conn, "ERR Invalid TTL value, must be >= 0");
+    return;
+  }
+  size_t keylen, len;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  const char* payload = miniredis_args_at(args, 3, &len);
+  if (!replace && db_get(server, key, keylen)) {
+    miniredis_conn_write_error(conn, "BUSYKEY Target key name already exists.");
+    return;
+  }
+  double expires = ttl > 0 ? server->now + ttl / 1000.0 : 0;
+  const char* err;
+  struct pair* pair =
+      obj_restore(server, key, keylen, payload, len, expires, &err);
+  if (!pair) {
+    miniredis_conn_write_error(conn, err);
+    return;
+  }
+  if (!db_set(server, pair)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  if (pair->type == TYPE_LIST || pair->type == TYPE_STREAM) {
+    signal_ready(server, key, keylen);
+  }
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// migrate_connect opens a blocking connection to host:port, giving up after
+// timeout milliseconds. Returns -1 on failure.
+int migrate_connect(const char* host, const char* port, int64_t timeout) {
+  struct addrinfo hints = {0}, *addrs;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &addrs) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo* ai = addrs; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK,
+                ai->ai_protocol);
+    if (fd == -1) continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 ||
+        errno == EINPROGRESS) {
+      struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+      int err = 0;
+      socklen_t errlen = sizeof(err);
+      if (poll(&pfd, 1, timeout) == 1 &&
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 &&
+          err == 0) {
+        break;
+      }
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  if (fd == -1) {
+    return -1;
+  }
+  struct timeval tv = {.tv_sec = timeout / 1000,
+                       .tv_usec = (timeout % 1000) * 1000};
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == -1 ||
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// migrate_readline reads a single reply line into line, without the CRLF.
+bool migrate_readline(int fd, char* line, size_t size) {
+  size_t n = 0;
+  for (;;) {
+    char ch;
+    if (read(fd, &ch, 1) != 1) {
+      return false;
+    }
+    if (ch == '\n') break;
+    if (n < size - 1) line[n++] = ch;
+  }
+  if (n > 0 && line[n - 1] == '\r') n--;
+  line[n] = '\0';
+  return true;
+}
+
+// MIGRATE host port key|"" destination-db timeout [COPY] [REPLACE]
+//         [KEYS key [key...]]
+void cmdMIGRATE(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 6) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool copy = false, replace = false;
+  int firstkey = 3, nkeys = 1;
+  for (int i = 6; i < nargs; i++) {
+    if (miniredis_args_eq(args, i, "copy")) {
+      copy = true;
+    } else if (miniredis_args_eq(args, i, "replace")) {
+      replace = true;
+    } else if (miniredis_args_eq(args, i, "keys")) {
+      size_t len;
+      miniredis_args_at(args, 3, &len);
+      if (len != 0) {
+        miniredis_conn_write_error(
+            conn,
+            "ERR When using MIGRATE KEYS option, the key argument must be set "
+            "to the empty string");
+        return;
+      }
+      firstkey = i + 1;
+      nkeys = nargs - firstkey;
+      break;
+    } else {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+  }
+  int64_t db, timeout;
+  if (!argtoint(args, 4, &db) || !argtoint(args, 5, &timeout)) {
+    miniredis_conn_write_error(conn,
+                               "ERR value is not an integer or out of range");
+    return;
+  }
+  if (db != 0) {
+    miniredis_conn_write_error(conn, "ERR DB index is out of range");
+    return;
+  }
+  if (timeout <= 0) {
+    timeout = 1000;
+  }
+  // build a pipeline of ASKING + RESTORE for every key that exists
+  struct buf out = {0};
+  struct buf payload = {0};
+  bool ok = true;
+  int nsent = 0;
+  for (int i = 0; i < nkeys && ok; i++) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, firstkey + i, &keylen);
+    struct pair* pair = db_get(server, key, keylen);
+    if (!pair) continue;
+    int64_t ttl = 0;
+    if (pair->hasex) {
+      ttl = (pair_expire(pair) - server->now) * 1000;
+      ttl = ttl < 1 ? 1 : ttl;
+    }
+    char str[32];
+    snprintf(str, sizeof(str), "%" PRId64, ttl);
+    payload.len = 0;
+    ok = obj_dump(pair, &payload) &&
+         miniredis_write_array(&out, 1) &&
+         miniredis_write_bulk(&out, "ASKING", -1) &&
+         miniredis_write_array(&out, replace ? 5 : 4) &&
+         miniredis_write_bulk(&out, "RESTORE", -1) &&
+         miniredis_write_bulk(&out, key, keylen) &&
+         miniredis_write_bulk(&out, str, -1) &&
+         miniredis_write_bulk(&out, payload.data, payload.len) &&
+         (!replace || miniredis_write_bulk(&out, "REPLACE", -1));
+    nsent++;
+  }
+  buf_clear(&payload);
+  if (!ok) {
+    buf_clear(&out);
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  if (nsent == 0) {
+    buf_clear(&out);
+    miniredis_conn_write_string(conn, "NOKEY");
+    return;
+  }
+  const char* host = miniredis_args_at(args, 1, NULL);
+  const char* port = miniredis_args_at(args, 2, NULL);
+  int fd = migrate_connect(host, port, timeout);
+  char line[256];
+  char err[300] = "";
+  if (fd == -1) {
+    snprintf(err, sizeof(err), "IOERR error or timeout connecting to %s:%s",
+             host, port);
+  }
+  for (size_t i = 0; fd != -1 && i < out.len;) {
+    ssize_t n = write(fd, out.data + i, out.len - i);
+    if (n <= 0) {
+      snprintf(err, sizeof(err), "IOERR error or timeout writing to target");
+      break;
+    }
+    i += n;
+  }
+  // every key gets its own pair of replies, only keys acknowledged with +OK
+  // are removed from this node.
+  for (int i = 0; i < nkeys && !err[0]; i++) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, firstkey + i, &keylen);
+    if (!db_get(server, key, keylen)) continue;
+    if (!migrate_readline(fd, line, sizeof(line)) ||
+        !migrate_readline(fd, line + 1, sizeof(line) - 1)) {
+      snprintf(err, sizeof(err), "IOERR error or timeout reading from target");
+      break;
+    }
+    if (line[1] == '-') {
+      snprintf(err, sizeof(err), "ERR Target instance replied with error: %s",
+               line + 2);
+      break;
+    }
+    if (!copy) {
+      db_retire(server, db_delete(server, key, keylen));
+    }
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  buf_clear(&out);
+  if (err[0]) {
+    miniredis_conn_write_error(conn, err);
+  } else {
+    miniredis_conn_write_string(conn, "OK");
+  }
+}
+
+enum {
+  CONFIG_BOOL,
+  CONFIG_INT,
+  CONFIG_OCTAL,
+  CONFIG_MEMORY,
+  CONFIG_STRING,
+  CONFIG_ENUM,
+  CONFIG_OBUF,
+};
+
+// config describes a server parameter, which can be set with a --name value
+// command line option and, unless immutable, with CONFIG SET.
+struct config {
+  const char* name;
+  int type;
+  size_t offset;
+  int64_t min;
+  int64_t max;
+  const char** enums;
+  bool immutable;
+};
+
+static const char* maxmemory_policies[] = {
+    "noeviction", "allkeys-lru", "allkeys-lfu", "volatile-ttl", NULL,
+};
+
+static struct config configs[] = {
+    {"cluster-enabled", CONFIG_BOOL, offsetof(struct server, cluster_enabled),
+     .immutable = true},
+    {"cluster-config-file", CONFIG_STRING,
+     offsetof(struct server, cluster_config_file), .immutable = true},
+    {"cluster-announce-ip", CONFIG_STRING,
+     offsetof(struct server, cluster_announce_ip), .immutable = true},
+    {"maxmemory", CONFIG_MEMORY, offsetof(struct server, maxmemory),
+     .max = INT64_MAX},
+    {"maxmemory-policy", CONFIG_ENUM,
+     offsetof(struct server, maxmemory_policy), .enums = maxmemory_policies},
+    {"maxmemory-samples", CONFIG_INT,
+     offsetof(struct server, maxmemory_samples), .min = 1, .max = 64},
+    {"lfu-log-factor", CONFIG_INT, offsetof(struct server, lfu_log_factor),
+     .max = INT32_MAX},
+    {"lfu-decay-time", CONFIG_INT, offsetof(struct server, lfu_decay_time),
+     .max = INT32_MAX},
+    {"client-output-buffer-limit", CONFIG_OBUF,
+     offsetof(struct server, obuf_limits), .enums = client_classes},
+    {"client-output-buffer-pause", CONFIG_MEMORY,
+     offsetof(struct server, client_output_buffer_pause), .max = INT64_MAX},
+    {"hash-max-listpack-entries", CONFIG_INT,
+     offsetof(struct server, hash_max_listpack_entries), .max = INT32_MAX},
+    {"hash-max-listpack-value", CONFIG_INT,
+     offsetof(struct server, hash_max_listpack_value), .max = INT32_MAX},
+    {"list-max-listpack-size", CONFIG_INT,
+     offsetof(struct server, list_max_listpack_size), .min = -5,
+     .max = INT16_MAX},
+    {"set-max-intset-entries", CONFIG_INT,
+     offsetof(struct server, set_max_intset_entries), .max = INT32_MAX},
+    {"zset-max-listpack-entries", CONFIG_INT,
+     offsetof(struct server, zset_max_listpack_entries), .max = INT32_MAX},
+    {"zset-max-listpack-value", CONFIG_INT,
+     offsetof(struct server, zset_max_listpack_value), .max = INT32_MAX},
+    {"hll-sparse-max-bytes", CONFIG_INT,
+     offsetof(struct server, hll_sparse_max_bytes), .max = INT32_MAX},
+    {"stream-node-max-entries", CONFIG_INT,
+     offsetof(struct server, stream_node_max_entries), .max = INT32_MAX},
+    {"stream-node-max-bytes", CONFIG_INT,
+     offsetof(struct server, stream_node_max_bytes), .max = INT32_MAX},
+    {"slowlog-log-slower-than", CONFIG_INT,
+     offsetof(struct server, slowlog_log_slower_than), .min = -1,
+     .max = INT64_MAX},
+    {"slowlog-max-len", CONFIG_INT, offsetof(struct server, slowlog_max_len),
+     .max = INT32_MAX},
+    {"latency-monitor-threshold", CONFIG_INT,
+     offsetof(struct server, latency_monitor_threshold), .max = INT64_MAX},
+    {"latency-tracking", CONFIG_BOOL,
+     offsetof(struct server, latency_tracking), .immutable = false},
+    {"edge-triggered", CONFIG_BOOL, offsetof(struct server, edge_triggered),
+     .immutable = true},
+    {"unixsocket", CONFIG_STRING, offsetof(struct server, unixsocket),
+     .immutable = true},
+    {"unixsocketperm", CONFIG_OCTAL, offsetof(struct server, unixsocketperm),
+     .max = 0777, .immutable = true},
+    {"tracking-table-max-keys", CONFIG_INT,
+     offsetof(struct server, tracking_table_max_keys), .max = INT64_MAX},
+    {"io-threads", CONFIG_INT, offsetof(struct server, io_threads), .min = 1,
+     .max = 64, .immutable = true},
+};
+
+// memtoll parses a memory amount such as "100mb" or "1gb".
+bool memtoll(const char* str, int64_t* x) {
+  char* end = NULL;
+  long long n = strtoll(str, &end, 10);
+  if (end == str || n < 0) return false;
+  int64_t mul = 1;
+  if (strcasecmp(end, "k") == 0) {
+    mul = 1000;
+  } else if (strcasecmp(end, "kb") == 0) {
+    mul = 1024;
+  } else if (strcasecmp(end, "m") == 0) {
+    mul = 1000 * 1000;
+  } else if (strcasecmp(end, "mb") == 0) {
+    mul = 1024 * 1024;
+  } else if (strcasecmp(end, "g") == 0) {
+    mul = 1000LL * 1000 * 1000;
+  } else if (strcasecmp(end, "gb") == 0) {
+    mul = 1024LL * 1024 * 1024;
+  } else if (*end && strcasecmp(end, "b") != 0) {
+    return false;
+  }
+  if (n > INT64_MAX / mul) return false;
+  *x = n * mul;
+  return true;
+}
+
+struct config* config_lookup(const char* name) {
+  for (size_t i = 0; i < sizeof(configs) / sizeof(struct config); i++) {
+    if (strcasecmp(configs[i].name, name) == 0) {
+      return &configs[i];
+    }
+  }
+  return NULL;
+}
+
+// obuf_parse parses "<class> <hard> <soft> <soft seconds> ..." into limits.
+bool obuf_parse(const char* val, struct obuf_limit* limits) {
+  char str[256];
+  snprintf(str, sizeof(str), "%s", val);
+  char* save = NULL;
+  char* tok = strtok_r(str, " ", &save);
+  if (!tok) return false;
+  for (; tok; tok = strtok_r(NULL, " ", &save)) {
+    int class = 0;
+    while (client_classes[class] && strcasecmp(client_classes[class], tok)) {
+      class++;
+    }
+    char* hard = strtok_r(NULL, " ", &save);
+    char* soft = strtok_r(NULL, " ", &save);
+    char* secs = strtok_r(NULL, " ", &save);
+    char* end = NULL;
+    struct obuf_limit limit;
+    if (!client_classes[class] || !secs || !memtoll(hard, &limit.hard) ||
+        !memtoll(soft, &limit.soft)) {
+      return false;
+    }
+    limit.soft_seconds = strtoll(secs, &end, 10);
+    if (end == secs || *end || limit.soft_seconds < 0) {
+      return false;
+    }
+    limits[class] = limit;
+  }
+  return true;
+}
+
+// config_set parses and sets a parameter. On failure false is returned and
+// err holds the reason.
+bool config_set(struct server* server, struct config* config, const char* val,
+                const char** err) {
+  char* field = ((char*)server) + config->offset;
+  int64_t x;
+  char* end = NULL;
+  switch (config->type) {
+    case CONFIG_BOOL:
+      if (strcasecmp(val, "yes") != 0 && strcasecmp(val, "no") != 0) {
+        *err = "argument must be 'yes' or 'no'";
+        return false;
+      }
+      *(bool*)field = strcasecmp(val, "yes") == 0;
+      return true;
+    case CONFIG_INT:
+    case CONFIG_OCTAL:
+    case CONFIG_MEMORY:
+      if (config->type == CONFIG_MEMORY) {
+        if (!memtoll(val, &x)) {
+          *err = "argument must be a memory value";
+          return false;
+        }
+      } else {
+        x = strtoll(val, &end, config->type == CONFIG_OCTAL ? 8 : 10);
+        if (end == val || *end) {
+          *err = "argument couldn't be parsed into an integer";
+          return false;
+        }
+      }
+      if (x < config->min || x > config->max) {
+        *err = "argument must be between the minimum and maximum value";
+        return false;
+      }
+      *(int64_t*)field = x;
+      return true;
+    case CONFIG_STRING: {
+      char* str = strdup(val);
+      if (!str) {
+        *err = "out of memory";
+        return false;
+      }
+      free(*(char**)field);
+      *(char**)field = str;
+      return true;
+    }
+    case CONFIG_ENUM:
+      for (int i = 0; config->enums[i]; i++) {
+        if (strcasecmp(config->enums[i], val) == 0) {
+          *(int64_t*)field = i;
+          return true;
+        }
+      }
+      *err = "argument(s) must be one of the accepted values";
+      return false;
+    case CONFIG_OBUF: {
+      struct obuf_limit limits[CLIENT_CLASSES];
+      memcpy(limits, field, sizeof(limits));
+      if (!obuf_parse(val, limits)) {
+        *err = "argument must be <class> <hard> <soft> <soft seconds>";
+        return false;
+      }
+      memcpy(field, limits, sizeof(limits));
+      return true;
+    }
+  }
+  return false;
+}
+
+// config_get formats the value of a parameter.
+void config_get(struct server* server, struct config* config, char* str,
+                size_t size) {
+  char* field = ((char*)server) + config->offset;
+  switch (config->type) {
+    case CONFIG_BOOL:
+      snprintf(str, size, "%s", *(bool*)field ? "yes" : "no");
+      break;
+    case CONFIG_INT:
+    case CONFIG_MEMORY:
+      snprintf(str, size, "%" PRId64, *(int64_t*)field);
+      break;
+    case CONFIG_OCTAL:
+      snprintf(str, size, "%" PRIo64, *(int64_t*)field);
+      break;
+    case CONFIG_STRING:
+      snprintf(str, size, "%s", *(char**)field ? *(char**)field : "");
+      break;
+    case CONFIG_ENUM:
+      snprintf(str, size, "%s", config->enums[*(int64_t*)field]);
+      break;
+    case CONFIG_OBUF: {
+      struct obuf_limit* limits = (struct obuf_limit*)field;
+      size_t n = 0;
+      str[0] = '\0';
+      for (int i = 0; i < CLIENT_CLASSES && n < size; i++) {
+        n += snprintf(str + n, size - n,
+                      "%s%s %" PRId64 " %" PRId64 " %" PRId64, i ? " " : "",
+                      client_classes[i], limits[i].hard, limits[i].soft,
+                      limits[i].soft_seconds);
+      }
+      break;
+    }
+  }
+}
+
+// CONFIG GET pattern | CONFIG SET parameter value [parameter value...]
+void cmdCONFIG(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  char str[256];
+  if (miniredis_args_eq(args, 1, "get") && nargs == 3) {
+    size_t plen;
+    const char* pat = miniredis_args_at(args, 2, &plen);
+    struct buf buf = {0};
+    int count = 0;
+    for (size_t i = 0; i < sizeof(configs) / sizeof(struct config); i++) {
+      if (!match(pat, plen, configs[i].name, -1)) continue;
+      config_get(server, &configs[i], str, sizeof(str));
+      if (!miniredis_write_bulk(&buf, configs[i].name, -1) ||
+          !miniredis_write_bulk(&buf, str, -1)) {
+        buf_clear(&buf);
+        miniredis_conn_write_error(conn, "ERR out of memory");
+        return;
+      }
+      count++;
+    }
+    miniredis_conn_write_map(conn, count);
+    miniredis_conn_write_raw(conn, buf.data, buf.len);
+    buf_clear(&buf);
+  } else if (miniredis_args_eq(args, 1, "set") && nargs >= 4 &&
+             nargs % 2 == 0) {
+    for (int i = 2; i < nargs; i += 2) {
+      const char* name = miniredis_args_at(args, i, NULL);
+      const char* val = miniredis_args_at(args, i + 1, NULL);
+      struct config* config = config_lookup(name);
+      const char* err = NULL;
+      if (!config) {
+        err = "Unknown option or number of arguments";
+      } else if (config->immutable) {
+        err = "can't set immutable config";
+      } else {
+        config_set(server, config, val, &err);
+      }
+      if (err) {
+        snprintf(str, sizeof(str),
+                 "ERR CONFIG SET failed (possibly related to argument '%s') - "
+                 "%s",
+                 name, err);
+        miniredis_conn_write_error(conn, str);
+        return;
+      }
+    }
+    server->config_epoch++;
+    evict(server);
+    miniredis_conn_write_string(conn, "OK");
+  } else {
+    miniredis_conn_write_error(conn,
+                               "ERR unknown subcommand or wrong number of "
+                               "arguments for 'config' command");
+  }
+}
+
+// Command flags
+#define CMD_DENYOOM 1  // may use more memory, refused when out of memory
+#define CMD_KEYNUM 2   // the argument before firstkey is the number of keys
+#define CMD_STREAMS 4  // the keys are the first half of the arguments after
+                       // STREAMS
+#define CMD_PUBSUB 8   // allowed in the subscribed state
+#define CMD_TX 16      // runs at once rather than being queued by MULTI
+#define CMD_READONLY 32  // only reads its keys, which tracking clients cache
+
+struct command {
+  const char* name;
+  void (*func)(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+  // Key positions, used for cluster redirection. firstkey is zero for
+  // commands without keys and a negative lastkey counts from the end.
+  int firstkey;
+  int lastkey;
+  int keystep;
+  int flags;
+};
+
+// command_keys finds the positions of the first and last keys of the command
+// in its arguments. Returns false if the command has no keys, or when its
+// arguments are malformed, which the command reports.
+bool command_keys(struct command* cmd, struct miniredis_args* args,
+                  int* first, int* last) {
+  int nargs = miniredis_args_count(args);
+  if (cmd->firstkey == 0 || cmd->firstkey >= nargs) {
+    return false;
+  }
+  int lastkey = cmd->lastkey < 0 ? nargs + cmd->lastkey : cmd->lastkey;
+  if (cmd->flags & CMD_KEYNUM) {
+    int64_t numkeys;
+    if (!argtoint(args, cmd->firstkey - 1, &numkeys) || numkeys < 1) {
+      return false;
+    }
+    lastkey = numkeys < nargs ? cmd->firstkey + numkeys - 1 : nargs - 1;
+  }
+  int firstkey = cmd->firstkey;
+  if (cmd->flags & CMD_STREAMS) {
+    while (firstkey < nargs && !miniredis_args_eq(args, firstkey, "streams")) {
+      firstkey++;
+    }
+    if ((nargs - firstkey - 1) % 2 != 0 || firstkey + 1 >= nargs) {
+      return false;
+    }
+    lastkey = firstkey + (nargs - firstkey - 1) / 2;
+    firstkey++;
+  }
+  if (lastkey >= nargs) {
+    lastkey = nargs - 1;
+  }
+  *first = firstkey;
+  *last = lastkey;
+  return true;
+}
+
+// client_apply_limits applies the output buffer limits of the client class.
+void client_apply_limits(struct server* server, struct miniredis_conn* conn,
+                         struct client* client) {
+  struct obuf_limit* limit = &server->obuf_limits[client->class];
+  miniredis_conn_set_output_limits(conn, server->client_output_buffer_pause,
+                                   limit->hard, limit->soft,
+                                   limit->soft_seconds);
+  client->config_epoch = server->config_epoch;
+}
+
+// client_update_class moves the client to the pubsub class, and its output
+// limits, while subscribed.
+void client_update_class(struct server* server, struct client* client) {
+  int class = client_subscriptions(client) ? CLIENT_PUBSUB : CLIENT_NORMAL;
+  if (client->class != class) {
+    server->pubsub_clients += class == CLIENT_PUBSUB ? 1 : -1;
+    client->class = class;
+    client_apply_limits(server, client->conn, client);
+  }
+}
+
+// latency_add records a latency of the event for the latency monitor when it
+// is above latency-monitor-threshold. Samples of the same second are merged.
+void latency_add(struct server* server, int event, int64_t ns) {
+  int64_t ms = ns / 1000000;
+  if (!server->latency_monitor_threshold ||
+      ms < server->latency_monitor_threshold) {
+    return;
+  }
+  struct latency_event* ev = &server->latency_events[event];
+  int64_t now = time(NULL);
+  struct latency_sample* last =
+      &ev->samples[(ev->next + LATENCY_SAMPLES - 1) % LATENCY_SAMPLES];
+  if (ev->len && last->time == now) {
+    last->ms = ms > last->ms ? ms : last->ms;
+  } else {
+    ev->samples[ev->next] = (struct latency_sample){now, ms};
+    ev->next = (ev->next + 1) % LATENCY_SAMPLES;
+    ev->len += ev->len < LATENCY_SAMPLES;
+  }
+  ev->max = ms > ev->max ? ms : ev->max;
+}
+
+void slowlog_entry_free(struct slowlog_entry* entry) {
+  free(entry->argv);
+  free(entry->addr);
+  free(entry->name);
+}
+
+// slowlog_at returns the i-th newest entry.
+struct slowlog_entry* slowlog_at(struct server* server, size_t i) {
+  size_t cap = server->slowlog_cap;
+  return &server->slowlog[(server->slowlog_next + cap - 1 - i) % cap];
+}
+
+// slowlog_resize applies a change of slowlog-max-len, keeping the newest
+// entries.
+void slowlog_resize(struct server* server) {
+  size_t cap = server->slowlog_max_len;
+  if (cap == server->slowlog_cap) {
+    return;
+  }
+  struct slowlog_entry* slowlog = NULL;
+  if (cap && !(slowlog = calloc(cap, sizeof(struct slowlog_entry)))) {
+    return;
+  }
+  size_t keep = server->slowlog_len < cap ? server->slowlog_len : cap;
+  for (size_t i = 0; i < server->slowlog_len; i++) {
+    struct slowlog_entry* entry = slowlog_at(server, i);
+    if (i < keep) {
+      slowlog[keep - 1 - i] = *entry;
+    } else {
+      slowlog_entry_free(entry);
+    }
+  }
+  free(server->slowlog);
+  server->slowlog = slowlog;
+  server->slowlog_cap = cap;
+  server->slowlog_len = keep;
+  server->slowlog_next = cap ? keep % cap : 0;
+}
+
+#define SLOWLOG_MAXARGC 32
+#define SLOWLOG_MAXARGLEN 128
+
+// wall_clock returns the seconds since the Unix epoch. Unlike server->now it
+// may jump, so it only serves timestamps shown to clients.
+double wall_clock(void) {
+  struct timespec tm;
+  clock_gettime(CLOCK_REALTIME, &tm);
+  return tm.tv_sec + tm.tv_nsec / 1e9;
+}
+
+#define CLOCK_SYNC_NS 10000000  // ns the clocks are derived from the ticks
+
+// clock_sync reads the monotonic and wall clocks. It is done once per event
+// loop iteration, and the commands advance both by the ticks since.
+void clock_sync(struct server* server) {
+  server->clock_tsc = tsc_now();
+  server->clock_now = miniredis_now() / 1e9;
+  server->clock_unix = wall_clock();
+  server->now = server->clock_now;
+  server->unixtime = server->clock_unix;
+}
+
+// clock_read derives the time from the timestamp counter, which takes no
+// system call, and the clocks last read. Returns false when they were read
+// too long ago, after an iteration that ran long or the wait for events
+// before it, for the calibrated rate of the counter not to drift far from
+// them. It leaves the server as it is, so I/O threads run it too.
+bool clock_read(struct server* server, double* now, double* unixtime) {
+  int64_t ns = tsc_ns(tsc_now() - server->clock_tsc);
+  if (ns < 0 || ns > CLOCK_SYNC_NS) {
+    return false;
+  }
+  *now = server->clock_now + ns / 1e9;
+  *unixtime = server->clock_unix + ns / 1e9;
+  return true;
+}
+
+// clock_update sets the time of the current command.
+void clock_update(struct server* server) {
+  if (!clock_read(server, &server->now, &server->unixtime)) {
+    clock_sync(server);
+  }
+}
+
+// slowlog_entry_new fills in the entry for the command, but for its id.
+// Only the first arguments, and the start of long ones, are kept. It leaves
+// the server alone, so I/O threads run it too. Returns false when out of
+// memory.
+bool slowlog_entry_new(struct slowlog_entry* entry,
+                       struct miniredis_conn* conn,
+                       struct miniredis_args* args, int64_t usec,
+                       double unixtime) {
+  int argc = miniredis_args_count(args);
+  int n = argc < SLOWLOG_MAXARGC ? argc : SLOWLOG_MAXARGC;
+  struct buf argv = {0};
+  bool ok = miniredis_write_array(&argv, n);
+  for (int i = 0; i < n && ok; i++) {
+    char str[SLOWLOG_MAXARGLEN + 32];
+    size_t len;
+    const char* arg = miniredis_args_at(args, i, &len);
+    if (i == n - 1 && n < argc) {
+      snprintf(str, sizeof(str), "... (%d more arguments)", argc - n + 1);
+      ok = miniredis_write_bulk(&argv, str, -1);
+    } else if (len > SLOWLOG_MAXARGLEN) {
+      memcpy(str, arg, SLOWLOG_MAXARGLEN);
+      int m = snprintf(str + SLOWLOG_MAXARGLEN, 32, "... (%zu more bytes)",
+                       len - SLOWLOG_MAXARGLEN);
+      ok = miniredis_write_bulk(&argv, str, SLOWLOG_MAXARGLEN + m);
+    } else {
+      ok = miniredis_write_bulk(&argv, arg, len);
+    }
+  }
+  struct client* client = miniredis_conn_udata(conn);
+  char* addr = strdup(miniredis_conn_addr(conn));
+  char* name = strdup(client->name ? client->name : "");
+  if (!ok || !addr || !name) {
+    buf_clear(&argv);
+    free(addr);
+    free(name);
+    return false;
+  }
+  *entry = (struct slowlog_entry){
+      0, (int64_t)unixtime, usec, argv.data, argv.len, addr, name,
+  };
+  return true;
+}
+
+// slowlog_insert adds the entry to the slowlog, which takes it over.
+void slowlog_insert(struct server* server, struct slowlog_entry* entry) {
+  slowlog_resize(server);
+  if (server->slowlog_cap == 0) {
+    slowlog_entry_free(entry);
+    return;
+  }
+  struct slowlog_entry* slot = &server->slowlog[server->slowlog_next];
+  if (server->slowlog_len == server->slowlog_cap) {
+    slowlog_entry_free(slot);
+  } else {
+    server->slowlog_len++;
+  }
+  *slot = *entry;
+  slot->id = server->slowlog_id++;
+  server->slowlog_next = (server->slowlog_next + 1) % server->slowlog_cap;
+}
+
+// slowlog_add adds the command to the slowlog.
+void slowlog_add(struct server* server, struct miniredis_conn* conn,
+                 struct miniredis_args* args, int64_t usec) {
+  slowlog_resize(server);
+  struct slowlog_entry entry;
+  if (server->slowlog_cap > 0 &&
+      slowlog_entry_new(&entry, conn, args, usec, server->unixtime)) {
+    slowlog_insert(server, &entry);
+  }
+}
+
+// command_record accounts for the time a command took in its total for
+// commandstats, its latency histogram, the slowlog and the latency monitor.
+void command_record(struct server* server, struct miniredis_conn* conn,
+                    struct command* cmd, struct miniredis_args* args,
+                    int64_t ns) {
+  server->ns[cmd - server->command_table] += ns;
+  if (server->latency_tracking) {
+    struct histogram** h = &server->latency[cmd - server->command_table];
+    if (*h || (*h = calloc(1, sizeof(struct histogram)))) {
+      histogram_record(*h, ns);
+    }
+  }
+  if (server->slowlog_log_slower_than >= 0 &&
+      ns / 1000 >= server->slowlog_log_slower_than) {
+    slowlog_add(server, conn, args, ns / 1000);
+  }
+  latency_add(server, LATENCY_COMMAND, ns);
+}
+
+// SLOWLOG GET [count] | SLOWLOG LEN | SLOWLOG RESET
+void cmdSLOWLOG(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  slowlog_resize(server);
+  if (nargs == 2 && miniredis_args_eq(args, 1, "len")) {
+    miniredis_conn_write_uint(conn, server->slowlog_len);
+  } else if (nargs == 2 && miniredis_args_eq(args, 1, "reset")) {
+    for (size_t i = 0; i < server->slowlog_len; i++) {
+      slowlog_entry_free(slowlog_at(server, i));
+    }
+    server->slowlog_len = 0;
+    server->slowlog_next = 0;
+    miniredis_conn_write_string(conn, "OK");
+  } else if ((nargs == 2 || nargs == 3) &&
+             miniredis_args_eq(args, 1, "get")) {
+    int64_t count = 10;
+    if (nargs == 3) {
+      size_t len;
+      const char* arg = miniredis_args_at(args, 2, &len);
+      if (!parse_int(arg, len, &count) || count < -1) {
+        miniredis_conn_write_error(
+            conn, "ERR count should be greater than or equal to -1");
+        return;
+      }
+    }
+    size_t n = count == -1 || (uint64_t)count > server->slowlog_len
+                   ? server->slowlog_len
+                   : (size_t)count;
+    miniredis_conn_write_array(conn, n);
+    for (size_t i = 0; i < n; i++) {
+      struct slowlog_entry* entry = slowlog_at(server, i);
+      miniredis_conn_write_array(conn, 6);
+      miniredis_conn_write_uint(conn, entry->id);
+      miniredis_conn_write_int(conn, entry->time);
+      miniredis_conn_write_int(conn, entry->usec);
+      miniredis_conn_write_raw(conn, entry->argv, entry->argvlen);
+      miniredis_conn_write_bulk(conn, entry->addr, -1);
+      miniredis_conn_write_bulk(conn, entry->name, -1);
+    }
+  } else {
+    miniredis_conn_write_error(conn, "ERR unknown subcommand or wrong number "
+                                     "of arguments for 'slowlog' command");
+  }
+}
+
+// latency_histogram writes the histogram of a command as cumulative counts
+// of calls up to each power of two microseconds, as Redis does.
+void latency_histogram(struct miniredis_conn* conn, struct histogram* h) {
+  struct buf out = {0};
+  int n = 0;
+  uint64_t seen = 0;
+  int i = 0;
+  for (uint64_t usec = 1; seen < h->count; usec *= 2) {
+    while (i < HISTOGRAM_BUCKETS && histogram_bucket_max(i) < usec * 1000) {
+      seen += h->buckets[i++];
+    }
+    if (i == HISTOGRAM_BUCKETS) {
+      seen = h->count;
+    }
+    if (seen) {
+      miniredis_write_uint(&out, usec);
+      miniredis_write_uint(&out, seen);
+      n++;
+    }
+  }
+  miniredis_conn_write_array(conn, 4);
+  miniredis_conn_write_bulk(conn, "calls", -1);
+  miniredis_conn_write_uint(conn, h->count);
+  miniredis_conn_write_bulk(conn, "histogram_usec", -1);
+  miniredis_conn_write_array(conn, n * 2);
+  miniredis_conn_write_raw(conn, out.data, out.len);
+  buf_clear(&out);
+}
+
+// latency_event_arg returns the latency monitor event at args[i], or -1.
+int latency_event_arg(struct miniredis_args* args, int i) {
+  for (int j = 0; latency_events[j]; j++) {
+    if (miniredis_args_eq(args, i, latency_events[j])) {
+      return j;
+    }
+  }
+  return -1;
+}
+
+// LATENCY LATEST | LATENCY HISTORY event | LATENCY RESET [event ...] |
+// LATENCY HISTOGRAM [command ...]
+void cmdLATENCY(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs == 2 && miniredis_args_eq(args, 1, "latest")) {
+    int n = 0;
+    for (int i = 0; i < LATENCY_EVENTS; i++) {
+      n += server->latency_events[i].len > 0;
+    }
+    miniredis_conn_write_array(conn, n);
+    for (int i = 0; i < LATENCY_EVENTS; i++) {
+      struct latency_event* ev = &server->latency_events[i];
+      if (!ev->len) continue;
+      struct latency_sample* last =
+          &ev->samples[(ev->next + LATENCY_SAMPLES - 1) % LATENCY_SAMPLES];
+      miniredis_conn_write_array(conn, 4);
+      miniredis_conn_write_bulk(conn, latency_events[i], -1);
+      miniredis_conn_write_int(conn, last->time);
+      miniredis_conn_write_int(conn, last->ms);
+      miniredis_conn_write_int(conn, ev->max);
+    }
+  } else if (nargs == 3 && miniredis_args_eq(args, 1, "history")) {
+    int event = latency_event_arg(args, 2);
+    struct latency_event* ev =
+        event == -1 ? NULL : &server->latency_events[event];
+    miniredis_conn_write_array(conn, ev ? ev->len : 0);
+    for (int i = 0; ev && i < ev->len; i++) {
+      struct latency_sample* sample =
+          &ev->samples[(ev->next + LATENCY_SAMPLES - ev->len + i) %
+                       LATENCY_SAMPLES];
+      miniredis_conn_write_array(conn, 2);
+      miniredis_conn_write_int(conn, sample->time);
+      miniredis_conn_write_int(conn, sample->ms);
+    }
+  } else if (nargs >= 2 && miniredis_args_eq(args, 1, "reset")) {
+    int n = 0;
+    for (int i = 0; i < LATENCY_EVENTS; i++) {
+      bool reset = nargs == 2;
+      for (int j = 2; j < nargs && !reset; j++) {
+        reset = latency_event_arg(args, j) == i;
+      }
+      if (reset && server->latency_events[i].len) {
+        memset(&server->latency_events[i], 0, sizeof(struct latency_event));
+        n++;
+      }
+    }
+    miniredis_conn_write_int(conn, n);
+  } else if (nargs >= 2 && miniredis_args_eq(args, 1, "histogram")) {
+    int n = 0;
+    size_t i = 0;
+    void* item;
+    while (hashmap_iter(server->commands, &i, &item)) {
+      struct command* cmd = *(struct command**)item;
+      bool want = nargs == 2;
+      for (int j = 2; j < nargs && !want; j++) {
+        want = miniredis_args_eq(args, j, cmd->name);
+      }
+      if (want && server->latency[cmd - server->command_table]) {
+        n++;
+      }
+    }
+    miniredis_conn_write_array(conn, n * 2);
+    i = 0;
+    while (hashmap_iter(server->commands, &i, &item)) {
+      struct command* cmd = *(struct command**)item;
+      struct histogram* h = server->latency[cmd - server->command_table];
+      bool want = nargs == 2;
+      for (int j = 2; j < nargs && !want; j++) {
+        want = miniredis_args_eq(args, j, cmd->name);
+      }
+      if (want && h) {
+        miniredis_conn_write_bulk(conn, cmd->name, -1);
+        latency_histogram(conn, h);
+      }
+    }
+  } else {
+    miniredis_conn_write_error(conn, "ERR unknown subcommand or wrong number "
+                                     "of arguments for 'latency' command");
+  }
+}
+
+// tracking_read remembers the keys read by the command for a client in the
+// default tracking mode, unless OPTIN or OPTOUT leave the command out.
+void tracking_read(struct server* server, struct client* client,
+                   struct command* cmd, struct miniredis_args* args,
+                   bool caching) {
+  // caching is set by CACHING YES for OPTIN clients and by CACHING NO for
+  // OPTOUT ones
+  int first, last;
+  if (client->tracking_bcast || client->tracking_optin != caching ||
+      !command_keys(cmd, args, &first, &last)) {
+    return;
+  }
+  for (int i = first; i <= last; i += cmd->keystep) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, i, &keylen);
+    if (!tracking_record(server, client, key, keylen)) {
+      return;
+    }
+  }
+}
+
+// command_run runs a command that passed the checks of its context, right
+// away or from EXEC.
+void command_run(struct server* server, struct miniredis_conn* conn,
+                 struct client* client, struct command* cmd,
+                 struct miniredis_args* args) {
+  if ((cmd->flags & CMD_DENYOOM) && !evict(server)) {
+    miniredis_conn_write_error(
+        conn, "OOM command not allowed when used memory > 'maxmemory'.");
+    client->asking = false;
+    return;
+  }
+  server->calls[cmd - server->command_table]++;
+  bool caching = client->caching;
+  client->caching = false;
+  struct client* current = server->current;
+  server->current = client;
+  uint64_t start = tsc_now();
+  cmd->func(conn, args, server);
+  command_record(server, conn, cmd, args, tsc_ns(tsc_now() - start));
+  server->current = current;
+  if (cmd->func != cmdASKING) {
+    client->asking = false;
+  }
+  if (client->tracking && (cmd->flags & CMD_READONLY)) {
+    tracking_read(server, client, cmd, args, caching);
+  }
+}
+
+// info is the reply of INFO, built a section at a time.
+struct info {
+  struct miniredis_args* args;
+  struct buf buf;
+  bool oom;
+};
+
+// info_section starts the section and returns true if it was asked for. The
+// default sections are all but commandstats.
+bool info_section(struct info* info, const char* name, bool dflt) {
+  int nargs = miniredis_args_count(info->args);
+  bool want = nargs == 1 && dflt;
+  for (int i = 1; i < nargs && !want; i++) {
+    want = miniredis_args_eq(info->args, i, name) ||
+           miniredis_args_eq(info->args, i, "all") ||
+           miniredis_args_eq(info->args, i, "everything") ||
+           (dflt && miniredis_args_eq(info->args, i, "default"));
+  }
+  if (!want) {
+    return false;
+  }
+  char title[32];
+  snprintf(title, sizeof(title), "%s# %c%s\r\n", info->buf.len ? "\r\n" : "",
+           toupper(name[0]), name + 1);
+  info->oom |= !buf_append(&info->buf, title, -1);
+  return true;
+}
+
+void info_add(struct info* info, const char* format, ...) {
+  char line[256];
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(line, sizeof(line) - 2, format, ap);
+  va_end(ap);
+  n = n < (int)sizeof(line) - 2 ? n : (int)sizeof(line) - 3;
+  line[n++] = '\r';
+  line[n++] = '\n';
+  info->oom |= !buf_append(&info->buf, line, n);
+}
+
+// info_human formats a number of bytes like 1.50M.
+void info_human(char str[32], uint64_t bytes) {
+  const char* units = "BKMGTP";
+  double n = bytes;
+  while (n >= 1024 && units[1]) {
+    n /= 1024;
+    units++;
+  }
+  if (units[0] == 'B') {
+    snprintf(str, 32, "%" PRIu64 "B", bytes);
+  } else {
+    snprintf(str, 32, "%.2f%c", n, units[0]);
+  }
+}
+
+// rss_memory returns the resident set size of the process.
+uint64_t rss_memory(void) {
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (!f) {
+    return 0;
+  }
+  unsigned long size, rss = 0;
+  if (fscanf(f, "%lu %lu", &size, &rss) != 2) {
+    rss = 0;
+  }
+  fclose(f);
+  return (uint64_t)rss * sysconf(_SC_PAGESIZE);
+}
+
+// INFO [section ...]
+//
+// Counters are plain increments of the thread that owns them, a call count
+// per command and network counters per event loop, and are only summed here.
+void cmdINFO(struct miniredis_conn* conn, struct miniredis_args* args,
              void* udata) {
-  if (miniredis_args_eq(args, 0, "set")) {
-    cmdSET(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "get")) {
-    cmdGET(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "ping")) {
-    cmdPING(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "del")) {
-    cmdDEL(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "ttl")) {
-    cmdTTL(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "keys")) {
-    cmdKEYS(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "dbsize")) {
-    cmdDBSIZE(conn, args, udata);
-  } else if (miniredis_args_eq(args, 0, "flushdb")) {
-    cmdFLUSHDB(conn, args, udata);
+  struct server* server = udata;
+  struct info info = {.args = args};
+  struct miniredis_stats stats;
+  miniredis_stats(&stats);
+  uint64_t calls = 0;
+  size_t i = 0;
+  void* item;
+  while (hashmap_iter(server->commands, &i, &item)) {
+    calls += server->calls[*(struct command**)item - server->command_table];
+  }
+  char human[32];
+  if (info_section(&info, "server", true)) {
+    struct utsname name;
+    int64_t uptime = (miniredis_now() - server->start) / 1000000000;
+    info_add(&info, "redis_version:7.0.0");
+    info_add(&info, "redis_mode:%s",
+             server->cluster_enabled ? "cluster" : "standalone");
+    if (uname(&name) == 0) {
+      info_add(&info, "os:%s %s %s", name.sysname, name.release,
+               name.machine);
+    }
+    info_add(&info, "arch_bits:%d", (int)sizeof(void*) * 8);
+    info_add(&info, "multiplexing_api:epoll");
+    info_add(&info, "process_id:%d", (int)getpid());
+    info_add(&info, "tcp_port:%d", server->port);
+    info_add(&info, "uptime_in_seconds:%" PRId64, uptime);
+    info_add(&info, "uptime_in_days:%" PRId64, uptime / 86400);
+  }
+  if (info_section(&info, "clients", true)) {
+    size_t blocked = 0;
+    for (struct client* c = server->blocked; c; c = c->bpop->next) {
+      blocked++;
+    }
+    info_add(&info, "connected_clients:%" PRIu64, stats.connections);
+    info_add(&info, "blocked_clients:%zu", blocked);
+    info_add(&info, "pubsub_clients:%zu", server->pubsub_clients);
+    info_add(&info, "watching_clients:%zu", server->watching);
+    info_add(&info, "tracking_clients:%zu", server->tracking_clients);
+  }
+  if (info_section(&info, "memory", true)) {
+    struct mallinfo2 mi = mallinfo2();
+    info_human(human, server->used_memory);
+    info_add(&info, "used_memory:%zu", server->used_memory);
+    info_add(&info, "used_memory_human:%s", human);
+    info_add(&info, "used_memory_allocator:%zu", mi.uordblks + mi.hblkhd);
+    info_add(&info, "used_memory_rss:%" PRIu64, rss_memory());
+    info_human(human, server->maxmemory);
+    info_add(&info, "maxmemory:%" PRId64, server->maxmemory);
+    info_add(&info, "maxmemory_human:%s", human);
+    info_add(&info, "maxmemory_policy:%s",
+             maxmemory_policies[server->maxmemory_policy]);
+    info_add(&info, "lazyfree_pending_objects:%zu",
+             epoch_pending(server->epoch));
+    info_add(&info, "mem_allocator:libc");
+  }
+  if (info_section(&info, "stats", true)) {
+    info_add(&info, "total_connections_received:%" PRIu64,
+             stats.total_connections);
+    info_add(&info, "total_commands_processed:%" PRIu64, calls);
+    info_add(&info, "total_net_input_bytes:%" PRIu64, stats.net_input_bytes);
+    info_add(&info, "total_net_output_bytes:%" PRIu64,
+             stats.net_output_bytes);
+    info_add(&info, "rejected_connections:%" PRIu64,
+             stats.rejected_connections);
+    info_add(&info, "evicted_keys:%" PRIu64, server->evicted_keys);
+    info_add(&info, "io_threaded_reads_processed:%" PRIu64,
+             stats.io_threaded_reads);
+    info_add(&info, "io_threaded_writes_processed:%" PRIu64,
+             stats.io_threaded_writes);
+    info_add(&info, "io_threaded_commands_processed:%" PRIu64,
+             server->read_ahead_calls);
+    info_add(&info, "pubsub_channels:%zu",
+             pubsub_count(server->pubsub, false));
+    info_add(&info, "pubsub_patterns:%zu",
+             pubsub_count(server->pubsub, true));
+  }
+  if (info_section(&info, "commandstats", false)) {
+    i = 0;
+    while (hashmap_iter(server->commands, &i, &item)) {
+      struct command* cmd = *(struct command**)item;
+      uint64_t n = server->calls[cmd - server->command_table];
+      uint64_t usec = server->ns[cmd - server->command_table] / 1000;
+      if (n) {
+        info_add(&info,
+                 "cmdstat_%s:calls=%" PRIu64 ",usec=%" PRIu64
+                 ",usec_per_call=%.2f",
+                 cmd->name, n, usec, (double)usec / n);
+      }
+    }
+  }
+  if (info_section(&info, "latencystats", true)) {
+    i = 0;
+    while (hashmap_iter(server->commands, &i, &item)) {
+      struct command* cmd = *(struct command**)item;
+      struct histogram* h = server->latency[cmd - server->command_table];
+      if (h) {
+        info_add(&info,
+                 "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,p99.9=%.3f",
+                 cmd->name, histogram_percentile(h, 50) / 1e3,
+                 histogram_percentile(h, 99) / 1e3,
+                 histogram_percentile(h, 99.9) / 1e3);
+      }
+    }
+  }
+  if (info_section(&info, "cluster", true)) {
+    info_add(&info, "cluster_enabled:%d", server->cluster_enabled);
+  }
+  if (info_section(&info, "keyspace", true)) {
+    size_t keys = cmap_count(server->pairs);
+    if (keys) {
+      info_add(&info, "db0:keys=%zu", keys);
+    }
+  }
+  if (info.oom) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
   } else {
+    miniredis_conn_write_verbatim(
+        conn, "txt", info.buf.len ? info.buf.data : "", info.buf.len);
+  }
+  buf_clear(&info.buf);
+}
+
+static struct command commands[] = {
+    {"set", cmdSET, 1, 1, 1, CMD_DENYOOM},
+    {"get", cmdGET, 1, 1, 1, CMD_READONLY},
+    {"ping", cmdPING, 0, 0, 0, CMD_PUBSUB},
+    {"hello", cmdHELLO, 0, 0, 0, 0},
+    {"client", cmdCLIENT, 0, 0, 0, 0},
+    {"del", cmdDEL, 1, -1, 1, 0},
+    {"ttl", cmdTTL, 1, 1, 1, CMD_READONLY},
+    {"keys", cmdKEYS, 0, 0, 0, 0},
+    {"dbsize", cmdDBSIZE, 0, 0, 0, 0},
+    {"flushdb", cmdFLUSHDB, 0, 0, 0, 0},
+    {"cluster", cmdCLUSTER, 0, 0, 0, 0},
+    {"asking", cmdASKING, 0, 0, 0, 0},
+    {"restore", cmdRESTORE, 1, 1, 1, CMD_DENYOOM},
+    {"migrate", cmdMIGRATE, 0, 0, 0, 0},
+    {"config", cmdCONFIG, 0, 0, 0, 0},
+    {"type", cmdTYPE, 1, 1, 1, CMD_READONLY},
+    {"object", cmdOBJECT, 2, 2, 1, 0},
+    {"hset", cmdHSET, 1, 1, 1, CMD_DENYOOM},
+    {"hget", cmdHGET, 1, 1, 1, CMD_READONLY},
+    {"hmget", cmdHMGET, 1, 1, 1, CMD_READONLY},
+    {"hdel", cmdHDEL, 1, 1, 1, 0},
+    {"hlen", cmdHLEN, 1, 1, 1, CMD_READONLY},
+    {"hexists", cmdHEXISTS, 1, 1, 1, CMD_READONLY},
+    {"hincrby", cmdHINCRBY, 1, 1, 1, CMD_DENYOOM},
+    {"hgetall", cmdHGETALL, 1, 1, 1, CMD_READONLY},
+    {"hscan", cmdHSCAN, 1, 1, 1, CMD_READONLY},
+    {"lpush", cmdLPUSH, 1, 1, 1, CMD_DENYOOM},
+    {"rpush", cmdRPUSH, 1, 1, 1, CMD_DENYOOM},
+    {"lpop", cmdLPOP, 1, 1, 1, 0},
+    {"rpop", cmdRPOP, 1, 1, 1, 0},
+    {"llen", cmdLLEN, 1, 1, 1, CMD_READONLY},
+    {"lindex", cmdLINDEX, 1, 1, 1, CMD_READONLY},
+    {"lrange", cmdLRANGE, 1, 1, 1, CMD_READONLY},
+    {"ltrim", cmdLTRIM, 1, 1, 1, 0},
+    {"lmove", cmdLMOVE, 1, 2, 1, CMD_DENYOOM},
+    {"blpop", cmdBLPOP, 1, -2, 1, 0},
+    {"brpop", cmdBRPOP, 1, -2, 1, 0},
+    {"blmove", cmdBLMOVE, 1, 2, 1, CMD_DENYOOM},
+    {"sadd", cmdSADD, 1, 1, 1, CMD_DENYOOM},
+    {"srem", cmdSREM, 1, 1, 1, 0},
+    {"sismember", cmdSISMEMBER, 1, 1, 1, CMD_READONLY},
+    {"scard", cmdSCARD, 1, 1, 1, CMD_READONLY},
+    {"smembers", cmdSMEMBERS, 1, 1, 1, CMD_READONLY},
+    {"sinter", cmdSINTER, 1, -1, 1, CMD_READONLY},
+    {"sintercard", cmdSINTERCARD, 2, -1, 1, CMD_KEYNUM | CMD_READONLY},
+    {"sunion", cmdSUNION, 1, -1, 1, CMD_READONLY},
+    {"sdiff", cmdSDIFF, 1, -1, 1, CMD_READONLY},
+    {"zadd", cmdZADD, 1, 1, 1, CMD_DENYOOM},
+    {"zincrby", cmdZINCRBY, 1, 1, 1, CMD_DENYOOM},
+    {"zrem", cmdZREM, 1, 1, 1, 0},
+    {"zcard", cmdZCARD, 1, 1, 1, CMD_READONLY},
+    {"zscore", cmdZSCORE, 1, 1, 1, CMD_READONLY},
+    {"zrank", cmdZRANK, 1, 1, 1, CMD_READONLY},
+    {"zrevrank", cmdZREVRANK, 1, 1, 1, CMD_READONLY},
+    {"zcount", cmdZCOUNT, 1, 1, 1, CMD_READONLY},
+    {"zrange", cmdZRANGE, 1, 1, 1, CMD_READONLY},
+    {"zpopmin", cmdZPOPMIN, 1, 1, 1, 0},
+    {"zpopmax", cmdZPOPMAX, 1, 1, 1, 0},
+    {"setbit", cmdSETBIT, 1, 1, 1, CMD_DENYOOM},
+    {"getbit", cmdGETBIT, 1, 1, 1, CMD_READONLY},
+    {"bitcount", cmdBITCOUNT, 1, 1, 1, CMD_READONLY},
+    {"bitpos", cmdBITPOS, 1, 1, 1, CMD_READONLY},
+    {"bitop", cmdBITOP, 2, -1, 1, CMD_DENYOOM},
+    {"bitfield", cmdBITFIELD, 1, 1, 1, CMD_DENYOOM},
+    {"pfadd", cmdPFADD, 1, 1, 1, CMD_DENYOOM},
+    {"pfcount", cmdPFCOUNT, 1, -1, 1, CMD_READONLY},
+    {"pfmerge", cmdPFMERGE, 1, -1, 1, CMD_DENYOOM},
+    {"xadd", cmdXADD, 1, 1, 1, CMD_DENYOOM},
+    {"xlen", cmdXLEN, 1, 1, 1, CMD_READONLY},
+    {"xrange", cmdXRANGE, 1, 1, 1, CMD_READONLY},
+    {"xrevrange", cmdXREVRANGE, 1, 1, 1, CMD_READONLY},
+    {"xtrim", cmdXTRIM, 1, 1, 1, 0},
+    {"xread", cmdXREAD, 1, -1, 1, CMD_STREAMS | CMD_READONLY},
+    {"xgroup", cmdXGROUP, 2, 2, 1, CMD_DENYOOM},
+    {"xreadgroup", cmdXREADGROUP, 1, -1, 1, CMD_STREAMS},
+    {"xack", cmdXACK, 1, 1, 1, 0},
+    {"xpending", cmdXPENDING, 1, 1, 1, CMD_READONLY},
+    {"subscribe", cmdSUBSCRIBE, 0, 0, 0, CMD_PUBSUB},
+    {"unsubscribe", cmdUNSUBSCRIBE, 0, 0, 0, CMD_PUBSUB},
+    {"psubscribe", cmdPSUBSCRIBE, 0, 0, 0, CMD_PUBSUB},
+    {"punsubscribe", cmdPUNSUBSCRIBE, 0, 0, 0, CMD_PUBSUB},
+    {"publish", cmdPUBLISH, 0, 0, 0, 0},
+    {"multi", cmdMULTI, 0, 0, 0, CMD_TX},
+    {"exec", cmdEXEC, 0, 0, 0, CMD_TX},
+    {"discard", cmdDISCARD, 0, 0, 0, CMD_TX},
+    {"watch", cmdWATCH, 1, -1, 1, CMD_TX},
+    {"unwatch", cmdUNWATCH, 0, 0, 0, 0},
+    {"info", cmdINFO, 0, 0, 0, 0},
+    {"slowlog", cmdSLOWLOG, 0, 0, 0, 0},
+    {"latency", cmdLATENCY, 0, 0, 0, 0},
+};
+
+uint64_t command_hash(const void* item) {
+  const char* name = (*(struct command**)item)->name;
+  return hashmap_xxhash(name, strlen(name));
+}
+
+int command_compare(const void* a, const void* b) {
+  return strcmp((*(struct command**)a)->name, (*(struct command**)b)->name);
+}
+
+struct command* command_lookup(struct server* server,
+                               struct miniredis_args* args) {
+  size_t len;
+  const char* arg = miniredis_args_at(args, 0, &len);
+  char name[32];
+  if (len >= sizeof(name)) {
+    return NULL;
+  }
+  for (size_t i = 0; i < len; i++) {
+    name[i] = tolower(arg[i]);
+  }
+  name[len] = '\0';
+  struct command key = {.name = name};
+  struct command* pkey = &key;
+  struct command** cmd = hashmap_get(server->commands, &pkey);
+  return cmd ? *cmd : NULL;
+}
+
+// cluster_redirect checks that the keys of the command are served by this
+// node. If not, a MOVED, ASK, TRYAGAIN, CROSSSLOT or CLUSTERDOWN error is
+// written and true is returned.
+bool cluster_redirect(struct miniredis_conn* conn, struct miniredis_args* args,
+                      struct command* cmd, struct server* server) {
+  struct cluster* cluster = server->cluster;
+  struct client* client = miniredis_conn_udata(conn);
+  int firstkey, lastkey;
+  if (!command_keys(cmd, args, &firstkey, &lastkey)) {
+    return false;
+  }
+  int slot = -1, nkeys = 0, missing = 0;
+  for (int i = firstkey; i <= lastkey; i += cmd->keystep) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, i, &keylen);
+    int kslot = cluster_keyslot(key, keylen);
+    if (slot != -1 && kslot != slot) {
+      miniredis_conn_write_error(
+          conn, "CROSSSLOT Keys in request don't hash to the same slot");
+      return true;
+    }
+    slot = kslot;
+    nkeys++;
+    if ((cluster->migrating[slot] || cluster->importing[slot]) &&
+        !db_get(server, key, keylen)) {
+      missing++;
+    }
+  }
+  struct cluster_node* node = cluster->slots[slot];
+  char str[128];
+  if (!node) {
+    miniredis_conn_write_error(conn, "CLUSTERDOWN Hash slot not served");
+    return true;
+  }
+  if (node != cluster->myself) {
+    if (cluster->importing[slot] && client->asking) {
+      if (missing > 0 && nkeys > 1) {
+        miniredis_conn_write_error(
+            conn,
+            "TRYAGAIN Multiple keys request during rehashing of slot");
+        return true;
+      }
+      return false;
+    }
+    snprintf(str, sizeof(str), "MOVED %d %s:%d", slot, node->host,
+             node->port);
+    miniredis_conn_write_error(conn, str);
+    return true;
+  }
+  if (cluster->migrating[slot] && missing > 0) {
+    if (missing < nkeys) {
+      miniredis_conn_write_error(
+          conn, "TRYAGAIN Multiple keys request during rehashing of slot");
+      return true;
+    }
+    node = cluster->migrating[slot];
+    snprintf(str, sizeof(str), "ASK %d %s:%d", slot, node->host, node->port);
+    miniredis_conn_write_error(conn, str);
+    return true;
+  }
+  return false;
+}
+
+void command(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  struct command* cmd = command_lookup(server, args);
+  if (!cmd) {
+    if (client->multi) {
+      client->multi_dirty = true;
+    }
     miniredis_conn_write_error(conn, "ERR unknown command");
+    return;
+  }
+  clock_update(server);
+  if (client->config_epoch != server->config_epoch) {
+    client_apply_limits(server, conn, client);
+  }
+  if (!(cmd->flags & CMD_PUBSUB) && client_subscriptions(client) &&
+      miniredis_conn_proto(conn) == 2) {
+    char err[160];
+    snprintf(err, sizeof(err),
+             "ERR Can't execute '%s': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / "
+             "PING / QUIT are allowed in this context",
+             cmd->name);
+    miniredis_conn_write_error(conn, err);
+    return;
+  }
+  if (server->cluster && cluster_redirect(conn, args, cmd, server)) {
+    if (client->multi) {
+      client->multi_dirty = true;
+    }
+    client->asking = false;
+    return;
+  }
+  if (client->multi && !(cmd->flags & CMD_TX)) {
+    multi_queue(conn, client, cmd, args);
+    return;
+  }
+  command_run(server, conn, client, cmd, args);
+  if (dict_count(server->ready) > 0) {
+    serve_ready(server);
+  }
+}
+
+static _Thread_local struct reader* thread_reader;
+
+// reader_get returns the reader of the thread, which is registered on its
+// first call. Returns NULL when out of memory.
+struct reader* reader_get(struct server* server) {
+  if (thread_reader) {
+    return thread_reader;
+  }
+  struct reader* reader = calloc(1, sizeof(struct reader));
+  if (!reader) {
+    return NULL;
+  }
+  reader->epoch = epoch_register(server->epoch);
+  if (!reader->epoch) {
+    free(reader);
+    return NULL;
+  }
+  pthread_mutex_lock(&server->readers_lock);
+  reader->next = server->readers;
+  server->readers = reader;
+  pthread_mutex_unlock(&server->readers_lock);
+  thread_reader = reader;
+  return reader;
+}
+
+// reader_record keeps what command_record and pair_touch do for a GET served
+// ahead, for read_done to do it. The pair is only used before any command
+// runs, so it can't be gone by then.
+void reader_record(struct server* server, struct reader* reader,
+                   struct miniredis_conn* conn, struct command* cmd,
+                   struct miniredis_args* args, struct pair* pair,
+                   int64_t ns, double unixtime) {
+  reader->cmd = cmd;
+  reader->calls++;
+  reader->ns += ns;
+  if (ns > reader->maxns) {
+    reader->maxns = ns;
+  }
+  if (server->latency_tracking &&
+      (reader->latency ||
+       (reader->latency = calloc(1, sizeof(struct histogram))))) {
+    histogram_record(reader->latency, ns);
+  }
+  if (server->slowlog_log_slower_than >= 0 && server->slowlog_max_len > 0 &&
+      ns / 1000 >= server->slowlog_log_slower_than) {
+    if (reader->nslow == reader->slowcap) {
+      size_t cap = reader->slowcap ? reader->slowcap * 2 : 4;
+      struct slowlog_entry* slow =
+          realloc(reader->slow, cap * sizeof(struct slowlog_entry));
+      if (slow) {
+        reader->slow = slow;
+        reader->slowcap = cap;
+      }
+    }
+    if (reader->nslow < reader->slowcap &&
+        slowlog_entry_new(&reader->slow[reader->nslow], conn, args, ns / 1000,
+                          unixtime)) {
+      reader->nslow++;
+    }
+  }
+  if (!pair) {
+    return;
+  }
+  if (reader->ntouched == reader->touchedcap) {
+    size_t cap = reader->touchedcap ? reader->touchedcap * 2 : 64;
+    struct pair** touched = realloc(reader->touched, cap * sizeof(pair));
+    if (!touched) {
+      return;
+    }
+    reader->touched = touched;
+    reader->touchedcap = cap;
+  }
+  reader->touched[reader->ntouched++] = pair;
+}
+
+// read_ahead serves GET on the I/O threads, while the main thread waits for
+// them to read, so readers of the keyspace don't wait for one another. The
+// keyspace is searched without locks inside an epoch section, as writers
+// retire the pairs they remove. GETs that need more than the keyspace, such
+// as those of clients in a transaction or tracking keys, and those of keys
+// that expired or hold another type, are left to the main thread.
+bool read_ahead(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  if (!client || client->multi || client->tracking ||
+      client_subscriptions(client) ||
+      client->config_epoch != server->config_epoch || server->cluster ||
+      miniredis_args_count(args) != 2) {
+    return false;
+  }
+  struct command* cmd = command_lookup(server, args);
+  struct reader* reader;
+  if (!cmd || cmd->func != cmdGET || !(reader = reader_get(server))) {
+    return false;
+  }
+  double now, unixtime;
+  if (!clock_read(server, &now, &unixtime)) {
+    now = miniredis_now() / 1e9;
+    unixtime = wall_clock();
+  }
+  uint64_t start = tsc_now();
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  struct pair* spair = alloca_pair();
+  struct pair* pkey = pair_new_forkey(key, keylen, spair);
+  if (!pkey) {
+    return false;
+  }
+  epoch_enter(reader->epoch);
+  struct pair* pair = cmap_get(server->pairs, pkey);
+  bool served = !pair || (pair->type == TYPE_STRING &&
+                          !(pair->hasex && pair_expire(pair) < now));
+  if (served) {
+    miniredis_conn_write_bulk(conn, pair ? pair_val(pair) : NULL,
+                              pair ? pair->vallen : 0);
+  }
+  epoch_exit(reader->epoch);
+  pair_free(pkey);
+  if (served) {
+    reader_record(server, reader, conn, cmd, args, pair,
+                  tsc_ns(tsc_now() - start), unixtime);
+  }
+  return served;
+}
+
+// read_done accounts for the GETs the threads served ahead.
+void read_done(void* udata) {
+  struct server* server = udata;
+  pthread_mutex_lock(&server->readers_lock);
+  for (struct reader* r = server->readers; r; r = r->next) {
+    if (!r->calls) {
+      continue;
+    }
+    size_t i = r->cmd - server->command_table;
+    server->calls[i] += r->calls;
+    server->ns[i] += r->ns;
+    server->read_ahead_calls += r->calls;
+    if (r->latency && r->latency->count) {
+      struct histogram** h = &server->latency[i];
+      if (*h || (*h = calloc(1, sizeof(struct histogram)))) {
+        histogram_merge(*h, r->latency);
+      }
+      memset(r->latency, 0, sizeof(struct histogram));
+    }
+    latency_add(server, LATENCY_COMMAND, r->maxns);
+    for (size_t j = 0; j < r->nslow; j++) {
+      slowlog_insert(server, &r->slow[j]);
+    }
+    for (size_t j = 0; j < r->ntouched; j++) {
+      pair_touch(server, r->touched[j]);
+    }
+    r->calls = 0;
+    r->ns = 0;
+    r->maxns = 0;
+    r->nslow = 0;
+    r->ntouched = 0;
+  }
+  pthread_mutex_unlock(&server->readers_lock);
+}
+
+// timeout_blocked times out blocked clients, and returns the delay until the
+// next deadline.
+int64_t timeout_blocked(struct server* server) {
+  if (!server->next_timeout) {
+    return -1;
+  }
+  if (server->now < server->next_timeout) {
+    return (server->next_timeout - server->now) * 1e9 + 1;
+  }
+  double next = 0;
+  struct client* client = server->blocked;
+  while (client) {
+    struct bpop* bpop = client->bpop;
+    struct client* nextclient = bpop->next;
+    if (bpop->deadline && bpop->deadline <= server->now) {
+      if (bpop->move) {
+        miniredis_conn_write_null(client->conn);
+      } else {
+        miniredis_conn_write_array(client->conn, -1);
+      }
+      client_unblock(server, client);
+      miniredis_conn_unblock(client->conn);
+    } else if (bpop->deadline && (!next || bpop->deadline < next)) {
+      next = bpop->deadline;
+    }
+    client = nextclient;
+  }
+  server->next_timeout = next;
+  return next ? (next - server->now) * 1e9 + 1 : -1;
+}
+
+#define EPOCH_DELAY 1000000  // ns between collections of the retired pairs
+
+// tick reads the clocks, frees the retired pairs that no reader can reach
+// anymore and times out blocked clients. Returns the delay until the next
+// deadline, or until the retired pairs can be collected again.
+int64_t tick(void* udata) {
+  struct server* server = udata;
+  clock_sync(server);
+  epoch_collect(server->epoch);
+  int64_t delay = timeout_blocked(server);
+  if (epoch_pending(server->epoch) && (delay < 0 || delay > EPOCH_DELAY)) {
+    delay = EPOCH_DELAY;
+  }
+  return delay;
+}
+
+// iteration feeds the latency monitor with the time each event loop
+// iteration took.
+void iteration(int64_t ns, void* udata) {
+  latency_add(udata, LATENCY_EVENT_LOOP, ns);
+}
+
+void opened(struct miniredis_conn* conn, void* udata) {
+  struct server* server = udata;
+  struct client* client = malloc(sizeof(struct client));
+  if (!client) {
+    miniredis_conn_close(conn);
+    return;
+  }
+  memset(client, 0, sizeof(struct client));
+  client->id = ++server->client_id;
+  client->class = CLIENT_NORMAL;
+  client->conn = conn;
+  hashmap_set(server->clients, &client);
+  if (hashmap_oom(server->clients)) {
+    free(client);
+    miniredis_conn_close(conn);
+    return;
+  }
+  miniredis_conn_set_udata(conn, client);
+  client_apply_limits(server, conn, client);
+}
+
+void closed(struct miniredis_conn* conn, void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  if (client && client->bpop) {
+    client_unblock(server, client);
   }
+  if (client) {
+    unsubscribe_all(server, client, false, NULL);
+    unsubscribe_all(server, client, true, NULL);
+    multi_discard(client);
+    unwatch(server, client);
+    tracking_off(server, client);
+    hashmap_delete(server->clients, &client);
+    if (client->class == CLIENT_PUBSUB) {
+      server->pubsub_clients--;
+    }
+    free(client->name);
+  }
+  free(client);
 }
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+  if (argc < 2 || argc % 2 != 0) {
+    fprintf(stderr, "Usage: %s <port> [--<config> <value> ...]\n", argv[0]);
     return EXIT_FAILURE;
   }
 
   struct server server = {0};
-  server.pairs = hashmap_new(sizeof(struct pair*), 0, key_hash, key_compare);
+  server.epoch = epoch_new();
+  pthread_mutex_init(&server.readers_lock, NULL);
+  server.pairs = cmap_new(server.epoch, key_hash, key_compare);
+  server.commands = hashmap_new(sizeof(struct command*), 0, command_hash,
+                                command_compare);
+  for (size_t i = 0; i < sizeof(commands) / sizeof(struct command); i++) {
+    struct command* cmd = &commands[i];
+    hashmap_set(server.commands, &cmd);
+  }
+  server.rand = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32) ^ 1;
+  server.cluster_announce_ip = strdup("127.0.0.1");
+  server.maxmemory_samples = 5;
+  server.lfu_log_factor = 10;
+  server.lfu_decay_time = 1;
+  server.obuf_limits[CLIENT_PUBSUB] = (struct obuf_limit){
+      .hard = 32 * 1024 * 1024,
+      .soft = 8 * 1024 * 1024,
+      .soft_seconds = 60,
+  };
+  server.client_output_buffer_pause = 1024 * 1024;
+  server.hash_max_listpack_entries = 128;
+  server.hash_max_listpack_value = 64;
+  server.list_max_listpack_size = -2;
+  server.set_max_intset_entries = 512;
+  server.zset_max_listpack_entries = 128;
+  server.zset_max_listpack_value = 64;
+  server.hll_sparse_max_bytes = 3000;
+  server.stream_node_max_entries = 100;
+  server.stream_node_max_bytes = 4096;
+  server.slowlog_log_slower_than = 10000;
+  server.slowlog_max_len = 128;
+  server.latency_tracking = true;
+  server.tracking_table_max_keys = 1000000;
+  server.io_threads = 1;
+  server.blocking = dict_new();
+  server.ready = dict_new();
+  server.pubsub = pubsub_new();
+  server.clients = hashmap_new(sizeof(struct client*), 0, client_hash,
+                               client_compare);
+  server.tracking = hashmap_new(sizeof(struct tracking_entry), 0,
+                                tracking_hash, tracking_compare);
+  server.command_table = commands;
+  size_t ncommands = sizeof(commands) / sizeof(struct command);
+  server.calls = calloc(ncommands, sizeof(uint64_t));
+  server.ns = calloc(ncommands, sizeof(uint64_t));
+  server.latency = calloc(ncommands, sizeof(struct histogram*));
+  if (!server.blocking || !server.ready || !server.pubsub || !server.calls ||
+      !server.ns || !server.latency || !server.clients || !server.tracking) {
+    fprintf(stderr, "%s\n", strerror(ENOMEM));
+    return EXIT_FAILURE;
+  }
   struct miniredis_events evs = {
+      .tick = tick,
       .serving = serving,
       .command = command,
+      .read_ahead = read_ahead,
+      .read_done = read_done,
+      .opened = opened,
+      .closed = closed,
       .error = error,
+      .iteration = iteration,
   };
 
   int port = atoi(argv[1]);
+  server.port = port;
+  server.start = miniredis_now();
+
+  for (int i = 2; i < argc; i += 2) {
+    struct config* config =
+        strncmp(argv[i], "--", 2) == 0 ? config_lookup(argv[i] + 2) : NULL;
+    const char* err = NULL;
+    if (!config) {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+    if (!config_set(&server, config, argv[i + 1], &err)) {
+      fprintf(stderr, "Invalid option %s: %s\n", argv[i], err);
+      return EXIT_FAILURE;
+    }
+  }
+  if (server.cluster_enabled) {
+    server.cluster = cluster_new(server.cluster_announce_ip, port);
+    server.slotkeys = calloc(CLUSTER_SLOTS, sizeof(struct pair*));
+    server.slotcounts = calloc(CLUSTER_SLOTS, sizeof(uint32_t));
+    if (!server.cluster || !server.slotkeys || !server.slotcounts) {
+      fprintf(stderr, "%s\n", strerror(ENOMEM));
+      return EXIT_FAILURE;
+    }
+    char errmsg[256];
+    if (server.cluster_config_file &&
+        !cluster_load(server.cluster, server.cluster_config_file, errmsg,
+                      sizeof(errmsg))) {
+      fprintf(stderr, "%s\n", errmsg);
+      return EXIT_FAILURE;
+    }
+  }
 
   char addr[64];
   snprintf(addr, 63, "tcp://localhost:%d", port);
+  char* unixaddr = NULL;
+  if (server.unixsocket) {
+    unixaddr = malloc(strlen(server.unixsocket) + 8);
+    if (!unixaddr) {
+      fprintf(stderr, "%s\n", strerror(ENOMEM));
+      return EXIT_FAILURE;
+    }
+    sprintf(unixaddr, "unix://%s", server.unixsocket);
+  }
 
-  const char* addrs[] = {addr};
-  miniredis_main(addrs, sizeof(addrs) / sizeof(char*), evs, &server);
+  const char* addrs[] = {addr, unixaddr};
+  struct miniredis_options options = {
+      .edge_triggered = server.edge_triggered,
+      .unix_perm = server.unixsocketperm,
+      .io_threads = server.io_threads,
+  };
+  miniredis_main(addrs, unixaddr ? 2 : 1, options, evs, &server);
 }
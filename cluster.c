@@ -0,0 +1,365 @@
+#include "cluster.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "miniredis.h"
+
+static uint16_t crc16tab[256];
+static bool crc16init = false;
+
+// crc16 is the CRC16-CCITT (XMODEM) checksum used for mapping keys to slots.
+static uint16_t crc16(const char* buf, size_t len) {
+  if (!crc16init) {
+    for (int i = 0; i < 256; i++) {
+      uint16_t crc = i << 8;
+      for (int j = 0; j < 8; j++) {
+        crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+      crc16tab[i] = crc;
+    }
+    crc16init = true;
+  }
+  uint16_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ (uint8_t)buf[i]) & 0xFF];
+  }
+  return crc;
+}
+
+// cluster_keyslot returns the hash slot of a key.
+// When the key contains a non-empty {hashtag} only the hashtag is hashed, so
+// related keys can be forced into the same slot.
+uint16_t cluster_keyslot(const char* key, size_t len) {
+  size_t s, e;
+  for (s = 0; s < len; s++) {
+    if (key[s] == '{') break;
+  }
+  if (s == len) {
+    return crc16(key, len) & (CLUSTER_SLOTS - 1);
+  }
+  for (e = s + 1; e < len; e++) {
+    if (key[e] == '}') break;
+  }
+  if (e == len || e == s + 1) {
+    return crc16(key, len) & (CLUSTER_SLOTS - 1);
+  }
+  return crc16(key + s + 1, e - s - 1) & (CLUSTER_SLOTS - 1);
+}
+
+static void random_id(char* id) {
+  static const char* hex = "0123456789abcdef";
+  unsigned char rnd[CLUSTER_NAMELEN];
+  FILE* f = fopen("/dev/urandom", "r");
+  if (!f || fread(rnd, 1, sizeof(rnd), f) != sizeof(rnd)) {
+    srand(time(NULL) ^ getpid());
+    for (int i = 0; i < CLUSTER_NAMELEN; i++) {
+      rnd[i] = rand();
+    }
+  }
+  if (f) fclose(f);
+  for (int i = 0; i < CLUSTER_NAMELEN; i++) {
+    id[i] = hex[rnd[i] & 15];
+  }
+  id[CLUSTER_NAMELEN] = '\0';
+}
+
+// cluster_node_add adds a node to the cluster. A random node id is generated
+// when `id` is NULL. Returns NULL when out of memory.
+struct cluster_node* cluster_node_add(struct cluster* cluster, const char* id,
+                                      const char* host, int port) {
+  struct cluster_node* node = malloc(sizeof(struct cluster_node));
+  if (!node) {
+    return NULL;
+  }
+  memset(node, 0, sizeof(struct cluster_node));
+  if (id) {
+    snprintf(node->id, sizeof(node->id), "%s", id);
+  } else {
+    random_id(node->id);
+  }
+  node->host = strdup(host);
+  node->port = port;
+  struct cluster_node** nodes =
+      realloc(cluster->nodes, (cluster->nnodes + 1) * sizeof(*nodes));
+  if (!node->host || !nodes) {
+    free(node->host);
+    free(node);
+    return NULL;
+  }
+  cluster->nodes = nodes;
+  cluster->nodes[cluster->nnodes++] = node;
+  return node;
+}
+
+// cluster_node_find returns the node with the provided id or NULL.
+struct cluster_node* cluster_node_find(struct cluster* cluster, const char* id,
+                                       size_t len) {
+  for (int i = 0; i < cluster->nnodes; i++) {
+    if (strlen(cluster->nodes[i]->id) == len &&
+        memcmp(cluster->nodes[i]->id, id, len) == 0) {
+      return cluster->nodes[i];
+    }
+  }
+  return NULL;
+}
+
+// cluster_new returns a new cluster containing only this node.
+struct cluster* cluster_new(const char* host, int port) {
+  struct cluster* cluster = malloc(sizeof(struct cluster));
+  if (!cluster) {
+    return NULL;
+  }
+  memset(cluster, 0, sizeof(struct cluster));
+  cluster->myself = cluster_node_add(cluster, NULL, host, port);
+  if (!cluster->myself) {
+    free(cluster);
+    return NULL;
+  }
+  return cluster;
+}
+
+void cluster_free(struct cluster* cluster) {
+  if (!cluster) return;
+  for (int i = 0; i < cluster->nnodes; i++) {
+    free(cluster->nodes[i]->host);
+    free(cluster->nodes[i]);
+  }
+  free(cluster->nodes);
+  free(cluster);
+}
+
+static bool parse_range(const char* tok, int* start, int* end) {
+  char* p = NULL;
+  long s = strtol(tok, &p, 10);
+  long e = s;
+  if (p == tok) return false;
+  if (*p == '-') {
+    const char* q = p + 1;
+    e = strtol(q, &p, 10);
+    if (p == q) return false;
+  }
+  if (*p || s < 0 || e < s || e >= CLUSTER_SLOTS) return false;
+  *start = s;
+  *end = e;
+  return true;
+}
+
+// cluster_load reads a static cluster configuration file.
+// Each non-empty line describes one node:
+//
+//   <node-id> <host>:<port> [myself] [<slot>|<start>-<end> ...]
+//
+// Lines starting with '#' are ignored. The node flagged `myself` replaces the
+// generated identity of this node.
+bool cluster_load(struct cluster* cluster, const char* path, char* errmsg,
+                  size_t errsz) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    snprintf(errmsg, errsz, "%s: %s", path, strerror(errno));
+    return false;
+  }
+  char line[65536];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), f)) {
+    lineno++;
+    char* save = NULL;
+    char* id = strtok_r(line, " \t\r\n", &save);
+    if (!id || id[0] == '#') continue;
+    char* addr = strtok_r(NULL, " \t\r\n", &save);
+    char* colon = addr ? strrchr(addr, ':') : NULL;
+    if (strlen(id) > CLUSTER_NAMELEN || !colon) {
+      snprintf(errmsg, errsz, "%s:%d: invalid node", path, lineno);
+      fclose(f);
+      return false;
+    }
+    *colon = '\0';
+    int port = atoi(colon + 1);
+    struct cluster_node* node = cluster_node_find(cluster, id, strlen(id));
+    char* tok = strtok_r(NULL, " \t\r\n", &save);
+    if (tok && strcmp(tok, "myself") == 0) {
+      node = cluster->myself;
+      snprintf(node->id, sizeof(node->id), "%s", id);
+      free(node->host);
+      node->host = strdup(addr);
+      node->port = port;
+      tok = strtok_r(NULL, " \t\r\n", &save);
+    } else if (!node) {
+      node = cluster_node_add(cluster, id, addr, port);
+    }
+    if (!node || !node->host) {
+      snprintf(errmsg, errsz, "%s", strerror(ENOMEM));
+      fclose(f);
+      return false;
+    }
+    for (; tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+      int start, end;
+      if (!parse_range(tok, &start, &end)) {
+        snprintf(errmsg, errsz, "%s:%d: invalid slot range '%s'", path,
+                 lineno, tok);
+        fclose(f);
+        return false;
+      }
+      for (int i = start; i <= end; i++) {
+        cluster->slots[i] = node;
+      }
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// next_range finds the next run of slots, starting at `*slot`, that are served
+// by the same node. Returns false when there are no more served slots.
+static bool next_range(struct cluster* cluster, int* slot, int* start,
+                       int* end) {
+  int i = *slot;
+  while (i < CLUSTER_SLOTS && !cluster->slots[i]) i++;
+  if (i == CLUSTER_SLOTS) return false;
+  *start = i;
+  while (i < CLUSTER_SLOTS && cluster->slots[i] == cluster->slots[*start]) i++;
+  *end = i - 1;
+  *slot = i;
+  return true;
+}
+
+static bool write_node(struct buf* buf, struct cluster_node* node) {
+  return miniredis_write_array(buf, 3) &&
+         miniredis_write_bulk(buf, node->host, -1) &&
+         miniredis_write_int(buf, node->port) &&
+         miniredis_write_bulk(buf, node->id, -1);
+}
+
+// cluster_write_slots writes the CLUSTER SLOTS reply.
+bool cluster_write_slots(struct cluster* cluster, struct buf* buf) {
+  int n = 0, slot = 0, start, end;
+  while (next_range(cluster, &slot, &start, &end)) n++;
+  if (!miniredis_write_array(buf, n)) return false;
+  slot = 0;
+  while (next_range(cluster, &slot, &start, &end)) {
+    if (!miniredis_write_array(buf, 3) || !miniredis_write_int(buf, start) ||
+        !miniredis_write_int(buf, end) ||
+        !write_node(buf, cluster->slots[start])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// cluster_write_shards writes the CLUSTER SHARDS reply. Without replicas each
+// node is its own shard.
+bool cluster_write_shards(struct cluster* cluster, struct buf* buf) {
+  if (!miniredis_write_array(buf, cluster->nnodes)) return false;
+  for (int i = 0; i < cluster->nnodes; i++) {
+    struct cluster_node* node = cluster->nodes[i];
+    int n = 0, slot = 0, start, end;
+    while (next_range(cluster, &slot, &start, &end)) {
+      n += cluster->slots[start] == node;
+    }
+    if (!miniredis_write_array(buf, 4) ||
+        !miniredis_write_bulk(buf, "slots", -1) ||
+        !miniredis_write_array(buf, n * 2)) {
+      return false;
+    }
+    slot = 0;
+    while (next_range(cluster, &slot, &start, &end)) {
+      if (cluster->slots[start] != node) continue;
+      if (!miniredis_write_int(buf, start) || !miniredis_write_int(buf, end)) {
+        return false;
+      }
+    }
+    if (!miniredis_write_bulk(buf, "nodes", -1) ||
+        !miniredis_write_array(buf, 1) || !miniredis_write_array(buf, 14) ||
+        !miniredis_write_bulk(buf, "id", -1) ||
+        !miniredis_write_bulk(buf, node->id, -1) ||
+        !miniredis_write_bulk(buf, "port", -1) ||
+        !miniredis_write_int(buf, node->port) ||
+        !miniredis_write_bulk(buf, "ip", -1) ||
+        !miniredis_write_bulk(buf, node->host, -1) ||
+        !miniredis_write_bulk(buf, "endpoint", -1) ||
+        !miniredis_write_bulk(buf, node->host, -1) ||
+        !miniredis_write_bulk(buf, "role", -1) ||
+        !miniredis_write_bulk(buf, "master", -1) ||
+        !miniredis_write_bulk(buf, "replication-offset", -1) ||
+        !miniredis_write_int(buf, 0) ||
+        !miniredis_write_bulk(buf, "health", -1) ||
+        !miniredis_write_bulk(buf, "online", -1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// cluster_write_nodes writes the text of the CLUSTER NODES reply, which uses
+// the same layout as the nodes.conf file of redis cluster.
+bool cluster_write_nodes(struct cluster* cluster, struct buf* buf) {
+  char str[256];
+  for (int i = 0; i < cluster->nnodes; i++) {
+    struct cluster_node* node = cluster->nodes[i];
+    snprintf(str, sizeof(str), "%s %s:%d@%d %s - 0 0 0 connected", node->id,
+             node->host, node->port, node->port + 10000,
+             node == cluster->myself ? "myself,master" : "master");
+    if (!buf_append(buf, str, -1)) return false;
+    int slot = 0, start, end;
+    while (next_range(cluster, &slot, &start, &end)) {
+      if (cluster->slots[start] != node) continue;
+      if (start == end) {
+        snprintf(str, sizeof(str), " %d", start);
+      } else {
+        snprintf(str, sizeof(str), " %d-%d", start, end);
+      }
+      if (!buf_append(buf, str, -1)) return false;
+    }
+    if (node == cluster->myself) {
+      for (int j = 0; j < CLUSTER_SLOTS; j++) {
+        if (cluster->migrating[j]) {
+          snprintf(str, sizeof(str), " [%d->-%s]", j,
+                   cluster->migrating[j]->id);
+          if (!buf_append(buf, str, -1)) return false;
+        }
+        if (cluster->importing[j]) {
+          snprintf(str, sizeof(str), " [%d-<-%s]", j,
+                   cluster->importing[j]->id);
+          if (!buf_append(buf, str, -1)) return false;
+        }
+      }
+    }
+    if (!buf_append_byte(buf, '\n')) return false;
+  }
+  return true;
+}
+
+// cluster_write_info writes the text of the CLUSTER INFO reply.
+bool cluster_write_info(struct cluster* cluster, struct buf* buf) {
+  int assigned = 0, size = 0;
+  for (int i = 0; i < CLUSTER_SLOTS; i++) {
+    assigned += cluster->slots[i] != NULL;
+  }
+  for (int i = 0; i < cluster->nnodes; i++) {
+    for (int j = 0; j < CLUSTER_SLOTS; j++) {
+      if (cluster->slots[j] == cluster->nodes[i]) {
+        size++;
+        break;
+      }
+    }
+  }
+  char str[512];
+  snprintf(str, sizeof(str),
+           "cluster_enabled:1\r\n"
+           "cluster_state:%s\r\n"
+           "cluster_slots_assigned:%d\r\n"
+           "cluster_slots_ok:%d\r\n"
+           "cluster_slots_pfail:0\r\n"
+           "cluster_slots_fail:0\r\n"
+           "cluster_known_nodes:%d\r\n"
+           "cluster_size:%d\r\n"
+           "cluster_current_epoch:0\r\n"
+           "cluster_my_epoch:0\r\n",
+           assigned == CLUSTER_SLOTS ? "ok" : "fail", assigned, assigned,
+           cluster->nnodes, size);
+  return buf_append(buf, str, -1);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buf.h"
+
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_NAMELEN 40
+
+struct cluster_node {
+  char id[CLUSTER_NAMELEN + 1];
+  char* host;
+  int port;
+};
+
+struct cluster {
+  struct cluster_node** nodes;
+  int nnodes;
+  struct cluster_node* myself;
+  struct cluster_node* slots[CLUSTER_SLOTS];
+  struct cluster_node* migrating[CLUSTER_SLOTS];
+  struct cluster_node* importing[CLUSTER_SLOTS];
+};
+
+uint16_t cluster_keyslot(const char* key, size_t len);
+struct cluster* cluster_new(const char* host, int port);
+void cluster_free(struct cluster* cluster);
+bool cluster_load(struct cluster* cluster, const char* path, char* errmsg,
+                  size_t errsz);
+struct cluster_node* cluster_node_add(struct cluster* cluster, const char* id,
+                                      const char* host, int port);
+struct cluster_node* cluster_node_find(struct cluster* cluster, const char* id,
+                                       size_t len);
+bool cluster_write_info(struct cluster* cluster, struct buf* buf);
+bool cluster_write_slots(struct cluster* cluster, struct buf* buf);
+bool cluster_write_shards(struct cluster* cluster, struct buf* buf);
+bool cluster_write_nodes(struct cluster* cluster, struct buf* buf);
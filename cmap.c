@@ -0,0 +1,278 @@
+#include "cmap.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CMAP_STRIPES 64  // writer locks, a power of two
+#define CMAP_MINCAP 64   // buckets, at least one per stripe
+
+struct node {
+  _Atomic(struct node*) next;
+  uint64_t hash;
+  _Atomic(void*) item;
+};
+
+struct table {
+  size_t nbuckets;
+  size_t mask;
+  _Atomic(struct node*) buckets[];
+};
+
+// stripe guards the buckets whose index modulo CMAP_STRIPES is its own, for
+// every table size, so a writer holding it may also read the table pointer.
+struct stripe {
+  _Alignas(64) pthread_mutex_t lock;
+};
+
+struct cmap {
+  struct stripe stripes[CMAP_STRIPES];
+  _Atomic(struct table*) table;
+  _Atomic size_t count;
+  struct epoch* epoch;
+  uint64_t (*hash)(const void* item);
+  int (*compare)(const void* a, const void* b);
+};
+
+static struct table* table_new(size_t nbuckets) {
+  struct table* table =
+      calloc(1, sizeof(struct table) + nbuckets * sizeof(table->buckets[0]));
+  if (!table) {
+    return NULL;
+  }
+  table->nbuckets = nbuckets;
+  table->mask = nbuckets - 1;
+  return table;
+}
+
+// table_free frees the table and its nodes, but not their items.
+static void table_free(void* ptr) {
+  struct table* table = ptr;
+  for (size_t i = 0; i < table->nbuckets; i++) {
+    struct node* node = atomic_load_explicit(&table->buckets[i],
+                                             memory_order_relaxed);
+    while (node) {
+      struct node* next =
+          atomic_load_explicit(&node->next, memory_order_relaxed);
+      free(node);
+      node = next;
+    }
+  }
+  free(table);
+}
+
+// cmap_new returns a new map. Param `hash` and `compare` are given items, or
+// the keys searched for, as in hashmap_new. Returns NULL when out of memory.
+struct cmap* cmap_new(struct epoch* epoch, uint64_t (*hash)(const void* item),
+                      int (*compare)(const void* a, const void* b)) {
+  struct cmap* map = aligned_alloc(_Alignof(struct cmap), sizeof(struct cmap));
+  if (!map) {
+    return NULL;
+  }
+  memset(map, 0, sizeof(struct cmap));
+  struct table* table = table_new(CMAP_MINCAP);
+  if (!table) {
+    free(map);
+    return NULL;
+  }
+  for (int i = 0; i < CMAP_STRIPES; i++) {
+    pthread_mutex_init(&map->stripes[i].lock, NULL);
+  }
+  atomic_init(&map->table, table);
+  atomic_init(&map->count, 0);
+  map->epoch = epoch;
+  map->hash = hash;
+  map->compare = compare;
+  return map;
+}
+
+// cmap_free frees the map, but not its items. No reader may be inside it.
+void cmap_free(struct cmap* map) {
+  if (!map) return;
+  table_free(atomic_load_explicit(&map->table, memory_order_relaxed));
+  for (int i = 0; i < CMAP_STRIPES; i++) {
+    pthread_mutex_destroy(&map->stripes[i].lock);
+  }
+  free(map);
+}
+
+size_t cmap_count(struct cmap* map) {
+  return atomic_load_explicit(&map->count, memory_order_relaxed);
+}
+
+static struct table* lock(struct cmap* map, uint64_t hash) {
+  pthread_mutex_lock(&map->stripes[hash & (CMAP_STRIPES - 1)].lock);
+  return atomic_load_explicit(&map->table, memory_order_relaxed);
+}
+
+static void unlock(struct cmap* map, uint64_t hash) {
+  pthread_mutex_unlock(&map->stripes[hash & (CMAP_STRIPES - 1)].lock);
+}
+
+// resize rehashes the map into a table of nbuckets, holding every stripe.
+// The nodes are copied, since readers may still walk the old chains, and
+// the old table is retired. The map is left as is when out of memory.
+static void resize(struct cmap* map, size_t from, size_t nbuckets) {
+  for (int i = 0; i < CMAP_STRIPES; i++) {
+    pthread_mutex_lock(&map->stripes[i].lock);
+  }
+  struct table* old = atomic_load_explicit(&map->table, memory_order_relaxed);
+  struct table* table = old->nbuckets == from ? table_new(nbuckets) : NULL;
+  for (size_t i = 0; table && i < old->nbuckets; i++) {
+    struct node* node =
+        atomic_load_explicit(&old->buckets[i], memory_order_relaxed);
+    for (; node;
+         node = atomic_load_explicit(&node->next, memory_order_relaxed)) {
+      struct node* copy = malloc(sizeof(struct node));
+      if (!copy) {
+        table_free(table);
+        table = NULL;
+        break;
+      }
+      _Atomic(struct node*)* bucket = &table->buckets[node->hash & table->mask];
+      copy->hash = node->hash;
+      atomic_init(&copy->item, atomic_load_explicit(&node->item,
+                                                    memory_order_relaxed));
+      atomic_init(&copy->next,
+                  atomic_load_explicit(bucket, memory_order_relaxed));
+      atomic_store_explicit(bucket, copy, memory_order_relaxed);
+    }
+  }
+  if (table) {
+    atomic_store_explicit(&map->table, table, memory_order_release);
+  }
+  for (int i = CMAP_STRIPES - 1; i >= 0; i--) {
+    pthread_mutex_unlock(&map->stripes[i].lock);
+  }
+  if (table) {
+    epoch_retire(map->epoch, old, table_free);
+  }
+}
+
+// cmap_get returns the item matching the key, or NULL.
+void* cmap_get(struct cmap* map, const void* key) {
+  uint64_t hash = map->hash(key);
+  struct table* table =
+      atomic_load_explicit(&map->table, memory_order_acquire);
+  struct node* node = atomic_load_explicit(
+      &table->buckets[hash & table->mask], memory_order_acquire);
+  for (; node;
+       node = atomic_load_explicit(&node->next, memory_order_acquire)) {
+    if (node->hash != hash) continue;
+    void* item = atomic_load_explicit(&node->item, memory_order_acquire);
+    if (map->compare(key, item) == 0) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+// cmap_set inserts the item, or replaces the matching one, which is stored
+// in *prev for the caller to retire. *prev is NULL if the item was inserted.
+// Returns false when out of memory.
+bool cmap_set(struct cmap* map, void* item, void** prev) {
+  uint64_t hash = map->hash(item);
+  struct table* table = lock(map, hash);
+  _Atomic(struct node*)* bucket = &table->buckets[hash & table->mask];
+  struct node* head = atomic_load_explicit(bucket, memory_order_relaxed);
+  for (struct node* node = head; node;
+       node = atomic_load_explicit(&node->next, memory_order_relaxed)) {
+    if (node->hash == hash &&
+        map->compare(item, atomic_load_explicit(&node->item,
+                                                memory_order_relaxed)) == 0) {
+      *prev = atomic_exchange_explicit(&node->item, item,
+                                       memory_order_acq_rel);
+      unlock(map, hash);
+      return true;
+    }
+  }
+  struct node* node = malloc(sizeof(struct node));
+  if (!node) {
+    unlock(map, hash);
+    return false;
+  }
+  node->hash = hash;
+  atomic_init(&node->item, item);
+  atomic_init(&node->next, head);
+  atomic_store_explicit(bucket, node, memory_order_release);
+  size_t count = atomic_fetch_add(&map->count, 1) + 1;
+  size_t nbuckets = table->nbuckets;
+  unlock(map, hash);
+  *prev = NULL;
+  if (count > nbuckets) {
+    resize(map, nbuckets, nbuckets * 2);
+  }
+  return true;
+}
+
+// cmap_delete removes the item matching the key and returns it for the
+// caller to retire, or returns NULL if there is none.
+void* cmap_delete(struct cmap* map, const void* key) {
+  uint64_t hash = map->hash(key);
+  struct table* table = lock(map, hash);
+  _Atomic(struct node*)* link = &table->buckets[hash & table->mask];
+  struct node* node;
+  while ((node = atomic_load_explicit(link, memory_order_relaxed))) {
+    void* item = atomic_load_explicit(&node->item, memory_order_relaxed);
+    if (node->hash == hash && map->compare(key, item) == 0) {
+      // readers on the node still find the rest of the chain through it
+      atomic_store_explicit(
+          link, atomic_load_explicit(&node->next, memory_order_relaxed),
+          memory_order_release);
+      epoch_retire(map->epoch, node, free);
+      size_t count = atomic_fetch_sub(&map->count, 1) - 1;
+      size_t nbuckets = table->nbuckets;
+      unlock(map, hash);
+      if (nbuckets > CMAP_MINCAP && count < nbuckets / 8) {
+        resize(map, nbuckets, nbuckets / 2);
+      }
+      return item;
+    }
+    link = &node->next;
+  }
+  unlock(map, hash);
+  return NULL;
+}
+
+// cmap_probe returns the first item in the bucket at position, modulo the
+// number of buckets, or NULL if the bucket is empty.
+void* cmap_probe(struct cmap* map, uint64_t position) {
+  struct table* table =
+      atomic_load_explicit(&map->table, memory_order_acquire);
+  struct node* node = atomic_load_explicit(
+      &table->buckets[position & table->mask], memory_order_acquire);
+  return node ? atomic_load_explicit(&node->item, memory_order_acquire)
+              : NULL;
+}
+
+// cmap_scan iterates over all items in the map. Param `iter` can return
+// false to stop iteration early. Returns false if the iteration has been
+// stopped early. Items set or deleted meanwhile may or may not be visited.
+bool cmap_scan(struct cmap* map, bool (*iter)(void* item, void* udata),
+               void* udata) {
+  struct table* table =
+      atomic_load_explicit(&map->table, memory_order_acquire);
+  for (size_t i = 0; i < table->nbuckets; i++) {
+    struct node* node =
+        atomic_load_explicit(&table->buckets[i], memory_order_acquire);
+    for (; node;
+         node = atomic_load_explicit(&node->next, memory_order_acquire)) {
+      if (!iter(atomic_load_explicit(&node->item, memory_order_acquire),
+                udata)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// cmap_memory returns the number of bytes allocated for the map, excluding
+// its items and the retired memory not freed yet.
+size_t cmap_memory(struct cmap* map) {
+  struct table* table =
+      atomic_load_explicit(&map->table, memory_order_relaxed);
+  return sizeof(struct cmap) + sizeof(struct table) +
+         table->nbuckets * sizeof(table->buckets[0]) +
+         cmap_count(map) * sizeof(struct node);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoch.h"
+
+// cmap is a hash map of item pointers that readers search without locks
+// while writers change it. Buckets are chains whose nodes are published with
+// release stores, so a reader sees each node either fully linked or not at
+// all and never has to retry. Writers lock one of a fixed set of stripes,
+// chosen by the hash, and unlinked nodes and outgrown tables are retired
+// through the epoch rather than freed.
+//
+// Readers on other threads search within epoch_enter and epoch_exit of a
+// reader registered with the map's epoch, and may use the items found until
+// epoch_exit, provided the writers retire removed items through the same
+// epoch. The writers' own reads need no section.
+
+struct cmap;
+
+struct cmap* cmap_new(struct epoch* epoch, uint64_t (*hash)(const void* item),
+                      int (*compare)(const void* a, const void* b));
+void cmap_free(struct cmap* map);
+size_t cmap_count(struct cmap* map);
+void* cmap_get(struct cmap* map, const void* key);
+bool cmap_set(struct cmap* map, void* item, void** prev);
+void* cmap_delete(struct cmap* map, const void* key);
+void* cmap_probe(struct cmap* map, uint64_t position);
+bool cmap_scan(struct cmap* map, bool (*iter)(void* item, void* udata),
+               void* udata);
+size_t cmap_memory(struct cmap* map);
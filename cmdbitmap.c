@@ -0,0 +1,520 @@
+#include "cmdbitmap.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitops.h"
+#include "server.h"
+
+#define BITMAP_MAX_BITS (UINT64_C(1) << 32)
+
+// string_grow returns the pair of the string key with its value zero-padded
+// to at least len bytes, replacing the pair if it has to grow, or creating it
+// if pair is NULL. Returns NULL when out of memory.
+static struct pair* string_grow(struct server* server, struct pair* pair,
+                                const char* key, size_t keylen, size_t len) {
+  if (pair && (size_t)pair->vallen >= len) {
+    return pair;
+  }
+  double expires = pair ? pair_expire(pair) : 0;
+  struct pair* npair =
+      pair_new(key, keylen, NULL, len, expires, server->cluster != NULL);
+  if (!npair) {
+    return NULL;
+  }
+  if (pair) {
+    memcpy((char*)pair_val(npair), pair_val(pair), pair->vallen);
+  }
+  return db_set(server, npair) ? npair : NULL;
+}
+
+// argtobitoffset parses a bit offset, which for BITFIELD may be given as
+// "#n" to mean n times the width of the field.
+static bool argtobitoffset(struct miniredis_conn* conn,
+                           struct miniredis_args* args, int index, int bits,
+                           uint64_t* offset) {
+  size_t len;
+  const char* str = miniredis_args_at(args, index, &len);
+  bool mul = bits > 0 && len > 0 && str[0] == '#';
+  char buf[32];
+  int64_t x;
+  char* end;
+  if (len - mul == 0 || len - mul >= sizeof(buf)) {
+    goto fail;
+  }
+  memcpy(buf, str + mul, len - mul);
+  buf[len - mul] = '\0';
+  errno = 0;
+  x = strtoll(buf, &end, 10);
+  if (errno || *end || x < 0 || (mul && x > INT64_MAX / bits)) {
+    goto fail;
+  }
+  *offset = mul ? (uint64_t)x * bits : (uint64_t)x;
+  if (*offset + (bits > 0 ? bits : 1) > BITMAP_MAX_BITS) {
+    goto fail;
+  }
+  return true;
+fail:
+  miniredis_conn_write_error(
+      conn, "ERR bit offset is not an integer or out of range");
+  return false;
+}
+
+// SETBIT key offset value
+void cmdSETBIT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  uint64_t offset;
+  if (!argtobitoffset(conn, args, 2, 0, &offset)) {
+    return;
+  }
+  int64_t bit;
+  if (!argtoint(args, 3, &bit) || (bit != 0 && bit != 1)) {
+    miniredis_conn_write_error(conn,
+                               "ERR bit is not an integer or out of range");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STRING, &pair)) {
+    return;
+  }
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  pair = string_grow(server, pair, key, keylen, offset / 8 + 1);
+  if (!pair) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  unsigned char* p = (unsigned char*)pair_val(pair);
+  int shift = 7 - (offset & 7);
+  int old = (p[offset / 8] >> shift) & 1;
+  p[offset / 8] = (p[offset / 8] & ~(1 << shift)) | (bit << shift);
+  db_modified(server, pair, pair_memory(pair));
+  miniredis_conn_write_int(conn, old);
+}
+
+// GETBIT key offset
+void cmdGETBIT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  uint64_t offset;
+  if (!argtobitoffset(conn, args, 2, 0, &offset)) {
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STRING, &pair)) {
+    return;
+  }
+  const unsigned char* p = pair ? (const unsigned char*)pair_val(pair) : NULL;
+  int bit = 0;
+  if (pair && offset / 8 < (uint64_t)pair->vallen) {
+    bit = (p[offset / 8] >> (7 - (offset & 7))) & 1;
+  }
+  miniredis_conn_write_int(conn, bit);
+}
+
+// parse_bitrange parses the optional start, end and BYTE|BIT arguments of
+// BITCOUNT and BITPOS, from args[index:], into an inclusive range of bits of
+// a string of len bytes. Returns false with an error written if the
+// arguments are invalid, or with *empty set if the range is empty.
+static bool parse_bitrange(struct miniredis_conn* conn,
+                           struct miniredis_args* args, int index, size_t len,
+                           int64_t* start, int64_t* end, bool* endgiven,
+                           bool* empty) {
+  int nargs = miniredis_args_count(args);
+  bool isbit = false;
+  int64_t s = 0, e = -1;
+  *endgiven = nargs > index + 1;
+  if (nargs > index + 3) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return false;
+  }
+  if (nargs == index + 3) {
+    if (miniredis_args_eq(args, index + 2, "bit")) {
+      isbit = true;
+    } else if (!miniredis_args_eq(args, index + 2, "byte")) {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return false;
+    }
+  }
+  if ((nargs > index && !argtoint(args, index, &s)) ||
+      (nargs > index + 1 && !argtoint(args, index + 1, &e))) {
+    miniredis_conn_write_error(conn,
+                               "ERR value is not an integer or out of range");
+    return false;
+  }
+  int64_t n = isbit ? (int64_t)len * 8 : (int64_t)len;
+  if (s < 0) s += n;
+  if (e < 0) e += n;
+  if (s < 0) s = 0;
+  if (e < 0) e = 0;
+  if (e >= n) e = n - 1;
+  *empty = s > e;
+  *start = isbit ? s : s * 8;
+  *end = isbit ? e : e * 8 + 7;
+  return true;
+}
+
+// bitcount_range counts the bits set in the inclusive bit range, counting
+// whole bytes with bit_count.
+static uint64_t bitcount_range(const unsigned char* p, int64_t start,
+                               int64_t end) {
+  uint64_t count = 0;
+  for (; start <= end && (start & 7); start++) {
+    count += (p[start / 8] >> (7 - (start & 7))) & 1;
+  }
+  int64_t nbytes = (end + 1 - start) / 8;
+  if (nbytes > 0) {
+    count += bit_count(p + start / 8, nbytes);
+    start += nbytes * 8;
+  }
+  for (; start <= end; start++) {
+    count += (p[start / 8] >> (7 - (start & 7))) & 1;
+  }
+  return count;
+}
+
+// bitpos_range is bitcount_range for the position of the first bit set to
+// bit, or -1.
+static int64_t bitpos_range(const unsigned char* p, int64_t start, int64_t end,
+                            int bit) {
+  for (; start <= end && (start & 7); start++) {
+    if (((p[start / 8] >> (7 - (start & 7))) & 1) == bit) return start;
+  }
+  int64_t nbytes = (end + 1 - start) / 8;
+  if (nbytes > 0) {
+    int64_t pos = bit_pos(p + start / 8, nbytes, bit);
+    if (pos >= 0) return start + pos;
+    start += nbytes * 8;
+  }
+  for (; start <= end; start++) {
+    if (((p[start / 8] >> (7 - (start & 7))) & 1) == bit) return start;
+  }
+  return -1;
+}
+
+// BITCOUNT key [start end [BYTE|BIT]]
+void cmdBITCOUNT(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2 || nargs == 3) {
+    miniredis_conn_write_error(conn, nargs == 3
+                                         ? "ERR syntax error"
+                                         : "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STRING, &pair)) {
+    return;
+  }
+  int64_t start, end;
+  bool endgiven, empty;
+  if (!parse_bitrange(conn, args, 2, pair ? pair->vallen : 0, &start, &end,
+                      &endgiven, &empty)) {
+    return;
+  }
+  uint64_t count = 0;
+  if (pair && !empty) {
+    count = bitcount_range((const unsigned char*)pair_val(pair), start, end);
+  }
+  miniredis_conn_write_int(conn, count);
+}
+
+// BITPOS key bit [start [end [BYTE|BIT]]]
+void cmdBITPOS(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int64_t bit;
+  if (!argtoint(args, 2, &bit) || (bit != 0 && bit != 1)) {
+    miniredis_conn_write_error(conn,
+                               "ERR The bit argument must be 1 or 0.");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STRING, &pair)) {
+    return;
+  }
+  int64_t start, end;
+  bool endgiven, empty;
+  if (!parse_bitrange(conn, args, 3, pair ? pair->vallen : 0, &start, &end,
+                      &endgiven, &empty)) {
+    return;
+  }
+  if (!pair) {
+    miniredis_conn_write_int(conn, bit ? -1 : 0);
+    return;
+  }
+  if (empty) {
+    miniredis_conn_write_int(conn, -1);
+    return;
+  }
+  int64_t pos =
+      bitpos_range((const unsigned char*)pair_val(pair), start, end, bit);
+  // without an end, the string is taken to be followed by zeros
+  if (pos == -1 && bit == 0 && !endgiven) {
+    pos = end + 1;
+  }
+  miniredis_conn_write_int(conn, pos);
+}
+
+// BITOP AND|OR|XOR|NOT destkey key [key ...]
+void cmdBITOP(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int op;
+  if (miniredis_args_eq(args, 1, "and")) {
+    op = BITOP_AND;
+  } else if (miniredis_args_eq(args, 1, "or")) {
+    op = BITOP_OR;
+  } else if (miniredis_args_eq(args, 1, "xor")) {
+    op = BITOP_XOR;
+  } else if (miniredis_args_eq(args, 1, "not")) {
+    op = BITOP_NOT;
+  } else {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  int n = nargs - 3;
+  if (op == BITOP_NOT && n != 1) {
+    miniredis_conn_write_error(
+        conn, "ERR BITOP NOT must be called with a single source key.");
+    return;
+  }
+  const unsigned char* srcs[n];
+  size_t lens[n];
+  size_t len = 0;
+  for (int i = 0; i < n; i++) {
+    struct pair* pair;
+    if (!lookup_key(conn, server, args, 3 + i, TYPE_STRING, &pair)) {
+      return;
+    }
+    srcs[i] = pair ? (const unsigned char*)pair_val(pair) : NULL;
+    lens[i] = pair ? pair->vallen : 0;
+    if (lens[i] > len) len = lens[i];
+  }
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 2, &keylen);
+  if (len == 0) {
+    db_retire(server, db_delete(server, key, keylen));
+    miniredis_conn_write_int(conn, 0);
+    return;
+  }
+  struct pair* dst =
+      pair_new(key, keylen, NULL, len, 0, server->cluster != NULL);
+  if (!dst) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  // the destination may be one of the sources, so it is replaced only after
+  bit_op(op, (unsigned char*)pair_val(dst), len, srcs, lens, n);
+  if (!db_set(server, dst)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  miniredis_conn_write_int(conn, len);
+}
+
+enum {
+  BITFIELD_WRAP,
+  BITFIELD_SAT,
+  BITFIELD_FAIL,
+};
+
+// bitfield_type parses a type such as i16 or u8.
+static bool bitfield_type(struct miniredis_args* args, int index, bool* sign,
+                          int* bits) {
+  size_t len;
+  const char* str = miniredis_args_at(args, index, &len);
+  char c = len > 0 ? tolower(str[0]) : 0;
+  if (len < 2 || len > 3 || (c != 'i' && c != 'u')) {
+    return false;
+  }
+  *sign = c == 'i';
+  *bits = 0;
+  for (size_t i = 1; i < len; i++) {
+    if (!isdigit(str[i])) return false;
+    *bits = *bits * 10 + (str[i] - '0');
+  }
+  return *bits >= 1 && *bits <= (*sign ? 64 : 63);
+}
+
+// bitfield_add adds incr to value, a field of the type, into *out. Returns
+// false if it overflows with the FAIL policy.
+static bool bitfield_add(int64_t value, int64_t incr, bool sign, int bits,
+                         int overflow, int64_t* out) {
+  uint64_t sum = (uint64_t)value + (uint64_t)incr;
+  if (sign) {
+    int64_t max = bits == 64 ? INT64_MAX : (INT64_C(1) << (bits - 1)) - 1;
+    int64_t min = -max - 1;
+    bool over = incr > 0 && value > max - incr;
+    bool under = incr < 0 && value < min - incr;
+    if ((over || under) && overflow == BITFIELD_FAIL) {
+      return false;
+    }
+    if ((over || under) && overflow == BITFIELD_SAT) {
+      *out = over ? max : min;
+    } else if (bits < 64 && (sum & (UINT64_C(1) << (bits - 1)))) {
+      // wrap by sign extending the low bits
+      *out = (int64_t)(sum | (UINT64_MAX << bits));
+    } else {
+      *out = bits < 64 ? (int64_t)(sum & ((UINT64_C(1) << bits) - 1))
+                       : (int64_t)sum;
+    }
+    return true;
+  }
+  uint64_t max = (UINT64_C(1) << bits) - 1;
+  bool over = incr > 0 && (uint64_t)incr > max - (uint64_t)value;
+  bool under = incr < 0 && -(uint64_t)incr > (uint64_t)value;
+  if ((over || under) && overflow == BITFIELD_FAIL) {
+    return false;
+  }
+  if ((over || under) && overflow == BITFIELD_SAT) {
+    *out = over ? (int64_t)max : 0;
+  } else {
+    *out = (int64_t)(sum & max);
+  }
+  return true;
+}
+
+// bitfield_get reads a field of the type, sign extending signed fields.
+static int64_t bitfield_get(const unsigned char* p, size_t len, uint64_t offset,
+                            bool sign, int bits) {
+  uint64_t x = bit_get_field(p, len, offset, bits);
+  if (sign && bits < 64 && (x & (UINT64_C(1) << (bits - 1)))) {
+    x |= UINT64_MAX << bits;
+  }
+  return (int64_t)x;
+}
+
+// BITFIELD key [GET type offset] [SET type offset value]
+//   [INCRBY type offset increment] [OVERFLOW WRAP|SAT|FAIL] ...
+void cmdBITFIELD(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  // validate all the operations and find how far they write before running
+  // any of them
+  uint64_t maxbit = 0;
+  int nops = 0;
+  for (int i = 2; i < nargs; i++) {
+    bool get = miniredis_args_eq(args, i, "get");
+    bool set = miniredis_args_eq(args, i, "set");
+    bool incrby = miniredis_args_eq(args, i, "incrby");
+    if (miniredis_args_eq(args, i, "overflow") && i + 1 < nargs) {
+      i++;
+      if (!miniredis_args_eq(args, i, "wrap") &&
+          !miniredis_args_eq(args, i, "sat") &&
+          !miniredis_args_eq(args, i, "fail")) {
+        miniredis_conn_write_error(conn, "ERR Invalid OVERFLOW type specified");
+        return;
+      }
+      continue;
+    }
+    if (!(get || set || incrby) || i + (get ? 2 : 3) >= nargs) {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+    bool sign;
+    int bits;
+    if (!bitfield_type(args, i + 1, &sign, &bits)) {
+      miniredis_conn_write_error(
+          conn,
+          "ERR Invalid bitfield type. Use something like i16 u8. Note that "
+          "u64 is not supported but i64 is.");
+      return;
+    }
+    uint64_t offset;
+    if (!argtobitoffset(conn, args, i + 2, bits, &offset)) {
+      return;
+    }
+    int64_t x;
+    if (!get && !argtoint(args, i + 3, &x)) {
+      miniredis_conn_write_error(
+          conn, "ERR value is not an integer or out of range");
+      return;
+    }
+    if (!get && offset + bits > maxbit) {
+      maxbit = offset + bits;
+    }
+    nops++;
+    i += get ? 2 : 3;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STRING, &pair)) {
+    return;
+  }
+  if (maxbit > 0) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, 1, &keylen);
+    pair = string_grow(server, pair, key, keylen, (maxbit + 7) / 8);
+    if (!pair) {
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+  }
+  unsigned char* p = pair ? (unsigned char*)pair_val(pair) : NULL;
+  size_t len = pair ? pair->vallen : 0;
+  int overflow = BITFIELD_WRAP;
+  miniredis_conn_write_array(conn, nops);
+  for (int i = 2; i < nargs; i++) {
+    if (miniredis_args_eq(args, i, "overflow")) {
+      i++;
+      overflow = miniredis_args_eq(args, i, "wrap")  ? BITFIELD_WRAP
+                 : miniredis_args_eq(args, i, "sat") ? BITFIELD_SAT
+                                                     : BITFIELD_FAIL;
+      continue;
+    }
+    bool get = miniredis_args_eq(args, i, "get");
+    bool set = miniredis_args_eq(args, i, "set");
+    bool sign;
+    int bits;
+    uint64_t offset;
+    int64_t x = 0;
+    bitfield_type(args, i + 1, &sign, &bits);
+    argtobitoffset(conn, args, i + 2, bits, &offset);
+    if (!get) argtoint(args, i + 3, &x);
+    i += get ? 2 : 3;
+    int64_t old = bitfield_get(p, len, offset, sign, bits);
+    if (get) {
+      miniredis_conn_write_int(conn, old);
+      continue;
+    }
+    // SET is checked for overflow as an increment of zero
+    int64_t val;
+    if (!bitfield_add(set ? 0 : old, x, sign, bits, overflow, &val)) {
+      miniredis_conn_write_null(conn);
+      continue;
+    }
+    bit_set_field(p, offset, bits, (uint64_t)val);
+    miniredis_conn_write_int(conn, set ? old : val);
+  }
+  if (maxbit > 0) {
+    db_modified(server, pair, pair_memory(pair));
+  }
+}
+
+// HyperLogLogs are strings, so that GET, SET and DUMP work on them as is.
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "miniredis.h"
+
+// Bitmaps are strings addressed by bit, grown with zero bytes as bits past
+// their end are set.
+
+void cmdSETBIT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdGETBIT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdBITCOUNT(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata);
+void cmdBITPOS(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdBITOP(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdBITFIELD(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata);
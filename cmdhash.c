@@ -0,0 +1,403 @@
+#include "cmdhash.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "buf.h"
+#include "dict.h"
+#include "listpack.h"
+#include "match.h"
+#include "server.h"
+
+static size_t hash_len(struct pair* pair) {
+  if (pair->enc == ENC_COMPACT) {
+    return lp_count(pair_obj(pair)) / 2;
+  }
+  return dict_count(pair_obj(pair));
+}
+
+// hash_get returns the value of the field, which is not null-terminated with
+// the compact encoding. Returns NULL if the field does not exist.
+static const char* hash_get(struct pair* pair, const char* field, size_t flen,
+                            size_t* vlen) {
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    unsigned char* p = lp_find(lp, lp_first(lp), field, flen, 1);
+    return p ? lp_get(lp_next(lp, p), vlen) : NULL;
+  }
+  struct dict_entry* entry = dict_get(pair_obj(pair), field, flen);
+  if (!entry) {
+    return NULL;
+  }
+  *vlen = entry->vallen;
+  return dict_entry_val(entry);
+}
+
+// hash_convert converts a listpack encoded hash to a dict.
+static bool hash_convert(struct pair* pair) {
+  unsigned char* lp = pair_obj(pair);
+  struct dict* dict = dict_new();
+  if (!dict) {
+    return false;
+  }
+  for (unsigned char* p = lp_first(lp); p; p = lp_next(lp, lp_next(lp, p))) {
+    size_t flen, vlen;
+    const char* field = lp_get(p, &flen);
+    const char* val = lp_get(lp_next(lp, p), &vlen);
+    if (dict_set(dict, field, flen, val, vlen) == -1) {
+      dict_free(dict);
+      return false;
+    }
+  }
+  lp_free(lp);
+  pair_set_obj(pair, dict);
+  pair->enc = ENC_FULL;
+  return true;
+}
+
+// hash_set sets the value of the field, first converting the hash to a dict
+// if it would outgrow the listpack limits. Returns 1 if the field was added,
+// 0 if it was updated, or -1 when out of memory.
+int hash_set(struct server* server, struct pair* pair, const char* field,
+             size_t flen, const char* val, size_t vlen) {
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    unsigned char* p = lp_find(lp, lp_first(lp), field, flen, 1);
+    if ((int64_t)flen > server->hash_max_listpack_value ||
+        (int64_t)vlen > server->hash_max_listpack_value ||
+        (!p && (int64_t)hash_len(pair) >= server->hash_max_listpack_entries)) {
+      if (!hash_convert(pair)) {
+        return -1;
+      }
+    } else if (p) {
+      lp = lp_replace(lp, lp_next(lp, p), val, vlen);
+      if (!lp) {
+        return -1;
+      }
+      pair_set_obj(pair, lp);
+      return 0;
+    } else {
+      unsigned char* nlp = lp_append(lp, field, flen);
+      if (!nlp) {
+        return -1;
+      }
+      lp = lp_append(nlp, val, vlen);
+      if (!lp) {
+        pair_set_obj(pair, lp_delete(nlp, lp_last(nlp), 1));
+        return -1;
+      }
+      pair_set_obj(pair, lp);
+      return 1;
+    }
+  }
+  return dict_set(pair_obj(pair), field, flen, val, vlen);
+}
+
+// hash_del deletes the field. Returns false if it does not exist.
+static bool hash_del(struct pair* pair, const char* field, size_t flen) {
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    unsigned char* p = lp_find(lp, lp_first(lp), field, flen, 1);
+    if (!p) {
+      return false;
+    }
+    pair_set_obj(pair, lp_delete(lp, p, 2));
+    return true;
+  }
+  return dict_delete(pair_obj(pair), field, flen);
+}
+
+// hash_write writes the fields and, if withvals, the values of the hash
+// matching the pattern, starting at the cursor. With the dict encoding the
+// cursor is a bucket position and at least count entries are visited, which
+// may repeat or skip entries if the dict is resized in between calls.
+// Returns the next cursor, or zero once done.
+static size_t hash_write(struct pair* pair, struct buf* buf, int* n,
+                         size_t cursor, size_t count, const char* pat,
+                         size_t plen, bool withvals) {
+  const char* field;
+  const char* val;
+  size_t flen, vlen;
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    for (unsigned char* p = lp_first(lp); p;
+         p = lp_next(lp, lp_next(lp, p))) {
+      field = lp_get(p, &flen);
+      val = lp_get(lp_next(lp, p), &vlen);
+      if (pat && !match(pat, plen, field, flen)) continue;
+      miniredis_write_bulk(buf, field, flen);
+      if (withvals) miniredis_write_bulk(buf, val, vlen);
+      (*n)++;
+    }
+    return 0;
+  }
+  struct dict_entry* entry;
+  for (size_t visited = 0; visited < count;) {
+    if (!dict_iter(pair_obj(pair), &cursor, &entry)) {
+      return 0;
+    }
+    visited++;
+    if (pat && !match(pat, plen, entry->key, entry->keylen)) continue;
+    miniredis_write_bulk(buf, entry->key, entry->keylen);
+    if (withvals) {
+      miniredis_write_bulk(buf, dict_entry_val(entry), entry->vallen);
+    }
+    (*n)++;
+  }
+  return cursor;
+}
+
+// HSET key field value [field value ...]
+void cmdHSET(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4 || nargs % 2 != 0) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_or_create(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  size_t mem = pair_memory(pair);
+  int added = 0;
+  for (int i = 2; i < nargs; i += 2) {
+    size_t flen, vlen;
+    const char* field = miniredis_args_at(args, i, &flen);
+    const char* val = miniredis_args_at(args, i + 1, &vlen);
+    int res = hash_set(server, pair, field, flen, val, vlen);
+    if (res == -1) {
+      db_modified(server, pair, mem);
+      if (hash_len(pair) == 0) {
+        db_remove(server, pair);
+      }
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+    added += res;
+  }
+  db_modified(server, pair, mem);
+  miniredis_conn_write_int(conn, added);
+}
+
+// HGET key field
+void cmdHGET(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  size_t flen, vlen = 0;
+  const char* field = miniredis_args_at(args, 2, &flen);
+  const char* val = pair ? hash_get(pair, field, flen, &vlen) : NULL;
+  miniredis_conn_write_bulk(conn, val, vlen);
+}
+
+// HMGET key field [field ...]
+void cmdHMGET(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  miniredis_conn_write_array(conn, nargs - 2);
+  for (int i = 2; i < nargs; i++) {
+    size_t flen, vlen = 0;
+    const char* field = miniredis_args_at(args, i, &flen);
+    const char* val = pair ? hash_get(pair, field, flen, &vlen) : NULL;
+    miniredis_conn_write_bulk(conn, val, vlen);
+  }
+}
+
+// HDEL key field [field ...]
+void cmdHDEL(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  int deleted = 0;
+  if (pair) {
+    size_t mem = pair_memory(pair);
+    for (int i = 2; i < nargs; i++) {
+      size_t flen;
+      const char* field = miniredis_args_at(args, i, &flen);
+      deleted += hash_del(pair, field, flen);
+    }
+    // removing nothing leaves the key as it was, for WATCH and tracking too
+    if (deleted > 0) {
+      db_modified(server, pair, mem);
+    }
+    if (hash_len(pair) == 0) {
+      db_remove(server, pair);
+    }
+  }
+  miniredis_conn_write_int(conn, deleted);
+}
+
+// HLEN key
+void cmdHLEN(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    miniredis_conn_write_int(conn, pair ? hash_len(pair) : 0);
+  }
+}
+
+// HEXISTS key field
+void cmdHEXISTS(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    size_t flen, vlen;
+    const char* field = miniredis_args_at(args, 2, &flen);
+    miniredis_conn_write_int(conn,
+                             pair && hash_get(pair, field, flen, &vlen));
+  }
+}
+
+// HINCRBY key field increment
+void cmdHINCRBY(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int64_t incr, x = 0;
+  if (!argtoint(args, 3, &incr)) {
+    miniredis_conn_write_error(conn,
+                               "ERR value is not an integer or out of range");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_or_create(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  size_t flen, vlen;
+  const char* field = miniredis_args_at(args, 2, &flen);
+  const char* val = hash_get(pair, field, flen, &vlen);
+  if (val && !parse_int(val, vlen, &x)) {
+    miniredis_conn_write_error(conn, "ERR hash value is not an integer");
+    return;
+  }
+  if ((incr < 0 && x < INT64_MIN - incr) ||
+      (incr > 0 && x > INT64_MAX - incr)) {
+    miniredis_conn_write_error(conn,
+                               "ERR increment or decrement would overflow");
+    return;
+  }
+  x += incr;
+  char str[32];
+  snprintf(str, sizeof(str), "%" PRId64, x);
+  size_t mem = pair_memory(pair);
+  int res = hash_set(server, pair, field, flen, str, strlen(str));
+  db_modified(server, pair, mem);
+  if (res == -1) {
+    if (hash_len(pair) == 0) {
+      db_remove(server, pair);
+    }
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  miniredis_conn_write_int(conn, x);
+}
+
+// HGETALL key
+void cmdHGETALL(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  struct buf buf = {0};
+  int n = 0;
+  if (pair) {
+    hash_write(pair, &buf, &n, 0, SIZE_MAX, NULL, 0, true);
+  }
+  miniredis_conn_write_map(conn, n);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
+
+// HSCAN key cursor [MATCH pattern] [COUNT count]
+void cmdHSCAN(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int64_t cursor, count = 10;
+  if (!argtoint(args, 2, &cursor) || cursor < 0) {
+    miniredis_conn_write_error(conn, "ERR invalid cursor");
+    return;
+  }
+  const char* pat = NULL;
+  size_t plen = 0;
+  for (int i = 3; i < nargs; i += 2) {
+    if (i + 1 < nargs && miniredis_args_eq(args, i, "match")) {
+      pat = miniredis_args_at(args, i + 1, &plen);
+    } else if (i + 1 < nargs && miniredis_args_eq(args, i, "count")) {
+      if (!argtoint(args, i + 1, &count) || count < 1) {
+        miniredis_conn_write_error(conn, "ERR syntax error");
+        return;
+      }
+    } else {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_HASH, &pair)) {
+    return;
+  }
+  struct buf buf = {0};
+  int n = 0;
+  size_t next = 0;
+  if (pair) {
+    next = hash_write(pair, &buf, &n, cursor, count, pat, plen, true);
+  }
+  char str[32];
+  snprintf(str, sizeof(str), "%zu", next);
+  miniredis_conn_write_array(conn, 2);
+  miniredis_conn_write_bulk(conn, str, -1);
+  miniredis_conn_write_array(conn, n * 2);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "miniredis.h"
+
+// Hashes are a listpack of field and value pairs until they outgrow the
+// listpack limits, and a dict from then on.
+
+struct pair;
+struct server;
+
+int hash_set(struct server* server, struct pair* pair, const char* field,
+             size_t flen, const char* val, size_t vlen);
+void cmdHSET(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdHGET(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdHMGET(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdHDEL(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdHLEN(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdHEXISTS(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdHINCRBY(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdHGETALL(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdHSCAN(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
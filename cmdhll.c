@@ -0,0 +1,168 @@
+#include "cmdhll.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hyperloglog.h"
+#include "server.h"
+
+#define HLL_WRONGTYPE_ERR \
+  "WRONGTYPE Key is not a valid HyperLogLog string value."
+
+// lookup_hll is lookup_key for keys that must hold a HyperLogLog.
+static bool lookup_hll(struct miniredis_conn* conn, struct server* server,
+                       struct miniredis_args* args, int index,
+                       struct pair** ppair) {
+  if (!lookup_key(conn, server, args, index, TYPE_STRING, ppair)) {
+    return false;
+  }
+  if (*ppair && !hll_valid((const unsigned char*)pair_val(*ppair),
+                           (*ppair)->vallen)) {
+    miniredis_conn_write_error(conn, HLL_WRONGTYPE_ERR);
+    return false;
+  }
+  return true;
+}
+
+// string_replace sets the value of the string key, keeping the expire of
+// its pair if any. Returns false when out of memory.
+static bool string_replace(struct server* server, struct pair* pair,
+                           const char* key, size_t keylen, const void* val,
+                           size_t len) {
+  double expires = pair ? pair_expire(pair) : 0;
+  struct pair* npair =
+      pair_new(key, keylen, val, len, expires, server->cluster != NULL);
+  return npair && db_set(server, npair);
+}
+
+// PFADD key [element ...]
+void cmdPFADD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_hll(conn, server, args, 1, &pair)) {
+    return;
+  }
+  // dense HyperLogLogs are updated in place, sparse ones are copied as they
+  // change size
+  unsigned char* hll = pair ? (unsigned char*)pair_val(pair) : NULL;
+  size_t len = pair ? pair->vallen : 0;
+  bool inplace = pair && hll_is_dense(hll);
+  if (!pair) {
+    hll = hll_new(&len);
+  } else if (!inplace) {
+    hll = malloc(len);
+    if (hll) memcpy(hll, pair_val(pair), len);
+  }
+  if (!hll) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  int changed = !pair;
+  for (int i = 2; i < nargs; i++) {
+    size_t elen;
+    const char* elem = miniredis_args_at(args, i, &elen);
+    int res = hll_add(&hll, &len, elem, elen, server->hll_sparse_max_bytes);
+    if (res == -1) {
+      changed = -1;
+      break;
+    }
+    changed |= res;
+  }
+  if (!inplace) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, 1, &keylen);
+    if (changed == 1 &&
+        !string_replace(server, pair, key, keylen, hll, len)) {
+      changed = -1;
+    }
+    free(hll);
+  } else if (changed == 1) {
+    db_modified(server, pair, pair_memory(pair));
+  }
+  if (changed == -1) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  miniredis_conn_write_int(conn, changed);
+}
+
+// PFCOUNT key [key ...]
+void cmdPFCOUNT(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (nargs == 2) {
+    // a single key refreshes its cached cardinality, which is part of the
+    // value as GET sees it
+    if (!lookup_hll(conn, server, args, 1, &pair)) {
+      return;
+    }
+    if (!pair) {
+      miniredis_conn_write_int(conn, 0);
+      return;
+    }
+    unsigned char* hll = (unsigned char*)pair_val(pair);
+    unsigned char hdr[HLL_HDR];
+    memcpy(hdr, hll, HLL_HDR);
+    uint64_t card = hll_count(hll, pair->vallen);
+    if (memcmp(hdr, hll, HLL_HDR) != 0) {
+      db_modified(server, pair, pair_memory(pair));
+    }
+    miniredis_conn_write_int(conn, card);
+    return;
+  }
+  uint8_t regs[HLL_REGISTERS] = {0};
+  for (int i = 1; i < nargs; i++) {
+    if (!lookup_hll(conn, server, args, i, &pair)) {
+      return;
+    }
+    if (pair) {
+      hll_max((const unsigned char*)pair_val(pair), pair->vallen, regs);
+    }
+  }
+  miniredis_conn_write_int(conn, hll_count_registers(regs));
+}
+
+// PFMERGE destkey [sourcekey ...]
+void cmdPFMERGE(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  uint8_t regs[HLL_REGISTERS] = {0};
+  struct pair* dst = NULL;
+  for (int i = 1; i < nargs; i++) {
+    struct pair* pair;
+    if (!lookup_hll(conn, server, args, i, &pair)) {
+      return;
+    }
+    if (i == 1) dst = pair;
+    if (pair) {
+      hll_max((const unsigned char*)pair_val(pair), pair->vallen, regs);
+    }
+  }
+  size_t len, keylen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  unsigned char* hll = hll_from_registers(regs, &len);
+  if (!hll || !string_replace(server, dst, key, keylen, hll, len)) {
+    free(hll);
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  free(hll);
+  miniredis_conn_write_string(conn, "OK");
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "miniredis.h"
+
+// HyperLogLogs are strings holding the sparse or dense encoding of
+// hyperloglog.c, which PFADD, PFCOUNT and PFMERGE check before using.
+
+void cmdPFADD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdPFCOUNT(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdPFMERGE(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
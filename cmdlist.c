@@ -0,0 +1,336 @@
+#include "cmdlist.h"
+
+#include <string.h>
+
+#include "blocking.h"
+#include "quicklist.h"
+#include "server.h"
+
+// list_push adds the elements at args[2:] to the head or the tail of the list
+// at args[1], creating it if needed.
+static void list_push(struct miniredis_conn* conn, struct miniredis_args* args,
+                      struct server* server, bool head) {
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_or_create(conn, server, args, 1, TYPE_LIST, &pair)) {
+    return;
+  }
+  struct quicklist* ql = pair_obj(pair);
+  size_t mem = pair_memory(pair);
+  for (int i = 2; i < nargs; i++) {
+    size_t len;
+    const char* elem = miniredis_args_at(args, i, &len);
+    if (!ql_push(ql, elem, len, head)) {
+      db_modified(server, pair, mem);
+      if (ql->count == 0) {
+        db_remove(server, pair);
+      }
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+  }
+  db_modified(server, pair, mem);
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  signal_ready(server, key, keylen);
+  miniredis_conn_write_int(conn, ql->count);
+}
+
+// LPUSH key element [element ...]
+void cmdLPUSH(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  list_push(conn, args, udata, true);
+}
+
+// RPUSH key element [element ...]
+void cmdRPUSH(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  list_push(conn, args, udata, false);
+}
+
+// list_pop removes elements from the head or the tail of the list at args[1]
+// and writes them. Without a count argument a single element is written as a
+// bulk string.
+static void list_pop(struct miniredis_conn* conn, struct miniredis_args* args,
+                     struct server* server, bool head) {
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2 || nargs > 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int64_t count = 1;
+  if (nargs == 3 && (!argtoint(args, 2, &count) || count < 0)) {
+    miniredis_conn_write_error(
+        conn, "ERR value is out of range, must be positive");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_LIST, &pair)) {
+    return;
+  }
+  if (!pair) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  struct quicklist* ql = pair_obj(pair);
+  if ((size_t)count > ql->count) {
+    count = ql->count;
+  }
+  if (nargs == 3) {
+    miniredis_conn_write_array(conn, count);
+  }
+  struct ql_iter it;
+  bool ok = ql_index(ql, head ? 0 : -1, &it);
+  for (int64_t i = 0; ok && i < count; i++) {
+    size_t len;
+    const char* elem = ql_get(&it, &len);
+    miniredis_conn_write_bulk(conn, elem, len);
+    ok = head ? ql_next(&it) : ql_prev(&it);
+  }
+  size_t mem = pair_memory(pair);
+  ql_delete_range(ql, head ? 0 : -count, count);
+  db_modified(server, pair, mem);
+  if (ql->count == 0) {
+    db_remove(server, pair);
+  }
+}
+
+// LPOP key [count]
+void cmdLPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  list_pop(conn, args, udata, true);
+}
+
+// RPOP key [count]
+void cmdRPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  list_pop(conn, args, udata, false);
+}
+
+// LLEN key
+void cmdLLEN(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (lookup_key(conn, server, args, 1, TYPE_LIST, &pair)) {
+    miniredis_conn_write_int(
+        conn, pair ? ((struct quicklist*)pair_obj(pair))->count : 0);
+  }
+}
+
+// LINDEX key index
+void cmdLINDEX(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int64_t index;
+  if (!argtoint(args, 2, &index)) {
+    miniredis_conn_write_error(conn,
+                               "ERR value is not an integer or out of range");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_LIST, &pair)) {
+    return;
+  }
+  struct ql_iter it;
+  if (!pair || !ql_index(pair_obj(pair), index, &it)) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  size_t len;
+  const char* elem = ql_get(&it, &len);
+  miniredis_conn_write_bulk(conn, elem, len);
+}
+
+// list_range parses the start and stop arguments of LRANGE and LTRIM into
+// an inclusive range of the list. Returns false if the range is empty.
+static bool list_range(struct miniredis_conn* conn, struct miniredis_args* args,
+                       size_t count, int64_t* start, int64_t* stop, bool* err) {
+  *err = false;
+  if (!argtoint(args, 2, start) || !argtoint(args, 3, stop)) {
+    miniredis_conn_write_error(conn,
+                               "ERR value is not an integer or out of range");
+    *err = true;
+    return false;
+  }
+  if (*start < 0) *start += count;
+  if (*stop < 0) *stop += count;
+  if (*start < 0) *start = 0;
+  if (*stop >= (int64_t)count) *stop = count - 1;
+  return *start <= *stop;
+}
+
+// LRANGE key start stop
+void cmdLRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_LIST, &pair)) {
+    return;
+  }
+  struct quicklist* ql = pair ? pair_obj(pair) : NULL;
+  int64_t start, stop;
+  bool err;
+  if (!list_range(conn, args, ql ? ql->count : 0, &start, &stop, &err)) {
+    if (!err) {
+      miniredis_conn_write_array(conn, 0);
+    }
+    return;
+  }
+  miniredis_conn_write_array(conn, stop - start + 1);
+  struct ql_iter it;
+  bool ok = ql_index(ql, start, &it);
+  for (int64_t i = start; ok && i <= stop; i++) {
+    size_t len;
+    const char* elem = ql_get(&it, &len);
+    miniredis_conn_write_bulk(conn, elem, len);
+    ok = ql_next(&it);
+  }
+}
+
+// LTRIM key start stop
+void cmdLTRIM(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_LIST, &pair)) {
+    return;
+  }
+  struct quicklist* ql = pair ? pair_obj(pair) : NULL;
+  int64_t start, stop;
+  bool err;
+  bool nonempty =
+      list_range(conn, args, ql ? ql->count : 0, &start, &stop, &err);
+  if (err) {
+    return;
+  }
+  if (ql) {
+    size_t mem = pair_memory(pair);
+    if (nonempty) {
+      ql_delete_range(ql, stop + 1, ql->count - stop - 1);
+      ql_delete_range(ql, 0, start);
+    } else {
+      ql_delete_range(ql, 0, ql->count);
+    }
+    db_modified(server, pair, mem);
+    if (ql->count == 0) {
+      db_remove(server, pair);
+    }
+  }
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// parse_where parses a LEFT or RIGHT argument.
+bool parse_where(struct miniredis_conn* conn, struct miniredis_args* args,
+                 int index, bool* head) {
+  if (miniredis_args_eq(args, index, "left")) {
+    *head = true;
+  } else if (miniredis_args_eq(args, index, "right")) {
+    *head = false;
+  } else {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return false;
+  }
+  return true;
+}
+
+// list_move pops an element from the head or the tail of the list src and
+// pushes it to the list at dst, creating it if needed, and writes the element.
+// The caller checks that dst is not of another type.
+void list_move(struct miniredis_conn* conn, struct server* server,
+               struct pair* src, const char* dst, size_t dstlen, bool srchead,
+               bool dsthead) {
+  struct quicklist* ql = pair_obj(src);
+  struct ql_iter it;
+  ql_index(ql, srchead ? 0 : -1, &it);
+  size_t len;
+  const char* elem = ql_get(&it, &len);
+  struct buf buf = {0};
+  if (!buf_append(&buf, elem, len)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  size_t mem = pair_memory(src);
+  ql_delete_range(ql, srchead ? 0 : -1, 1);
+  db_modified(server, src, mem);
+  if (ql->count == 0) {
+    db_remove(server, src);
+  }
+  struct pair* pair = db_get(server, dst, dstlen);
+  if (!pair) {
+    pair = db_create(server, dst, dstlen, TYPE_LIST);
+  }
+  if (pair) {
+    ql = pair_obj(pair);
+    mem = pair_memory(pair);
+    bool ok = ql_push(ql, buf.data, buf.len, dsthead);
+    db_modified(server, pair, mem);
+    if (ql->count == 0) {
+      db_remove(server, pair);
+    }
+    if (!ok) {
+      pair = NULL;
+    }
+  }
+  if (!pair) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  } else {
+    signal_ready(server, dst, dstlen);
+    miniredis_conn_write_bulk(conn, buf.data, buf.len);
+  }
+  buf_clear(&buf);
+}
+
+// LMOVE source destination LEFT|RIGHT LEFT|RIGHT
+void cmdLMOVE(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 5) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool srchead, dsthead;
+  if (!parse_where(conn, args, 3, &srchead) ||
+      !parse_where(conn, args, 4, &dsthead)) {
+    return;
+  }
+  struct pair* src;
+  struct pair* dst;
+  if (!lookup_key(conn, server, args, 1, TYPE_LIST, &src) ||
+      !lookup_key(conn, server, args, 2, TYPE_LIST, &dst)) {
+    return;
+  }
+  if (!src) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  size_t dstlen;
+  const char* dstkey = miniredis_args_at(args, 2, &dstlen);
+  list_move(conn, server, src, dstkey, dstlen, srchead, dsthead);
+}
+
+// Blocking pops. A client whose keys are all empty is parked on the waitq of
+// each key, and its connection stops executing commands. Pushes mark keys
+// with waiters as ready, and once the pushing command is done the ready keys
+// are handed to their waiters in arrival order. Deadlines are checked by the
+// tick callback.
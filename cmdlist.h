@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "miniredis.h"
+
+// Lists are a quicklist, a doubly linked list of listpack nodes.
+
+struct pair;
+struct server;
+
+bool parse_where(struct miniredis_conn* conn, struct miniredis_args* args,
+                 int index, bool* head);
+void list_move(struct miniredis_conn* conn, struct server* server,
+               struct pair* src, const char* dst, size_t dstlen, bool srchead,
+               bool dsthead);
+void cmdLPUSH(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdRPUSH(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdLPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdRPOP(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdLLEN(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdLINDEX(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdLRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdLTRIM(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdLMOVE(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
@@ -0,0 +1,191 @@
+#include "cmdmulti.h"
+
+#include <stdlib.h>
+
+#include "server.h"
+
+// multi_queue queues a command of a client in MULTI until EXEC.
+void multi_queue(struct miniredis_conn* conn, struct client* client,
+                 struct command* cmd, struct miniredis_args* args) {
+  if (client->nqueued == client->queuecap) {
+    int cap = client->queuecap ? client->queuecap * 2 : 8;
+    struct txcmd* queue = realloc(client->queue, cap * sizeof(*queue));
+    if (!queue) {
+      client->multi_dirty = true;
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+    client->queue = queue;
+    client->queuecap = cap;
+  }
+  struct miniredis_args* copy = miniredis_args_copy(args);
+  if (!copy) {
+    client->multi_dirty = true;
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  client->queue[client->nqueued++] = (struct txcmd){cmd, copy};
+  miniredis_conn_write_string(conn, "QUEUED");
+}
+
+// multi_discard drops the queued commands and leaves MULTI.
+void multi_discard(struct client* client) {
+  for (int i = 0; i < client->nqueued; i++) {
+    free(client->queue[i].args);
+  }
+  free(client->queue);
+  client->queue = NULL;
+  client->nqueued = 0;
+  client->queuecap = 0;
+  client->multi = false;
+  client->multi_dirty = false;
+}
+
+void unwatch(struct server* server, struct client* client) {
+  if (client->watched) {
+    server->watching--;
+  }
+  free(client->watched);
+  client->watched = NULL;
+  client->nwatched = 0;
+  client->watch_expire = 0;
+}
+
+// watch_valid returns false if a key watched by the client was changed, or
+// may have expired, since it was watched.
+static bool watch_valid(struct server* server, struct client* client) {
+  if (client->watch_expire && client->watch_expire <= server->now) {
+    return false;
+  }
+  for (int i = 0; i < client->nwatched; i++) {
+    struct watch* w = &client->watched[i];
+    if (server->versions[w->bucket] != w->version) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// MULTI
+void cmdMULTI(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  (void)udata;
+  struct client* client = miniredis_conn_udata(conn);
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (client->multi) {
+    miniredis_conn_write_error(conn, "ERR MULTI calls can not be nested");
+    return;
+  }
+  client->multi = true;
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// EXEC
+void cmdEXEC(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!client->multi) {
+    miniredis_conn_write_error(conn, "ERR EXEC without MULTI");
+    return;
+  }
+  if (client->multi_dirty) {
+    miniredis_conn_write_error(
+        conn, "EXECABORT Transaction discarded because of previous errors.");
+  } else if (!watch_valid(server, client)) {
+    miniredis_conn_write_array(conn, -1);
+  } else {
+    // each command writes exactly one reply, straight into the array
+    client->exec = true;
+    miniredis_conn_write_array(conn, client->nqueued);
+    for (int i = 0; i < client->nqueued; i++) {
+      struct txcmd* tx = &client->queue[i];
+      command_run(server, conn, client, tx->cmd, tx->args);
+    }
+    client->exec = false;
+  }
+  multi_discard(client);
+  unwatch(server, client);
+}
+
+// DISCARD
+void cmdDISCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!client->multi) {
+    miniredis_conn_write_error(conn, "ERR DISCARD without MULTI");
+    return;
+  }
+  multi_discard(client);
+  unwatch(server, client);
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// WATCH key [key ...]
+void cmdWATCH(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  struct client* client = miniredis_conn_udata(conn);
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (client->multi) {
+    miniredis_conn_write_error(conn, "ERR WATCH inside MULTI is not allowed");
+    return;
+  }
+  if (!server->versions) {
+    server->versions = calloc(WATCH_BUCKETS, sizeof(uint64_t));
+  }
+  struct watch* watched = server->versions
+                              ? realloc(client->watched,
+                                        (client->nwatched + nargs - 1) *
+                                            sizeof(struct watch))
+                              : NULL;
+  if (!watched) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  if (!client->watched) {
+    server->watching++;
+  }
+  client->watched = watched;
+  for (int i = 1; i < nargs; i++) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, i, &keylen);
+    uint32_t bucket = watch_bucket(key, keylen);
+    watched[client->nwatched++] =
+        (struct watch){bucket, server->versions[bucket]};
+    // expiring is not a write, the deadline is checked instead
+    struct pair* pair = db_get(server, key, keylen);
+    if (pair && pair->hasex &&
+        (!client->watch_expire || pair_expire(pair) < client->watch_expire)) {
+      client->watch_expire = pair_expire(pair);
+    }
+  }
+  miniredis_conn_write_string(conn, "OK");
+}
+
+// UNWATCH
+void cmdUNWATCH(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  if (miniredis_args_count(args) != 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  unwatch(udata, miniredis_conn_udata(conn));
+  miniredis_conn_write_string(conn, "OK");
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "miniredis.h"
+
+// Transactions queue the commands of a client between MULTI and EXEC, which
+// runs them one after the other, unless a command failed to queue or a key
+// watched by WATCH was written since. Writes bump the version of the bucket
+// of their key, which WATCH records and EXEC compares.
+
+struct client;
+struct command;
+struct server;
+
+void multi_queue(struct miniredis_conn* conn, struct client* client,
+                 struct command* cmd, struct miniredis_args* args);
+void multi_discard(struct client* client);
+void unwatch(struct server* server, struct client* client);
+void cmdMULTI(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdEXEC(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdDISCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdWATCH(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdUNWATCH(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
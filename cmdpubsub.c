@@ -0,0 +1,195 @@
+#include "cmdpubsub.h"
+
+#include "dict.h"
+#include "pubsub.h"
+#include "server.h"
+
+static void write_subscription(struct miniredis_conn* conn, const char* kind,
+                               const char* name, size_t len, size_t count) {
+  miniredis_conn_write_push(conn, 3);
+  miniredis_conn_write_bulk(conn, kind, -1);
+  miniredis_conn_write_bulk(conn, name, len);
+  miniredis_conn_write_uint(conn, count);
+}
+
+// unsubscribe_all drops all the channel or pattern subscriptions of the
+// client, replying for each one when conn is set.
+void unsubscribe_all(struct server* server, struct client* client,
+                     bool pattern, struct miniredis_conn* conn) {
+  struct dict** subs = pattern ? &client->patterns : &client->channels;
+  if (!*subs) {
+    return;
+  }
+  size_t count = client_subscriptions(client);
+  struct dict_entry* entry;
+  size_t i = 0;
+  while (dict_iter(*subs, &i, &entry)) {
+    pubsub_remove(server->pubsub, pattern, entry->key, entry->keylen, client);
+    if (conn) {
+      write_subscription(conn, pattern ? "punsubscribe" : "unsubscribe",
+                         entry->key, entry->keylen, --count);
+    }
+  }
+  dict_free(*subs);
+  *subs = NULL;
+}
+
+static void subscribe(struct miniredis_conn* conn, struct miniredis_args* args,
+                      struct server* server, bool pattern) {
+  struct client* client = miniredis_conn_udata(conn);
+  int argc = miniredis_args_count(args);
+  if (argc < 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct dict** subs = pattern ? &client->patterns : &client->channels;
+  if (!*subs && !(*subs = dict_new())) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  for (int i = 1; i < argc; i++) {
+    size_t len;
+    const char* name = miniredis_args_at(args, i, &len);
+    if (!dict_get(*subs, name, len) &&
+        (dict_set(*subs, name, len, "", 0) == -1 ||
+         pubsub_add(server->pubsub, pattern, name, len, client) == -1)) {
+      dict_delete(*subs, name, len);
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      break;
+    }
+    write_subscription(conn, pattern ? "psubscribe" : "subscribe", name, len,
+                       client_subscriptions(client));
+  }
+  client_update_class(server, client);
+}
+
+static void unsubscribe(struct miniredis_conn* conn,
+                        struct miniredis_args* args, struct server* server,
+                        bool pattern) {
+  struct client* client = miniredis_conn_udata(conn);
+  struct dict* subs = pattern ? client->patterns : client->channels;
+  const char* kind = pattern ? "punsubscribe" : "unsubscribe";
+  int argc = miniredis_args_count(args);
+  if (argc == 1) {
+    if (!subs || dict_count(subs) == 0) {
+      write_subscription(conn, kind, NULL, 0, client_subscriptions(client));
+    }
+    unsubscribe_all(server, client, pattern, conn);
+  }
+  for (int i = 1; i < argc; i++) {
+    size_t len;
+    const char* name = miniredis_args_at(args, i, &len);
+    if (subs && dict_delete(subs, name, len)) {
+      pubsub_remove(server->pubsub, pattern, name, len, client);
+    }
+    write_subscription(conn, kind, name, len, client_subscriptions(client));
+  }
+  client_update_class(server, client);
+}
+
+// SUBSCRIBE channel [channel ...]
+void cmdSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                  void* udata) {
+  subscribe(conn, args, udata, false);
+}
+
+// PSUBSCRIBE pattern [pattern ...]
+void cmdPSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                   void* udata) {
+  subscribe(conn, args, udata, true);
+}
+
+// UNSUBSCRIBE [channel ...]
+void cmdUNSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                    void* udata) {
+  unsubscribe(conn, args, udata, false);
+}
+
+// PUNSUBSCRIBE [pattern ...]
+void cmdPUNSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                     void* udata) {
+  unsubscribe(conn, args, udata, true);
+}
+
+// publish is a message being published, serialized once for each channel or
+// pattern it is delivered through.
+struct publish {
+  const char* channel;
+  size_t chlen;
+  const char* msg;
+  size_t msglen;
+  struct buf buf;
+  int64_t receivers;
+};
+
+// publish_deliver queues the serialized message to all the subscribers. They
+// share a single copy of it, unless it's too small to be worth sharing, in
+// which case each gets its own. The message is serialized as a RESP2 array,
+// and RESP3 subscribers get a copy with the push type in its place.
+static void publish_deliver(struct publish* pub, struct pubsub_subs* subs) {
+  struct chunk_shared* shared[2] = {NULL, NULL};
+  size_t i = 0;
+  void* sub;
+  while (pubsub_subs_next(subs, &i, &sub)) {
+    struct client* client = sub;
+    int resp3 = miniredis_conn_proto(client->conn) == 3;
+    if (!shared[resp3] && pub->buf.len >= CHUNK_MINSHARED) {
+      shared[resp3] = chunk_shared_new(pub->buf.data, pub->buf.len);
+      if (shared[resp3] && resp3) {
+        shared[resp3]->data[0] = '>';
+      }
+    }
+    if (shared[resp3]) {
+      miniredis_conn_write_shared(client->conn, shared[resp3]);
+    } else {
+      miniredis_conn_write_raw(client->conn, resp3 ? ">" : "*", 1);
+      miniredis_conn_write_raw(client->conn, pub->buf.data + 1,
+                               pub->buf.len - 1);
+    }
+    pub->receivers++;
+  }
+  for (int j = 0; j < 2; j++) {
+    if (shared[j]) {
+      chunk_shared_release(shared[j]);
+    }
+  }
+  pub->buf.len = 0;
+}
+
+static void publish_pattern(struct pubsub_subs* subs, void* udata) {
+  struct publish* pub = udata;
+  miniredis_write_array(&pub->buf, 4);
+  miniredis_write_bulk(&pub->buf, "pmessage", -1);
+  miniredis_write_bulk(&pub->buf, subs->name, subs->len);
+  miniredis_write_bulk(&pub->buf, pub->channel, pub->chlen);
+  miniredis_write_bulk(&pub->buf, pub->msg, pub->msglen);
+  publish_deliver(pub, subs);
+}
+
+// PUBLISH channel message
+void cmdPUBLISH(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct publish pub = {0};
+  pub.channel = miniredis_args_at(args, 1, &pub.chlen);
+  pub.msg = miniredis_args_at(args, 2, &pub.msglen);
+  struct pubsub_subs* subs =
+      pubsub_get(server->pubsub, false, pub.channel, pub.chlen);
+  if (subs) {
+    miniredis_write_array(&pub.buf, 3);
+    miniredis_write_bulk(&pub.buf, "message", -1);
+    miniredis_write_bulk(&pub.buf, pub.channel, pub.chlen);
+    miniredis_write_bulk(&pub.buf, pub.msg, pub.msglen);
+    publish_deliver(&pub, subs);
+  }
+  if (pubsub_count(server->pubsub, true) > 0) {
+    pubsub_match(server->pubsub, pub.channel, pub.chlen, publish_pattern,
+                 &pub);
+  }
+  buf_clear(&pub.buf);
+  miniredis_conn_write_int(conn, pub.receivers);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "miniredis.h"
+
+// Pub/sub commands, over the channels and patterns of pubsub.c. Subscribed
+// clients are moved to the pubsub client class, with its output limits.
+
+struct client;
+struct server;
+
+void unsubscribe_all(struct server* server, struct client* client, bool pattern,
+                     struct miniredis_conn* conn);
+void cmdSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                  void* udata);
+void cmdPSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                   void* udata);
+void cmdUNSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                    void* udata);
+void cmdPUNSUBSCRIBE(struct miniredis_conn* conn, struct miniredis_args* args,
+                     void* udata);
+void cmdPUBLISH(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
@@ -0,0 +1,506 @@
+#include "cmdset.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "dict.h"
+#include "intset.h"
+#include "server.h"
+
+// set_int reports whether the member is an integer in canonical form, which
+// an intset stores and writes back unchanged.
+static bool set_int(const char* member, size_t len, int64_t* x) {
+  char str[32];
+  return parse_int(member, len, x) &&
+         (size_t)snprintf(str, sizeof(str), "%" PRId64, *x) == len &&
+         memcmp(str, member, len) == 0;
+}
+
+static size_t set_len(struct pair* pair) {
+  if (pair->enc == ENC_COMPACT) {
+    return ((struct intset*)pair_obj(pair))->len;
+  }
+  return dict_count(pair_obj(pair));
+}
+
+static bool set_has(struct pair* pair, const char* member, size_t len) {
+  if (pair->enc == ENC_COMPACT) {
+    int64_t x;
+    return set_int(member, len, &x) && is_find(pair_obj(pair), x);
+  }
+  return dict_get(pair_obj(pair), member, len) != NULL;
+}
+
+// set_next returns the member at the cursor, and advances it. Integers of an
+// intset are formatted into str. Returns false once done.
+bool set_next(struct pair* pair, size_t* i, const char** member, size_t* len,
+              char str[32]) {
+  if (pair->enc == ENC_COMPACT) {
+    struct intset* is = pair_obj(pair);
+    if (*i >= is->len) {
+      return false;
+    }
+    *len = snprintf(str, 32, "%" PRId64, is_get(is, (*i)++));
+    *member = str;
+    return true;
+  }
+  struct dict_entry* entry;
+  if (!dict_iter(pair_obj(pair), i, &entry)) {
+    return false;
+  }
+  *member = entry->key;
+  *len = entry->keylen;
+  return true;
+}
+
+// set_convert converts an intset encoded set to a dict.
+static bool set_convert(struct pair* pair) {
+  struct intset* is = pair_obj(pair);
+  struct dict* dict = dict_new();
+  if (!dict) {
+    return false;
+  }
+  for (uint32_t i = 0; i < is->len; i++) {
+    char str[32];
+    int len = snprintf(str, sizeof(str), "%" PRId64, is_get(is, i));
+    if (dict_set(dict, str, len, "", 0) == -1) {
+      dict_free(dict);
+      return false;
+    }
+  }
+  is_free(is);
+  pair_set_obj(pair, dict);
+  pair->enc = ENC_FULL;
+  return true;
+}
+
+// set_add adds the member, first converting the set to a dict if the member
+// is not an integer or the intset would outgrow its limit. Returns 1 if the
+// member was added, 0 if it already exists, or -1 when out of memory.
+int set_add(struct server* server, struct pair* pair, const char* member,
+            size_t len) {
+  if (pair->enc == ENC_COMPACT) {
+    struct intset* is = pair_obj(pair);
+    int64_t x;
+    if (!set_int(member, len, &x)) {
+      if (!set_convert(pair)) {
+        return -1;
+      }
+    } else if (!is_find(is, x) &&
+               (int64_t)is->len >= server->set_max_intset_entries) {
+      if (!set_convert(pair)) {
+        return -1;
+      }
+    } else {
+      bool added;
+      is = is_add(is, x, &added);
+      if (!is) {
+        return -1;
+      }
+      pair_set_obj(pair, is);
+      return added;
+    }
+  }
+  return dict_set(pair_obj(pair), member, len, "", 0);
+}
+
+// set_remove removes the member. Returns false if it does not exist.
+static bool set_remove(struct pair* pair, const char* member, size_t len) {
+  if (pair->enc == ENC_COMPACT) {
+    int64_t x;
+    bool removed = false;
+    if (set_int(member, len, &x)) {
+      pair_set_obj(pair, is_remove(pair_obj(pair), x, &removed));
+    }
+    return removed;
+  }
+  return dict_delete(pair_obj(pair), member, len);
+}
+
+// intset_write writes the integers of the intset as bulk strings.
+static void intset_write(struct intset* is, struct buf* buf) {
+  for (uint32_t i = 0; i < is->len; i++) {
+    char str[32];
+    int len = snprintf(str, sizeof(str), "%" PRId64, is_get(is, i));
+    miniredis_write_bulk(buf, str, len);
+  }
+}
+
+// SADD key member [member ...]
+void cmdSADD(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_or_create(conn, server, args, 1, TYPE_SET, &pair)) {
+    return;
+  }
+  size_t mem = pair_memory(pair);
+  int added = 0;
+  for (int i = 2; i < nargs; i++) {
+    size_t len;
+    const char* member = miniredis_args_at(args, i, &len);
+    int res = set_add(server, pair, member, len);
+    if (res == -1) {
+      db_modified(server, pair, mem);
+      if (set_len(pair) == 0) {
+        db_remove(server, pair);
+      }
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+    added += res;
+  }
+  if (added > 0) {
+    db_modified(server, pair, mem);
+  }
+  miniredis_conn_write_int(conn, added);
+}
+
+// SREM key member [member ...]
+void cmdSREM(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_SET, &pair)) {
+    return;
+  }
+  int removed = 0;
+  if (pair) {
+    size_t mem = pair_memory(pair);
+    for (int i = 2; i < nargs; i++) {
+      size_t len;
+      const char* member = miniredis_args_at(args, i, &len);
+      removed += set_remove(pair, member, len);
+    }
+    // removing nothing leaves the key as it was, for WATCH and tracking too
+    if (removed > 0) {
+      db_modified(server, pair, mem);
+    }
+    if (set_len(pair) == 0) {
+      db_remove(server, pair);
+    }
+  }
+  miniredis_conn_write_int(conn, removed);
+}
+
+// SISMEMBER key member
+void cmdSISMEMBER(struct miniredis_conn* conn, struct miniredis_args* args,
+                  void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_SET, &pair)) {
+    return;
+  }
+  size_t len;
+  const char* member = miniredis_args_at(args, 2, &len);
+  miniredis_conn_write_int(conn, pair && set_has(pair, member, len));
+}
+
+// SCARD key
+void cmdSCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (lookup_key(conn, server, args, 1, TYPE_SET, &pair)) {
+    miniredis_conn_write_int(conn, pair ? set_len(pair) : 0);
+  }
+}
+
+// SMEMBERS key
+void cmdSMEMBERS(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_SET, &pair)) {
+    return;
+  }
+  struct buf buf = {0};
+  size_t n = 0;
+  const char* member;
+  size_t len, i = 0;
+  char str[32];
+  while (pair && set_next(pair, &i, &member, &len, str)) {
+    miniredis_write_bulk(&buf, member, len);
+    n++;
+  }
+  miniredis_conn_write_set(conn, n);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
+
+// lookup_sets looks up the n sets at args[first:], writing WRONGTYPE if any
+// key holds another type. Missing sets are NULL.
+static bool lookup_sets(struct miniredis_conn* conn, struct server* server,
+                        struct miniredis_args* args, int first, int n,
+                        struct pair** sets) {
+  for (int i = 0; i < n; i++) {
+    if (!lookup_key(conn, server, args, first + i, TYPE_SET, &sets[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int set_len_compare(const void* a, const void* b) {
+  size_t x = set_len(*(struct pair**)a);
+  size_t y = set_len(*(struct pair**)b);
+  return x < y ? -1 : x > y;
+}
+
+// set_inter intersects the sets, writing up to limit members to buf if not
+// NULL, and returns the number of members found or -1 when out of memory.
+// Intsets are intersected pairwise from the smallest up. Otherwise the
+// smallest set is iterated and its members probed in the others.
+static int64_t set_inter(struct pair** sets, int n, size_t limit,
+                         struct buf* buf) {
+  bool allint = true;
+  for (int i = 0; i < n; i++) {
+    if (!sets[i]) {
+      return 0;
+    }
+    allint = allint && sets[i]->enc == ENC_COMPACT;
+  }
+  qsort(sets, n, sizeof(struct pair*), set_len_compare);
+  if (allint && n > 1) {
+    struct intset* res = is_intersect(pair_obj(sets[0]), pair_obj(sets[1]));
+    for (int i = 2; res && res->len > 0 && i < n; i++) {
+      struct intset* next = is_intersect(res, pair_obj(sets[i]));
+      is_free(res);
+      res = next;
+    }
+    if (!res) {
+      return -1;
+    }
+    if (res->len > limit) {
+      res->len = limit;
+    }
+    if (buf) {
+      intset_write(res, buf);
+    }
+    int64_t count = res->len;
+    is_free(res);
+    return count;
+  }
+  int64_t count = 0;
+  const char* member;
+  size_t len, i = 0;
+  char str[32];
+  while ((size_t)count < limit && set_next(sets[0], &i, &member, &len, str)) {
+    int j = 1;
+    while (j < n && set_has(sets[j], member, len)) j++;
+    if (j < n) continue;
+    if (buf) miniredis_write_bulk(buf, member, len);
+    count++;
+  }
+  return count;
+}
+
+// SINTER key [key ...]
+void cmdSINTER(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  int n = miniredis_args_count(args) - 1;
+  if (n < 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* sets[n];
+  if (!lookup_sets(conn, server, args, 1, n, sets)) {
+    return;
+  }
+  struct buf buf = {0};
+  int64_t count = set_inter(sets, n, SIZE_MAX, &buf);
+  if (count == -1) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  } else {
+    miniredis_conn_write_set(conn, count);
+    miniredis_conn_write_raw(conn, buf.data, buf.len);
+  }
+  buf_clear(&buf);
+}
+
+// SINTERCARD numkeys key [key ...] [LIMIT limit]
+void cmdSINTERCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+                   void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  int64_t n, limit = 0;
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!argtoint(args, 1, &n) || n < 1) {
+    miniredis_conn_write_error(conn, "ERR numkeys should be greater than 0");
+    return;
+  }
+  if (n > nargs - 2) {
+    miniredis_conn_write_error(
+        conn, "ERR Number of keys can't be greater than number of args");
+    return;
+  }
+  for (int i = 2 + n; i < nargs; i += 2) {
+    if (i + 1 < nargs && miniredis_args_eq(args, i, "limit")) {
+      if (!argtoint(args, i + 1, &limit) || limit < 0) {
+        miniredis_conn_write_error(conn, "ERR LIMIT can't be negative");
+        return;
+      }
+    } else {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+  }
+  struct pair* sets[n];
+  if (!lookup_sets(conn, server, args, 2, n, sets)) {
+    return;
+  }
+  int64_t count = set_inter(sets, n, limit ? (size_t)limit : SIZE_MAX, NULL);
+  if (count == -1) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  } else {
+    miniredis_conn_write_int(conn, count);
+  }
+}
+
+static int int64_compare(const void* a, const void* b) {
+  int64_t x = *(int64_t*)a, y = *(int64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+// set_union writes the members of the sets to buf and returns their number,
+// or -1 when out of memory. Intsets are merged by sorting their integers,
+// other sets are deduplicated with a dict.
+static int64_t set_union(struct pair** sets, int n, struct buf* buf) {
+  bool allint = true;
+  size_t total = 0;
+  for (int i = 0; i < n; i++) {
+    if (sets[i]) {
+      allint = allint && sets[i]->enc == ENC_COMPACT;
+      total += set_len(sets[i]);
+    }
+  }
+  int64_t count = 0;
+  if (allint) {
+    int64_t* xs = malloc(total * sizeof(int64_t) + 1);
+    if (!xs) {
+      return -1;
+    }
+    size_t k = 0;
+    for (int i = 0; i < n; i++) {
+      struct intset* is = sets[i] ? pair_obj(sets[i]) : NULL;
+      for (uint32_t j = 0; is && j < is->len; j++) {
+        xs[k++] = is_get(is, j);
+      }
+    }
+    qsort(xs, k, sizeof(int64_t), int64_compare);
+    for (size_t j = 0; j < k; j++) {
+      if (j > 0 && xs[j] == xs[j - 1]) continue;
+      char str[32];
+      int len = snprintf(str, sizeof(str), "%" PRId64, xs[j]);
+      miniredis_write_bulk(buf, str, len);
+      count++;
+    }
+    free(xs);
+    return count;
+  }
+  struct dict* seen = dict_new();
+  if (!seen) {
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    const char* member;
+    size_t len, j = 0;
+    char str[32];
+    while (sets[i] && set_next(sets[i], &j, &member, &len, str)) {
+      int res = dict_set(seen, member, len, "", 0);
+      if (res == -1) {
+        dict_free(seen);
+        return -1;
+      }
+      if (res == 1) {
+        miniredis_write_bulk(buf, member, len);
+        count++;
+      }
+    }
+  }
+  dict_free(seen);
+  return count;
+}
+
+// SUNION key [key ...]
+void cmdSUNION(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  int n = miniredis_args_count(args) - 1;
+  if (n < 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* sets[n];
+  if (!lookup_sets(conn, server, args, 1, n, sets)) {
+    return;
+  }
+  struct buf buf = {0};
+  int64_t count = set_union(sets, n, &buf);
+  if (count == -1) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  } else {
+    miniredis_conn_write_set(conn, count);
+    miniredis_conn_write_raw(conn, buf.data, buf.len);
+  }
+  buf_clear(&buf);
+}
+
+// SDIFF key [key ...]
+void cmdSDIFF(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  int n = miniredis_args_count(args) - 1;
+  if (n < 1) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* sets[n];
+  if (!lookup_sets(conn, server, args, 1, n, sets)) {
+    return;
+  }
+  struct buf buf = {0};
+  int64_t count = 0;
+  const char* member;
+  size_t len, i = 0;
+  char str[32];
+  while (sets[0] && set_next(sets[0], &i, &member, &len, str)) {
+    int j = 1;
+    while (j < n && !(sets[j] && set_has(sets[j], member, len))) j++;
+    if (j < n) continue;
+    miniredis_write_bulk(&buf, member, len);
+    count++;
+  }
+  miniredis_conn_write_set(conn, count);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "miniredis.h"
+
+// Sets are an intset while they only hold integers and are small enough,
+// and a dict of members without values from then on.
+
+struct pair;
+struct server;
+
+bool set_next(struct pair* pair, size_t* i, const char** member, size_t* len,
+              char str[32]);
+int set_add(struct server* server, struct pair* pair, const char* member,
+            size_t len);
+void cmdSADD(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdSREM(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdSISMEMBER(struct miniredis_conn* conn, struct miniredis_args* args,
+                  void* udata);
+void cmdSCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdSMEMBERS(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata);
+void cmdSINTER(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdSINTERCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+                   void* udata);
+void cmdSUNION(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdSDIFF(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
@@ -0,0 +1,1123 @@
+#include "cmdstream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocking.h"
+#include "dict.h"
+#include "server.h"
+#include "stream.h"
+
+// server_ms returns the wall clock of the current command in Unix
+// milliseconds, as stream IDs and delivery times are.
+static int64_t server_ms(struct server* server) {
+  return (int64_t)(server->unixtime * 1000);
+}
+
+static bool write_stream_id(struct buf* buf, struct stream_id id) {
+  char str[44];
+  return miniredis_write_bulk(buf, str, stream_format_id(str, id));
+}
+
+// write_stream_entry writes the current entry of the iterator as its ID and
+// an array of its fields and values.
+static void write_stream_entry(struct buf* buf, struct stream_iter* it,
+                               struct stream_id id, uint64_t nfields) {
+  miniredis_write_array(buf, 2);
+  write_stream_id(buf, id);
+  miniredis_write_array(buf, nfields * 2);
+  for (uint64_t i = 0; i < nfields; i++) {
+    const char* field;
+    const char* val;
+    size_t flen, vlen;
+    stream_iter_field(it, &field, &flen, &val, &vlen);
+    miniredis_write_bulk(buf, field, flen);
+    miniredis_write_bulk(buf, val, vlen);
+  }
+}
+
+#define INVALID_ID_ERR \
+  "ERR Invalid stream ID specified as stream command argument"
+
+// parse_stream_id parses an ID argument, with a missing sequence number
+// defaulting to seq. An error is written when it is invalid.
+static bool parse_stream_id(struct miniredis_conn* conn,
+                            struct miniredis_args* args, int index,
+                            uint64_t seq, struct stream_id* id) {
+  size_t len;
+  const char* str = miniredis_args_at(args, index, &len);
+  bool seqgiven;
+  if (!stream_parse_id(str, len, seq, id, &seqgiven)) {
+    miniredis_conn_write_error(conn, INVALID_ID_ERR);
+    return false;
+  }
+  return true;
+}
+
+// parse_range_id parses a bound of XRANGE: "-" or "+", or an ID whose
+// missing sequence number is the lowest for a start and the highest for an
+// end, prefixed with "(" when exclusive. An error is written when it is
+// invalid, or when an exclusive bound leaves no IDs.
+static bool parse_range_id(struct miniredis_conn* conn,
+                           struct miniredis_args* args, int index, bool end,
+                           struct stream_id* id) {
+  size_t len;
+  const char* str = miniredis_args_at(args, index, &len);
+  if (len == 1 && (str[0] == '-' || str[0] == '+')) {
+    *id = str[0] == '-' ? (struct stream_id){0} : STREAM_ID_MAX;
+    return true;
+  }
+  bool excl = len > 0 && str[0] == '(';
+  bool seqgiven;
+  if (!stream_parse_id(str + excl, len - excl, end ? UINT64_MAX : 0, id,
+                       &seqgiven)) {
+    miniredis_conn_write_error(conn, INVALID_ID_ERR);
+    return false;
+  }
+  if (excl && !(end ? stream_id_decr(id) : stream_id_incr(id))) {
+    miniredis_conn_write_error(conn, end ? "ERR invalid end ID for the interval"
+                                         : "ERR invalid start ID for the "
+                                           "interval");
+    return false;
+  }
+  return true;
+}
+
+// parse_xadd_id parses the ID of a new entry of XADD: "*" for the current
+// time, "ms-*" for the next sequence number, or an explicit ID, which must
+// be above the last ID of the stream. An error is written when it is not.
+static bool parse_xadd_id(struct miniredis_conn* conn, struct server* server,
+                          struct miniredis_args* args, int index,
+                          struct stream_id last, struct stream_id* id) {
+  size_t len;
+  const char* str = miniredis_args_at(args, index, &len);
+  bool ok = true;
+  if (len == 1 && str[0] == '*') {
+    id->ms = server_ms(server);
+    id->seq = 0;
+    if (id->ms <= last.ms) {
+      *id = last;
+      ok = stream_id_incr(id);
+    }
+  } else {
+    bool autoseq = len > 2 && str[len - 2] == '-' && str[len - 1] == '*';
+    bool seqgiven;
+    if (!stream_parse_id(str, autoseq ? len - 2 : len, 0, id, &seqgiven)) {
+      miniredis_conn_write_error(conn, INVALID_ID_ERR);
+      return false;
+    }
+    if (autoseq && id->ms == last.ms) {
+      id->seq = last.seq;
+      ok = stream_id_incr(id) && id->ms == last.ms;
+    }
+    if (id->ms == 0 && id->seq == 0) {
+      miniredis_conn_write_error(
+          conn, "ERR The ID specified in XADD must be greater than 0-0");
+      return false;
+    }
+  }
+  if (!ok || stream_id_cmp(*id, last) <= 0) {
+    miniredis_conn_write_error(conn,
+                               "ERR The ID specified in XADD is equal or "
+                               "smaller than the target stream top item");
+    return false;
+  }
+  return true;
+}
+
+// trimopts are the trimming options of XADD and XTRIM.
+struct trimopts {
+  bool set;
+  bool approx;
+  uint64_t maxlen;
+  struct stream_id minid;
+  int64_t limit;
+};
+
+// parse_trim parses MAXLEN|MINID [=|~] threshold [LIMIT count] at
+// args[*index], and moves the index past them. An error is written when
+// they are invalid.
+static bool parse_trim(struct miniredis_conn* conn, struct server* server,
+                       struct miniredis_args* args, int* index,
+                       struct trimopts* opts) {
+  int nargs = miniredis_args_count(args);
+  int i = *index;
+  bool minid = miniredis_args_eq(args, i, "minid");
+  opts->set = true;
+  opts->maxlen = UINT64_MAX;
+  opts->minid = (struct stream_id){0};
+  opts->limit = -1;
+  i++;
+  if (i < nargs && (miniredis_args_eq(args, i, "~") ||
+                    miniredis_args_eq(args, i, "="))) {
+    opts->approx = miniredis_args_eq(args, i, "~");
+    i++;
+  }
+  if (i >= nargs) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return false;
+  }
+  if (minid) {
+    if (!parse_stream_id(conn, args, i, 0, &opts->minid)) {
+      return false;
+    }
+  } else {
+    int64_t maxlen;
+    if (!argtoint(args, i, &maxlen)) {
+      miniredis_conn_write_error(
+          conn, "ERR value is not an integer or out of range");
+      return false;
+    }
+    if (maxlen < 0) {
+      miniredis_conn_write_error(conn,
+                                 "ERR The MAXLEN argument must be >= 0.");
+      return false;
+    }
+    opts->maxlen = maxlen;
+  }
+  i++;
+  if (i + 1 < nargs && miniredis_args_eq(args, i, "limit")) {
+    if (!argtoint(args, i + 1, &opts->limit) || opts->limit < 0) {
+      miniredis_conn_write_error(
+          conn, "ERR The LIMIT argument must be >= 0.");
+      return false;
+    }
+    if (!opts->approx) {
+      miniredis_conn_write_error(conn,
+                                 "ERR syntax error, LIMIT cannot be used "
+                                 "without the special ~ option");
+      return false;
+    }
+    i += 2;
+  }
+  if (opts->limit == -1) {
+    // approximate trims do a bounded amount of work by default
+    opts->limit = opts->approx ? 100 * server->stream_node_max_entries : 0;
+  }
+  *index = i;
+  return true;
+}
+
+static int64_t stream_apply_trim(struct stream* s, struct trimopts* opts) {
+  return stream_trim(s, opts->maxlen, opts->minid, opts->approx,
+                     opts->approx ? opts->limit : 0);
+}
+
+// XADD key [NOMKSTREAM] [MAXLEN|MINID [=|~] threshold [LIMIT count]]
+//   *|id field value [field value ...]
+void cmdXADD(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  bool nomkstream = false;
+  struct trimopts trim = {0};
+  int i = 2;
+  while (i < nargs) {
+    if (miniredis_args_eq(args, i, "nomkstream")) {
+      nomkstream = true;
+      i++;
+    } else if (miniredis_args_eq(args, i, "maxlen") ||
+               miniredis_args_eq(args, i, "minid")) {
+      if (!parse_trim(conn, server, args, &i, &trim)) {
+        return;
+      }
+    } else {
+      break;
+    }
+  }
+  int nfields = nargs - i - 1;
+  if (nfields <= 0 || nfields % 2 != 0) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STREAM, &pair)) {
+    return;
+  }
+  if (!pair && nomkstream) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  struct stream_id last = pair ? ((struct stream*)pair_obj(pair))->last_id
+                               : (struct stream_id){0};
+  struct stream_id id;
+  if (!parse_xadd_id(conn, server, args, i, last, &id)) {
+    return;
+  }
+  const char** fields = malloc(nfields * sizeof(char*));
+  size_t* lens = malloc(nfields * sizeof(size_t));
+  if (!pair && fields && lens) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, 1, &keylen);
+    pair = db_create(server, key, keylen, TYPE_STREAM);
+  }
+  if (!fields || !lens || !pair) {
+    free(fields);
+    free(lens);
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  for (int j = 0; j < nfields; j++) {
+    fields[j] = miniredis_args_at(args, i + 1 + j, &lens[j]);
+  }
+  struct stream* s = pair_obj(pair);
+  size_t mem = pair_memory(pair);
+  bool ok = stream_append(s, id, fields, lens, nfields / 2,
+                          server->stream_node_max_entries,
+                          server->stream_node_max_bytes);
+  free(fields);
+  free(lens);
+  if (ok && trim.set) {
+    stream_apply_trim(s, &trim);
+  }
+  db_modified(server, pair, mem);
+  if (!ok) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  size_t keylen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  signal_ready(server, key, keylen);
+  char str[44];
+  miniredis_conn_write_bulk(conn, str, stream_format_id(str, id));
+}
+
+// XLEN key
+void cmdXLEN(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STREAM, &pair)) {
+    return;
+  }
+  miniredis_conn_write_uint(
+      conn, pair ? ((struct stream*)pair_obj(pair))->len : 0);
+}
+
+// stream_range implements XRANGE and XREVRANGE.
+static void stream_range(struct miniredis_conn* conn,
+                         struct miniredis_args* args, struct server* server,
+                         bool rev) {
+  int nargs = miniredis_args_count(args);
+  if (nargs != 4 && nargs != 6) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct stream_id start, end;
+  if (!parse_range_id(conn, args, rev ? 3 : 2, false, &start) ||
+      !parse_range_id(conn, args, rev ? 2 : 3, true, &end)) {
+    return;
+  }
+  int64_t count = -1;
+  if (nargs == 6) {
+    if (!miniredis_args_eq(args, 4, "count")) {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+    if (!argtoint(args, 5, &count)) {
+      miniredis_conn_write_error(
+          conn, "ERR value is not an integer or out of range");
+      return;
+    }
+    if (count < 0) count = 0;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STREAM, &pair)) {
+    return;
+  }
+  struct buf buf = {0};
+  int64_t n = 0;
+  if (pair && stream_id_cmp(start, end) <= 0) {
+    struct stream_iter it;
+    stream_iter_start(&it, pair_obj(pair), start, end, rev);
+    struct stream_id id;
+    uint64_t nfields;
+    while ((count < 0 || n < count) &&
+           stream_iter_next(&it, &id, &nfields)) {
+      write_stream_entry(&buf, &it, id, nfields);
+      n++;
+    }
+  }
+  miniredis_conn_write_array(conn, n);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
+
+// XRANGE key start end [COUNT count]
+void cmdXRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  stream_range(conn, args, udata, false);
+}
+
+// XREVRANGE key end start [COUNT count]
+void cmdXREVRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+                  void* udata) {
+  stream_range(conn, args, udata, true);
+}
+
+// XTRIM key MAXLEN|MINID [=|~] threshold [LIMIT count]
+void cmdXTRIM(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  if (!miniredis_args_eq(args, 2, "maxlen") &&
+      !miniredis_args_eq(args, 2, "minid")) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  struct trimopts trim = {0};
+  int i = 2;
+  if (!parse_trim(conn, server, args, &i, &trim)) {
+    return;
+  }
+  if (i != nargs) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STREAM, &pair)) {
+    return;
+  }
+  int64_t removed = 0;
+  if (pair) {
+    size_t mem = pair_memory(pair);
+    removed = stream_apply_trim(pair_obj(pair), &trim);
+    if (removed > 0) {
+      db_modified(server, pair, mem);
+    }
+  }
+  miniredis_conn_write_int(conn, removed);
+}
+
+// xread_history writes the entries pending for the consumer after the ID,
+// for XREADGROUP with an ID other than ">", which counts as another
+// delivery. Entries that were deleted since are written with a null value.
+static int64_t xread_history(struct buf* buf, struct stream* s,
+                             struct stream_consumer* c, struct stream_id after,
+                             int64_t count, int64_t now) {
+  if (!stream_id_incr(&after)) {
+    return 0;
+  }
+  unsigned char key[RADIX_KEYLEN];
+  stream_id_key(after, key);
+  int64_t n = 0;
+  struct radix_leaf* leaf = radix_ceil(c->pel, key);
+  for (; leaf && (count == 0 || n < count); leaf = leaf->next, n++) {
+    struct stream_id id = stream_key_id(leaf->key);
+    struct stream_nack* nack = leaf->value;
+    nack->delivery_time = now;
+    nack->delivery_count++;
+    struct stream_iter it;
+    stream_iter_start(&it, s, id, id, false);
+    uint64_t nfields;
+    if (stream_iter_next(&it, &id, &nfields)) {
+      write_stream_entry(buf, &it, id, nfields);
+    } else {
+      miniredis_write_array(buf, 2);
+      write_stream_id(buf, id);
+      miniredis_write_array(buf, -1);
+    }
+  }
+  return n;
+}
+
+// xread_entries writes the entries of the stream at the i-th key of an
+// XREAD or XREADGROUP into buf, and returns how many. XREAD reads the
+// entries after the ID of the key. XREADGROUP reads the entries after the
+// last one delivered to the group, which are then pending for the consumer,
+// or for an ID other than ">" those already pending. Returns -1 when out of
+// memory.
+static int64_t xread_entries(struct server* server, struct buf* buf,
+                             struct pair* pair, struct bpop* bpop, int i) {
+  struct stream* s = pair_obj(pair);
+  struct stream_id start = bpop->ids[i];
+  struct stream_group* g = NULL;
+  struct stream_consumer* c = NULL;
+  int64_t now = server_ms(server);
+  if (bpop->group) {
+    g = stream_group_get(s, bpop->group, bpop->grouplen);
+    c = stream_consumer_get(g, bpop->consumer, bpop->consumerlen);
+    if (!c) {
+      c = stream_consumer_create(s, g, bpop->consumer, bpop->consumerlen,
+                                 now);
+      if (!c) {
+        return -1;
+      }
+    }
+    c->seen_time = now;
+    if (stream_id_cmp(start, STREAM_ID_MAX) != 0) {
+      return xread_history(buf, s, c, start, bpop->count, now);
+    }
+    start = g->last_id;
+  }
+  if (!stream_id_incr(&start)) {
+    return 0;
+  }
+  struct stream_iter it;
+  stream_iter_start(&it, s, start, STREAM_ID_MAX, false);
+  struct stream_id id;
+  uint64_t nfields;
+  int64_t n = 0;
+  while ((bpop->count == 0 || n < bpop->count) &&
+         stream_iter_next(&it, &id, &nfields)) {
+    if (g) {
+      if (!bpop->noack && !stream_nack_add(s, g, c, id, now)) {
+        break;
+      }
+      g->last_id = id;
+      if (g->entries_read >= 0) {
+        g->entries_read++;
+      }
+    }
+    write_stream_entry(buf, &it, id, nfields);
+    n++;
+  }
+  return n;
+}
+
+// write_nogroup writes the error for a missing key or group of XREADGROUP.
+static void write_nogroup(struct miniredis_conn* conn, const char* key,
+                          size_t keylen, const char* group, size_t grouplen) {
+  char err[300];
+  snprintf(err, sizeof(err),
+           "NOGROUP No such key '%.*s' or consumer group '%.*s' in "
+           "XREADGROUP with GROUP option",
+           (int)(keylen > 100 ? 100 : keylen), key,
+           (int)(grouplen > 100 ? 100 : grouplen), group);
+  miniredis_conn_write_error(conn, err);
+}
+
+// xread implements XREAD and XREADGROUP once their options are parsed into
+// the bpop, for the nkeys keys at args[first:] and their IDs. Replies with
+// the streams that have entries to read, or blocks the client when there are
+// none and the command has a deadline. Takes over the bpop.
+static void xread(struct miniredis_conn* conn, struct server* server,
+                  struct miniredis_args* args, int first, int nkeys,
+                  struct bpop* bpop, bool block) {
+  bool history = false;
+  for (int i = 0; i < nkeys; i++) {
+    struct pair* pair;
+    if (!lookup_key(conn, server, args, first + i, TYPE_STREAM, &pair)) {
+      bpop_free(bpop);
+      return;
+    }
+    if (bpop->group &&
+        (!pair || !stream_group_get(pair_obj(pair), bpop->group,
+                                    bpop->grouplen))) {
+      size_t keylen;
+      const char* key = miniredis_args_at(args, first + i, &keylen);
+      write_nogroup(conn, key, keylen, bpop->group, bpop->grouplen);
+      bpop_free(bpop);
+      return;
+    }
+    if (bpop->group && stream_id_cmp(bpop->ids[i], STREAM_ID_MAX) != 0) {
+      history = true;
+    }
+  }
+  struct buf out = {0}, entries = {0};
+  int nstreams = 0;
+  for (int i = 0; i < nkeys; i++) {
+    size_t keylen;
+    const char* key = miniredis_args_at(args, first + i, &keylen);
+    struct pair* pair = db_get(server, key, keylen);
+    if (!pair) {
+      continue;
+    }
+    size_t mem = pair_memory(pair);
+    entries.len = 0;
+    int64_t n = xread_entries(server, &entries, pair, bpop, i);
+    if (bpop->group && n != 0) {
+      // only reads for a group change the stream, through its PEL
+      db_modified(server, pair, mem);
+    }
+    if (n == -1) {
+      buf_clear(&out);
+      buf_clear(&entries);
+      bpop_free(bpop);
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+    // history is replied to for every stream, even without entries
+    if (n > 0 || history) {
+      miniredis_write_array(&out, 2);
+      miniredis_write_bulk(&out, key, keylen);
+      miniredis_write_array(&out, n);
+      buf_append(&out, entries.data, entries.len);
+      nstreams++;
+    }
+  }
+  buf_clear(&entries);
+  if (nstreams > 0 || history || !block) {
+    if (nstreams > 0 || history) {
+      miniredis_conn_write_array(conn, nstreams);
+      miniredis_conn_write_raw(conn, out.data, out.len);
+    } else {
+      miniredis_conn_write_array(conn, -1);
+    }
+    buf_clear(&out);
+    bpop_free(bpop);
+    return;
+  }
+  buf_clear(&out);
+  if (!client_block(server, miniredis_conn_udata(conn), args, first,
+                    first + nkeys - 1, bpop)) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  }
+}
+
+// xread_serve replies to a client blocked by XREAD or XREADGROUP on the i-th
+// of its keys, which holds a stream, if it has entries to read. Returns
+// false if it does not.
+static bool xread_serve(struct server* server, struct client* client,
+                        struct pair* pair, int i) {
+  struct bpop* bpop = client->bpop;
+  if (bpop->group &&
+      !stream_group_get(pair_obj(pair), bpop->group, bpop->grouplen)) {
+    write_nogroup(client->conn, pair_key(pair), pair->keylen, bpop->group,
+                  bpop->grouplen);
+    return true;
+  }
+  struct buf buf = {0};
+  size_t mem = pair_memory(pair);
+  int64_t n = xread_entries(server, &buf, pair, bpop, i);
+  if (bpop->group && n != 0) {
+    db_modified(server, pair, mem);
+  }
+  if (n == 0) {
+    buf_clear(&buf);
+    return false;
+  }
+  if (n == -1) {
+    miniredis_conn_write_error(client->conn, "ERR out of memory");
+  } else {
+    miniredis_conn_write_array(client->conn, 1);
+    miniredis_conn_write_array(client->conn, 2);
+    miniredis_conn_write_bulk(client->conn, pair_key(pair), pair->keylen);
+    miniredis_conn_write_array(client->conn, n);
+    miniredis_conn_write_raw(client->conn, buf.data, buf.len);
+  }
+  buf_clear(&buf);
+  return true;
+}
+
+// parse_xread parses the options of XREAD and XREADGROUP from args[*index]
+// up to STREAMS into the bpop, and moves the index to the first key. Returns
+// the number of keys, or -1 with an error written.
+static int parse_xread(struct miniredis_conn* conn, struct server* server,
+                       struct miniredis_args* args, int* index,
+                       struct bpop* bpop, bool* block) {
+  int nargs = miniredis_args_count(args);
+  int i = *index;
+  for (; i < nargs && !miniredis_args_eq(args, i, "streams"); i++) {
+    if (i + 1 < nargs && miniredis_args_eq(args, i, "count")) {
+      if (!argtoint(args, ++i, &bpop->count)) {
+        miniredis_conn_write_error(
+            conn, "ERR value is not an integer or out of range");
+        return -1;
+      }
+      if (bpop->count < 0) bpop->count = 0;
+    } else if (i + 1 < nargs && miniredis_args_eq(args, i, "block")) {
+      int64_t ms;
+      if (!argtoint(args, ++i, &ms)) {
+        miniredis_conn_write_error(
+            conn, "ERR timeout is not an integer or out of range");
+        return -1;
+      }
+      if (ms < 0) {
+        miniredis_conn_write_error(conn, "ERR timeout is negative");
+        return -1;
+      }
+      *block = true;
+      bpop->deadline = ms > 0 ? server->now + ms / 1000.0 : 0;
+    } else if (bpop->group && miniredis_args_eq(args, i, "noack")) {
+      bpop->noack = true;
+    } else {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return -1;
+    }
+  }
+  int nkeys = (nargs - i - 1) / 2;
+  if (i >= nargs || nkeys == 0 || (nargs - i - 1) % 2 != 0) {
+    miniredis_conn_write_error(
+        conn, i >= nargs ? "ERR syntax error"
+                         : "ERR Unbalanced XREAD list of streams: for each "
+                           "stream key an ID or '$' must be specified.");
+    return -1;
+  }
+  bpop->stream = true;
+  bpop->ids = calloc(nkeys, sizeof(struct stream_id));
+  if (!bpop->ids) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return -1;
+  }
+  *index = i + 1;
+  return nkeys;
+}
+
+// XREAD [COUNT count] [BLOCK milliseconds] STREAMS key [key ...]
+//   id [id ...]
+void cmdXREAD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  struct bpop* bpop = calloc(1, sizeof(struct bpop));
+  if (!bpop) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  bool block = false;
+  int first = 1;
+  int nkeys = parse_xread(conn, server, args, &first, bpop, &block);
+  if (nkeys == -1) {
+    bpop_free(bpop);
+    return;
+  }
+  for (int i = 0; i < nkeys; i++) {
+    // "$" reads only the entries added from now on
+    if (miniredis_args_eq(args, first + nkeys + i, "$")) {
+      struct pair* pair;
+      if (!lookup_key(conn, server, args, first + i, TYPE_STREAM, &pair)) {
+        bpop_free(bpop);
+        return;
+      }
+      if (pair) {
+        bpop->ids[i] = ((struct stream*)pair_obj(pair))->last_id;
+      }
+    } else if (!parse_stream_id(conn, args, first + nkeys + i, 0,
+                                &bpop->ids[i])) {
+      bpop_free(bpop);
+      return;
+    }
+  }
+  xread(conn, server, args, first, nkeys, bpop, block);
+}
+
+// XREADGROUP GROUP group consumer [COUNT count] [BLOCK milliseconds]
+//   [NOACK] STREAMS key [key ...] id [id ...]
+void cmdXREADGROUP(struct miniredis_conn* conn, struct miniredis_args* args,
+                   void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) < 7 ||
+      !miniredis_args_eq(args, 1, "group")) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  size_t grouplen, consumerlen;
+  const char* group = miniredis_args_at(args, 2, &grouplen);
+  const char* consumer = miniredis_args_at(args, 3, &consumerlen);
+  struct bpop* bpop = calloc(1, sizeof(struct bpop));
+  if (bpop) {
+    bpop->group = malloc(grouplen + 1);
+    bpop->consumer = malloc(consumerlen + 1);
+  }
+  if (!bpop || !bpop->group || !bpop->consumer) {
+    if (bpop) bpop_free(bpop);
+    miniredis_conn_write_error(conn, "ERR out of memory");
+    return;
+  }
+  memcpy(bpop->group, group, grouplen + 1);
+  bpop->grouplen = grouplen;
+  memcpy(bpop->consumer, consumer, consumerlen + 1);
+  bpop->consumerlen = consumerlen;
+  bool block = false;
+  int first = 4;
+  int nkeys = parse_xread(conn, server, args, &first, bpop, &block);
+  if (nkeys == -1) {
+    bpop_free(bpop);
+    return;
+  }
+  for (int i = 0; i < nkeys; i++) {
+    // ">" reads the entries never delivered to the group
+    if (miniredis_args_eq(args, first + nkeys + i, ">")) {
+      bpop->ids[i] = STREAM_ID_MAX;
+    } else if (miniredis_args_eq(args, first + nkeys + i, "$")) {
+      miniredis_conn_write_error(
+          conn, "ERR The $ ID is meaningful only for XREAD command");
+      bpop_free(bpop);
+      return;
+    } else if (!parse_stream_id(conn, args, first + nkeys + i, 0,
+                                &bpop->ids[i])) {
+      bpop_free(bpop);
+      return;
+    }
+  }
+  xread(conn, server, args, first, nkeys, bpop, block);
+}
+
+// parse_group_id parses the ID of XGROUP CREATE and SETID, where "$" is the
+// last ID of the stream, along with an optional ENTRIESREAD count at
+// args[index+1:]. An error is written when they are invalid.
+static bool parse_group_id(struct miniredis_conn* conn,
+                           struct miniredis_args* args, int index,
+                           struct stream* s, struct stream_id* id,
+                           int64_t* entries_read) {
+  int nargs = miniredis_args_count(args);
+  if (miniredis_args_eq(args, index, "$")) {
+    *id = s->last_id;
+    *entries_read = s->entries_added;
+  } else {
+    if (!parse_stream_id(conn, args, index, 0, id)) {
+      return false;
+    }
+    // the number of entries read is only known when reading from the start
+    *entries_read = id->ms == 0 && id->seq == 0 ? 0 : -1;
+  }
+  for (int i = index + 1; i < nargs; i++) {
+    if (miniredis_args_eq(args, i, "mkstream")) {
+      continue;
+    }
+    if (i + 1 < nargs && miniredis_args_eq(args, i, "entriesread")) {
+      if (!argtoint(args, ++i, entries_read) || *entries_read < -1) {
+        miniredis_conn_write_error(
+            conn, "ERR value for ENTRIESREAD must be positive or -1");
+        return false;
+      }
+      continue;
+    }
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return false;
+  }
+  return true;
+}
+
+// XGROUP CREATE key group id|$ [MKSTREAM] [ENTRIESREAD entries-read]
+// XGROUP SETID key group id|$ [ENTRIESREAD entries-read]
+// XGROUP DESTROY key group
+// XGROUP CREATECONSUMER key group consumer
+// XGROUP DELCONSUMER key group consumer
+void cmdXGROUP(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool create = miniredis_args_eq(args, 1, "create");
+  bool setid = miniredis_args_eq(args, 1, "setid");
+  bool destroy = miniredis_args_eq(args, 1, "destroy");
+  bool createconsumer = miniredis_args_eq(args, 1, "createconsumer");
+  bool delconsumer = miniredis_args_eq(args, 1, "delconsumer");
+  if (!create && !setid && !destroy && !createconsumer && !delconsumer) {
+    miniredis_conn_write_error(conn, "ERR unknown XGROUP subcommand");
+    return;
+  }
+  if (((create || setid) && nargs < 5) || (destroy && nargs != 4) ||
+      ((createconsumer || delconsumer) && nargs != 5)) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 2, TYPE_STREAM, &pair)) {
+    return;
+  }
+  size_t keylen, grouplen;
+  const char* key = miniredis_args_at(args, 2, &keylen);
+  const char* group = miniredis_args_at(args, 3, &grouplen);
+  bool mkstream = false;
+  for (int i = 5; create && i < nargs; i++) {
+    mkstream |= miniredis_args_eq(args, i, "mkstream");
+  }
+  if (!pair && !mkstream) {
+    miniredis_conn_write_error(
+        conn,
+        "ERR The XGROUP subcommand requires the key to exist. Note that for "
+        "CREATE you may want to use the MKSTREAM option to create an empty "
+        "stream automatically.");
+    return;
+  }
+  struct stream_id id;
+  int64_t entries_read;
+  struct stream empty = {0};
+  if ((create || setid) &&
+      !parse_group_id(conn, args, 4, pair ? pair_obj(pair) : &empty, &id,
+                      &entries_read)) {
+    return;
+  }
+  if (!pair) {
+    pair = db_create(server, key, keylen, TYPE_STREAM);
+    if (!pair) {
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+  }
+  struct stream* s = pair_obj(pair);
+  struct stream_group* g = stream_group_get(s, group, grouplen);
+  if (create) {
+    if (g) {
+      miniredis_conn_write_error(
+          conn, "BUSYGROUP Consumer Group name already exists");
+      return;
+    }
+    size_t mem = pair_memory(pair);
+    g = stream_group_create(s, group, grouplen, id);
+    db_modified(server, pair, mem);
+    if (!g) {
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+    g->entries_read = entries_read;
+    miniredis_conn_write_string(conn, "OK");
+    return;
+  }
+  if (!g) {
+    if (destroy) {
+      miniredis_conn_write_int(conn, 0);
+      return;
+    }
+    char err[300];
+    snprintf(err, sizeof(err),
+             "NOGROUP No such consumer group '%.*s' for key name '%.*s'",
+             (int)(grouplen > 100 ? 100 : grouplen), group,
+             (int)(keylen > 100 ? 100 : keylen), key);
+    miniredis_conn_write_error(conn, err);
+    return;
+  }
+  size_t mem = pair_memory(pair);
+  if (setid) {
+    g->last_id = id;
+    g->entries_read = entries_read;
+    miniredis_conn_write_string(conn, "OK");
+  } else if (destroy) {
+    stream_group_destroy(s, group, grouplen);
+    // readers blocked on the group get an error
+    signal_ready(server, key, keylen);
+    miniredis_conn_write_int(conn, 1);
+  } else {
+    size_t namelen;
+    const char* name = miniredis_args_at(args, 4, &namelen);
+    struct stream_consumer* c = stream_consumer_get(g, name, namelen);
+    if (createconsumer) {
+      if (!c && !stream_consumer_create(s, g, name, namelen,
+                                        server_ms(server))) {
+        db_modified(server, pair, mem);
+        miniredis_conn_write_error(conn, "ERR out of memory");
+        return;
+      }
+      miniredis_conn_write_int(conn, c ? 0 : 1);
+    } else {
+      miniredis_conn_write_uint(
+          conn, c ? stream_consumer_delete(s, g, name, namelen) : 0);
+    }
+  }
+  db_modified(server, pair, mem);
+}
+
+// XACK key group id [id ...]
+void cmdXACK(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct stream_id id;
+  for (int i = 3; i < nargs; i++) {
+    if (!parse_stream_id(conn, args, i, 0, &id)) {
+      return;
+    }
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STREAM, &pair)) {
+    return;
+  }
+  size_t grouplen;
+  const char* group = miniredis_args_at(args, 2, &grouplen);
+  struct stream_group* g =
+      pair ? stream_group_get(pair_obj(pair), group, grouplen) : NULL;
+  int64_t acked = 0;
+  if (g) {
+    size_t mem = pair_memory(pair);
+    for (int i = 3; i < nargs; i++) {
+      size_t len;
+      const char* str = miniredis_args_at(args, i, &len);
+      bool seqgiven;
+      stream_parse_id(str, len, 0, &id, &seqgiven);
+      acked += stream_ack(pair_obj(pair), g, id);
+    }
+    if (acked > 0) {
+      db_modified(server, pair, mem);
+    }
+  }
+  miniredis_conn_write_int(conn, acked);
+}
+
+// xpending_summary writes the number of pending entries of the group, their
+// smallest and largest IDs, and the number pending for each consumer.
+static void xpending_summary(struct miniredis_conn* conn,
+                             struct stream_group* g) {
+  if (g->pel->count == 0) {
+    miniredis_conn_write_array(conn, 4);
+    miniredis_conn_write_int(conn, 0);
+    miniredis_conn_write_null(conn);
+    miniredis_conn_write_null(conn);
+    miniredis_conn_write_array(conn, -1);
+    return;
+  }
+  char str[44];
+  miniredis_conn_write_array(conn, 4);
+  miniredis_conn_write_uint(conn, g->pel->count);
+  miniredis_conn_write_bulk(
+      conn, str, stream_format_id(str, stream_key_id(g->pel->first->key)));
+  miniredis_conn_write_bulk(
+      conn, str, stream_format_id(str, stream_key_id(g->pel->last->key)));
+  struct buf buf = {0};
+  int n = 0;
+  struct dict_entry* entry;
+  size_t i = 0;
+  while (dict_iter(g->consumers, &i, &entry)) {
+    struct stream_consumer* c;
+    memcpy(&c, dict_entry_val(entry), sizeof(c));
+    if (c->pel->count == 0) {
+      continue;
+    }
+    miniredis_write_array(&buf, 2);
+    miniredis_write_bulk(&buf, c->name, c->namelen);
+    snprintf(str, sizeof(str), "%zu", c->pel->count);
+    miniredis_write_bulk(&buf, str, -1);
+    n++;
+  }
+  miniredis_conn_write_array(conn, n);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
+
+// XPENDING key group [[IDLE min-idle-time] start end count [consumer]]
+void cmdXPENDING(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  int i = 3;
+  int64_t minidle = 0;
+  if (nargs > 4 && miniredis_args_eq(args, 3, "idle")) {
+    if (!argtoint(args, 4, &minidle)) {
+      miniredis_conn_write_error(
+          conn, "ERR value is not an integer or out of range");
+      return;
+    }
+    i = 5;
+  }
+  if (nargs < 3 || (nargs > 3 && nargs - i != 3 && nargs - i != 4)) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool extended = nargs > 3;
+  struct stream_id start, end;
+  int64_t count = 0;
+  if (extended) {
+    if (!parse_range_id(conn, args, i, false, &start) ||
+        !parse_range_id(conn, args, i + 1, true, &end)) {
+      return;
+    }
+    if (!argtoint(args, i + 2, &count)) {
+      miniredis_conn_write_error(
+          conn, "ERR value is not an integer or out of range");
+      return;
+    }
+    if (count < 0) count = 0;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_STREAM, &pair)) {
+    return;
+  }
+  size_t keylen, grouplen;
+  const char* key = miniredis_args_at(args, 1, &keylen);
+  const char* group = miniredis_args_at(args, 2, &grouplen);
+  struct stream_group* g =
+      pair ? stream_group_get(pair_obj(pair), group, grouplen) : NULL;
+  if (!g) {
+    char err[300];
+    snprintf(err, sizeof(err),
+             "NOGROUP No such key '%.*s' or consumer group '%.*s'",
+             (int)(keylen > 100 ? 100 : keylen), key,
+             (int)(grouplen > 100 ? 100 : grouplen), group);
+    miniredis_conn_write_error(conn, err);
+    return;
+  }
+  if (!extended) {
+    xpending_summary(conn, g);
+    return;
+  }
+  // the PEL of a single consumer, or of the whole group
+  struct radix* pel = g->pel;
+  if (nargs - i == 4) {
+    size_t namelen;
+    const char* name = miniredis_args_at(args, i + 3, &namelen);
+    struct stream_consumer* c = stream_consumer_get(g, name, namelen);
+    if (!c) {
+      miniredis_conn_write_array(conn, 0);
+      return;
+    }
+    pel = c->pel;
+  }
+  unsigned char key1[RADIX_KEYLEN];
+  stream_id_key(start, key1);
+  int64_t now = server_ms(server);
+  struct buf buf = {0};
+  int64_t n = 0;
+  struct radix_leaf* leaf = radix_ceil(pel, key1);
+  for (; leaf && n < count; leaf = leaf->next) {
+    struct stream_id id = stream_key_id(leaf->key);
+    if (stream_id_cmp(id, end) > 0) {
+      break;
+    }
+    struct stream_nack* nack = leaf->value;
+    int64_t idle = now - nack->delivery_time;
+    if (idle < minidle) {
+      continue;
+    }
+    miniredis_write_array(&buf, 4);
+    write_stream_id(&buf, id);
+    miniredis_write_bulk(&buf, nack->consumer->name, nack->consumer->namelen);
+    miniredis_write_int(&buf, idle > 0 ? idle : 0);
+    miniredis_write_uint(&buf, nack->delivery_count);
+    n++;
+  }
+  miniredis_conn_write_array(conn, n);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
+
+// serve_stream replies to the clients blocked on the stream at key that
+// have entries to read.
+void serve_stream(struct server* server, const char* key, size_t keylen) {
+  struct waitq* q = waitq_get(server, key, keylen);
+  // clients leave the queue as they are served
+  size_t n = q->len;
+  struct client** clients = malloc(n * sizeof(struct client*));
+  if (!clients) {
+    return;
+  }
+  memcpy(clients, q->clients, n * sizeof(struct client*));
+  for (size_t i = 0; i < n; i++) {
+    struct pair* pair = db_get(server, key, keylen);
+    if (!pair || pair->type != TYPE_STREAM) {
+      break;
+    }
+    struct client* client = clients[i];
+    struct bpop* bpop = client->bpop;
+    if (!bpop || !bpop->stream) {
+      // a client served for another of its keys is no longer blocked
+      continue;
+    }
+    int k = 0;
+    while (bpop->keylens[k] != keylen ||
+           memcmp(bpop->keys[k], key, keylen) != 0) {
+      k++;
+    }
+    if (xread_serve(server, client, pair, k)) {
+      client_unblock(server, client);
+      miniredis_conn_unblock(client->conn);
+    }
+  }
+  free(clients);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "miniredis.h"
+
+// Streams are the log of entries and the consumer groups of stream.c. XREAD
+// and XREADGROUP block through blocking.c, which hands the streams added to
+// back to serve_stream for their blocked readers.
+
+struct server;
+
+void serve_stream(struct server* server, const char* key, size_t keylen);
+void cmdXADD(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdXLEN(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdXRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdXREVRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+                  void* udata);
+void cmdXTRIM(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdXREAD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdXREADGROUP(struct miniredis_conn* conn, struct miniredis_args* args,
+                   void* udata);
+void cmdXGROUP(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdXACK(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdXPENDING(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata);
@@ -0,0 +1,879 @@
+#include "cmdzset.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "listpack.h"
+#include "server.h"
+#include "skiplist.h"
+
+void zset_free(struct zset* zs) {
+  dict_free(zs->dict);
+  zsl_free(zs->zsl);
+  free(zs);
+}
+
+size_t zset_memory(struct zset* zs) {
+  return sizeof(struct zset) + dict_memory(zs->dict) + zs->zsl->bytes;
+}
+
+// parse_score parses a score, which may be "inf" or "-inf" but not NaN.
+bool parse_score(const char* str, size_t len, double* x) {
+  char buf[64];
+  if (len == 0 || len >= sizeof(buf) || isspace(str[0])) return false;
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  char* end;
+  *x = strtod(buf, &end);
+  return end == buf + len && !isnan(*x);
+}
+
+// lp_score returns the score of the listpack entry at p.
+static double lp_score(unsigned char* p) {
+  size_t len;
+  const char* str = lp_get(p, &len);
+  double x = 0;
+  parse_score(str, len, &x);
+  return x;
+}
+
+static size_t zset_len(struct pair* pair) {
+  if (pair->enc == ENC_COMPACT) {
+    return lp_count(pair_obj(pair)) / 2;
+  }
+  return ((struct zset*)pair_obj(pair))->zsl->len;
+}
+
+// zset_score sets the score of the member. Returns false if it does not
+// exist.
+static bool zset_score(struct pair* pair, const char* member, size_t len,
+                       double* score) {
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    unsigned char* p = lp_find(lp, lp_first(lp), member, len, 1);
+    if (!p) {
+      return false;
+    }
+    *score = lp_score(lp_next(lp, p));
+    return true;
+  }
+  struct dict_entry* entry = dict_get(((struct zset*)pair_obj(pair))->dict,
+                                      member, len);
+  if (!entry) {
+    return false;
+  }
+  memcpy(score, dict_entry_val(entry), sizeof(double));
+  return true;
+}
+
+// zset_convert converts a listpack encoded sorted set to a dict and skiplist.
+static bool zset_convert(struct pair* pair) {
+  unsigned char* lp = pair_obj(pair);
+  struct zset* zs = malloc(sizeof(struct zset));
+  if (!zs) {
+    return false;
+  }
+  zs->dict = dict_new();
+  zs->zsl = zsl_new();
+  bool ok = zs->dict && zs->zsl;
+  for (unsigned char* p = lp_first(lp); ok && p;
+       p = lp_next(lp, lp_next(lp, p))) {
+    size_t len;
+    const char* member = lp_get(p, &len);
+    double score = lp_score(lp_next(lp, p));
+    ok = dict_set(zs->dict, member, len, (char*)&score, sizeof(double)) !=
+             -1 &&
+         zsl_insert(zs->zsl, score, member, len);
+  }
+  if (!ok) {
+    if (zs->dict) dict_free(zs->dict);
+    if (zs->zsl) zsl_free(zs->zsl);
+    free(zs);
+    return false;
+  }
+  lp_free(lp);
+  pair_set_obj(pair, zs);
+  pair->enc = ENC_FULL;
+  return true;
+}
+
+// zset_del deletes the member. Returns false if it does not exist.
+static bool zset_del(struct pair* pair, const char* member, size_t len) {
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    unsigned char* p = lp_find(lp, lp_first(lp), member, len, 1);
+    if (!p) {
+      return false;
+    }
+    pair_set_obj(pair, lp_delete(lp, p, 2));
+    return true;
+  }
+  struct zset* zs = pair_obj(pair);
+  double score;
+  if (!zset_score(pair, member, len, &score)) {
+    return false;
+  }
+  zsl_delete(zs->zsl, score, member, len);
+  dict_delete(zs->dict, member, len);
+  return true;
+}
+
+// zset_insert inserts the member and score of a listpack encoded sorted set
+// in order. Returns false when out of memory.
+static bool zset_insert(struct pair* pair, const char* member, size_t len,
+                        double score) {
+  unsigned char* lp = pair_obj(pair);
+  unsigned char* p = lp_first(lp);
+  while (p) {
+    size_t mlen;
+    const char* m = lp_get(p, &mlen);
+    if (zsl_compare(lp_score(lp_next(lp, p)), m, mlen, score, member, len) >
+        0) {
+      break;
+    }
+    p = lp_next(lp, lp_next(lp, p));
+  }
+  char str[32];
+  int slen = miniredis_format_double(str, score);
+  size_t off = p ? (size_t)(p - lp) : lp_bytes(lp);
+  lp = lp_insert(lp, p, member, len);
+  if (!lp) {
+    return false;
+  }
+  pair_set_obj(pair, lp);
+  unsigned char* nlp = lp_insert(lp, lp_next(lp, lp + off), str, slen);
+  if (!nlp) {
+    pair_set_obj(pair, lp_delete(lp, lp + off, 1));
+    return false;
+  }
+  pair_set_obj(pair, nlp);
+  return true;
+}
+
+// zset_set sets the score of the member, first converting the sorted set if
+// it would outgrow the listpack limits. Returns 1 if the member was added, 0
+// if it was updated, or -1 when out of memory.
+int zset_set(struct server* server, struct pair* pair, const char* member,
+             size_t len, double score) {
+  double old;
+  bool exists = zset_score(pair, member, len, &old);
+  if (pair->enc == ENC_COMPACT &&
+      ((int64_t)len > server->zset_max_listpack_value ||
+       (!exists &&
+        (int64_t)zset_len(pair) >= server->zset_max_listpack_entries))) {
+    if (!zset_convert(pair)) {
+      return -1;
+    }
+  }
+  if (pair->enc == ENC_COMPACT) {
+    if (exists) {
+      if (old == score) {
+        return 0;
+      }
+      zset_del(pair, member, len);
+    }
+    return zset_insert(pair, member, len, score) ? !exists : -1;
+  }
+  struct zset* zs = pair_obj(pair);
+  if (exists && old == score) {
+    return 0;
+  }
+  if (!zsl_insert(zs->zsl, score, member, len)) {
+    return -1;
+  }
+  if (dict_set(zs->dict, member, len, (char*)&score, sizeof(double)) == -1) {
+    zsl_delete(zs->zsl, score, member, len);
+    return -1;
+  }
+  if (exists) {
+    zsl_delete(zs->zsl, old, member, len);
+  }
+  return !exists;
+}
+
+bool zset_iter_get(struct zset_iter* it, const char** member, size_t* len,
+                   double* score) {
+  if (it->pair->enc == ENC_COMPACT) {
+    if (!it->p) {
+      return false;
+    }
+    *member = lp_get(it->p, len);
+    *score = lp_score(lp_next(pair_obj(it->pair), it->p));
+    return true;
+  }
+  if (!it->node) {
+    return false;
+  }
+  *member = it->node->member;
+  *len = it->node->len;
+  *score = it->node->score;
+  return true;
+}
+
+void zset_iter_next(struct zset_iter* it) {
+  if (it->pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(it->pair);
+    if (it->rev) {
+      unsigned char* p = lp_prev(lp, it->p);
+      it->p = p ? lp_prev(lp, p) : NULL;
+    } else {
+      it->p = lp_next(lp, lp_next(lp, it->p));
+    }
+  } else {
+    it->node = it->rev ? it->node->backward : it->node->level[0].forward;
+  }
+}
+
+// zset_seek_rank positions the iterator at the 0-based rank, counted from
+// the end if rev.
+void zset_seek_rank(struct pair* pair, size_t rank, bool rev,
+                    struct zset_iter* it) {
+  *it = (struct zset_iter){.pair = pair, .rev = rev};
+  if (pair->enc == ENC_COMPACT) {
+    long index = 2 * (long)rank;
+    it->p = lp_seek(pair_obj(pair), rev ? -index - 2 : index);
+  } else {
+    struct skiplist* zsl = ((struct zset*)pair_obj(pair))->zsl;
+    it->node = zsl_by_rank(zsl, rev ? zsl->len - rank : rank + 1);
+  }
+}
+
+// zset_seek_score positions the iterator at the first member in the score
+// range, or the last if rev. The other end of the range is left to the
+// caller.
+static void zset_seek_score(struct pair* pair, const struct zrange* range,
+                            bool rev, struct zset_iter* it) {
+  *it = (struct zset_iter){.pair = pair, .rev = rev};
+  if (pair->enc == ENC_FULL) {
+    struct skiplist* zsl = ((struct zset*)pair_obj(pair))->zsl;
+    it->node =
+        rev ? zsl_last_in_range(zsl, range) : zsl_first_in_range(zsl, range);
+    return;
+  }
+  unsigned char* lp = pair_obj(pair);
+  it->p = rev ? lp_seek(lp, -2) : lp_first(lp);
+  const char* member;
+  size_t len;
+  double score;
+  while (zset_iter_get(it, &member, &len, &score)) {
+    if (rev ? zrange_lte_max(score, range) : zrange_gte_min(score, range)) {
+      break;
+    }
+    zset_iter_next(it);
+  }
+}
+
+// zset_seek_lex is zset_seek_score for member ranges.
+static void zset_seek_lex(struct pair* pair, const struct zlexrange* range,
+                          bool rev, struct zset_iter* it) {
+  *it = (struct zset_iter){.pair = pair, .rev = rev};
+  if (pair->enc == ENC_FULL) {
+    struct skiplist* zsl = ((struct zset*)pair_obj(pair))->zsl;
+    it->node =
+        rev ? zsl_last_in_lex(zsl, range) : zsl_first_in_lex(zsl, range);
+    return;
+  }
+  unsigned char* lp = pair_obj(pair);
+  it->p = rev ? lp_seek(lp, -2) : lp_first(lp);
+  const char* member;
+  size_t len;
+  double score;
+  while (zset_iter_get(it, &member, &len, &score)) {
+    if (rev ? zlex_lte_max(member, len, range)
+            : zlex_gte_min(member, len, range)) {
+      break;
+    }
+    zset_iter_next(it);
+  }
+}
+
+// zset_rank returns the 0-based rank of the member, counted from the end if
+// rev, or -1 if it does not exist.
+static int64_t zset_rank(struct pair* pair, const char* member, size_t len,
+                         bool rev) {
+  int64_t rank = -1;
+  if (pair->enc == ENC_COMPACT) {
+    unsigned char* lp = pair_obj(pair);
+    int64_t i = 0;
+    for (unsigned char* p = lp_first(lp); p;
+         p = lp_next(lp, lp_next(lp, p)), i++) {
+      size_t mlen;
+      const char* m = lp_get(p, &mlen);
+      if (mlen == len && memcmp(m, member, len) == 0) {
+        rank = i;
+        break;
+      }
+    }
+  } else {
+    double score;
+    if (zset_score(pair, member, len, &score)) {
+      rank = zsl_rank(((struct zset*)pair_obj(pair))->zsl, score, member,
+                      len) - 1;
+    }
+  }
+  if (rank >= 0 && rev) {
+    rank = zset_len(pair) - 1 - rank;
+  }
+  return rank;
+}
+
+// parse_zrange parses the min and max of a score range, such as "(1" or
+// "-inf".
+static bool parse_zrange(const char* min, size_t minlen, const char* max,
+                         size_t maxlen, struct zrange* range) {
+  range->minex = minlen > 0 && min[0] == '(';
+  range->maxex = maxlen > 0 && max[0] == '(';
+  return parse_score(min + range->minex, minlen - range->minex,
+                     &range->min) &&
+         parse_score(max + range->maxex, maxlen - range->maxex, &range->max);
+}
+
+// parse_lex parses an end of a member range: "-", "+", "[member" or
+// "(member".
+static bool parse_lex(const char* str, size_t len, const char** data,
+                      size_t* dlen, bool* ex, int* inf) {
+  *data = NULL;
+  *dlen = 0;
+  *ex = false;
+  *inf = 0;
+  if (len == 1 && (str[0] == '-' || str[0] == '+')) {
+    *inf = str[0] == '-' ? -1 : 1;
+    return true;
+  }
+  if (len == 0 || (str[0] != '(' && str[0] != '[')) {
+    return false;
+  }
+  *ex = str[0] == '(';
+  *data = str + 1;
+  *dlen = len - 1;
+  return true;
+}
+
+static bool parse_zlexrange(const char* min, size_t minlen, const char* max,
+                            size_t maxlen, struct zlexrange* range) {
+  return parse_lex(min, minlen, &range->min, &range->minlen, &range->minex,
+                   &range->mininf) &&
+         parse_lex(max, maxlen, &range->max, &range->maxlen, &range->maxex,
+                   &range->maxinf);
+}
+
+// ZADD key [NX|XX] [GT|LT] [CH] [INCR] score member [score member ...]
+void cmdZADD(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  bool nx = false, xx = false, gt = false, lt = false, ch = false;
+  bool incr = false;
+  int i = 2;
+  for (; i < nargs; i++) {
+    if (miniredis_args_eq(args, i, "nx")) {
+      nx = true;
+    } else if (miniredis_args_eq(args, i, "xx")) {
+      xx = true;
+    } else if (miniredis_args_eq(args, i, "gt")) {
+      gt = true;
+    } else if (miniredis_args_eq(args, i, "lt")) {
+      lt = true;
+    } else if (miniredis_args_eq(args, i, "ch")) {
+      ch = true;
+    } else if (miniredis_args_eq(args, i, "incr")) {
+      incr = true;
+    } else {
+      break;
+    }
+  }
+  int nelems = nargs - i;
+  if (nelems == 0 || nelems % 2 != 0) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  if (nx && xx) {
+    miniredis_conn_write_error(
+        conn, "ERR XX and NX options at the same time are not compatible");
+    return;
+  }
+  if ((gt && nx) || (lt && nx) || (gt && lt)) {
+    miniredis_conn_write_error(
+        conn,
+        "ERR GT, LT, and/or NX options at the same time are not compatible");
+    return;
+  }
+  if (incr && nelems > 2) {
+    miniredis_conn_write_error(
+        conn, "ERR INCR option supports a single increment-element pair");
+    return;
+  }
+  for (int j = i; j < nargs; j += 2) {
+    size_t len;
+    const char* str = miniredis_args_at(args, j, &len);
+    double score;
+    if (!parse_score(str, len, &score)) {
+      miniredis_conn_write_error(conn, "ERR value is not a valid float");
+      return;
+    }
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  if (!pair && xx) {
+    if (incr) {
+      miniredis_conn_write_null(conn);
+    } else {
+      miniredis_conn_write_int(conn, 0);
+    }
+    return;
+  }
+  if (!pair && !lookup_or_create(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  size_t mem = pair_memory(pair);
+  int64_t added = 0, changed = 0;
+  double score = 0;
+  bool skipped = false;
+  for (int j = i; j < nargs; j += 2) {
+    size_t slen, len;
+    const char* str = miniredis_args_at(args, j, &slen);
+    const char* member = miniredis_args_at(args, j + 1, &len);
+    parse_score(str, slen, &score);
+    double old;
+    bool exists = zset_score(pair, member, len, &old);
+    skipped = (exists && nx) || (!exists && xx);
+    if (!skipped && exists && incr) {
+      score += old;
+      if (isnan(score)) {
+        db_modified(server, pair, mem);
+        miniredis_conn_write_error(conn,
+                                   "ERR resulting score is not a number (NaN)");
+        return;
+      }
+    }
+    if (!skipped && exists && ((gt && score <= old) || (lt && score >= old))) {
+      skipped = true;
+    }
+    if (skipped) {
+      continue;
+    }
+    int res = zset_set(server, pair, member, len, score);
+    if (res == -1) {
+      db_modified(server, pair, mem);
+      if (zset_len(pair) == 0) {
+        db_remove(server, pair);
+      }
+      miniredis_conn_write_error(conn, "ERR out of memory");
+      return;
+    }
+    added += res;
+    changed += res == 1 || (exists && old != score);
+  }
+  if (changed > 0) {
+    db_modified(server, pair, mem);
+  }
+  if (zset_len(pair) == 0) {
+    db_remove(server, pair);
+  }
+  if (incr) {
+    if (skipped) {
+      miniredis_conn_write_null(conn);
+    } else {
+      miniredis_conn_write_double(conn, score);
+    }
+  } else {
+    miniredis_conn_write_int(conn, ch ? changed : added);
+  }
+}
+
+// ZINCRBY key increment member
+void cmdZINCRBY(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  size_t slen, len;
+  const char* str = miniredis_args_at(args, 2, &slen);
+  const char* member = miniredis_args_at(args, 3, &len);
+  double score;
+  if (!parse_score(str, slen, &score)) {
+    miniredis_conn_write_error(conn, "ERR value is not a valid float");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_or_create(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  double old;
+  if (zset_score(pair, member, len, &old)) {
+    score += old;
+  }
+  size_t mem = pair_memory(pair);
+  int res = isnan(score) ? -2 : zset_set(server, pair, member, len, score);
+  db_modified(server, pair, mem);
+  if (zset_len(pair) == 0) {
+    db_remove(server, pair);
+  }
+  if (res == -2) {
+    miniredis_conn_write_error(conn,
+                               "ERR resulting score is not a number (NaN)");
+  } else if (res == -1) {
+    miniredis_conn_write_error(conn, "ERR out of memory");
+  } else {
+    miniredis_conn_write_double(conn, score);
+  }
+}
+
+// ZREM key member [member ...]
+void cmdZREM(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  int removed = 0;
+  if (pair) {
+    size_t mem = pair_memory(pair);
+    for (int i = 2; i < nargs; i++) {
+      size_t len;
+      const char* member = miniredis_args_at(args, i, &len);
+      removed += zset_del(pair, member, len);
+    }
+    // removing nothing leaves the key as it was, for WATCH and tracking too
+    if (removed > 0) {
+      db_modified(server, pair, mem);
+    }
+    if (zset_len(pair) == 0) {
+      db_remove(server, pair);
+    }
+  }
+  miniredis_conn_write_int(conn, removed);
+}
+
+// ZCARD key
+void cmdZCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 2) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    miniredis_conn_write_int(conn, pair ? zset_len(pair) : 0);
+  }
+}
+
+// ZSCORE key member
+void cmdZSCORE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  size_t len;
+  const char* member = miniredis_args_at(args, 2, &len);
+  double score;
+  if (!pair || !zset_score(pair, member, len, &score)) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  miniredis_conn_write_double(conn, score);
+}
+
+// zset_rank_command implements ZRANK and ZREVRANK.
+static void zset_rank_command(struct miniredis_conn* conn,
+                              struct miniredis_args* args,
+                              struct server* server, bool rev) {
+  if (miniredis_args_count(args) != 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  size_t len;
+  const char* member = miniredis_args_at(args, 2, &len);
+  int64_t rank = pair ? zset_rank(pair, member, len, rev) : -1;
+  if (rank < 0) {
+    miniredis_conn_write_null(conn);
+  } else {
+    miniredis_conn_write_int(conn, rank);
+  }
+}
+
+// ZRANK key member
+void cmdZRANK(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata) {
+  zset_rank_command(conn, args, udata, false);
+}
+
+// ZREVRANK key member
+void cmdZREVRANK(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata) {
+  zset_rank_command(conn, args, udata, true);
+}
+
+// ZCOUNT key min max
+void cmdZCOUNT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  if (miniredis_args_count(args) != 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  size_t minlen, maxlen;
+  const char* min = miniredis_args_at(args, 2, &minlen);
+  const char* max = miniredis_args_at(args, 3, &maxlen);
+  struct zrange range;
+  if (!parse_zrange(min, minlen, max, maxlen, &range)) {
+    miniredis_conn_write_error(conn, "ERR min or max is not a float");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  int64_t count = 0;
+  if (pair && pair->enc == ENC_FULL) {
+    // the difference of the ranks of both ends
+    struct skiplist* zsl = ((struct zset*)pair_obj(pair))->zsl;
+    struct zsl_node* first = zsl_first_in_range(zsl, &range);
+    if (first) {
+      struct zsl_node* last = zsl_last_in_range(zsl, &range);
+      count = zsl_rank(zsl, last->score, last->member, last->len) -
+              zsl_rank(zsl, first->score, first->member, first->len) + 1;
+    }
+  } else if (pair) {
+    struct zset_iter it;
+    zset_seek_score(pair, &range, false, &it);
+    const char* member;
+    size_t len;
+    double score;
+    while (zset_iter_get(&it, &member, &len, &score) &&
+           zrange_lte_max(score, &range)) {
+      count++;
+      zset_iter_next(&it);
+    }
+  }
+  miniredis_conn_write_int(conn, count);
+}
+
+// ZRANGE key start stop [BYSCORE|BYLEX] [REV] [LIMIT offset count]
+//   [WITHSCORES]
+void cmdZRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata) {
+  struct server* server = udata;
+  int nargs = miniredis_args_count(args);
+  if (nargs < 4) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  bool byscore = false, bylex = false, rev = false, withscores = false;
+  bool limited = false;
+  int64_t offset = 0, limit = -1;
+  for (int i = 4; i < nargs; i++) {
+    if (miniredis_args_eq(args, i, "byscore")) {
+      byscore = true;
+    } else if (miniredis_args_eq(args, i, "bylex")) {
+      bylex = true;
+    } else if (miniredis_args_eq(args, i, "rev")) {
+      rev = true;
+    } else if (miniredis_args_eq(args, i, "withscores")) {
+      withscores = true;
+    } else if (miniredis_args_eq(args, i, "limit") && i + 2 < nargs) {
+      if (!argtoint(args, i + 1, &offset) || !argtoint(args, i + 2, &limit)) {
+        miniredis_conn_write_error(
+            conn, "ERR value is not an integer or out of range");
+        return;
+      }
+      limited = true;
+      i += 2;
+    } else {
+      miniredis_conn_write_error(conn, "ERR syntax error");
+      return;
+    }
+  }
+  if (byscore && bylex) {
+    miniredis_conn_write_error(conn, "ERR syntax error");
+    return;
+  }
+  if (limited && !byscore && !bylex) {
+    miniredis_conn_write_error(conn,
+                               "ERR syntax error, LIMIT is only supported in "
+                               "combination with either BYSCORE or BYLEX");
+    return;
+  }
+  if (withscores && bylex) {
+    miniredis_conn_write_error(conn,
+                               "ERR syntax error, WITHSCORES not supported in "
+                               "combination with BYLEX");
+    return;
+  }
+  // with REV the range is given from max to min
+  size_t startlen, stoplen;
+  const char* start = miniredis_args_at(args, 2, &startlen);
+  const char* stop = miniredis_args_at(args, 3, &stoplen);
+  if ((byscore || bylex) && rev) {
+    const char* t = start;
+    size_t tlen = startlen;
+    start = stop;
+    startlen = stoplen;
+    stop = t;
+    stoplen = tlen;
+  }
+  struct zrange range;
+  struct zlexrange lexrange;
+  int64_t from = 0, to = 0;
+  if (byscore && !parse_zrange(start, startlen, stop, stoplen, &range)) {
+    miniredis_conn_write_error(conn, "ERR min or max is not a float");
+    return;
+  }
+  if (bylex && !parse_zlexrange(start, startlen, stop, stoplen, &lexrange)) {
+    miniredis_conn_write_error(conn,
+                               "ERR min or max not valid string range item");
+    return;
+  }
+  if (!byscore && !bylex &&
+      (!argtoint(args, 2, &from) || !argtoint(args, 3, &to))) {
+    miniredis_conn_write_error(conn,
+                               "ERR value is not an integer or out of range");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  struct buf buf = {0};
+  int64_t n = 0;
+  if (pair) {
+    struct zset_iter it;
+    int64_t count = INT64_MAX;
+    if (byscore) {
+      zset_seek_score(pair, &range, rev, &it);
+    } else if (bylex) {
+      zset_seek_lex(pair, &lexrange, rev, &it);
+    } else {
+      int64_t len = zset_len(pair);
+      if (from < 0) from += len;
+      if (to < 0) to += len;
+      if (from < 0) from = 0;
+      if (to >= len) to = len - 1;
+      count = from <= to ? to - from + 1 : 0;
+      zset_seek_rank(pair, count ? from : 0, rev, &it);
+    }
+    if (limited && limit >= 0) {
+      count = limit;
+    }
+    if (offset < 0) {
+      count = 0;
+    }
+    const char* member;
+    size_t len;
+    double score;
+    while (n < count && zset_iter_get(&it, &member, &len, &score)) {
+      if (byscore && !(rev ? zrange_gte_min(score, &range)
+                           : zrange_lte_max(score, &range))) {
+        break;
+      }
+      if (bylex && !(rev ? zlex_gte_min(member, len, &lexrange)
+                         : zlex_lte_max(member, len, &lexrange))) {
+        break;
+      }
+      zset_iter_next(&it);
+      if (offset > 0) {
+        offset--;
+        continue;
+      }
+      miniredis_write_bulk(&buf, member, len);
+      if (withscores) {
+        char str[32];
+        miniredis_write_bulk(&buf, str, miniredis_format_double(str, score));
+      }
+      n++;
+    }
+  }
+  miniredis_conn_write_array(conn, withscores ? n * 2 : n);
+  miniredis_conn_write_raw(conn, buf.data, buf.len);
+  buf_clear(&buf);
+}
+
+// zset_pop implements ZPOPMIN and ZPOPMAX.
+static void zset_pop(struct miniredis_conn* conn, struct miniredis_args* args,
+                     struct server* server, bool max) {
+  int nargs = miniredis_args_count(args);
+  if (nargs < 2 || nargs > 3) {
+    miniredis_conn_write_error(conn, "ERR wrong number of arguments");
+    return;
+  }
+  int64_t count = 1;
+  if (nargs == 3 && (!argtoint(args, 2, &count) || count < 0)) {
+    miniredis_conn_write_error(
+        conn, "ERR value is out of range, must be positive");
+    return;
+  }
+  struct pair* pair;
+  if (!lookup_key(conn, server, args, 1, TYPE_ZSET, &pair)) {
+    return;
+  }
+  if (!pair) {
+    miniredis_conn_write_array(conn, 0);
+    return;
+  }
+  if ((size_t)count > zset_len(pair)) {
+    count = zset_len(pair);
+  }
+  miniredis_conn_write_array(conn, count * 2);
+  size_t mem = pair_memory(pair);
+  struct buf member = {0};
+  for (int64_t i = 0; i < count; i++) {
+    struct zset_iter it;
+    zset_seek_rank(pair, 0, max, &it);
+    const char* m;
+    size_t len;
+    double score;
+    zset_iter_get(&it, &m, &len, &score);
+    miniredis_conn_write_bulk(conn, m, len);
+    miniredis_conn_write_double(conn, score);
+    // the member is freed along with its node
+    member.len = 0;
+    if (!buf_append(&member, m, len)) {
+      break;
+    }
+    zset_del(pair, member.data, member.len);
+  }
+  buf_clear(&member);
+  db_modified(server, pair, mem);
+  if (zset_len(pair) == 0) {
+    db_remove(server, pair);
+  }
+}
+
+// ZPOPMIN key [count]
+void cmdZPOPMIN(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  zset_pop(conn, args, udata, false);
+}
+
+// ZPOPMAX key [count]
+void cmdZPOPMAX(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata) {
+  zset_pop(conn, args, udata, true);
+}
+
+// Bitmaps are strings, addressed from the most significant bit of the first
+// byte. Writes past the end grow the string with zeros, up to 2^32 bits.
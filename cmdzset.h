@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "miniredis.h"
+
+// Sorted sets are a listpack of member and score pairs, ordered by score and
+// then by member, until they outgrow the listpack limits. They are then a
+// dict from member to score, for lookups, along with a skiplist for ordered
+// access.
+
+struct dict;
+struct pair;
+struct server;
+struct skiplist;
+struct zsl_node;
+
+struct zset {
+  struct dict* dict;
+  struct skiplist* zsl;
+};
+
+// zset_iter walks a sorted set in either direction.
+struct zset_iter {
+  struct pair* pair;
+  bool rev;
+  unsigned char* p;
+  struct zsl_node* node;
+};
+
+void zset_free(struct zset* zs);
+size_t zset_memory(struct zset* zs);
+bool parse_score(const char* str, size_t len, double* x);
+int zset_set(struct server* server, struct pair* pair, const char* member,
+             size_t len, double score);
+bool zset_iter_get(struct zset_iter* it, const char** member, size_t* len,
+                   double* score);
+void zset_iter_next(struct zset_iter* it);
+void zset_seek_rank(struct pair* pair, size_t rank, bool rev,
+                    struct zset_iter* it);
+void cmdZADD(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdZINCRBY(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdZREM(struct miniredis_conn* conn, struct miniredis_args* args,
+             void* udata);
+void cmdZCARD(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdZSCORE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdZRANK(struct miniredis_conn* conn, struct miniredis_args* args,
+              void* udata);
+void cmdZREVRANK(struct miniredis_conn* conn, struct miniredis_args* args,
+                 void* udata);
+void cmdZCOUNT(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdZRANGE(struct miniredis_conn* conn, struct miniredis_args* args,
+               void* udata);
+void cmdZPOPMIN(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
+void cmdZPOPMAX(struct miniredis_conn* conn, struct miniredis_args* args,
+                void* udata);
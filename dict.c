@@ -0,0 +1,131 @@
+#include "dict.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+
+struct dict {
+  struct hashmap* map;
+  size_t memory;
+};
+
+static uint64_t entry_hash(const void* item) {
+  struct dict_entry* entry = *(struct dict_entry**)item;
+  return hashmap_xxhash(entry->key, entry->keylen);
+}
+
+static int entry_compare(const void* a, const void* b) {
+  struct dict_entry* ea = *(struct dict_entry**)a;
+  struct dict_entry* eb = *(struct dict_entry**)b;
+  if (ea->keylen != eb->keylen) {
+    return ea->keylen < eb->keylen ? -1 : 1;
+  }
+  return memcmp(ea->key, eb->key, ea->keylen);
+}
+
+struct dict* dict_new(void) {
+  struct dict* dict = malloc(sizeof(struct dict));
+  if (!dict) {
+    return NULL;
+  }
+  dict->map = hashmap_new(sizeof(struct dict_entry*), 0, entry_hash,
+                          entry_compare);
+  if (!dict->map) {
+    free(dict);
+    return NULL;
+  }
+  dict->memory = 0;
+  return dict;
+}
+
+void dict_free(struct dict* dict) {
+  if (!dict) return;
+  size_t i = 0;
+  void* item;
+  while (hashmap_iter(dict->map, &i, &item)) {
+    free(*(struct dict_entry**)item);
+  }
+  hashmap_free(dict->map);
+  free(dict);
+}
+
+size_t dict_count(struct dict* dict) { return hashmap_count(dict->map); }
+
+// dict_memory returns the number of bytes allocated for the dict and its
+// entries.
+size_t dict_memory(struct dict* dict) {
+  return malloc_usable_size(dict) + hashmap_memory(dict->map) + dict->memory;
+}
+
+struct dict_entry* dict_get(struct dict* dict, const char* key,
+                            size_t keylen) {
+  struct dict_entry kentry = {.key = key, .keylen = keylen};
+  struct dict_entry* pkey = &kentry;
+  struct dict_entry** pentry = hashmap_get(dict->map, &pkey);
+  return pentry ? *pentry : NULL;
+}
+
+// dict_set inserts or replaces the value of key. Returns 1 if the key was
+// added, 0 if its value was replaced, or -1 when out of memory.
+int dict_set(struct dict* dict, const char* key, size_t keylen,
+             const char* val, size_t vallen) {
+  struct dict_entry* prev = dict_get(dict, key, keylen);
+  if (prev && prev->vallen == vallen) {
+    memcpy(prev->data + keylen + 1, val, vallen);
+    return 0;
+  }
+  struct dict_entry* entry =
+      malloc(sizeof(struct dict_entry) + keylen + 1 + vallen + 1);
+  if (!entry) {
+    return -1;
+  }
+  entry->key = entry->data;
+  entry->keylen = keylen;
+  entry->vallen = vallen;
+  memcpy(entry->data, key, keylen);
+  entry->data[keylen] = '\0';
+  memcpy(entry->data + keylen + 1, val, vallen);
+  entry->data[keylen + 1 + vallen] = '\0';
+  struct dict_entry** pprev = hashmap_set(dict->map, &entry);
+  if (!pprev && hashmap_oom(dict->map)) {
+    free(entry);
+    return -1;
+  }
+  dict->memory += malloc_usable_size(entry);
+  if (pprev) {
+    dict->memory -= malloc_usable_size(*pprev);
+    free(*pprev);
+    return 0;
+  }
+  return 1;
+}
+
+// dict_delete removes the key. Returns false if it does not exist.
+bool dict_delete(struct dict* dict, const char* key, size_t keylen) {
+  struct dict_entry kentry = {.key = key, .keylen = keylen};
+  struct dict_entry* pkey = &kentry;
+  struct dict_entry** pentry = hashmap_delete(dict->map, &pkey);
+  if (!pentry) {
+    return false;
+  }
+  dict->memory -= malloc_usable_size(*pentry);
+  free(*pentry);
+  return true;
+}
+
+// dict_iter iterates over the entries, starting with *i set to zero. The
+// position can be used as a cursor for incremental scans.
+bool dict_iter(struct dict* dict, size_t* i, struct dict_entry** entry) {
+  void* item;
+  if (!hashmap_iter(dict->map, i, &item)) {
+    return false;
+  }
+  *entry = *(struct dict_entry**)item;
+  return true;
+}
+
+const char* dict_entry_val(struct dict_entry* entry) {
+  return entry->data + entry->keylen + 1;
+}
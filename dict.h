@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// dict maps binary safe keys to binary safe values. Keys and values are
+// stored together, null-terminated, in a single allocation per entry.
+struct dict_entry {
+  const char* key;
+  uint32_t keylen;
+  uint32_t vallen;
+  char data[];
+};
+
+struct dict;
+
+struct dict* dict_new(void);
+void dict_free(struct dict* dict);
+size_t dict_count(struct dict* dict);
+size_t dict_memory(struct dict* dict);
+struct dict_entry* dict_get(struct dict* dict, const char* key, size_t keylen);
+int dict_set(struct dict* dict, const char* key, size_t keylen,
+             const char* val, size_t vallen);
+bool dict_delete(struct dict* dict, const char* key, size_t keylen);
+bool dict_iter(struct dict* dict, size_t* i, struct dict_entry** entry);
+const char* dict_entry_val(struct dict_entry* entry);
@@ -0,0 +1,171 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct retired {
+  void* ptr;
+  void (*release)(void* ptr);
+};
+
+// limbo holds the memory retired during one epoch.
+struct limbo {
+  struct retired* items;
+  size_t len;
+  size_t cap;
+};
+
+struct epoch_reader {
+  // announced epoch shifted left, with the low bit set while inside a
+  // section, or zero. On its own cache line, as only its reader writes it.
+  _Alignas(64) _Atomic uint64_t state;
+  struct epoch* epoch;
+  struct epoch_reader* next;
+};
+
+struct epoch {
+  _Atomic uint64_t global;
+  pthread_mutex_t lock;  // guards the readers list and the limbo lists
+  struct epoch_reader* readers;
+  struct limbo limbo[3];  // by epoch modulo 3
+  _Atomic size_t pending;
+};
+
+struct epoch* epoch_new(void) {
+  struct epoch* epoch = calloc(1, sizeof(struct epoch));
+  if (!epoch) {
+    return NULL;
+  }
+  pthread_mutex_init(&epoch->lock, NULL);
+  return epoch;
+}
+
+static void limbo_free(struct limbo* limbo) {
+  for (size_t i = 0; i < limbo->len; i++) {
+    limbo->items[i].release(limbo->items[i].ptr);
+  }
+  free(limbo->items);
+  memset(limbo, 0, sizeof(struct limbo));
+}
+
+// epoch_free frees everything still retired. No reader may be inside a
+// section.
+void epoch_free(struct epoch* epoch) {
+  if (!epoch) return;
+  for (int i = 0; i < 3; i++) {
+    limbo_free(&epoch->limbo[i]);
+  }
+  while (epoch->readers) {
+    struct epoch_reader* next = epoch->readers->next;
+    free(epoch->readers);
+    epoch->readers = next;
+  }
+  pthread_mutex_destroy(&epoch->lock);
+  free(epoch);
+}
+
+// epoch_register returns the reader record of a thread, which lives as long
+// as the epoch. Returns NULL when out of memory.
+struct epoch_reader* epoch_register(struct epoch* epoch) {
+  struct epoch_reader* reader =
+      aligned_alloc(_Alignof(struct epoch_reader), sizeof(struct epoch_reader));
+  if (!reader) {
+    return NULL;
+  }
+  atomic_init(&reader->state, 0);
+  reader->epoch = epoch;
+  pthread_mutex_lock(&epoch->lock);
+  reader->next = epoch->readers;
+  epoch->readers = reader;
+  pthread_mutex_unlock(&epoch->lock);
+  return reader;
+}
+
+// epoch_enter starts a read-side section, during which memory reached by the
+// thread is not freed. Sections do not nest.
+void epoch_enter(struct epoch_reader* reader) {
+  uint64_t e = atomic_load(&reader->epoch->global);
+  for (;;) {
+    atomic_store(&reader->state, e << 1 | 1);
+    // the epoch may have moved on before the announcement was seen, in which
+    // case memory retired since may already be freed
+    uint64_t now = atomic_load(&reader->epoch->global);
+    if (now == e) {
+      return;
+    }
+    e = now;
+  }
+}
+
+void epoch_exit(struct epoch_reader* reader) {
+  atomic_store_explicit(&reader->state, 0, memory_order_release);
+}
+
+// epoch_wait waits for every reader inside a section to leave it.
+static void epoch_wait(struct epoch* epoch) {
+  pthread_mutex_lock(&epoch->lock);
+  for (struct epoch_reader* r = epoch->readers; r; r = r->next) {
+    uint64_t state = atomic_load(&r->state);
+    while ((state & 1) && atomic_load(&r->state) == state) {
+      sched_yield();
+    }
+  }
+  pthread_mutex_unlock(&epoch->lock);
+}
+
+// epoch_retire hands memory that was unlinked from every shared structure
+// to the epoch, which frees it once no reader can still be using it. When
+// out of memory it waits for the readers and frees it right away.
+void epoch_retire(struct epoch* epoch, void* ptr,
+                  void (*release)(void* ptr)) {
+  if (!ptr) {
+    return;
+  }
+  pthread_mutex_lock(&epoch->lock);
+  struct limbo* limbo = &epoch->limbo[atomic_load(&epoch->global) % 3];
+  if (limbo->len == limbo->cap) {
+    size_t cap = limbo->cap ? limbo->cap * 2 : 64;
+    struct retired* items = realloc(limbo->items, cap * sizeof(*items));
+    if (!items) {
+      pthread_mutex_unlock(&epoch->lock);
+      epoch_wait(epoch);
+      release(ptr);
+      return;
+    }
+    limbo->items = items;
+    limbo->cap = cap;
+  }
+  limbo->items[limbo->len++] = (struct retired){ptr, release};
+  atomic_fetch_add(&epoch->pending, 1);
+  pthread_mutex_unlock(&epoch->lock);
+}
+
+// epoch_collect moves the global epoch on if every reader inside a section
+// has announced it, and frees the memory retired two epochs before, which
+// no reader can reach anymore. Called regularly by one of the writers.
+void epoch_collect(struct epoch* epoch) {
+  pthread_mutex_lock(&epoch->lock);
+  uint64_t e = atomic_load(&epoch->global);
+  for (struct epoch_reader* r = epoch->readers; r; r = r->next) {
+    uint64_t state = atomic_load(&r->state);
+    if ((state & 1) && state >> 1 != e) {
+      pthread_mutex_unlock(&epoch->lock);
+      return;
+    }
+  }
+  atomic_store(&epoch->global, e + 1);
+  struct limbo limbo = epoch->limbo[(e + 1) % 3];
+  memset(&epoch->limbo[(e + 1) % 3], 0, sizeof(struct limbo));
+  pthread_mutex_unlock(&epoch->lock);
+  atomic_fetch_sub(&epoch->pending, limbo.len);
+  limbo_free(&limbo);
+}
+
+// epoch_pending returns the number of retired allocations not freed yet.
+size_t epoch_pending(struct epoch* epoch) {
+  return atomic_load(&epoch->pending);
+}
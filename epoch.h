@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// epoch is epoch-based reclamation of memory that readers on other threads
+// may still be using. A reader announces the global epoch while inside a
+// read-side section. Memory unlinked by a writer is retired with the epoch
+// it was retired in, and freed only once the global epoch moved on twice,
+// which it can only do once every reader inside a section has announced the
+// current epoch. Readers never block and writers never wait for them: a
+// stalled reader only delays the frees.
+
+struct epoch;
+struct epoch_reader;
+
+struct epoch* epoch_new(void);
+void epoch_free(struct epoch* epoch);
+struct epoch_reader* epoch_register(struct epoch* epoch);
+void epoch_enter(struct epoch_reader* reader);
+void epoch_exit(struct epoch_reader* reader);
+void epoch_retire(struct epoch* epoch, void* ptr,
+                  void (*release)(void* ptr));
+void epoch_collect(struct epoch* epoch);
+size_t epoch_pending(struct epoch* epoch);
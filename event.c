@@ -1,3 +1,6 @@
+// accept4
+#define _GNU_SOURCE
+
 #include "event.h"
 
 #include <arpa/inet.h>
@@ -6,20 +9,33 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "buf.h"
-#include "hashmap.h"
+#include "chunk.h"
+#include "tsc.h"
 
 #define EDELAYNS 1000000000
+#define MAXRWIN (256 * 1024)
+#define MAXLOOPS 64
+#ifndef SPSC_SIZE
+#define SPSC_SIZE 1024  // smaller in tests, to fill the rings
+#endif
 
 #define panic(format, ...)                             \
   {                                                    \
@@ -41,13 +57,104 @@
 
 static bool wake(struct event_conn* conn);
 
+static size_t conn_pending(struct event_conn* conn) {
+  return conn->wbuf.len;
+}
+
+// conn_overflow closes the connection without flushing when its pending
+// output is over the hard limit, or over the soft limit for too long.
+static void conn_overflow(struct event_conn* conn) {
+  struct event_limits* limits = &conn->limits;
+  size_t pending = conn_pending(conn);
+  bool overflow = limits->hard && pending > limits->hard;
+  if (limits->soft && pending > limits->soft) {
+    int64_t now = event_now();
+    if (!conn->soft_since) {
+      conn->soft_since = now;
+    } else if (now - conn->soft_since > limits->soft_ns) {
+      overflow = true;
+    }
+  } else {
+    conn->soft_since = 0;
+  }
+  if (!overflow) {
+    return;
+  }
+  struct event* event = conn->event;
+  eprintf(false, "Client %s closed for overcoming of output buffer limits",
+          conn->addr);
+  chain_clear(&conn->wbuf, &event->pool);
+  event_conn_close(conn);
+}
+
 void event_conn_write(struct event_conn* conn, const void* data, ssize_t len) {
   if (conn->closed) {
     return;
   }
-  if (!buf_append(&conn->wbuf, data, len) || !wake(conn)) {
+  if (len < 0) {
+    len = strlen(data);
+  }
+  // the I/O threads write with pools of their own and leave the limits to
+  // the main thread
+  struct chunk_pool* pool = conn->io_pool ? conn->io_pool : &conn->event->pool;
+  if (!chain_append(&conn->wbuf, pool, data, len) || !wake(conn)) {
     return;
   }
+  if (!conn->io_pool && (conn->limits.hard || conn->limits.soft)) {
+    conn_overflow(conn);
+  }
+}
+
+// event_conn_write_shared queues a reference to the shared buffer rather than
+// a copy of it. Small buffers are copied anyway, a reference costs a chunk
+// header and an iovec entry of its own.
+void event_conn_write_shared(struct event_conn* conn,
+                             struct chunk_shared* shared) {
+  if (conn->closed) {
+    return;
+  }
+  if (shared->len < CHUNK_MINSHARED) {
+    event_conn_write(conn, shared->data, shared->len);
+    return;
+  }
+  if (!chain_append_shared(&conn->wbuf, shared) || !wake(conn)) {
+    return;
+  }
+  if (!conn->io_pool && (conn->limits.hard || conn->limits.soft)) {
+    conn_overflow(conn);
+  }
+}
+
+void event_conn_set_limits(struct event_conn* conn,
+                           struct event_limits limits) {
+  conn->limits = limits;
+}
+
+// event_conn_congested returns true when the pending output of the connection
+// is above its pause limit. Input should not be processed until it's flushed,
+// the data callback is invoked again with the unprocessed input once the
+// connection resumes.
+bool event_conn_congested(struct event_conn* conn) {
+  return conn->limits.pause && conn_pending(conn) > conn->limits.pause;
+}
+
+// event_conn_limited returns true when the pending output of the connection
+// is above any of its limits. The parse callback stops writing to it then,
+// and leaves the rest of the input to data, whose writes enforce them.
+bool event_conn_limited(struct event_conn* conn) {
+  size_t pending = conn_pending(conn);
+  struct event_limits* limits = &conn->limits;
+  return (limits->pause && pending > limits->pause) ||
+         (limits->hard && pending > limits->hard) ||
+         (limits->soft && pending > limits->soft);
+}
+
+// event_conn_expect is called by the data callback when the unprocessed input
+// holds an incomplete frame of known size. The input buffer is sized to hold
+// the whole frame, which is read straight into place, and the callback is not
+// invoked again until all of it has arrived.
+void event_conn_expect(struct event_conn* conn, size_t len) {
+  conn->expect = len;
 }
 
 void event_conn_close(struct event_conn* conn) {
@@ -66,43 +173,59 @@ void event_conn_set_udata(struct event_conn* conn, void* udata) {
   conn->udata = udata;
 }
 
+// listener is a listening socket, registered with the queue like a
+// connection.
+struct listener {
+  bool listener;  // always true
+  int fd;
+};
+
 static int net_queue() { return epoll_create1(0); }
 
-static int net_addrd(int qfd, int sfd) {
-  struct epoll_event ev = {0};
-  ev.events = EPOLLIN;
-  ev.data.fd = sfd;
-  return epoll_ctl(qfd, EPOLL_CTL_ADD, sfd, &ev);
-}
+// net_event is a ready socket, with ptr its listener or connection.
+struct net_event {
+  void* ptr;
+  bool rd;
+  bool wr;
+};
 
-static int net_addwr(int qfd, int sfd) {
+// net_addrd registers the socket for reads, or for both reads and writes when
+// edge-triggered, with ptr, a listener or a connection, as the data returned
+// by net_events.
+static int net_addrd(int qfd, int sfd, void* ptr, bool edge) {
   struct epoll_event ev = {0};
-  ev.events = EPOLLIN | EPOLLOUT;
-  ev.data.fd = sfd;
-  return epoll_ctl(qfd, EPOLL_CTL_MOD, sfd, &ev);
+  ev.events = edge ? EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET : EPOLLIN;
+  ev.data.ptr = ptr;
+  return epoll_ctl(qfd, EPOLL_CTL_ADD, sfd, &ev);
 }
 
-static int net_delwr(int qfd, int sfd) {
+static int net_interest(int qfd, int sfd, void* ptr, bool rd, bool wr) {
   struct epoll_event ev = {0};
-  ev.events = EPOLLIN;
-  ev.data.fd = sfd;
+  ev.events = (rd ? EPOLLIN : 0) | (wr ? EPOLLOUT : 0);
+  ev.data.ptr = ptr;
   return epoll_ctl(qfd, EPOLL_CTL_MOD, sfd, &ev);
 }
 
-static int net_events(int qfd, int* fds, int nfds, int64_t timeout_ns) {
-  struct epoll_event evs[nfds];  // VLA
+static int net_events(int qfd, struct net_event* nevs, int nevents,
+                      int64_t timeout_ns) {
+  struct epoll_event evs[nevents];  // VLA
   int n;
   if (timeout_ns < 0) {
-    n = epoll_wait(qfd, evs, nfds, -1);
+    n = epoll_wait(qfd, evs, nevents, -1);
   } else {
     if (timeout_ns > EDELAYNS) {
       timeout_ns = EDELAYNS;
     }
-    n = epoll_wait(qfd, evs, nfds, (int)(timeout_ns / 1000000));
+    // round up, so that the loop does not spin until a close deadline
+    n = epoll_wait(qfd, evs, nevents,
+                   (int)((timeout_ns + 999999) / 1000000));
   }
   if (n > 0) {
     for (int i = 0; i < n; i++) {
-      fds[i] = evs[i].data.fd;
+      uint32_t mask = evs[i].events;
+      nevs[i].ptr = evs[i].data.ptr;
+      nevs[i].rd = mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+      nevs[i].wr = mask & EPOLLOUT;
     }
   }
   return n;
@@ -156,6 +279,9 @@ void ipstr(const struct sockaddr* sa, char* s, size_t len) {
                 len - 7);
       strcat(s, "]");
       break;
+    case AF_UNIX:
+      snprintf(s, len, "unix://%s", ((struct sockaddr_un*)sa)->sun_path);
+      break;
     default:
       strncpy(s, "Unknown AF", len);
       return;
@@ -164,23 +290,27 @@ void ipstr(const struct sockaddr* sa, char* s, size_t len) {
 
 const char* event_conn_addr(struct event_conn* conn) { return conn->addr; }
 
-static void net_accept(struct event* event, int qfd, int sfd) {
-  struct event_conn* conn = NULL;
-  int cfd = -1;
-  struct sockaddr_storage addr;
-  socklen_t addrlen = sizeof(addr);
-  cfd = accept(sfd, (struct sockaddr*)&addr, &addrlen);
-  if (cfd < 0) goto fail;
-  if (setnonblock(cfd) == -1) goto fail;
-  if (setkeepalive(cfd) == -1) goto fail;
-  if (net_addrd(qfd, cfd) == -1) goto fail;
-  conn = malloc(sizeof(struct event_conn));
+// net_conn sets up an accepted connection. Returns false if it was rejected.
+static bool net_conn(struct event* event, int qfd, int cfd,
+                     struct sockaddr_storage* addr) {
+  struct event_conn* conn = calloc(1, sizeof(struct event_conn));
   if (!conn) goto fail;
-  memset(conn, 0, sizeof(struct event_conn));
+  bool local = addr->ss_family == AF_UNIX;
+  if (local) {
+    // the peer is usually unnamed, so the connection is known by the path
+    // it connected to
+    socklen_t addrlen = sizeof(*addr);
+    if (getsockname(cfd, (struct sockaddr*)addr, &addrlen) == -1) goto fail;
+  } else if (setkeepalive(cfd) == -1) {
+    goto fail;
+  }
   char saddr[256];
 
-  ipstr((struct sockaddr*)&addr, saddr, sizeof(saddr) - 1);
-  sprintf(saddr + strlen(saddr), ":%d", ((struct sockaddr_in*)&addr)->sin_port);
+  ipstr((struct sockaddr*)addr, saddr, sizeof(saddr) - 1);
+  if (!local) {
+    sprintf(saddr + strlen(saddr), ":%d",
+            ((struct sockaddr_in*)addr)->sin_port);
+  }
 
   size_t saddrlen = strlen(saddr);
   conn->addr = malloc(saddrlen + 1);
@@ -189,22 +319,102 @@ static void net_accept(struct event* event, int qfd, int sfd) {
   conn->fd = cfd;
   conn->qfd = qfd;
   conn->event = event;
-  if (hashmap_set(event->conns, &conn)) {
-    panic("duplicate fd %d", conn->fd);
-  } else if (hashmap_oom(event->conns)) {
-    goto fail;
+  conn->rwin = CHUNK_SIZE;
+  conn->rd = true;
+  if (net_addrd(qfd, cfd, conn, event->edge) == -1) goto fail;
+  event->nconns++;
+  event->stats.total_connections++;
+  if (event->events.opened) {
+    event->events.opened(conn, event->udata);
   }
-
-  return;
+  return true;
 fail:
-  if (cfd != -1) close(cfd);
   if (conn) {
-    if (conn->addr) free(conn->addr);
+    free(conn->addr);
     free(conn);
   }
+  return false;
 }
 
-static struct addr* addr_listen(struct event* event, const char* str) {
+// net_accept accepts all the pending connections of the listener, so a burst
+// of connections is taken in one wakeup.
+static void net_accept(struct event* event, int qfd, int sfd) {
+  for (;;) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int cfd = accept4(sfd, (struct sockaddr*)&addr, &addrlen,
+                      SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN) {
+        // out of fds or memory, the rest are accepted on a later wakeup
+        event->stats.rejected_connections++;
+      }
+      return;
+    }
+    if (!net_conn(event, qfd, cfd, &addr)) {
+      event->stats.rejected_connections++;
+      close(cfd);
+    }
+  }
+}
+
+// unix_listen listens on a unix socket, replacing a stale socket file left at
+// the path. The socket file gets the permissions perm, unless zero.
+static struct addr* unix_listen(struct event* event, const char* str,
+                                int perm) {
+  const char* path = str + 7;
+  struct sockaddr_un sun = {.sun_family = AF_UNIX};
+  if (!*path || strlen(path) >= sizeof(sun.sun_path)) {
+    eprintf(true, "Invalid address: %s", str);
+  }
+  strcpy(sun.sun_path, path);
+  struct addr* addr = calloc(1, sizeof(struct addr));
+  if (!addr) {
+    eprintf(true, "%s", strerror(ENOMEM));
+  }
+  addr->host = strdup(path);
+  addr->fds = malloc(sizeof(int));
+  addr->addrs = malloc(sizeof(char*));
+  if (!addr->host || !addr->fds || !addr->addrs) {
+    eprintf(true, "%s", strerror(ENOMEM));
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    eprintf(true, "socket: %s: %s", strerror(errno), str);
+  }
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+  if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) == -1) {
+    eprintf(true, "bind: %s: %s", strerror(errno), str);
+  }
+  if (perm && chmod(path, perm) == -1) {
+    eprintf(true, "chmod: %s: %s", strerror(errno), str);
+  }
+  if (setnonblock(fd) == -1) {
+    eprintf(true, "setnonblock: %s: %s", strerror(errno), str);
+  }
+  if (listen(fd, SOMAXCONN) == -1) {
+    eprintf(true, "listen: %s: %s", strerror(errno), str);
+  }
+  addr->fds[0] = fd;
+  addr->addrs[0] = strdup(str);
+  if (!addr->addrs[0]) {
+    eprintf(true, "%s", strerror(ENOMEM));
+  }
+  addr->nfds = 1;
+  return addr;
+}
+
+static struct addr* addr_listen(struct event* event, const char* str,
+                                struct event_options* options) {
+  if (strstr(str, "unix://") == str) {
+    return unix_listen(event, str, options->unix_perm);
+  }
   const char* host = str;
   if (strstr(str, "tcp://") == str) {
     host = str + 6;
@@ -332,27 +542,72 @@ static struct addr* addr_listen(struct event* event, const char* str) {
   return addr;
 }
 
+// ready_push adds the connection to the ready list, to be handled on the
+// next loop iteration.
+static void ready_push(struct event* event, struct event_conn* conn) {
+  if (conn->pprev) {
+    return;
+  }
+  conn->next = event->ready;
+  if (conn->next) {
+    conn->next->pprev = &conn->next;
+  }
+  conn->pprev = &event->ready;
+  event->ready = conn;
+}
+
+static void ready_remove(struct event_conn* conn) {
+  if (!conn->pprev) {
+    return;
+  }
+  *conn->pprev = conn->next;
+  if (conn->next) {
+    conn->next->pprev = conn->pprev;
+  }
+  conn->next = NULL;
+  conn->pprev = NULL;
+}
+
 static void close_remove_conn(struct event_conn* conn, struct event* event) {
-  buf_clear(&conn->wbuf);
+  if (event->events.closed) {
+    event->events.closed(conn, event->udata);
+  }
+  chain_clear(&conn->wbuf, &event->pool);
+  chunk_put(&event->pool, conn->rbuf);
   close(conn->fd);
-  hashmap_delete(event->conns, &conn);
+  ready_remove(conn);
+  event->nconns--;
   free(conn->addr);
   free(conn);
 }
 
-static int conn_compare(const void* a, const void* b) {
-  struct event_conn* ca = *(struct event_conn**)a;
-  struct event_conn* cb = *(struct event_conn**)b;
-  return ca->fd < cb->fd ? -1 : ca->fd > cb->fd ? 1 : 0;
+// conn_interest registers interest in the connection becoming readable or
+// writable, unless it's already registered. Edge-triggered connections stay
+// registered for both.
+static bool conn_interest(struct event_conn* conn, bool rd, bool wr) {
+  if (conn->event->edge || (conn->rd == rd && conn->wr == wr)) {
+    return true;
+  }
+  if (net_interest(conn->qfd, conn->fd, conn, rd, wr) == -1) {
+    return false;
+  }
+  conn->rd = rd;
+  conn->wr = wr;
+  return true;
 }
 
-static uint64_t conn_hash(const void* item) {
-  return (*(struct event_conn**)item)->fd;
+// held_full reports whether a held connection has buffered as much input as
+// it may read while held.
+static bool held_full(struct event_conn* conn) {
+  return conn->held && conn->rbuf &&
+         conn->rbuf->len - conn->rbuf->start >= conn->rwin;
 }
 
 static bool wake(struct event_conn* conn) {
   if (!conn->woke) {
-    if (net_addwr(conn->qfd, conn->fd) == -1) {
+    if (conn->event->edge) {
+      ready_push(conn->event, conn);
+    } else if (!conn_interest(conn, !conn->paused && !held_full(conn), true)) {
       return false;
     }
     conn->woke = true;
@@ -360,36 +615,82 @@ static bool wake(struct event_conn* conn) {
   return true;
 }
 
+// unwake is called once all output is flushed, it stops waiting for the
+// connection to become writable and resumes reading if it was paused.
 static bool unwake(struct event_conn* conn) {
-  if (conn->woke) {
-    if (net_delwr(conn->qfd, conn->fd) == -1) {
+  if (!conn_interest(conn, !held_full(conn), false)) {
+    return false;
+  }
+  conn->woke = false;
+  if (conn->paused) {
+    conn->resumed = true;
+  }
+  conn->paused = false;
+  return true;
+}
+
+// pause_reads stops reading from the connection until its output is flushed.
+static bool pause_reads(struct event_conn* conn) {
+  if (!conn->paused) {
+    if (!conn_interest(conn, false, true)) {
       return false;
     }
-    conn->woke = false;
+    conn->woke = true;
+    conn->paused = true;
   }
   return true;
 }
 
-static bool conn_flush(struct event* event, struct event_conn* conn) {
-  if (conn->wbuf.len > 0) {
-    for (size_t i = conn->wbuf_idx; i < conn->wbuf.len;) {
-      int n = write(conn->fd, conn->wbuf.data + i, conn->wbuf.len - i);
-      if (n == -1) {
-        if (errno == EAGAIN) {
-          if (!wake(conn)) {
-            close_remove_conn(conn, event);
-          } else {
-            conn->wbuf_idx = i;
-          }
-        } else {
-          close_remove_conn(conn, event);
-        }
-        return false;
-      }
-      i += n;
+// event_conn_hold stops processing the input of the connection until
+// event_conn_release is called, such as while a command waits for data.
+// Reading goes on, up to the read window, so that a peer that goes away is
+// still noticed.
+void event_conn_hold(struct event_conn* conn) { conn->held = true; }
+
+// event_conn_release resumes a held connection. Its buffered input is
+// processed once the connection is next polled.
+void event_conn_release(struct event_conn* conn) {
+  conn->held = false;
+  conn->resumed = true;
+  conn->woke = false;
+  if (!wake(conn)) {
+    event_conn_close(conn);
+  }
+}
+
+// conn_write writes the pending output of the connection until all of it is
+// written or the socket would block, adding what it wrote to written. Returns
+// zero or the errno of the failed write. It only uses the connection and the
+// pool, so I/O threads run it too.
+static int conn_write(struct event_conn* conn, struct chunk_pool* pool,
+                      size_t* written) {
+  while (conn->wbuf.len > 0) {
+    struct iovec iov[64];
+    int iovcnt = chain_iov(&conn->wbuf, iov, 64);
+    ssize_t n = writev(conn->fd, iov, iovcnt);
+    if (n == -1) {
+      return errno;
     }
-    conn->wbuf.len = 0;
-    conn->wbuf_idx = 0;
+    chain_consume(&conn->wbuf, pool, n);
+    *written += n;
+  }
+  return 0;
+}
+
+// conn_flushed completes a write of the connection that ended with err.
+// Returns false if the connection was removed or waits to become writable.
+static bool conn_flushed(struct event* event, struct event_conn* conn,
+                         int err) {
+  if (err == EAGAIN && event->edge) {
+    // resumed by the next EPOLLOUT edge
+    conn->woke = true;
+    return false;
+  }
+  if (err) {
+    if (err != EAGAIN || !wake(conn)) {
+      close_remove_conn(conn, event);
+    }
+    return false;
   }
   if (conn->closed) {
     close_remove_conn(conn, event);
@@ -402,6 +703,13 @@ static bool conn_flush(struct event* event, struct event_conn* conn) {
   return true;
 }
 
+static bool conn_flush(struct event* event, struct event_conn* conn) {
+  size_t written = 0;
+  int err = conn_write(conn, &event->pool, &written);
+  event->stats.net_output_bytes += written;
+  return conn_flushed(event, conn, err);
+}
+
 int64_t event_now() {
   struct timespec tm;
   if (clock_gettime(CLOCK_MONOTONIC, &tm) == -1) {
@@ -410,29 +718,471 @@ int64_t event_now() {
   return tm.tv_sec * 1000000000 + tm.tv_nsec;
 }
 
-static int which_socketfd(int fd, struct addr** addrs, int naddrs) {
-  for (int j = 0; j < naddrs; j++) {
-    for (int k = 0; k < addrs[j]->nfds; k++) {
-      if (fd == addrs[j]->fds[k]) {
-        return j;
+// conn_process passes the unprocessed input of the connection to the data
+// callback, unless it's known to still hold an incomplete frame. The input
+// chunk is returned to the pool once it is fully consumed, so idle connections
+// hold no buffers.
+static void conn_process(struct event* event, struct event_conn* conn) {
+  struct chunk* rbuf = conn->rbuf;
+  if (rbuf->len - rbuf->start < conn->expect) {
+    return;
+  }
+  conn->expect = 0;
+  if (event->events.data) {
+    conn->woke = true;
+    rbuf->start += event->events.data(conn, rbuf->data + rbuf->start,
+                                      rbuf->len - rbuf->start, event->udata);
+    conn->woke = false;
+  } else {
+    rbuf->start = rbuf->len;
+  }
+  if (rbuf->start == rbuf->len) {
+    chunk_put(&event->pool, rbuf);
+    conn->rbuf = NULL;
+  }
+}
+
+// conn_reserve makes room at the end of the input chunk for the rest of the
+// pending frame, or at least one more byte, plus the terminating zero.
+// Leftover input is moved to the front of the chunk, and a chunk too small for
+// the frame is replaced by one that fits it. The parser needs frames in one
+// piece, so input is copied rather than chained, but each byte only a bounded
+// number of times: a partial frame is moved to the front once, after which it
+// fits, and a chunk grows at least twofold, so the copies to grown chunks add
+// up to less than twice the frame.
+static bool conn_reserve(struct chunk_pool* pool, struct event_conn* conn) {
+  struct chunk* rbuf = conn->rbuf;
+  size_t pending = rbuf ? rbuf->len - rbuf->start : 0;
+  size_t need = conn->expect > pending ? conn->expect : pending + 1;
+  need++;
+  if (!rbuf) {
+    size_t cap = conn->rwin > need ? conn->rwin : need;
+    conn->rbuf = chunk_get(pool, cap);
+    return conn->rbuf != NULL;
+  }
+  if (rbuf->start + need <= rbuf->cap) {
+    return true;
+  }
+  if (need <= rbuf->cap) {
+    memmove(rbuf->data, rbuf->data + rbuf->start, pending);
+    rbuf->start = 0;
+    rbuf->len = pending;
+    return true;
+  }
+  // a frame is only announced up to the end of its next argument, so one
+  // with many large arguments grows the chunk many times, and inline
+  // commands are not announced at all
+  size_t cap = need > rbuf->cap * 2 ? need : rbuf->cap * 2;
+  struct chunk* grown = chunk_get(pool, cap);
+  if (!grown) {
+    return false;
+  }
+  memcpy(grown->data, rbuf->data + rbuf->start, pending);
+  grown->len = pending;
+  chunk_put(pool, rbuf);
+  conn->rbuf = grown;
+  return true;
+}
+
+// conn_fill reads once from the connection into its input chunk. Returns the
+// number of bytes read, zero when the socket would block, or -1 with errno
+// set when reading failed, to ECONNRESET when the peer closed the
+// connection. Like conn_write, I/O threads run it.
+static ssize_t conn_fill(struct event_conn* conn, struct chunk_pool* pool) {
+  if (!conn_reserve(pool, conn)) {
+    errno = ENOMEM;
+    return -1;
+  }
+  struct chunk* rbuf = conn->rbuf;
+  size_t room = rbuf->cap - rbuf->len - 1;
+  ssize_t n = read(conn->fd, rbuf->data + rbuf->len, room);
+  if (n <= 0) {
+    if (n == -1 && errno == EAGAIN) {
+      conn->readable = false;
+      if (rbuf->start == rbuf->len) {
+        chunk_put(pool, rbuf);
+        conn->rbuf = NULL;
+      }
+      return 0;
+    }
+    if (n == 0) {
+      errno = ECONNRESET;
+    }
+    return -1;
+  }
+  // pipelined clients that fill the whole input chunk get a larger one next
+  // time, and it shrinks back when they slow down
+  if (!conn->expect) {
+    if ((size_t)n == room && conn->rwin < MAXRWIN) {
+      conn->rwin *= 2;
+    } else if ((size_t)n < room / 4 && conn->rwin > CHUNK_SIZE) {
+      conn->rwin /= 2;
+    }
+  }
+  rbuf->len += n;
+  rbuf->data[rbuf->len] = '\0';
+  return n;
+}
+
+// conn_read reads from the connection until it would block or its pending
+// output is too large. Returns false if the connection was removed.
+static bool conn_read(struct event* event, struct event_conn* conn) {
+  if (conn->resumed) {
+    // process input that was left unprocessed when pausing
+    conn->resumed = false;
+    if (conn->rbuf && !conn->held) {
+      conn_process(event, conn);
+    }
+  }
+  while (!conn->closed) {
+    if (held_full(conn)) {
+      // enough input is buffered for when the connection is released, but
+      // errors are still reported without read interest
+      char ch;
+      ssize_t n = recv(conn->fd, &ch, 1, MSG_PEEK);
+      if (n == 0 || (n == -1 && errno != EAGAIN) ||
+          !conn_interest(conn, false, conn->wr)) {
+        close_remove_conn(conn, event);
+        return false;
       }
+      break;
+    }
+    if (event_conn_congested(conn)) {
+      // apply backpressure, the input stays in the socket buffer
+      if (!pause_reads(conn)) {
+        close_remove_conn(conn, event);
+        return false;
+      }
+      break;
+    }
+    ssize_t n = conn_fill(conn, &event->pool);
+    if (n == -1) {
+      if (errno == ENOMEM) {
+        eprintf(false, "%s", strerror(ENOMEM));
+      }
+      close_remove_conn(conn, event);
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    event->stats.net_input_bytes += n;
+    if (!conn->held) {
+      conn_process(event, conn);
+    }
+  }
+  return true;
+}
+
+// loops are the events of the running event loop threads, whose stats are
+// summed by event_stats.
+static struct event* loops[MAXLOOPS];
+static int nloops;
+
+// event_stats sums the counters of all the event loops.
+void event_stats(struct event_stats* stats) {
+  memset(stats, 0, sizeof(struct event_stats));
+  for (int i = 0; i < nloops; i++) {
+    struct event_stats* ls = &loops[i]->stats;
+    stats->connections += loops[i]->nconns;
+    stats->total_connections += ls->total_connections;
+    stats->rejected_connections += ls->rejected_connections;
+    stats->net_input_bytes += ls->net_input_bytes;
+    stats->net_output_bytes += ls->net_output_bytes;
+    stats->io_threaded_reads += ls->io_threaded_reads;
+    stats->io_threaded_writes += ls->io_threaded_writes;
+  }
+}
+
+// conn_handle flushes the output of the connection and processes its input,
+// then flushes the output that produced.
+static void conn_handle(struct event* event, struct event_conn* conn) {
+  ready_remove(conn);
+  if (!conn_flush(event, conn)) {
+    return;
+  }
+  if ((conn->readable || conn->resumed) &&
+      (!conn_read(event, conn) || !conn_flush(event, conn))) {
+    return;
+  }
+  // a connection that was resumed by the flush may hold input which it
+  // could not process while paused
+  while (conn->resumed) {
+    if (!conn_read(event, conn) || !conn_flush(event, conn)) {
+      break;
     }
   }
-  return -1;
 }
 
-struct event_conn* get_conn(struct event* event, int fd) {
-  struct event_conn key = {.fd = fd};
-  struct event_conn* keyptr = &key;
-  void* v = hashmap_get(event->conns, &keyptr);
-  if (!v) {
+// spsc is a lock-free ring of connections with a single producer and a
+// single consumer, that hands connections between the main thread and an I/O
+// thread. Each side only writes its own index, which is kept on a cache line
+// of its own.
+struct spsc {
+  _Atomic size_t head;  // next to pop, written by the consumer
+  char pad[64 - sizeof(size_t)];
+  _Atomic size_t tail;  // next to push, written by the producer
+  struct event_conn* items[SPSC_SIZE];
+};
+
+static bool spsc_push(struct spsc* q, struct event_conn* conn) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&q->head, memory_order_acquire) ==
+      SPSC_SIZE) {
+    return false;
+  }
+  q->items[tail % SPSC_SIZE] = conn;
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+static struct event_conn* spsc_pop(struct spsc* q) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&q->tail, memory_order_acquire)) {
     return NULL;
   }
-  return *(struct event_conn**)v;
+  struct event_conn* conn = q->items[head % SPSC_SIZE];
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return conn;
+}
+
+// io_thread reads and writes the connections the main thread hands it, with
+// a chunk pool of its own. A connection belongs to the thread from when it is
+// pushed to jobs until it is popped from done, and the main thread runs no
+// callbacks meanwhile, so connections need no locks. The thread drains jobs
+// while they are pushed, so the jobs ring alone does not bound the jobs out:
+// pending does.
+struct io_thread {
+  struct spsc jobs;
+  struct spsc done;
+  sem_t sem;       // posted when jobs are pushed
+  size_t pending;  // jobs not popped from done yet, main thread only
+  struct chunk_pool pool;
+  struct event* event;
+  pthread_t thread;
+};
+
+// io_run reads the connection and parses its input, or flushes its output,
+// leaving the outcome in the connection for the main thread.
+static void io_run(struct event* event, struct chunk_pool* pool,
+                   struct event_conn* conn) {
+  conn->io_err = 0;
+  conn->io_bytes = 0;
+  if (conn->io_write) {
+    conn->io_err = conn_write(conn, pool, &conn->io_bytes);
+    return;
+  }
+  ssize_t n = conn_fill(conn, pool);
+  if (n == -1) {
+    conn->io_err = errno;
+    return;
+  }
+  conn->io_bytes = n;
+  struct chunk* rbuf = conn->rbuf;
+  if (n > 0 && event->events.parse && rbuf->len - rbuf->start >= conn->expect) {
+    // output written meanwhile is flushed after the commands run, so the
+    // connection is not woken for it
+    bool woke = conn->woke;
+    conn->woke = true;
+    conn->io_pool = pool;
+    size_t consumed = event->events.parse(
+        conn, rbuf->data + rbuf->start, rbuf->len - rbuf->start, event->udata);
+    if (consumed > 0) {
+      // including the frame that was expected
+      rbuf->start += consumed;
+      conn->expect = 0;
+    }
+    conn->io_pool = NULL;
+    conn->woke = woke;
+  }
+}
+
+static void* io_main(void* arg) {
+  struct io_thread* io = arg;
+  for (;;) {
+    if (sem_wait(&io->sem) == -1) {
+      continue;  // EINTR
+    }
+    struct event_conn* conn;
+    while ((conn = spsc_pop(&io->jobs))) {
+      io_run(io->event, &io->pool, conn);
+      // io_dispatch keeps no more than SPSC_SIZE jobs out, so done has room,
+      // but a connection dropped here would leave it waiting forever
+      while (!spsc_push(&io->done, conn)) {
+        sched_yield();
+      }
+    }
+  }
+  return NULL;
+}
+
+static void io_start(struct event* event, int nthreads) {
+  event->io = calloc(nthreads, sizeof(struct io_thread));
+  if (!event->io) {
+    eprintf(true, "%s", strerror(ENOMEM));
+  }
+  for (int i = 0; i < nthreads; i++) {
+    struct io_thread* io = &event->io[i];
+    io->event = event;
+    io->pool.maxfree = 256;
+    if (sem_init(&io->sem, 0, 0) == -1) {
+      eprintf(true, "sem_init: %s", strerror(errno));
+    }
+    int err = pthread_create(&io->thread, NULL, io_main, io);
+    if (err) {
+      eprintf(true, "pthread_create: %s", strerror(err));
+    }
+  }
+  event->nio = nthreads;
+}
+
+// io_dispatch reads or flushes the connections on the I/O threads, dealing
+// them out in turn with a share for the main thread, and waits for all of
+// them to be done.
+static void io_dispatch(struct event* event, struct event_conn** conns,
+                        size_t n, bool write) {
+  size_t nthreads = event->nio + 1;
+  for (size_t i = 0; i < n; i++) {
+    conns[i]->io_write = write;
+    if (i % nthreads == 0) continue;
+    struct io_thread* io = &event->io[i % nthreads - 1];
+    // done must have room for every job out, beyond those the thread
+    // already took from jobs
+    if (io->pending < SPSC_SIZE && spsc_push(&io->jobs, conns[i])) {
+      io->pending++;
+    } else {
+      io_run(event, &event->pool, conns[i]);
+    }
+  }
+  for (int i = 0; i < event->nio; i++) {
+    if (event->io[i].pending) {
+      sem_post(&event->io[i].sem);
+    }
+  }
+  for (size_t i = 0; i < n; i += nthreads) {
+    io_run(event, &event->pool, conns[i]);
+  }
+  for (int i = 0; i < event->nio; i++) {
+    struct io_thread* io = &event->io[i];
+    while (io->pending) {
+      if (spsc_pop(&io->done)) {
+        io->pending--;
+      } else {
+        // the threads may be sharing our core
+        sched_yield();
+      }
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (write) {
+      event->stats.net_output_bytes += conns[i]->io_bytes;
+    } else {
+      event->stats.net_input_bytes += conns[i]->io_bytes;
+    }
+  }
+  if (write) {
+    event->stats.io_threaded_writes += n;
+  } else {
+    event->stats.io_threaded_reads += n;
+  }
+}
+
+// batch_add adds the connection to the ready connections of the iteration.
+// Returns false when out of memory.
+static bool batch_add(struct event* event, size_t* n,
+                      struct event_conn* conn) {
+  if (*n == event->batchcap) {
+    size_t cap = event->batchcap ? event->batchcap * 2 : 256;
+    struct event_conn** batch =
+        realloc(event->batch, cap * sizeof(struct event_conn*));
+    if (batch) event->batch = batch;
+    struct event_conn** flush =
+        realloc(event->flush, cap * sizeof(struct event_conn*));
+    if (flush) event->flush = flush;
+    if (!batch || !flush) {
+      return false;
+    }
+    event->batchcap = cap;
+  }
+  event->batch[(*n)++] = conn;
+  return true;
+}
+
+// batch_handle handles the ready connections of the iteration. Unless there
+// are too few for it to pay off, those that may just read are read and their
+// input parsed on the I/O threads, then their commands run here, and their
+// output is flushed on the threads together with that of the connections
+// that only need a flush. Connections in any other state, like paused or
+// blocked ones, are handled here.
+static void batch_handle(struct event* event, size_t n) {
+  struct event_conn** reads = event->batch;
+  if (n < (size_t)(event->nio + 1) * 2) {
+    for (size_t i = 0; i < n; i++) {
+      conn_handle(event, reads[i]);
+    }
+    return;
+  }
+  struct event_conn** flushes = event->flush;
+  size_t nrd = 0, nfl = 0;
+  for (size_t i = 0; i < n; i++) {
+    struct event_conn* conn = reads[i];
+    if (conn->closed || conn->held || conn->paused || conn->resumed) {
+      conn_handle(event, conn);
+    } else if (conn->readable) {
+      reads[nrd++] = conn;
+    } else if (conn->wbuf.len > 0) {
+      flushes[nfl++] = conn;
+    } else {
+      conn_handle(event, conn);
+    }
+  }
+  io_dispatch(event, reads, nrd, false);
+  if (event->events.parsed) {
+    event->events.parsed(event->udata);
+  }
+  for (size_t i = 0; i < nrd; i++) {
+    struct event_conn* conn = reads[i];
+    if (conn->io_err) {
+      if (conn->io_err == ENOMEM) {
+        eprintf(false, "%s", strerror(ENOMEM));
+      }
+      close_remove_conn(conn, event);
+      reads[i] = NULL;
+      continue;
+    }
+    if (conn->rbuf && !conn->held) {
+      conn_process(event, conn);
+    }
+    if (event->edge && conn->readable) {
+      // there may be more input, which epoll won't report again
+      ready_push(event, conn);
+    }
+    if (!conn->closed && event_conn_congested(conn) && !pause_reads(conn)) {
+      close_remove_conn(conn, event);
+      reads[i] = NULL;
+    }
+  }
+  for (size_t i = 0; i < nrd; i++) {
+    struct event_conn* conn = reads[i];
+    if (!conn) continue;
+    if (conn->wbuf.len > 0) {
+      flushes[nfl++] = conn;
+    } else if (conn_flushed(event, conn, 0) && conn->resumed) {
+      conn_handle(event, conn);
+    }
+  }
+  io_dispatch(event, flushes, nfl, true);
+  for (size_t i = 0; i < nfl; i++) {
+    struct event_conn* conn = flushes[i];
+    if (conn_flushed(event, conn, conn->io_err) && conn->resumed) {
+      conn_handle(event, conn);
+    }
+  }
 }
 
 struct thread_context {
   bool serving;
+  struct event_options options;
   int server_id;
   struct event_events events;
   void* udata;
@@ -447,9 +1197,13 @@ static void* thread(void* thdata) {
   memset(event, 0, sizeof(struct event));
   event->events = thctx->events;
   event->udata = thctx->udata;
-  event->conns = hashmap_new(sizeof(struct conn*), 0, conn_hash, conn_compare);
-  if (!event->conns) {
-    eprintf(true, "%s", strerror(ENOMEM));
+  event->pool.maxfree = 256;
+  event->edge = thctx->options.edge_triggered;
+  if (thctx->options.io_threads > 1) {
+    io_start(event, thctx->options.io_threads - 1);
+  }
+  if (nloops < MAXLOOPS) {
+    loops[nloops++] = event;
   }
   int qfd = net_queue();
   if (qfd == -1) {
@@ -458,16 +1212,22 @@ static void* thread(void* thdata) {
   // add all socket fds to queue
   int naddrsfds = 0;
   for (int i = 0; i < thctx->naddrs; i++) {
-    for (int j = 0; j < thctx->paddrs[i]->nfds; j++) {
-      int sfd = thctx->paddrs[i]->fds[j];
-      if (net_addrd(qfd, sfd) == -1) {
+    naddrsfds += thctx->paddrs[i]->nfds;
+  }
+  struct listener* listeners = malloc(naddrsfds * sizeof(struct listener));
+  if (!listeners) {
+    eprintf(true, "%s", strerror(ENOMEM));
+  }
+  for (int i = 0, k = 0; i < thctx->naddrs; i++) {
+    for (int j = 0; j < thctx->paddrs[i]->nfds; j++, k++) {
+      listeners[k].listener = true;
+      listeners[k].fd = thctx->paddrs[i]->fds[j];
+      if (net_addrd(qfd, listeners[k].fd, &listeners[k], false) == -1) {
         eprintf(true, "net_addrd(socket): %s", strerror(errno));
       }
-      naddrsfds++;
     }
   }
 
-  int64_t tick_delay = -1;
   thctx->server_id++;
 
   if (!thctx->serving) {
@@ -487,89 +1247,87 @@ static void* thread(void* thdata) {
     }
   }
 
-  bool synced = false;
-  char buffer[4096];
-  int fds[128];
+  struct net_event nevs[128];
 
   for (;;) {
-    int64_t delay = synced ? tick_delay : 0;
-    int n = net_events(qfd, fds, sizeof(fds) / sizeof(int), delay);
+    int64_t delay = -1;
+    if (event->events.tick) {
+      delay = event->events.tick(event->udata);
+    }
+    if (event->ready) {
+      delay = 0;
+    }
+    int n = net_events(qfd, nevs, sizeof(nevs) / sizeof(nevs[0]), delay);
     if (n == -1) {
       panic("net_events: %s", strerror(errno));
     }
+    uint64_t start = n > 0 && event->events.iteration ? tsc_now() : 0;
 
+    // each ready socket is handled once: a connection is only removed while
+    // its own event is handled, so the later events of the batch stay valid
+    size_t nbatch = 0;
     for (int i = 0; i < n; i++) {
-      // not a connection, check if it's a server socket.
-      int j = which_socketfd(fds[i], thctx->paddrs, thctx->naddrs);
-      if (j != -1) {
-        // accept the incoming connection.
-        net_accept(event, qfd, fds[i]);
+      if (*(bool*)nevs[i].ptr) {
+        net_accept(event, qfd, ((struct listener*)nevs[i].ptr)->fd);
         continue;
       }
-      struct event_conn* conn = get_conn(event, fds[i]);
-      if (!conn) {
-        continue;
-      }
-      if (!conn_flush(event, conn)) {
-        continue;
-      }
-      while (true) {
-        int n = read(conn->fd, buffer, sizeof(buffer) - 1);
-        if (n <= 0) {
-          if (n != -1 || errno != EAGAIN) {
-            close_remove_conn(conn, event);
-          }
-          break;
-        }
-        buffer[n] = '\0';
-        if (event->events.data) {
-          conn->woke = true;
-          event->events.data(conn, buffer, n, event->udata);
-          conn->woke = false;
-        }
+      struct event_conn* conn = nevs[i].ptr;
+      conn->readable |= nevs[i].rd;
+      if (event->nio) {
+        ready_remove(conn);
+        if (batch_add(event, &nbatch, conn)) continue;
       }
+      conn_handle(event, conn);
     }
-
-    for (int i = 0; i < n; i++) {
-      if (which_socketfd(fds[i], thctx->paddrs, thctx->naddrs) != -1) {
-        continue;
-      }
-      struct event_conn* conn = get_conn(event, fds[i]);
-      if (!conn) {
-        continue;
-      }
-      if (!conn_flush(event, conn)) {
-        continue;
-      }
-      if (conn->wbuf.cap > 4096) {
-        free(conn->wbuf.data);
-        conn->wbuf.data = NULL;
-        conn->wbuf.cap = 0;
+    // then the connections readied outside of epoll, such as by output from
+    // other connections; those readied meanwhile wait for the next iteration
+    struct event_conn* ready = event->ready;
+    event->ready = NULL;
+    if (ready) {
+      ready->pprev = &ready;
+    }
+    while (ready) {
+      struct event_conn* conn = ready;
+      if (event->nio) {
+        ready_remove(conn);
+        if (batch_add(event, &nbatch, conn)) continue;
       }
+      conn_handle(event, conn);
+    }
+    if (nbatch) {
+      batch_handle(event, nbatch);
+    }
+    if (start) {
+      event->events.iteration(tsc_ns(tsc_now() - start), event->udata);
     }
   }
   return NULL;
 }
 
-void event_main(const char* addrs[], int naddrs, struct event_events events,
-                void* udata) {
+void event_main(const char* addrs[], int naddrs, struct event_options options,
+                struct event_events events, void* udata) {
   // create local event for the purpose of error logging only.
   struct event _event;
   struct event* event = &_event;
   memset(event, 0, sizeof(struct event));
   event->events = events;
   event->udata = udata;
+  // writing to a connection closed by the peer must fail with EPIPE rather
+  // than terminate the server
+  signal(SIGPIPE, SIG_IGN);
+  tsc_init();
   struct addr** paddrs = malloc(naddrs * sizeof(struct addr*));
   if (!paddrs) {
     eprintf(true, "%s", strerror(ENOMEM));
   }
   memset(paddrs, 0, naddrs * sizeof(struct addr*));
   for (int i = 0; i < naddrs; i++) {
-    paddrs[i] = addr_listen(event, addrs[i]);
+    paddrs[i] = addr_listen(event, addrs[i], &options);
   }
   struct thread_context thctx;
   memset(&thctx, 0, sizeof(struct thread_context));
   thctx.serving = false;
+  thctx.options = options;
   thctx.events = events;
   thctx.udata = udata;
   thctx.paddrs = paddrs;
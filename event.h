@@ -6,6 +6,7 @@
 #include <sys/types.h>
 
 #include "buf.h"
+#include "chunk.h"
 
 struct addr {
   char* host;
@@ -18,26 +19,114 @@ struct addr {
 struct event_conn;
 
 struct event_events {
-  void (*data)(struct event_conn* conn, const void* data, size_t len,
-               void* udata);
+  // tick is called on every loop iteration and returns the maximum delay in
+  // nanoseconds until it should be called again, or -1 for no limit.
+  int64_t (*tick)(void* udata);
+  void (*opened)(struct event_conn* conn, void* udata);
+  void (*closed)(struct event_conn* conn, void* udata);
+  // data is called with the unprocessed input of the connection and returns
+  // the number of bytes it consumed. The rest is passed again, together with
+  // new input, on the next call. The input may be modified in place.
+  size_t (*data)(struct event_conn* conn, void* data, size_t len,
+                 void* udata);
+  // parse is called from an I/O thread with the input that data is called
+  // with next, on the main thread, to do the work that doesn't touch shared
+  // state ahead of it. It may only use the connection, which it may write
+  // to, and returns the number of bytes it consumed, which data is not
+  // called with.
+  size_t (*parse)(struct event_conn* conn, void* data, size_t len,
+                  void* udata);
+  // parsed is called on the main thread once the input of the ready
+  // connections was read and parsed, before data is called with it.
+  void (*parsed)(void* udata);
   void (*serving)(const char** addrs, int naddrs, void* udata);
   void (*error)(const char* message, bool fatal, void* udata);
+  // iteration is called after each loop iteration that handled events, with
+  // the time it took in nanoseconds.
+  void (*iteration)(int64_t ns, void* udata);
 };
 
+// event_stats are counters kept by each event loop thread without
+// synchronization, only summed when they are read.
+struct event_stats {
+  uint64_t connections;  // open connections
+  uint64_t total_connections;
+  uint64_t rejected_connections;
+  uint64_t net_input_bytes;
+  uint64_t net_output_bytes;
+  uint64_t io_threaded_reads;  // reads and writes done by the I/O threads
+  uint64_t io_threaded_writes;
+};
+
+// event_options configures the event loops.
+struct event_options {
+  // edge_triggered registers connections once for both reads and writes,
+  // edge-triggered, rather than changing their registration as they go from
+  // reading to writing. Output is written as soon as input is processed, and
+  // connections with work that epoll won't report, such as output queued by
+  // other connections, are kept on a ready list.
+  bool edge_triggered;
+  int unix_perm;  // mode of unix socket files, or zero for the umask
+  // io_threads is the number of threads, the main one included, that read
+  // and write connections. The main thread alone runs the callbacks but
+  // parse, between a phase where the threads read and parse the input of
+  // the ready connections and one where they flush their output.
+  int io_threads;
+};
+
+struct io_thread;
+
 struct event {
   struct event_events events;
   char errmsg[256];
-  struct hashmap* conns;
+  bool edge;
+  struct event_conn* ready;  // edge-triggered only
+  size_t nconns;
+  struct chunk_pool pool;
+  struct event_stats stats;
   void* udata;
+  struct io_thread* io;  // io_threads - 1 threads
+  int nio;
+  struct event_conn** batch;  // ready connections of the iteration
+  struct event_conn** flush;  // those flushed by the I/O threads
+  size_t batchcap;
+};
+
+// event_limits bounds the pending output of a connection. Zero disables a
+// limit.
+struct event_limits {
+  size_t pause;     // stop reading input while pending output is above
+  size_t hard;      // close when pending output is above
+  size_t soft;      // close when pending output stays above for soft_ns
+  int64_t soft_ns;
 };
 
+// Connections and listeners are both registered with the queue by address.
+// The listener field, which both start with, tells them apart.
 struct event_conn {
+  bool listener;  // always false
   int qfd;
   int fd;
   bool closed;
   bool woke;
-  struct buf wbuf;
-  size_t wbuf_idx;
+  bool paused;
+  bool resumed;
+  bool held;
+  bool rd;  // registered interest in the connection becoming readable
+  bool wr;  // registered interest in the connection becoming writable
+  bool readable;  // input may be left in the socket
+  struct event_conn* next;  // on the ready list
+  struct event_conn** pprev;
+  struct chunk* rbuf;
+  size_t rwin;    // size of the next input chunk, grows for pipelined input
+  size_t expect;  // input needed to complete the pending frame, if known
+  struct chain wbuf;
+  struct event_limits limits;
+  int64_t soft_since;
+  bool io_write;    // the I/O thread job is a flush rather than a read
+  int io_err;       // errno of the failed job, or zero
+  size_t io_bytes;  // read or written by the job
+  struct chunk_pool* io_pool;  // of the thread parsing the input, or NULL
   void* udata;
   struct event* event;
   char* addr;
@@ -47,7 +136,18 @@ void event_conn_close(struct event_conn* conn);
 void* event_conn_udata(struct event_conn* conn);
 void event_conn_set_udata(struct event_conn* conn, void* udata);
 void event_conn_write(struct event_conn* conn, const void* data, ssize_t len);
+void event_conn_write_shared(struct event_conn* conn,
+                             struct chunk_shared* shared);
+void event_conn_set_limits(struct event_conn* conn, struct event_limits limits);
+bool event_conn_congested(struct event_conn* conn);
+bool event_conn_limited(struct event_conn* conn);
+void event_conn_expect(struct event_conn* conn, size_t len);
+void event_conn_hold(struct event_conn* conn);
+void event_conn_release(struct event_conn* conn);
 const char* event_conn_addr(struct event_conn* conn);
 int64_t event_now();
-void event_main(const char* addrs[], int naddrs, struct event_events events,
-                void* udata);
+void event_stats(struct event_stats* stats);
+// event_main listens on addresses of the form tcp://host:port, or
+// unix://path for unix sockets, and runs the event loop.
+void event_main(const char* addrs[], int naddrs, struct event_options options,
+                struct event_events events, void* udata);
@@ -280,6 +280,27 @@ bool hashmap_scan(struct hashmap* map,
   return true;
 }
 
+// hashmap_iter iterates one bucket at a time, starting with *i set to zero.
+// Returns false once all items were visited. Items should not be added or
+// removed while iterating, as that may move the remaining items.
+bool hashmap_iter(struct hashmap* map, size_t* i, void** item) {
+  for (; *i < map->nbuckets; (*i)++) {
+    struct bucket* bucket = bucket_at(map, *i);
+    if (bucket->psl) {
+      *item = bucket_item(bucket);
+      (*i)++;
+      return true;
+    }
+  }
+  return false;
+}
+
+// hashmap_memory returns the number of bytes allocated for the hash map,
+// excluding anything its items point to.
+size_t hashmap_memory(struct hashmap* map) {
+  return sizeof(struct hashmap) + map->bucketsz * (2 + map->nbuckets);
+}
+
 uint64_t hashmap_xxhash(const void* data, size_t len) {
   return XXH3_64bits(data, len);
 }
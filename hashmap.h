@@ -18,4 +18,6 @@ void* hashmap_delete(struct hashmap* map, void* item);
 void* hashmap_probe(struct hashmap* map, uint64_t position);
 bool hashmap_scan(struct hashmap* map,
                   bool (*iter)(const void* item, void* udata), void* udata);
+bool hashmap_iter(struct hashmap* map, size_t* i, void** item);
+size_t hashmap_memory(struct hashmap* map);
 uint64_t hashmap_xxhash(const void* data, size_t len);
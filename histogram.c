@@ -0,0 +1,66 @@
+#include "histogram.h"
+
+#include <math.h>
+
+// bucket returns the bucket of the value. Values below HISTOGRAM_SUB have a
+// bucket each; above, the exponent picks a group of HISTOGRAM_SUB buckets and
+// the four bits below the leading one pick the bucket in the group.
+static int bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB) {
+    return value;
+  }
+  int exp = 63 - __builtin_clzll(value);
+  if (exp >= HISTOGRAM_MAXEXP) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  int sub = (value >> (exp - 4)) & (HISTOGRAM_SUB - 1);
+  return (exp - 3) * HISTOGRAM_SUB + sub;
+}
+
+void histogram_record(struct histogram* h, uint64_t value) {
+  h->buckets[bucket(value)]++;
+  h->count++;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+// histogram_merge adds the values counted by other to h.
+void histogram_merge(struct histogram* h, const struct histogram* other) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    h->buckets[i] += other->buckets[i];
+  }
+  h->count += other->count;
+  if (other->max > h->max) {
+    h->max = other->max;
+  }
+}
+
+// histogram_bucket_max returns the largest value counted in the bucket.
+uint64_t histogram_bucket_max(int i) {
+  if (i < HISTOGRAM_SUB) {
+    return i;
+  }
+  int exp = i / HISTOGRAM_SUB + 3;
+  uint64_t sub = i % HISTOGRAM_SUB;
+  return ((HISTOGRAM_SUB + sub + 1) << (exp - 4)) - 1;
+}
+
+// histogram_percentile returns an upper bound of the p-th percentile, from 0
+// to 100, of the values.
+uint64_t histogram_percentile(struct histogram* h, double p) {
+  if (h->count == 0) {
+    return 0;
+  }
+  uint64_t rank = ceil(p / 100 * h->count);
+  rank = rank < 1 ? 1 : rank > h->count ? h->count : rank;
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t max = histogram_bucket_max(i);
+      return max < h->max ? max : h->max;
+    }
+  }
+  return h->max;
+}
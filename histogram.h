@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// A histogram counts values, such as latencies in nanoseconds, in log-linear
+// buckets: 16 buckets for each power of two, so every value is counted to
+// within 6.25% of its size, with a fixed 5kb of counters covering values up
+// to 2^40. Recording a value is a couple of shifts and an increment.
+
+#define HISTOGRAM_SUB 16
+#define HISTOGRAM_MAXEXP 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAXEXP - 3) * HISTOGRAM_SUB)
+
+struct histogram {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_record(struct histogram* h, uint64_t value);
+void histogram_merge(struct histogram* h, const struct histogram* other);
+uint64_t histogram_bucket_max(int i);
+uint64_t histogram_percentile(struct histogram* h, double p);
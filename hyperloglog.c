@@ -0,0 +1,349 @@
+#include "hyperloglog.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xxhash.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Header: "HYLL", the encoding, 3 unused bytes and the cardinality as a
+// little-endian integer, with the top bit of its last byte set while the
+// cached value is stale.
+#define HLL_DENSE 0
+#define HLL_SPARSE 1
+#define HLL_Q (64 - HLL_P)
+
+// Sparse opcodes, each covering a run of registers:
+//   00xxxxxx           ZERO: 1 to 64 zero registers
+//   01xxxxxx yyyyyyyy  XZERO: 1 to 16384 zero registers
+//   1vvvvvxx           VAL: 1 to 4 registers set to 1 to 32
+// Registers above 32 need the dense encoding.
+#define SPARSE_VAL_MAX 32
+#define IS_ZERO(b) (((b) & 0xc0) == 0)
+#define IS_XZERO(b) (((b) & 0xc0) == 0x40)
+
+// sparse_op decodes the opcode at p into its length, run and value.
+static int sparse_op(const unsigned char* p, long* run, int* val) {
+  if (IS_ZERO(*p)) {
+    *run = (*p & 0x3f) + 1;
+    *val = 0;
+    return 1;
+  }
+  if (IS_XZERO(*p)) {
+    *run = (((long)(*p & 0x3f) << 8) | p[1]) + 1;
+    *val = 0;
+    return 2;
+  }
+  *run = (*p & 3) + 1;
+  *val = ((*p >> 2) & 0x1f) + 1;
+  return 1;
+}
+
+// sparse_put writes the opcode for a run of len registers set to val, which
+// is at most 4 registers for nonzero values. Returns its length.
+static int sparse_put(unsigned char* p, int val, long len) {
+  if (len == 0) {
+    return 0;
+  }
+  if (val) {
+    *p = 0x80 | ((val - 1) << 2) | (len - 1);
+    return 1;
+  }
+  if (len <= 64) {
+    *p = len - 1;
+    return 1;
+  }
+  p[0] = 0x40 | ((len - 1) >> 8);
+  p[1] = (len - 1) & 0xff;
+  return 2;
+}
+
+static int dense_get(const unsigned char* regs, long i) {
+  long bit = i * 6;
+  unsigned x = regs[bit / 8] >> (bit & 7);
+  if ((bit & 7) > 2) {
+    x |= regs[bit / 8 + 1] << (8 - (bit & 7));
+  }
+  return x & 0x3f;
+}
+
+static void dense_set(unsigned char* regs, long i, int val) {
+  long bit = i * 6;
+  unsigned shift = bit & 7;
+  unsigned char* p = regs + bit / 8;
+  p[0] = (p[0] & ~(0x3f << shift)) | (val << shift);
+  if (shift > 2) {
+    p[1] = (p[1] & ~(0x3f >> (8 - shift))) | (val >> (8 - shift));
+  }
+}
+
+// unpack expands the dense registers to a byte each, 4 registers per 3
+// bytes.
+static void unpack(const unsigned char* regs, uint8_t* out) {
+  for (long i = 0; i < HLL_REGISTERS; i += 4, regs += 3) {
+    out[i] = regs[0] & 0x3f;
+    out[i + 1] = ((regs[0] >> 6) | (regs[1] << 2)) & 0x3f;
+    out[i + 2] = ((regs[1] >> 4) | (regs[2] << 4)) & 0x3f;
+    out[i + 3] = regs[2] >> 2;
+  }
+}
+
+static void pack(const uint8_t* in, unsigned char* regs) {
+  for (long i = 0; i < HLL_REGISTERS; i += 4, regs += 3) {
+    regs[0] = in[i] | (in[i + 1] << 6);
+    regs[1] = (in[i + 1] >> 2) | (in[i + 2] << 4);
+    regs[2] = (in[i + 2] >> 4) | (in[i + 3] << 2);
+  }
+}
+
+static void invalidate(unsigned char* hll) { hll[15] |= 0x80; }
+
+bool hll_is_dense(const unsigned char* hll) { return hll[4] == HLL_DENSE; }
+
+// hll_valid checks that the len bytes at hll form a HyperLogLog, as opposed
+// to any other string.
+bool hll_valid(const unsigned char* hll, size_t len) {
+  if (len < HLL_HDR || memcmp(hll, "HYLL", 4) != 0) {
+    return false;
+  }
+  if (hll[4] == HLL_DENSE) {
+    return len == HLL_DENSE_SIZE;
+  }
+  if (hll[4] != HLL_SPARSE) {
+    return false;
+  }
+  const unsigned char* p = hll + HLL_HDR;
+  const unsigned char* end = hll + len;
+  long total = 0;
+  while (p < end && total <= HLL_REGISTERS) {
+    if (IS_XZERO(*p) && p + 1 == end) {
+      return false;
+    }
+    long run;
+    int val;
+    p += sparse_op(p, &run, &val);
+    total += run;
+  }
+  return p == end && total == HLL_REGISTERS;
+}
+
+// hll_new returns an empty sparse HyperLogLog of *len bytes. Returns NULL
+// when out of memory.
+unsigned char* hll_new(size_t* len) {
+  unsigned char* hll = calloc(1, HLL_HDR + 2);
+  if (!hll) {
+    return NULL;
+  }
+  memcpy(hll, "HYLL", 4);
+  hll[4] = HLL_SPARSE;
+  sparse_put(hll + HLL_HDR, 0, HLL_REGISTERS);
+  *len = HLL_HDR + 2;
+  return hll;
+}
+
+// hll_max raises each of the registers to the matching register of the
+// HyperLogLog.
+void hll_max(const unsigned char* hll, size_t len, uint8_t* regs) {
+  if (hll[4] == HLL_SPARSE) {
+    const unsigned char* p = hll + HLL_HDR;
+    long i = 0;
+    while (p < hll + len) {
+      long run;
+      int val;
+      p += sparse_op(p, &run, &val);
+      for (long j = 0; val && j < run; j++) {
+        if (regs[i + j] < val) regs[i + j] = val;
+      }
+      i += run;
+    }
+    return;
+  }
+  uint8_t dense[HLL_REGISTERS];
+  unpack(hll + HLL_HDR, dense);
+  long i = 0;
+#ifdef __AVX2__
+  for (; i < HLL_REGISTERS; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(regs + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(dense + i));
+    _mm256_storeu_si256((__m256i*)(regs + i), _mm256_max_epu8(a, b));
+  }
+#elif defined(__SSE2__)
+  for (; i < HLL_REGISTERS; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(regs + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(dense + i));
+    _mm_storeu_si128((__m128i*)(regs + i), _mm_max_epu8(a, b));
+  }
+#endif
+  for (; i < HLL_REGISTERS; i++) {
+    if (regs[i] < dense[i]) regs[i] = dense[i];
+  }
+}
+
+// to_dense converts a sparse HyperLogLog. Returns NULL when out of memory,
+// in which case it is left untouched.
+static unsigned char* to_dense(unsigned char* hll, size_t len) {
+  uint8_t regs[HLL_REGISTERS] = {0};
+  hll_max(hll, len, regs);
+  unsigned char* dense = realloc(hll, HLL_DENSE_SIZE);
+  if (!dense) {
+    return NULL;
+  }
+  dense[4] = HLL_DENSE;
+  pack(regs, dense + HLL_HDR);
+  return dense;
+}
+
+// sparse_set raises register i to val. Returns 1 if it changed, 0 if not or
+// -1 when out of memory. Converts to dense when val does not fit or the
+// registers outgrow sparse_max bytes.
+static int sparse_set(unsigned char** phll, size_t* len, long i, int val,
+                      size_t sparse_max) {
+  unsigned char* hll = *phll;
+  unsigned char* p = hll + HLL_HDR;
+  long first = 0, run = 0;
+  int cur = 0, oplen = 0;
+  while (p < hll + *len) {
+    oplen = sparse_op(p, &run, &cur);
+    if (i < first + run) break;
+    first += run;
+    p += oplen;
+  }
+  if (cur >= val) {
+    return 0;
+  }
+  if (val <= SPARSE_VAL_MAX && cur && run == 1) {
+    sparse_put(p, val, 1);
+    return 1;
+  }
+  // split the run around the register
+  unsigned char seq[5];
+  int n = sparse_put(seq, cur, i - first);
+  n += sparse_put(seq + n, val, 1);
+  n += sparse_put(seq + n, cur, first + run - 1 - i);
+  size_t nlen = *len - oplen + n;
+  if (val > SPARSE_VAL_MAX || nlen - HLL_HDR > sparse_max) {
+    unsigned char* dense = to_dense(hll, *len);
+    if (!dense) {
+      return -1;
+    }
+    *phll = dense;
+    *len = HLL_DENSE_SIZE;
+    dense_set(dense + HLL_HDR, i, val);
+    return 1;
+  }
+  size_t off = p - hll;
+  if (nlen > *len) {
+    hll = realloc(hll, nlen);
+    if (!hll) {
+      return -1;
+    }
+  }
+  memmove(hll + off + n, hll + off + oplen, *len - off - oplen);
+  memcpy(hll + off, seq, n);
+  *phll = hll;
+  *len = nlen;
+  return 1;
+}
+
+// hll_add adds the element. Returns 1 if a register changed, 0 if not or -1
+// when out of memory. Sparse HyperLogLogs are allocated with malloc and may
+// be moved, dense ones are updated in place.
+int hll_add(unsigned char** hll, size_t* len, const void* data, size_t dlen,
+            size_t sparse_max) {
+  uint64_t hash = XXH3_64bits(data, dlen);
+  long i = hash & (HLL_REGISTERS - 1);
+  // the position of the first set bit of the rest of the hash
+  hash >>= HLL_P;
+  hash |= UINT64_C(1) << HLL_Q;
+  int val = __builtin_ctzll(hash) + 1;
+  int changed;
+  if ((*hll)[4] == HLL_DENSE) {
+    changed = dense_get(*hll + HLL_HDR, i) < val;
+    if (changed) dense_set(*hll + HLL_HDR, i, val);
+  } else {
+    changed = sparse_set(hll, len, i, val, sparse_max);
+  }
+  if (changed == 1) {
+    invalidate(*hll);
+  }
+  return changed;
+}
+
+static double tau(double x) {
+  if (x == 0 || x == 1) {
+    return 0;
+  }
+  double y = 1, z = 1 - x, prev;
+  do {
+    x = sqrt(x);
+    prev = z;
+    y *= 0.5;
+    z -= (1 - x) * (1 - x) * y;
+  } while (prev != z);
+  return z / 3;
+}
+
+static double sigma(double x) {
+  if (x == 1) {
+    return INFINITY;
+  }
+  double y = 1, z = x, prev;
+  do {
+    x *= x;
+    prev = z;
+    z += x * y;
+    y += y;
+  } while (prev != z);
+  return z;
+}
+
+// hll_count_registers estimates the cardinality from the histogram of the
+// registers, with Ertl's improved estimator that needs no bias correction.
+uint64_t hll_count_registers(const uint8_t* regs) {
+  uint32_t histo[64] = {0};
+  for (long i = 0; i < HLL_REGISTERS; i++) {
+    histo[regs[i]]++;
+  }
+  double m = HLL_REGISTERS;
+  double z = m * tau((m - histo[HLL_Q + 1]) / m);
+  for (int j = HLL_Q; j >= 1; j--) {
+    z += histo[j];
+    z *= 0.5;
+  }
+  z += m * sigma(histo[0] / m);
+  return (uint64_t)llround(0.5 / log(2) * m * m / z);
+}
+
+// hll_count returns the cardinality, recomputing the cached value if it is
+// stale.
+uint64_t hll_count(unsigned char* hll, size_t len) {
+  uint64_t card;
+  if (!(hll[15] & 0x80)) {
+    memcpy(&card, hll + 8, 8);
+    return card;
+  }
+  uint8_t regs[HLL_REGISTERS] = {0};
+  hll_max(hll, len, regs);
+  card = hll_count_registers(regs);
+  memcpy(hll + 8, &card, 8);
+  return card;
+}
+
+// hll_from_registers returns a dense HyperLogLog of *len bytes with the
+// registers. Returns NULL when out of memory.
+unsigned char* hll_from_registers(const uint8_t* regs, size_t* len) {
+  unsigned char* hll = calloc(1, HLL_DENSE_SIZE);
+  if (!hll) {
+    return NULL;
+  }
+  memcpy(hll, "HYLL", 4);
+  hll[4] = HLL_DENSE;
+  invalidate(hll);
+  pack(regs, hll + HLL_HDR);
+  *len = HLL_DENSE_SIZE;
+  return hll;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A HyperLogLog estimates the number of distinct elements added to it using
+// 16384 registers, each holding the longest run of zeros seen in the hashes
+// of the elements that map to it. It is stored as a string starting with
+// "HYLL", an encoding byte and a cached cardinality, followed either by the
+// registers packed at 6 bits each (dense, 12kb) or by run-length encoded
+// registers (sparse), which is far smaller while most registers are zero.
+
+#define HLL_P 14
+#define HLL_REGISTERS (1 << HLL_P)
+#define HLL_HDR 16
+#define HLL_DENSE_SIZE (HLL_HDR + HLL_REGISTERS * 6 / 8)
+
+bool hll_valid(const unsigned char* hll, size_t len);
+bool hll_is_dense(const unsigned char* hll);
+unsigned char* hll_new(size_t* len);
+int hll_add(unsigned char** hll, size_t* len, const void* data, size_t dlen,
+            size_t sparse_max);
+uint64_t hll_count(unsigned char* hll, size_t len);
+void hll_max(const unsigned char* hll, size_t len, uint8_t* regs);
+uint64_t hll_count_registers(const uint8_t* regs);
+unsigned char* hll_from_registers(const uint8_t* regs, size_t* len);
@@ -0,0 +1,300 @@
+#include "intset.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static uint32_t width_of(int64_t value) {
+  if (value >= INT16_MIN && value <= INT16_MAX) return 2;
+  if (value >= INT32_MIN && value <= INT32_MAX) return 4;
+  return 8;
+}
+
+static int64_t get_at(const char* data, uint32_t width, uint32_t pos) {
+  if (width == 2) {
+    int16_t x;
+    memcpy(&x, data + pos * 2, 2);
+    return x;
+  }
+  if (width == 4) {
+    int32_t x;
+    memcpy(&x, data + pos * 4, 4);
+    return x;
+  }
+  int64_t x;
+  memcpy(&x, data + pos * 8, 8);
+  return x;
+}
+
+static void set_at(char* data, uint32_t width, uint32_t pos, int64_t value) {
+  if (width == 2) {
+    int16_t x = value;
+    memcpy(data + pos * 2, &x, 2);
+  } else if (width == 4) {
+    int32_t x = value;
+    memcpy(data + pos * 4, &x, 4);
+  } else {
+    memcpy(data + pos * 8, &value, 8);
+  }
+}
+
+struct intset* is_new(void) {
+  struct intset* is = malloc(sizeof(struct intset));
+  if (!is) {
+    return NULL;
+  }
+  is->width = 2;
+  is->len = 0;
+  return is;
+}
+
+void is_free(struct intset* is) { free(is); }
+
+size_t is_bytes(const struct intset* is) {
+  return sizeof(struct intset) + (size_t)is->len * is->width;
+}
+
+int64_t is_get(const struct intset* is, uint32_t pos) {
+  return get_at(is->data, is->width, pos);
+}
+
+// search returns true if value is in the intset, and sets *pos to its
+// position or to where it would be inserted.
+static bool search(const struct intset* is, int64_t value, uint32_t* pos) {
+  uint32_t lo = 0, hi = is->len;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int64_t x = is_get(is, mid);
+    if (x < value) {
+      lo = mid + 1;
+    } else if (x > value) {
+      hi = mid;
+    } else {
+      *pos = mid;
+      return true;
+    }
+  }
+  *pos = lo;
+  return false;
+}
+
+bool is_find(const struct intset* is, int64_t value) {
+  uint32_t pos;
+  return width_of(value) <= is->width && search(is, value, &pos);
+}
+
+// upgrade widens all the integers of the intset and adds value, which does
+// not fit the current width and so is either the smallest or the largest.
+static struct intset* upgrade(struct intset* is, int64_t value) {
+  uint32_t width = width_of(value);
+  struct intset* nis =
+      realloc(is, sizeof(struct intset) + (size_t)(is->len + 1) * width);
+  if (!nis) {
+    return NULL;
+  }
+  uint32_t off = value < 0 ? 1 : 0;
+  // from the back, so that wider integers don't overwrite narrower ones
+  for (uint32_t i = nis->len; i-- > 0;) {
+    set_at(nis->data, width, i + off, get_at(nis->data, nis->width, i));
+  }
+  set_at(nis->data, width, off ? 0 : nis->len, value);
+  nis->width = width;
+  nis->len++;
+  return nis;
+}
+
+struct intset* is_add(struct intset* is, int64_t value, bool* added) {
+  *added = false;
+  if (width_of(value) > is->width) {
+    struct intset* nis = upgrade(is, value);
+    if (nis) *added = true;
+    return nis;
+  }
+  uint32_t pos;
+  if (search(is, value, &pos)) {
+    return is;
+  }
+  struct intset* nis =
+      realloc(is, sizeof(struct intset) + (size_t)(is->len + 1) * is->width);
+  if (!nis) {
+    return NULL;
+  }
+  memmove(nis->data + (pos + 1) * nis->width, nis->data + pos * nis->width,
+          (size_t)(nis->len - pos) * nis->width);
+  set_at(nis->data, nis->width, pos, value);
+  nis->len++;
+  *added = true;
+  return nis;
+}
+
+// is_remove never fails, the intset is left larger than needed if it can't
+// be shrunk.
+struct intset* is_remove(struct intset* is, int64_t value, bool* removed) {
+  uint32_t pos;
+  *removed = false;
+  if (width_of(value) > is->width || !search(is, value, &pos)) {
+    return is;
+  }
+  memmove(is->data + pos * is->width, is->data + (pos + 1) * is->width,
+          (size_t)(is->len - pos - 1) * is->width);
+  is->len--;
+  *removed = true;
+  struct intset* nis = realloc(is, is_bytes(is));
+  return nis ? nis : is;
+}
+
+// Intersection kernels. The merge kernels compare a block of each array
+// against all the rotations of the other, then advance past the block with
+// the smaller maximum. Arrays that differ a lot in size are intersected by
+// galloping through the larger one instead.
+
+#define GALLOP_RATIO 32
+
+// gallop returns the position of the first integer of the intset that is not
+// smaller than value, searching from pos.
+static uint32_t gallop(const struct intset* is, uint32_t pos, int64_t value) {
+  uint32_t step = 1;
+  uint32_t hi = pos;
+  while (hi < is->len && is_get(is, hi) < value) {
+    pos = hi + 1;
+    hi += step;
+    step *= 2;
+  }
+  if (hi > is->len) {
+    hi = is->len;
+  }
+  while (pos < hi) {
+    uint32_t mid = pos + (hi - pos) / 2;
+    if (is_get(is, mid) < value) {
+      pos = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return pos;
+}
+
+static uint32_t inter_gallop(const struct intset* small,
+                             const struct intset* large, struct intset* out) {
+  uint32_t n = 0, j = 0;
+  for (uint32_t i = 0; i < small->len && j < large->len; i++) {
+    int64_t x = is_get(small, i);
+    j = gallop(large, j, x);
+    if (j < large->len && is_get(large, j) == x) {
+      set_at(out->data, out->width, n++, x);
+    }
+  }
+  return n;
+}
+
+static uint32_t inter_scalar(const struct intset* a, uint32_t i,
+                             const struct intset* b, uint32_t j,
+                             struct intset* out, uint32_t n) {
+  while (i < a->len && j < b->len) {
+    int64_t x = is_get(a, i), y = is_get(b, j);
+    if (x < y) {
+      i++;
+    } else if (x > y) {
+      j++;
+    } else {
+      set_at(out->data, out->width, n++, x);
+      i++;
+      j++;
+    }
+  }
+  return n;
+}
+
+#ifdef __SSE2__
+#define ROT(v, k) \
+  _mm_or_si128(_mm_srli_si128(v, 2 * (k)), _mm_slli_si128(v, 16 - 2 * (k)))
+
+static uint32_t inter16(const struct intset* a, const struct intset* b,
+                        struct intset* out) {
+  const int16_t* pa = (const int16_t*)a->data;
+  const int16_t* pb = (const int16_t*)b->data;
+  int16_t* po = (int16_t*)out->data;
+  uint32_t i = 0, j = 0, n = 0;
+  while (i + 8 <= a->len && j + 8 <= b->len) {
+    __m128i va = _mm_loadu_si128((const __m128i*)(pa + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(pb + j));
+    __m128i m = _mm_cmpeq_epi16(va, vb);
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 1)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 2)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 3)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 4)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 5)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 6)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi16(va, ROT(vb, 7)));
+    int mask = _mm_movemask_epi8(m);
+    for (int k = 0; k < 8; k++) {
+      if (mask & (1 << (2 * k))) po[n++] = pa[i + k];
+    }
+    int16_t amax = pa[i + 7], bmax = pb[j + 7];
+    if (amax <= bmax) i += 8;
+    if (bmax <= amax) j += 8;
+  }
+  return inter_scalar(a, i, b, j, out, n);
+}
+
+static uint32_t inter32(const struct intset* a, const struct intset* b,
+                        struct intset* out) {
+  const int32_t* pa = (const int32_t*)a->data;
+  const int32_t* pb = (const int32_t*)b->data;
+  int32_t* po = (int32_t*)out->data;
+  uint32_t i = 0, j = 0, n = 0;
+  while (i + 4 <= a->len && j + 4 <= b->len) {
+    __m128i va = _mm_loadu_si128((const __m128i*)(pa + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(pb + j));
+    __m128i m = _mm_cmpeq_epi32(va, vb);
+    m = _mm_or_si128(m, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4e)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93)));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+    for (int k = 0; k < 4; k++) {
+      if (mask & (1 << k)) po[n++] = pa[i + k];
+    }
+    int32_t amax = pa[i + 3], bmax = pb[j + 3];
+    if (amax <= bmax) i += 4;
+    if (bmax <= amax) j += 4;
+  }
+  return inter_scalar(a, i, b, j, out, n);
+}
+#endif
+
+// is_intersect returns a new intset with the integers found in both a and b.
+// Returns NULL when out of memory.
+struct intset* is_intersect(const struct intset* a, const struct intset* b) {
+  if (a->len > b->len) {
+    const struct intset* t = a;
+    a = b;
+    b = t;
+  }
+  // the intersection fits the narrower width
+  uint32_t width = a->width < b->width ? a->width : b->width;
+  struct intset* out =
+      malloc(sizeof(struct intset) + (size_t)a->len * width);
+  if (!out) {
+    return NULL;
+  }
+  out->width = width;
+  uint32_t n;
+  if (a->len == 0) {
+    n = 0;
+  } else if (b->len / a->len >= GALLOP_RATIO) {
+    n = inter_gallop(a, b, out);
+#ifdef __SSE2__
+  } else if (a->width == 2 && b->width == 2) {
+    n = inter16(a, b, out);
+  } else if (a->width == 4 && b->width == 4) {
+    n = inter32(a, b, out);
+#endif
+  } else {
+    n = inter_scalar(a, 0, b, 0, out, 0);
+  }
+  out->len = n;
+  struct intset* nout = realloc(out, is_bytes(out));
+  return nout ? nout : out;
+}
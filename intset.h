@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An intset is a sorted array of unique integers, packed with the smallest
+// width (16, 32 or 64 bits) that holds all of them. Functions that grow the
+// intset may move it and return its new address, or NULL when out of memory
+// in which case the original intset is left untouched.
+struct intset {
+  uint32_t width;
+  uint32_t len;
+  char data[];
+};
+
+struct intset* is_new(void);
+void is_free(struct intset* is);
+size_t is_bytes(const struct intset* is);
+int64_t is_get(const struct intset* is, uint32_t pos);
+bool is_find(const struct intset* is, int64_t value);
+struct intset* is_add(struct intset* is, int64_t value, bool* added);
+struct intset* is_remove(struct intset* is, int64_t value, bool* removed);
+struct intset* is_intersect(const struct intset* a, const struct intset* b);
@@ -0,0 +1,286 @@
+#include "listpack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Layout: a header with the total size in bytes and the number of entries,
+// followed by the entries. Each entry is the length of its data as a varint,
+// the data, and the size of the length and data as a varint that is read
+// backwards, so the list can be walked in both directions.
+//
+//   <bytes:u32> <count:u32> [<len> <data> <backlen>]...
+
+#define LP_HDR 8
+#define LP_MAXVARINT 5
+
+static uint32_t lp_u32(const unsigned char* p) {
+  uint32_t x;
+  memcpy(&x, p, 4);
+  return x;
+}
+
+static void lp_set_u32(unsigned char* p, uint32_t x) { memcpy(p, &x, 4); }
+
+size_t lp_bytes(const unsigned char* lp) { return lp_u32(lp); }
+
+uint32_t lp_count(const unsigned char* lp) { return lp_u32(lp + 4); }
+
+static int varint_size(size_t x) {
+  int n = 1;
+  while (x >= 0x80) {
+    x >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static int varint_put(unsigned char* p, size_t x) {
+  int n = 0;
+  while (x >= 0x80) {
+    p[n++] = (x & 0x7F) | 0x80;
+    x >>= 7;
+  }
+  p[n++] = x;
+  return n;
+}
+
+static int varint_get(const unsigned char* p, size_t* x) {
+  size_t v = 0;
+  int n = 0;
+  do {
+    v |= (size_t)(p[n] & 0x7F) << (7 * n);
+  } while (p[n++] & 0x80);
+  *x = v;
+  return n;
+}
+
+// backlen_put writes x so that it can be read backwards from p + size.
+static void backlen_put(unsigned char* p, size_t x) {
+  int n = varint_size(x);
+  for (int i = n - 1; i >= 0; i--) {
+    p[i] = (x & 0x7F) | (i > 0 ? 0x80 : 0);
+    x >>= 7;
+  }
+}
+
+// backlen_get reads the value that ends right before p.
+static size_t backlen_get(const unsigned char* p) {
+  size_t v = 0;
+  int n = 0;
+  do {
+    p--;
+    v |= (size_t)(*p & 0x7F) << (7 * n);
+    n++;
+  } while (*p & 0x80);
+  return v;
+}
+
+static size_t entry_size(size_t len) {
+  size_t sz = varint_size(len) + len;
+  return sz + varint_size(sz);
+}
+
+static size_t entry_size_at(const unsigned char* p) {
+  size_t len;
+  varint_get(p, &len);
+  return entry_size(len);
+}
+
+unsigned char* lp_new(void) {
+  unsigned char* lp = malloc(LP_HDR);
+  if (!lp) {
+    return NULL;
+  }
+  lp_set_u32(lp, LP_HDR);
+  lp_set_u32(lp + 4, 0);
+  return lp;
+}
+
+void lp_free(unsigned char* lp) { free(lp); }
+
+// lp_valid checks that the len bytes at lp form a well formed listpack, such
+// as one received from a client.
+bool lp_valid(const unsigned char* lp, size_t len) {
+  if (len < LP_HDR || lp_bytes(lp) != len) {
+    return false;
+  }
+  const unsigned char* p = lp + LP_HDR;
+  const unsigned char* end = lp + len;
+  uint32_t count = 0;
+  while (p < end) {
+    size_t dlen = 0;
+    int n = 0;
+    do {
+      if (p + n >= end || n == LP_MAXVARINT) return false;
+      dlen |= (size_t)(p[n] & 0x7F) << (7 * n);
+    } while (p[n++] & 0x80);
+    if (n != varint_size(dlen) || dlen > (size_t)(end - p)) return false;
+    size_t sz = entry_size(dlen);
+    if (sz > (size_t)(end - p)) return false;
+    unsigned char back[LP_MAXVARINT];
+    backlen_put(back, n + dlen);
+    if (memcmp(p + n + dlen, back, sz - n - dlen) != 0) return false;
+    p += sz;
+    count++;
+  }
+  return count == lp_count(lp);
+}
+
+unsigned char* lp_first(unsigned char* lp) {
+  return lp_bytes(lp) > LP_HDR ? lp + LP_HDR : NULL;
+}
+
+unsigned char* lp_last(unsigned char* lp) {
+  unsigned char* end = lp + lp_bytes(lp);
+  if (end == lp + LP_HDR) {
+    return NULL;
+  }
+  size_t sz = backlen_get(end);
+  return end - sz - varint_size(sz);
+}
+
+unsigned char* lp_next(unsigned char* lp, unsigned char* p) {
+  p += entry_size_at(p);
+  return p < lp + lp_bytes(lp) ? p : NULL;
+}
+
+unsigned char* lp_prev(unsigned char* lp, unsigned char* p) {
+  if (p == lp + LP_HDR) {
+    return NULL;
+  }
+  size_t sz = backlen_get(p);
+  return p - sz - varint_size(sz);
+}
+
+// lp_seek returns the entry at index, counting from the end when negative.
+// Returns NULL if out of range.
+unsigned char* lp_seek(unsigned char* lp, long index) {
+  long count = lp_count(lp);
+  if (index < 0) {
+    index += count;
+  }
+  if (index < 0 || index >= count) {
+    return NULL;
+  }
+  unsigned char* p;
+  if (index < count / 2) {
+    p = lp_first(lp);
+    while (index-- > 0) p = lp_next(lp, p);
+  } else {
+    p = lp_last(lp);
+    for (long i = count - 1; i > index; i--) p = lp_prev(lp, p);
+  }
+  return p;
+}
+
+// lp_get returns the data of the entry at p.
+const char* lp_get(unsigned char* p, size_t* len) {
+  int n = varint_get(p, len);
+  return (const char*)p + n;
+}
+
+// lp_find returns the first entry equal to data, starting at p and skipping
+// `skip` entries after each comparison, such as the values of field-value
+// pairs. Returns NULL if not found.
+unsigned char* lp_find(unsigned char* lp, unsigned char* p, const void* data,
+                       size_t len, int skip) {
+  while (p) {
+    size_t elen;
+    const char* edata = lp_get(p, &elen);
+    if (elen == len && memcmp(edata, data, len) == 0) {
+      return p;
+    }
+    p = lp_next(lp, p);
+    for (int i = 0; i < skip && p; i++) {
+      p = lp_next(lp, p);
+    }
+  }
+  return NULL;
+}
+
+// lp_resize moves the bytes from off onwards by delta bytes.
+static unsigned char* lp_resize(unsigned char* lp, size_t off, long delta) {
+  size_t bytes = lp_bytes(lp);
+  if (delta > 0 && bytes + delta > UINT32_MAX) {
+    return NULL;
+  }
+  if (delta < 0) {
+    memmove(lp + off + delta, lp + off, bytes - off);
+  }
+  unsigned char* nlp = realloc(lp, bytes + delta);
+  if (!nlp) {
+    if (delta < 0) {
+      // shrinking in place is fine, the allocation is just larger than needed
+      lp_set_u32(lp, bytes + delta);
+      return lp;
+    }
+    return NULL;
+  }
+  if (delta > 0) {
+    memmove(nlp + off + delta, nlp + off, bytes - off);
+  }
+  lp_set_u32(nlp, bytes + delta);
+  return nlp;
+}
+
+static void entry_put(unsigned char* p, const void* data, size_t len) {
+  int n = varint_put(p, len);
+  memcpy(p + n, data, len);
+  backlen_put(p + n + len, n + len);
+}
+
+// lp_insert inserts data before the entry at p, or at the end if p is NULL.
+unsigned char* lp_insert(unsigned char* lp, unsigned char* p,
+                         const void* data, size_t len) {
+  size_t off = p ? (size_t)(p - lp) : lp_bytes(lp);
+  size_t sz = entry_size(len);
+  unsigned char* nlp = lp_resize(lp, off, sz);
+  if (!nlp) {
+    return NULL;
+  }
+  entry_put(nlp + off, data, len);
+  lp_set_u32(nlp + 4, lp_count(nlp) + 1);
+  return nlp;
+}
+
+unsigned char* lp_append(unsigned char* lp, const void* data, size_t len) {
+  return lp_insert(lp, NULL, data, len);
+}
+
+unsigned char* lp_prepend(unsigned char* lp, const void* data, size_t len) {
+  return lp_insert(lp, lp_first(lp), data, len);
+}
+
+// lp_replace replaces the data of the entry at p.
+unsigned char* lp_replace(unsigned char* lp, unsigned char* p,
+                          const void* data, size_t len) {
+  size_t off = p - lp;
+  size_t oldsz = entry_size_at(p);
+  size_t sz = entry_size(len);
+  unsigned char* nlp = lp;
+  if (sz != oldsz) {
+    nlp = lp_resize(lp, off + oldsz, (long)sz - (long)oldsz);
+    if (!nlp) {
+      return NULL;
+    }
+  }
+  entry_put(nlp + off, data, len);
+  return nlp;
+}
+
+// lp_delete deletes up to n entries starting at p. The entry that followed
+// the deleted ones, if any, is found at the same offset as p.
+unsigned char* lp_delete(unsigned char* lp, unsigned char* p, uint32_t n) {
+  size_t off = p - lp;
+  unsigned char* end = p;
+  uint32_t deleted = 0;
+  while (end && deleted < n) {
+    end = lp_next(lp, end);
+    deleted++;
+  }
+  size_t endoff = end ? (size_t)(end - lp) : lp_bytes(lp);
+  uint32_t count = lp_count(lp) - deleted;
+  lp = lp_resize(lp, endoff, -(long)(endoff - off));
+  lp_set_u32(lp + 4, count);
+  return lp;
+}
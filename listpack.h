@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A listpack is a list of binary safe strings packed into a single
+// allocation. Functions that grow or shrink the listpack may move it and
+// return its new address, or NULL when out of memory in which case the
+// original listpack is left untouched.
+
+unsigned char* lp_new(void);
+void lp_free(unsigned char* lp);
+size_t lp_bytes(const unsigned char* lp);
+uint32_t lp_count(const unsigned char* lp);
+bool lp_valid(const unsigned char* lp, size_t len);
+
+unsigned char* lp_first(unsigned char* lp);
+unsigned char* lp_last(unsigned char* lp);
+unsigned char* lp_next(unsigned char* lp, unsigned char* p);
+unsigned char* lp_prev(unsigned char* lp, unsigned char* p);
+unsigned char* lp_seek(unsigned char* lp, long index);
+const char* lp_get(unsigned char* p, size_t* len);
+unsigned char* lp_find(unsigned char* lp, unsigned char* p, const void* data,
+                       size_t len, int skip);
+
+unsigned char* lp_insert(unsigned char* lp, unsigned char* p,
+                         const void* data, size_t len);
+unsigned char* lp_append(unsigned char* lp, const void* data, size_t len);
+unsigned char* lp_prepend(unsigned char* lp, const void* data, size_t len);
+unsigned char* lp_replace(unsigned char* lp, unsigned char* p,
+                          const void* data, size_t len);
+unsigned char* lp_delete(unsigned char* lp, unsigned char* p, uint32_t n);
@@ -2,6 +2,7 @@
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,30 +13,89 @@
 #define MAXARGS 1048575
 #define MAXARGSZ 536870912
 
+// Arguments of RESP commands point straight into the connection's input,
+// which stays in place while the command runs, and are null-terminated in
+// place of their trailing CR. Inline commands are unescaped into bufs, which
+// are reused from command to command.
+struct miniredis_arg {
+  const char* data;
+  size_t len;
+};
+
 struct miniredis_args {
+  struct miniredis_arg* items;
   struct buf* bufs;
   int len, cap;
 };
 
-struct miniredis_conn {
-  bool closed;
-  struct event_conn* econn;
-  struct buf packet;
-  struct buf wrbuf;
+// Unprocessed input is held by the event layer, and replies are formatted in
+// a scratch buffer of the thread, the I/O threads serving reads ahead having
+// their own, before being appended to the connection's pooled output chunks,
+// so a connection owns no buffers itself.
+struct mainctx {
   void* udata;
-  int nls;
+  struct miniredis_events* events;
   struct miniredis_args args;
 };
 
-struct mainctx {
+static _Thread_local struct buf wrbuf;
+
+// proto holds the encodings of the reply types that differ between RESP2 and
+// RESP3. A connection points at the one of its protocol, so the writers don't
+// branch on it.
+struct proto {
+  int version;
+  char map;
+  int mapitems;  // RESP2 maps are flat arrays of keys and values
+  char set;
+  char push;
+  const char* null;
+  const char* yes;
+  const char* no;
+};
+
+static const struct proto resp2 = {
+    2, '*', 2, '*', '*', "$-1\r\n", ":1\r\n", ":0\r\n",
+};
+
+static const struct proto resp3 = {
+    3, '%', 1, '~', '>', "_\r\n", "#t\r\n", "#f\r\n",
+};
+
+// batch_cmd is a command parsed ahead, with end the offset of the input that
+// follows it.
+struct batch_cmd {
+  int first;  // of its arguments in the items of the batch
+  int nargs;
+  size_t end;
+};
+
+// batch holds the commands an I/O thread parsed from the input of a
+// connection, which data runs rather than parsing them again. It is only
+// valid during the next call to data, which starts at base.
+struct batch {
+  const char* base;
+  struct miniredis_arg* items;
+  int nitems, itemscap;
+  struct batch_cmd* cmds;
+  int ncmds, cmdscap;
+  int next;
+  struct miniredis_args args;  // of the command being parsed
+};
+
+struct miniredis_conn {
+  bool closed;
+  bool blocked;
+  const struct proto* proto;
+  struct event_conn* econn;
+  struct batch* batch;  // allocated by the first parse ahead
   void* udata;
-  struct miniredis_events* events;
 };
 
 const char* miniredis_args_at(struct miniredis_args* args, int idx,
                               size_t* len) {
-  if (len) *len = args->bufs[idx].len;
-  return args->bufs[idx].data;
+  if (len) *len = args->items[idx].len;
+  return args->items[idx].data;
 }
 
 int miniredis_args_count(struct miniredis_args* args) { return args->len; }
@@ -59,40 +119,195 @@ bool miniredis_args_eq(struct miniredis_args* args, int index,
   return true;
 }
 
-static bool append_arg(struct miniredis_args* args, const char* data,
-                       size_t len) {
-  if (args->len == args->cap) {
-    size_t cap = args->cap ? args->cap * 2 : 1;
-    struct buf* bufs = malloc(cap * sizeof(struct buf));
-    if (!bufs) {
-      return false;
-    }
-    memcpy(bufs, args->bufs, args->len * sizeof(struct buf));
-    memset(&bufs[args->len], 0, (cap - args->len) * sizeof(struct buf));
-    free(args->bufs);
-    args->bufs = bufs;
-    args->cap = cap;
-  }
-  args->bufs[args->len].len = 0;
-  if (!buf_append(&args->bufs[args->len], data, len)) {
+// miniredis_args_copy copies the arguments, which otherwise point into input
+// that is gone once the command returns, into a single allocation that is
+// released with free. Returns NULL when out of memory.
+struct miniredis_args* miniredis_args_copy(struct miniredis_args* args) {
+  size_t size = sizeof(struct miniredis_args) +
+                args->len * sizeof(struct miniredis_arg);
+  for (int i = 0; i < args->len; i++) {
+    size += args->items[i].len + 1;
+  }
+  struct miniredis_args* copy = malloc(size);
+  if (!copy) {
+    return NULL;
+  }
+  copy->items = (struct miniredis_arg*)(copy + 1);
+  copy->bufs = NULL;
+  copy->len = args->len;
+  copy->cap = args->len;
+  char* data = (char*)(copy->items + args->len);
+  for (int i = 0; i < args->len; i++) {
+    memcpy(data, args->items[i].data, args->items[i].len);
+    data[args->items[i].len] = '\0';
+    copy->items[i].data = data;
+    copy->items[i].len = args->items[i].len;
+    data += args->items[i].len + 1;
+  }
+  return copy;
+}
+
+static bool grow_args(struct miniredis_args* args) {
+  size_t cap = args->cap ? args->cap * 2 : 1;
+  struct miniredis_arg* items = malloc(cap * sizeof(struct miniredis_arg));
+  struct buf* bufs = malloc(cap * sizeof(struct buf));
+  if (!items || !bufs) {
+    free(items);
+    free(bufs);
     return false;
   }
+  memcpy(items, args->items, args->len * sizeof(struct miniredis_arg));
+  memcpy(bufs, args->bufs, args->cap * sizeof(struct buf));
+  memset(&bufs[args->cap], 0, (cap - args->cap) * sizeof(struct buf));
+  free(args->items);
+  free(args->bufs);
+  args->items = items;
+  args->bufs = bufs;
+  args->cap = cap;
+  return true;
+}
+
+// push_arg adds an argument that refers to data without copying it.
+static bool push_arg(struct miniredis_args* args, const char* data,
+                     size_t len) {
+  if (args->len == args->cap && !grow_args(args)) {
+    return false;
+  }
+  args->items[args->len].data = data;
+  args->items[args->len].len = len;
   args->len++;
   return true;
 }
 
+// append_arg adds a copy of data as an argument.
+static bool append_arg(struct miniredis_args* args, const char* data,
+                       size_t len) {
+  if (args->len == args->cap && !grow_args(args)) {
+    return false;
+  }
+  struct buf* buf = &args->bufs[args->len];
+  buf->len = 0;
+  if (!buf_append(buf, data, len)) {
+    return false;
+  }
+  return push_arg(args, buf->data, buf->len);
+}
+
 int64_t miniredis_now() { return event_now(); }
 
+void miniredis_stats(struct miniredis_stats* stats) {
+  struct event_stats es;
+  event_stats(&es);
+  stats->connections = es.connections;
+  stats->total_connections = es.total_connections;
+  stats->rejected_connections = es.rejected_connections;
+  stats->net_input_bytes = es.net_input_bytes;
+  stats->net_output_bytes = es.net_output_bytes;
+  stats->io_threaded_reads = es.io_threaded_reads;
+  stats->io_threaded_writes = es.io_threaded_writes;
+}
+
 void miniredis_conn_close(struct miniredis_conn* conn) {
   if (conn->closed) return;
   conn->closed = true;
   event_conn_close(conn->econn);
 }
 
+// miniredis_conn_set_proto switches the replies of the connection to RESP2 or
+// RESP3, as negotiated by HELLO.
+void miniredis_conn_set_proto(struct miniredis_conn* conn, int version) {
+  conn->proto = version == 3 ? &resp3 : &resp2;
+}
+
+int miniredis_conn_proto(struct miniredis_conn* conn) {
+  return conn->proto->version;
+}
+
 const char* miniredis_conn_addr(struct miniredis_conn* conn) {
   return event_conn_addr(conn->econn);
 }
 
+void* miniredis_conn_udata(struct miniredis_conn* conn) { return conn->udata; }
+
+void miniredis_conn_set_udata(struct miniredis_conn* conn, void* udata) {
+  conn->udata = udata;
+}
+
+// miniredis_conn_block stops executing commands from the connection, after
+// the current one, until miniredis_conn_unblock is called.
+void miniredis_conn_block(struct miniredis_conn* conn) {
+  if (conn->closed || conn->blocked) return;
+  conn->blocked = true;
+  event_conn_hold(conn->econn);
+}
+
+void miniredis_conn_unblock(struct miniredis_conn* conn) {
+  if (conn->closed || !conn->blocked) return;
+  conn->blocked = false;
+  event_conn_release(conn->econn);
+}
+
+// miniredis_conn_set_output_limits bounds the pending output of the
+// connection. Reading is paused above `pause` bytes, and the connection is
+// closed above `hard` bytes or when above `soft` bytes for soft_seconds.
+void miniredis_conn_set_output_limits(struct miniredis_conn* conn,
+                                      size_t pause, size_t hard, size_t soft,
+                                      int64_t soft_seconds) {
+  struct event_limits limits = {
+      .pause = pause,
+      .hard = hard,
+      .soft = soft,
+      .soft_ns = soft_seconds * 1000000000,
+  };
+  event_conn_set_limits(conn->econn, limits);
+}
+
+static void opened(struct event_conn* econn, void* udata) {
+  struct mainctx* ctx = udata;
+  struct miniredis_conn* conn = malloc(sizeof(struct miniredis_conn));
+  if (!conn) {
+    event_conn_close(econn);
+    return;
+  }
+  memset(conn, 0, sizeof(struct miniredis_conn));
+  conn->econn = econn;
+  conn->proto = &resp2;
+  event_conn_set_udata(econn, conn);
+  if (ctx->events->opened) {
+    ctx->events->opened(conn, ctx->udata);
+  }
+}
+
+static void batch_free(struct batch* batch) {
+  if (!batch) {
+    return;
+  }
+  free(batch->items);
+  free(batch->cmds);
+  free(batch->args.items);
+  free(batch->args.bufs);
+  free(batch);
+}
+
+static void closed(struct event_conn* econn, void* udata) {
+  struct mainctx* ctx = udata;
+  struct miniredis_conn* conn = event_conn_udata(econn);
+  if (!conn) {
+    return;
+  }
+  if (ctx->events->closed) {
+    ctx->events->closed(conn, ctx->udata);
+  }
+  batch_free(conn->batch);
+  free(conn);
+  event_conn_set_udata(econn, NULL);
+}
+
+static int64_t tick(void* udata) {
+  struct mainctx* ctx = udata;
+  return ctx->events->tick(ctx->udata);
+}
+
 static void serving(const char** addrs, int naddrs, void* udata) {
   struct mainctx* ctx = udata;
   if (ctx->events->serving) {
@@ -100,6 +315,16 @@ static void serving(const char** addrs, int naddrs, void* udata) {
   }
 }
 
+static void parsed(void* udata) {
+  struct mainctx* ctx = udata;
+  ctx->events->read_done(ctx->udata);
+}
+
+static void iteration(int64_t ns, void* udata) {
+  struct mainctx* ctx = udata;
+  ctx->events->iteration(ns, ctx->udata);
+}
+
 static void error(const char* message, bool fatal, void* udata) {
   struct mainctx* ctx = udata;
   if (ctx->events->error) {
@@ -198,6 +423,18 @@ fail:
   return -1;
 }
 
+// parse_error reports a protocol error, unless parsing ahead without a
+// connection, in which case data finds the error again.
+static void parse_error(struct miniredis_conn* conn, const char* err) {
+  if (conn) {
+    miniredis_conn_write_error(conn, err);
+  }
+}
+
+// resp_parse parses a RESP command. Returns its length, zero if it is
+// incomplete, or -1 on error. conn is NULL when parsing ahead on an I/O
+// thread, where errors are not reported and the size of partial commands is
+// not passed on to the event layer.
 static size_t resp_parse(char* data, size_t len, struct miniredis_conn* conn,
                          struct miniredis_args* args) {
   args->len = 0;
@@ -211,8 +448,7 @@ static size_t resp_parse(char* data, size_t len, struct miniredis_conn* conn,
   char* end = NULL;
   long nargs = strtol(data + i, &end, 10);
   if (end == data + i || nargs > MAXARGS || end[0] != '\r' || end[1] != '\n') {
-    miniredis_conn_write_error(conn,
-                               "ERR Protocol error: invalid multibulk length");
+    parse_error(conn, "ERR Protocol error: invalid multibulk length");
     return -1;
   }
   i += (end - (data + i)) + 2;
@@ -223,60 +459,165 @@ static size_t resp_parse(char* data, size_t len, struct miniredis_conn* conn,
     if (data[i] != '$') {
       char str[64];
       sprintf(str, "ERR Protocol error: expected '$', got '%c'", data[i]);
-      miniredis_conn_write_error(conn, str);
+      parse_error(conn, str);
       return -1;
     }
     i++;
     if (i == len) return 0;
     if (!memchr(data + i, '\n', len - i)) return 0;
     long nbytes = strtol(data + i, &end, 10);
-    if (end == data + i || nbytes > MAXARGSZ || end[0] != '\r' ||
-        end[1] != '\n') {
-      miniredis_conn_write_error(conn,
-                                 "ERR Protocol error: invalid bulk length");
+    if (end == data + i || nbytes < 0 || nbytes > MAXARGSZ ||
+        end[0] != '\r' || end[1] != '\n') {
+      parse_error(conn, "ERR Protocol error: invalid bulk length");
       return -1;
     }
     i += (end - (data + i)) + 2;
-    if (i + nbytes + 2 > len) return 0;
-    if (!append_arg(args, data + i, nbytes)) {
+    if (i + nbytes + 2 > len) {
+      // let the event layer read the rest of the bulk in one go
+      if (conn) {
+        event_conn_expect(conn->econn, i + nbytes + 2);
+      }
+      return 0;
+    }
+    if (!push_arg(args, data + i, nbytes)) {
       return -1;
     }
     i += nbytes + 2;
   }
+  for (int j = 0; j < args->len; j++) {
+    ((char*)args->items[j].data)[args->items[j].len] = '\0';
+  }
   return i;
 }
 
-static void data(struct event_conn* econn, const void* edata, size_t elen,
-                 void* udata) {
+// batch_push appends the parsed command to the batch. Returns false when out
+// of memory.
+static bool batch_push(struct batch* batch, size_t end) {
+  struct miniredis_args* args = &batch->args;
+  if (batch->nitems + args->len > batch->itemscap) {
+    int cap = batch->itemscap ? batch->itemscap : 16;
+    while (cap < batch->nitems + args->len) cap *= 2;
+    struct miniredis_arg* items =
+        realloc(batch->items, cap * sizeof(struct miniredis_arg));
+    if (!items) {
+      return false;
+    }
+    batch->items = items;
+    batch->itemscap = cap;
+  }
+  if (batch->ncmds == batch->cmdscap) {
+    int cap = batch->cmdscap ? batch->cmdscap * 2 : 16;
+    struct batch_cmd* cmds = realloc(batch->cmds, cap * sizeof(*cmds));
+    if (!cmds) {
+      return false;
+    }
+    batch->cmds = cmds;
+    batch->cmdscap = cap;
+  }
+  memcpy(batch->items + batch->nitems, args->items,
+         args->len * sizeof(struct miniredis_arg));
+  batch->cmds[batch->ncmds++] = (struct batch_cmd){
+      .first = batch->nitems, .nargs = args->len, .end = end};
+  batch->nitems += args->len;
+  return true;
+}
+
+// parse runs on an I/O thread, ahead of data, and parses the complete RESP
+// commands at the start of the input into the batch of the connection.
+// Inline commands and errors end the batch, and are left to data. The
+// leading commands that read_ahead serves are consumed right away.
+static size_t parse(struct event_conn* econn, void* edata, size_t elen,
+                    void* udata) {
   struct mainctx* ctx = udata;
   struct miniredis_conn* conn = event_conn_udata(econn);
-  if (!conn || conn->closed) {
-    goto close;
+  if (!conn || conn->closed || conn->blocked) {
+    return 0;
   }
-
-  char* data;
-  size_t len;
-  bool copied;
-
-  if (conn->packet.len == 0) {
-    data = (char*)edata;
-    len = elen;
-    copied = false;
-  } else {
-    if (!buf_append(&conn->packet, edata, elen)) {
-      goto close;
+  struct batch* batch = conn->batch;
+  if (!batch && !(batch = conn->batch = calloc(1, sizeof(struct batch)))) {
+    return 0;
+  }
+  batch->base = edata;
+  batch->nitems = 0;
+  batch->ncmds = 0;
+  batch->next = 0;
+  char* data = edata;
+  size_t off = 0;
+  while (off < elen && data[off] == '*') {
+    long n = resp_parse(data + off, elen - off, NULL, &batch->args);
+    if (n <= 0 || !batch_push(batch, off + n)) {
+      break;
     }
-    len = conn->packet.len;
-    data = conn->packet.data;
-    copied = true;
+    off += n;
+  }
+  if (!ctx->events->read_ahead) {
+    return 0;
   }
+  // batch_next takes up after the commands served, where data then starts
+  while (batch->next < batch->ncmds && !conn->closed &&
+         !event_conn_limited(econn)) {
+    struct batch_cmd* cmd = &batch->cmds[batch->next];
+    struct miniredis_args args = {
+        .items = batch->items + cmd->first,
+        .len = cmd->nargs,
+        .cap = cmd->nargs,
+    };
+    if (!ctx->events->read_ahead(conn, &args, ctx->udata)) {
+      break;
+    }
+    batch->next++;
+  }
+  return batch->next ? batch->cmds[batch->next - 1].end : 0;
+}
 
-  while (len > 0 && !conn->closed) {
+// batch_next returns the next command of the batch as args, with its length
+// in n, if the batch is valid and the command starts at data.
+static bool batch_next(struct miniredis_conn* conn, const char* data,
+                       struct miniredis_args* args, long* n) {
+  struct batch* batch = conn->batch;
+  if (!batch || batch->next == batch->ncmds) {
+    return false;
+  }
+  size_t start = batch->next ? batch->cmds[batch->next - 1].end : 0;
+  if (batch->base + start != data) {
+    batch->ncmds = 0;
+    return false;
+  }
+  struct batch_cmd* cmd = &batch->cmds[batch->next++];
+  args->items = batch->items + cmd->first;
+  args->bufs = NULL;
+  args->len = cmd->nargs;
+  args->cap = cmd->nargs;
+  *n = cmd->end - start;
+  return true;
+}
+
+// data parses and executes the complete commands found in the input, and
+// returns the number of bytes consumed. Partial commands are left to the event
+// layer until more input arrives.
+static size_t data(struct event_conn* econn, void* edata, size_t elen,
+                   void* udata) {
+  struct mainctx* ctx = udata;
+  struct miniredis_conn* conn = event_conn_udata(econn);
+  if (!conn || conn->closed) {
+    goto close;
+  }
+  char* data = edata;
+  size_t len = elen;
+  while (len > 0 && !conn->closed && !conn->blocked) {
+    if (event_conn_congested(econn)) {
+      // keep the rest for when the output is flushed
+      break;
+    }
+    struct miniredis_args* args = &ctx->args;
+    struct miniredis_args ahead;
     long n;
-    if (data[0] != '*') {
-      n = telnet_parse(data, len, conn, &conn->args);
+    if (batch_next(conn, data, &ahead, &n)) {
+      args = &ahead;
+    } else if (data[0] != '*') {
+      n = telnet_parse(data, len, conn, args);
     } else {
-      n = resp_parse(data, len, conn, &conn->args);
+      n = resp_parse(data, len, conn, args);
     }
     if (n == 0) {
       break;
@@ -285,58 +626,55 @@ static void data(struct event_conn* econn, const void* edata, size_t elen,
       conn->closed = true;
       break;
     }
-    if (conn->args.len > 0) {
-      if (miniredis_args_eq(&conn->args, 0, "quit")) {
+    if (args->len > 0) {
+      if (miniredis_args_eq(args, 0, "quit")) {
         miniredis_conn_write_string(conn, "OK");
         conn->closed = true;
         break;
       }
       if (ctx->events->command) {
-        ctx->events->command(conn, &conn->args, ctx->udata);
+        ctx->events->command(conn, args, ctx->udata);
       }
     }
     len -= n;
     data += n;
   }
-  if (conn->closed) {
-    goto close;
+  if (conn->batch) {
+    // the commands parsed ahead are stale once data returns
+    conn->batch->ncmds = 0;
   }
-
-  if (len == 0) {
-    if (copied) {
-      if (conn->packet.cap > 4096) {
-        buf_clear(&conn->packet);
-      }
-      conn->packet.len = 0;
-    }
-  } else {
-    if (copied) {
-      memmove(conn->packet.data, data, len);
-      conn->packet.len = len;
-    } else {
-      if (!buf_append(&conn->packet, data, len)) {
-        goto close;
-      }
-    }
+  if (!conn->closed) {
+    return elen - len;
   }
-  return;
 close:
   event_conn_close(econn);
-  return;
+  return elen;
 }
 
 void miniredis_main(const char** addrs, int naddrs,
+                    struct miniredis_options options,
                     struct miniredis_events events, void* udata) {
   struct mainctx ctx = {
       .udata = udata,
       .events = &events,
   };
   struct event_events eevents = {
+      .tick = events.tick ? tick : NULL,
+      .opened = opened,
+      .closed = closed,
       .data = data,
+      .parse = parse,
+      .parsed = events.read_done ? parsed : NULL,
       .serving = events.serving ? serving : NULL,
       .error = events.error ? error : NULL,
+      .iteration = events.iteration ? iteration : NULL,
   };
-  event_main(addrs, naddrs, eevents, &ctx);
+  struct event_options eoptions = {
+      .edge_triggered = options.edge_triggered,
+      .unix_perm = options.unix_perm,
+      .io_threads = options.io_threads,
+  };
+  event_main(addrs, naddrs, eoptions, eevents, &ctx);
 }
 
 static bool writeln(struct buf* buf, char ch, const void* data, ssize_t len) {
@@ -411,6 +749,19 @@ bool miniredis_write_null(struct buf* buf) {
   return buf_append(buf, "$-1\r\n", 5);
 }
 
+// miniredis_format_double writes the shortest form of the value that parses
+// back to it.
+int miniredis_format_double(char str[32], double x) {
+  if (isinf(x)) {
+    return snprintf(str, 32, "%s", x > 0 ? "inf" : "-inf");
+  }
+  int len = snprintf(str, 32, "%.15g", x);
+  if (strtod(str, NULL) != x) {
+    len = snprintf(str, 32, "%.17g", x);
+  }
+  return len;
+}
+
 bool miniredis_write_bulk(struct buf* buf, const void* data, ssize_t len) {
   if (data == NULL) {
     return miniredis_write_null(buf);
@@ -426,22 +777,80 @@ bool miniredis_write_bulk(struct buf* buf, const void* data, ssize_t len) {
 #define rwrite(func, ...)                                             \
   {                                                                   \
     if (conn->closed) return;                                         \
-    if (!func(&conn->wrbuf, ##__VA_ARGS__)) {                         \
+    if (!func(&wrbuf, ##__VA_ARGS__)) {                               \
       conn->closed = true;                                            \
       return;                                                         \
     }                                                                 \
-    event_conn_write(conn->econn, conn->wrbuf.data, conn->wrbuf.len); \
-    if (conn->wrbuf.cap > 4096) {                                     \
-      buf_clear(&conn->wrbuf);                                        \
+    event_conn_write(conn->econn, wrbuf.data, wrbuf.len);             \
+    if (wrbuf.cap > 4096) {                                           \
+      buf_clear(&wrbuf);                                              \
     } else {                                                          \
-      conn->wrbuf.len = 0;                                            \
+      wrbuf.len = 0;                                                  \
     }                                                                 \
   }
 
+// miniredis_conn_write_array writes an array header, or a null array for a
+// negative count.
 void miniredis_conn_write_array(struct miniredis_conn* conn, int count) {
+  if (count < 0) {
+    rwrite(buf_append, conn->proto->null, -1);
+    return;
+  }
   rwrite(miniredis_write_array, count);
 }
 
+// miniredis_conn_write_map writes the header of a map of count keys and
+// values, which follow it in turn.
+void miniredis_conn_write_map(struct miniredis_conn* conn, int count) {
+  char str[32];
+  rwrite(writeln, conn->proto->map, i64toa(count * conn->proto->mapitems, str),
+         -1);
+}
+
+void miniredis_conn_write_set(struct miniredis_conn* conn, int count) {
+  char str[32];
+  rwrite(writeln, conn->proto->set, i64toa(count, str), -1);
+}
+
+// miniredis_conn_write_push writes the header of an out-of-band message, such
+// as a published message.
+void miniredis_conn_write_push(struct miniredis_conn* conn, int count) {
+  char str[32];
+  rwrite(writeln, conn->proto->push, i64toa(count, str), -1);
+}
+
+void miniredis_conn_write_bool(struct miniredis_conn* conn, bool value) {
+  rwrite(buf_append, value ? conn->proto->yes : conn->proto->no, -1);
+}
+
+// miniredis_conn_write_double writes a RESP3 double, or a bulk string for
+// RESP2.
+void miniredis_conn_write_double(struct miniredis_conn* conn, double value) {
+  char str[32];
+  int len = miniredis_format_double(str, value);
+  if (conn->proto == &resp3) {
+    rwrite(writeln, ',', str, len);
+  } else {
+    rwrite(miniredis_write_bulk, str, len);
+  }
+}
+
+// miniredis_conn_write_verbatim writes a RESP3 verbatim string of the
+// three-letter format, such as "txt", or a bulk string for RESP2.
+void miniredis_conn_write_verbatim(struct miniredis_conn* conn,
+                                   const char* format, const void* data,
+                                   size_t len) {
+  if (conn->proto != &resp3) {
+    miniredis_conn_write_bulk(conn, data, len);
+    return;
+  }
+  char hdr[48];
+  int n = snprintf(hdr, sizeof(hdr), "=%zu\r\n%.3s:", len + 4, format);
+  rwrite(buf_append, hdr, n);
+  event_conn_write(conn->econn, data, len);
+  event_conn_write(conn->econn, "\r\n", 2);
+}
+
 void miniredis_conn_write_string(struct miniredis_conn* conn, const char* str) {
   rwrite(miniredis_write_string, str);
 }
@@ -458,8 +867,21 @@ void miniredis_conn_write_int(struct miniredis_conn* conn, int64_t value) {
   rwrite(miniredis_write_int, value);
 }
 
+// miniredis_conn_write_bulk appends large values straight to the connection's
+// output chunks rather than staging a copy in the scratch buffer.
 void miniredis_conn_write_bulk(struct miniredis_conn* conn, const void* data,
                                ssize_t len) {
+  if (!data) {
+    miniredis_conn_write_null(conn);
+    return;
+  }
+  if (len >= 4096) {
+    char str[32];
+    rwrite(writeln, '$', i64toa(len, str), -1);
+    event_conn_write(conn->econn, data, len);
+    event_conn_write(conn->econn, "\r\n", 2);
+    return;
+  }
   rwrite(miniredis_write_bulk, data, len);
 }
 
@@ -468,6 +890,14 @@ void miniredis_conn_write_raw(struct miniredis_conn* conn, const void* data,
   rwrite(buf_append, data, len);
 }
 
+// miniredis_conn_write_shared queues a reply serialized once for many
+// connections, such as a published message.
+void miniredis_conn_write_shared(struct miniredis_conn* conn,
+                                 struct chunk_shared* shared) {
+  if (conn->closed) return;
+  event_conn_write_shared(conn->econn, shared);
+}
+
 void miniredis_conn_write_null(struct miniredis_conn* conn) {
-  rwrite(miniredis_write_null);
+  rwrite(buf_append, conn->proto->null, -1);
 }
@@ -5,11 +5,21 @@
 #include <sys/types.h>
 
 #include "buf.h"
+#include "chunk.h"
 
 struct miniredis_conn;
 
 void miniredis_conn_close(struct miniredis_conn* conn);
 const char* miniredis_conn_addr(struct miniredis_conn* conn);
+void* miniredis_conn_udata(struct miniredis_conn* conn);
+void miniredis_conn_set_udata(struct miniredis_conn* conn, void* udata);
+void miniredis_conn_set_proto(struct miniredis_conn* conn, int version);
+int miniredis_conn_proto(struct miniredis_conn* conn);
+void miniredis_conn_block(struct miniredis_conn* conn);
+void miniredis_conn_unblock(struct miniredis_conn* conn);
+void miniredis_conn_set_output_limits(struct miniredis_conn* conn,
+                                      size_t pause, size_t hard, size_t soft,
+                                      int64_t soft_seconds);
 void miniredis_conn_write_raw(struct miniredis_conn* conn, const void* data,
                               ssize_t len);
 void miniredis_conn_write_array(struct miniredis_conn* conn, int count);
@@ -20,6 +30,16 @@ void miniredis_conn_write_int(struct miniredis_conn* conn, int64_t value);
 void miniredis_conn_write_bulk(struct miniredis_conn* conn, const void* data,
                                ssize_t len);
 void miniredis_conn_write_null(struct miniredis_conn* conn);
+void miniredis_conn_write_map(struct miniredis_conn* conn, int count);
+void miniredis_conn_write_set(struct miniredis_conn* conn, int count);
+void miniredis_conn_write_push(struct miniredis_conn* conn, int count);
+void miniredis_conn_write_bool(struct miniredis_conn* conn, bool value);
+void miniredis_conn_write_double(struct miniredis_conn* conn, double value);
+void miniredis_conn_write_verbatim(struct miniredis_conn* conn,
+                                   const char* format, const void* data,
+                                   size_t len);
+void miniredis_conn_write_shared(struct miniredis_conn* conn,
+                                 struct chunk_shared* shared);
 
 struct miniredis_args;
 
@@ -27,16 +47,36 @@ const char* miniredis_args_at(struct miniredis_args* args, int index,
                               size_t* len);
 int miniredis_args_count(struct miniredis_args* args);
 bool miniredis_args_eq(struct miniredis_args* args, int index, const char* cmd);
+struct miniredis_args* miniredis_args_copy(struct miniredis_args* args);
 
 struct miniredis_events {
   int64_t (*tick)(void* udata);
+  void (*opened)(struct miniredis_conn* conn, void* udata);
+  void (*closed)(struct miniredis_conn* conn, void* udata);
   void (*command)(struct miniredis_conn* conn, struct miniredis_args* args,
                   void* udata);
+  // read_ahead is called on an I/O thread with the commands parsed ahead of
+  // command, in order, for as long as it returns true, which it does when it
+  // served the command, replies included. It may only use the connection and
+  // the state that the main thread leaves alone while the threads read.
+  bool (*read_ahead)(struct miniredis_conn* conn, struct miniredis_args* args,
+                     void* udata);
+  // read_done is called on the main thread once the threads are done
+  // reading, before command is called with the commands they left.
+  void (*read_done)(void* udata);
   void (*serving)(const char** addrs, int naddrs, void* udata);
   void (*error)(const char* message, bool fatal, void* udata);
+  void (*iteration)(int64_t ns, void* udata);
+};
+
+struct miniredis_options {
+  bool edge_triggered;  // see struct event_options
+  int unix_perm;
+  int io_threads;
 };
 
 void miniredis_main(const char** addrs, int naddrs,
+                    struct miniredis_options options,
                     struct miniredis_events events, void* udata);
 
 // general purpose resp message writing
@@ -48,5 +88,19 @@ bool miniredis_write_uint(struct buf* buf, uint64_t value);
 bool miniredis_write_int(struct buf* buf, int64_t value);
 bool miniredis_write_bulk(struct buf* buf, const void* data, ssize_t len);
 bool miniredis_write_null(struct buf* buf);
+int miniredis_format_double(char str[32], double x);
 
 int64_t miniredis_now();
+
+// miniredis_stats are the connection and network counters of the server.
+struct miniredis_stats {
+  uint64_t connections;  // open connections
+  uint64_t total_connections;
+  uint64_t rejected_connections;
+  uint64_t net_input_bytes;
+  uint64_t net_output_bytes;
+  uint64_t io_threaded_reads;
+  uint64_t io_threaded_writes;
+};
+
+void miniredis_stats(struct miniredis_stats* stats);
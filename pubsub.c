@@ -0,0 +1,296 @@
+#include "pubsub.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "hashmap.h"
+#include "match.h"
+
+// trie_node holds the patterns whose literal prefix is the path to the node.
+// Children are kept in label order.
+struct trie_node {
+  int nchildren;
+  unsigned char* labels;
+  struct trie_node** children;
+  int npatterns;
+  struct pubsub_subs** patterns;
+};
+
+struct pubsub {
+  struct dict* channels;  // name to struct pubsub_subs*
+  struct dict* patterns;
+  struct trie_node root;
+};
+
+static uint64_t sub_hash(const void* item) {
+  return hashmap_xxhash(item, sizeof(void*));
+}
+
+static int sub_compare(const void* a, const void* b) {
+  return memcmp(a, b, sizeof(void*));
+}
+
+static struct pubsub_subs* subs_at(struct dict_entry* entry) {
+  struct pubsub_subs* subs;
+  memcpy(&subs, dict_entry_val(entry), sizeof(subs));
+  return subs;
+}
+
+static void subs_free(struct pubsub_subs* subs) {
+  if (subs->subs) {
+    hashmap_free(subs->subs);
+  }
+  free(subs->name);
+  free(subs);
+}
+
+static void trie_free(struct trie_node* node) {
+  for (int i = 0; i < node->nchildren; i++) {
+    trie_free(node->children[i]);
+    free(node->children[i]);
+  }
+  free(node->labels);
+  free(node->children);
+  free(node->patterns);
+}
+
+struct pubsub* pubsub_new(void) {
+  struct pubsub* ps = calloc(1, sizeof(struct pubsub));
+  if (!ps) {
+    return NULL;
+  }
+  ps->channels = dict_new();
+  ps->patterns = dict_new();
+  if (!ps->channels || !ps->patterns) {
+    pubsub_free(ps);
+    return NULL;
+  }
+  return ps;
+}
+
+void pubsub_free(struct pubsub* ps) {
+  struct dict* dicts[] = {ps->channels, ps->patterns};
+  for (int i = 0; i < 2; i++) {
+    if (!dicts[i]) continue;
+    struct dict_entry* entry;
+    size_t j = 0;
+    while (dict_iter(dicts[i], &j, &entry)) {
+      subs_free(subs_at(entry));
+    }
+    dict_free(dicts[i]);
+  }
+  trie_free(&ps->root);
+  free(ps);
+}
+
+// pubsub_count returns the number of channels or patterns with subscribers.
+size_t pubsub_count(struct pubsub* ps, bool pattern) {
+  return dict_count(pattern ? ps->patterns : ps->channels);
+}
+
+struct pubsub_subs* pubsub_get(struct pubsub* ps, bool pattern,
+                               const char* name, size_t len) {
+  struct dict_entry* entry =
+      dict_get(pattern ? ps->patterns : ps->channels, name, len);
+  return entry ? subs_at(entry) : NULL;
+}
+
+// literal_len returns the length of the literal prefix of the pattern.
+static size_t literal_len(const char* pat, size_t len) {
+  size_t i = 0;
+  while (i < len && pat[i] != '*' && pat[i] != '?' && pat[i] != '\\') {
+    i++;
+  }
+  return i;
+}
+
+static int child_index(struct trie_node* node, unsigned char label) {
+  int lo = 0, hi = node->nchildren;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (node->labels[mid] < label) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static struct trie_node* child(struct trie_node* node, unsigned char label) {
+  int i = child_index(node, label);
+  return i < node->nchildren && node->labels[i] == label ? node->children[i]
+                                                         : NULL;
+}
+
+// trie_add adds the pattern to the node for its literal prefix, creating the
+// path as needed. Returns false when out of memory.
+static bool trie_add(struct trie_node* node, struct pubsub_subs* pat) {
+  size_t prefix = literal_len(pat->name, pat->len);
+  for (size_t i = 0; i < prefix; i++) {
+    unsigned char label = pat->name[i];
+    struct trie_node* next = child(node, label);
+    if (!next) {
+      int n = node->nchildren;
+      unsigned char* labels = realloc(node->labels, n + 1);
+      if (labels) node->labels = labels;
+      struct trie_node** children =
+          realloc(node->children, (n + 1) * sizeof(struct trie_node*));
+      if (children) node->children = children;
+      next = calloc(1, sizeof(struct trie_node));
+      if (!labels || !children || !next) {
+        free(next);
+        return false;
+      }
+      int j = child_index(node, label);
+      memmove(labels + j + 1, labels + j, n - j);
+      memmove(children + j + 1, children + j,
+              (n - j) * sizeof(struct trie_node*));
+      labels[j] = label;
+      children[j] = next;
+      node->nchildren++;
+    }
+    node = next;
+  }
+  struct pubsub_subs** patterns = realloc(
+      node->patterns, (node->npatterns + 1) * sizeof(struct pubsub_subs*));
+  if (!patterns) {
+    return false;
+  }
+  patterns[node->npatterns++] = pat;
+  node->patterns = patterns;
+  return true;
+}
+
+// trie_remove removes the pattern, whose literal prefix starts at depth, from
+// below the node, and prunes the nodes left empty. Returns true if the node
+// itself is left empty.
+static bool trie_remove(struct trie_node* node, struct pubsub_subs* pat,
+                        size_t depth, size_t prefix) {
+  if (depth == prefix) {
+    for (int i = 0; i < node->npatterns; i++) {
+      if (node->patterns[i] == pat) {
+        node->patterns[i] = node->patterns[--node->npatterns];
+        break;
+      }
+    }
+  } else {
+    unsigned char label = pat->name[depth];
+    int i = child_index(node, label);
+    if (i < node->nchildren && node->labels[i] == label &&
+        trie_remove(node->children[i], pat, depth + 1, prefix)) {
+      free(node->children[i]);
+      node->nchildren--;
+      memmove(node->labels + i, node->labels + i + 1, node->nchildren - i);
+      memmove(node->children + i, node->children + i + 1,
+              (node->nchildren - i) * sizeof(struct trie_node*));
+    }
+  }
+  if (node->npatterns > 0 || node->nchildren > 0) {
+    return false;
+  }
+  free(node->labels);
+  free(node->children);
+  free(node->patterns);
+  node->labels = NULL;
+  node->children = NULL;
+  node->patterns = NULL;
+  return true;
+}
+
+// pubsub_add subscribes to a channel or pattern. Returns 1 if subscribed, 0
+// if it already was or -1 when out of memory.
+int pubsub_add(struct pubsub* ps, bool pattern, const char* name, size_t len,
+               void* sub) {
+  struct dict* dict = pattern ? ps->patterns : ps->channels;
+  struct pubsub_subs* subs = pubsub_get(ps, pattern, name, len);
+  if (!subs) {
+    subs = calloc(1, sizeof(struct pubsub_subs));
+    if (!subs) {
+      return -1;
+    }
+    subs->name = malloc(len + 1);
+    subs->subs = hashmap_new(sizeof(void*), 0, sub_hash, sub_compare);
+    if (!subs->name || !subs->subs) {
+      subs_free(subs);
+      return -1;
+    }
+    memcpy(subs->name, name, len);
+    subs->name[len] = '\0';
+    subs->len = len;
+    if (dict_set(dict, name, len, (char*)&subs, sizeof(subs)) == -1) {
+      subs_free(subs);
+      return -1;
+    }
+    if (pattern && !trie_add(&ps->root, subs)) {
+      trie_remove(&ps->root, subs, 0, literal_len(name, len));
+      dict_delete(dict, name, len);
+      subs_free(subs);
+      return -1;
+    }
+  }
+  if (hashmap_get(subs->subs, &sub)) {
+    return 0;
+  }
+  hashmap_set(subs->subs, &sub);
+  if (hashmap_oom(subs->subs)) {
+    if (hashmap_count(subs->subs) == 0) {
+      pubsub_remove(ps, pattern, name, len, NULL);
+    }
+    return -1;
+  }
+  return 1;
+}
+
+// pubsub_remove unsubscribes from a channel or pattern. Returns false if it
+// was not subscribed.
+bool pubsub_remove(struct pubsub* ps, bool pattern, const char* name,
+                   size_t len, void* sub) {
+  struct pubsub_subs* subs = pubsub_get(ps, pattern, name, len);
+  if (!subs) {
+    return false;
+  }
+  bool removed = hashmap_delete(subs->subs, &sub) != NULL;
+  if (hashmap_count(subs->subs) == 0) {
+    if (pattern) {
+      trie_remove(&ps->root, subs, 0, literal_len(name, len));
+    }
+    dict_delete(pattern ? ps->patterns : ps->channels, name, len);
+    subs_free(subs);
+  }
+  return removed;
+}
+
+// pubsub_match calls iter with each pattern that matches the channel.
+void pubsub_match(struct pubsub* ps, const char* channel, size_t len,
+                  void (*iter)(struct pubsub_subs* subs, void* udata),
+                  void* udata) {
+  struct trie_node* node = &ps->root;
+  for (size_t depth = 0; node; depth++) {
+    // the prefix matched, the rest of the pattern is matched to the rest of
+    // the channel
+    for (int i = 0; i < node->npatterns; i++) {
+      struct pubsub_subs* pat = node->patterns[i];
+      if (match(pat->name + depth, pat->len - depth, channel + depth,
+                len - depth)) {
+        iter(pat, udata);
+      }
+    }
+    node = depth < len ? child(node, channel[depth]) : NULL;
+  }
+}
+
+size_t pubsub_subs_count(struct pubsub_subs* subs) {
+  return hashmap_count(subs->subs);
+}
+
+bool pubsub_subs_next(struct pubsub_subs* subs, size_t* i, void** sub) {
+  void* item;
+  if (!hashmap_iter(subs->subs, i, &item)) {
+    return false;
+  }
+  memcpy(sub, item, sizeof(void*));
+  return true;
+}
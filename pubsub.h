@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// pubsub keeps the subscribers of channels and of patterns. Patterns are also
+// indexed by a trie on their literal prefix, the part before their first
+// wildcard, so a published channel is only matched against the patterns
+// whose prefix it starts with, found by walking the trie along its name.
+
+// pubsub_subs is a channel or pattern with its subscribers, which are opaque
+// pointers.
+struct pubsub_subs {
+  char* name;
+  size_t len;
+  struct hashmap* subs;
+};
+
+struct pubsub;
+
+struct pubsub* pubsub_new(void);
+void pubsub_free(struct pubsub* ps);
+size_t pubsub_count(struct pubsub* ps, bool pattern);
+int pubsub_add(struct pubsub* ps, bool pattern, const char* name, size_t len,
+               void* sub);
+bool pubsub_remove(struct pubsub* ps, bool pattern, const char* name,
+                   size_t len, void* sub);
+struct pubsub_subs* pubsub_get(struct pubsub* ps, bool pattern,
+                               const char* name, size_t len);
+void pubsub_match(struct pubsub* ps, const char* channel, size_t len,
+                  void (*iter)(struct pubsub_subs* subs, void* udata),
+                  void* udata);
+size_t pubsub_subs_count(struct pubsub_subs* subs);
+bool pubsub_subs_next(struct pubsub_subs* subs, size_t* i, void** sub);
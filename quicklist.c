@@ -0,0 +1,228 @@
+#include "quicklist.h"
+
+#include <stdlib.h>
+
+#include "listpack.h"
+
+// Node size limits in bytes for negative fill values, -1 to -5. A positive
+// fill limits the number of elements per node instead.
+static const size_t fill_bytes[] = {4096, 8192, 16384, 32768, 65536};
+
+// Space taken by an element in a listpack besides its data, at most.
+#define LP_ENTRY_OVERHEAD 10
+
+static size_t node_bytes(struct ql_node* node) {
+  return sizeof(struct ql_node) + lp_bytes(node->lp);
+}
+
+static bool node_allows(struct quicklist* ql, struct ql_node* node,
+                        size_t len) {
+  if (!node) {
+    return false;
+  }
+  if (ql->fill < 0) {
+    int i = -ql->fill - 1;
+    size_t limit = fill_bytes[i < 5 ? i : 4];
+    return lp_bytes(node->lp) + len + LP_ENTRY_OVERHEAD <= limit;
+  }
+  return (int)lp_count(node->lp) < ql->fill;
+}
+
+struct quicklist* ql_new(int fill) {
+  struct quicklist* ql = malloc(sizeof(struct quicklist));
+  if (!ql) {
+    return NULL;
+  }
+  ql->head = NULL;
+  ql->tail = NULL;
+  ql->count = 0;
+  ql->nnodes = 0;
+  ql->bytes = 0;
+  ql->fill = fill ? fill : -2;
+  return ql;
+}
+
+void ql_free(struct quicklist* ql) {
+  if (!ql) return;
+  struct ql_node* node = ql->head;
+  while (node) {
+    struct ql_node* next = node->next;
+    lp_free(node->lp);
+    free(node);
+    node = next;
+  }
+  free(ql);
+}
+
+// ql_memory returns the number of bytes used by the quicklist.
+size_t ql_memory(struct quicklist* ql) {
+  return sizeof(struct quicklist) + ql->bytes;
+}
+
+static struct ql_node* node_new(void) {
+  struct ql_node* node = malloc(sizeof(struct ql_node));
+  if (!node) {
+    return NULL;
+  }
+  node->lp = lp_new();
+  if (!node->lp) {
+    free(node);
+    return NULL;
+  }
+  node->prev = NULL;
+  node->next = NULL;
+  return node;
+}
+
+static void node_unlink(struct quicklist* ql, struct ql_node* node) {
+  if (node->prev) {
+    node->prev->next = node->next;
+  } else {
+    ql->head = node->next;
+  }
+  if (node->next) {
+    node->next->prev = node->prev;
+  } else {
+    ql->tail = node->prev;
+  }
+  ql->bytes -= node_bytes(node);
+  ql->nnodes--;
+  lp_free(node->lp);
+  free(node);
+}
+
+// ql_push adds an element at the head or the tail. A new node is started
+// when the end node is full. Returns false when out of memory.
+bool ql_push(struct quicklist* ql, const void* data, size_t len, bool head) {
+  struct ql_node* node = head ? ql->head : ql->tail;
+  bool created = false;
+  if (!node_allows(ql, node, len)) {
+    node = node_new();
+    if (!node) {
+      return false;
+    }
+    created = true;
+  }
+  size_t before = created ? 0 : node_bytes(node);
+  unsigned char* lp = head ? lp_prepend(node->lp, data, len)
+                           : lp_append(node->lp, data, len);
+  if (!lp) {
+    if (created) {
+      lp_free(node->lp);
+      free(node);
+    }
+    return false;
+  }
+  node->lp = lp;
+  if (created) {
+    if (head) {
+      node->next = ql->head;
+      if (ql->head) ql->head->prev = node;
+      ql->head = node;
+      if (!ql->tail) ql->tail = node;
+    } else {
+      node->prev = ql->tail;
+      if (ql->tail) ql->tail->next = node;
+      ql->tail = node;
+      if (!ql->head) ql->head = node;
+    }
+    ql->nnodes++;
+  }
+  ql->bytes += node_bytes(node) - before;
+  ql->count++;
+  return true;
+}
+
+// ql_delete_range deletes n elements starting at index start, which counts
+// from the end when negative. Nodes that become empty are freed.
+void ql_delete_range(struct quicklist* ql, long start, long n) {
+  if (start < 0) {
+    start += ql->count;
+  }
+  if (start < 0) {
+    n += start;
+    start = 0;
+  }
+  struct ql_node* node = ql->head;
+  while (node && n > 0) {
+    struct ql_node* next = node->next;
+    long count = lp_count(node->lp);
+    if (start >= count) {
+      start -= count;
+      node = next;
+      continue;
+    }
+    long del = count - start < n ? count - start : n;
+    if (del == count) {
+      node_unlink(ql, node);
+    } else {
+      size_t before = node_bytes(node);
+      node->lp = lp_delete(node->lp, lp_seek(node->lp, start), del);
+      ql->bytes -= before - node_bytes(node);
+    }
+    ql->count -= del;
+    n -= del;
+    start = 0;
+    node = next;
+  }
+}
+
+// ql_index positions the iterator at the element at index, which counts
+// from the end when negative. Returns false if out of range.
+bool ql_index(struct quicklist* ql, long index, struct ql_iter* it) {
+  if (index < 0) {
+    index += ql->count;
+  }
+  if (index < 0 || index >= (long)ql->count) {
+    return false;
+  }
+  struct ql_node* node;
+  if (index < (long)ql->count / 2) {
+    node = ql->head;
+    while (index >= (long)lp_count(node->lp)) {
+      index -= lp_count(node->lp);
+      node = node->next;
+    }
+  } else {
+    index -= ql->count;
+    node = ql->tail;
+    while (-index > (long)lp_count(node->lp)) {
+      index += lp_count(node->lp);
+      node = node->prev;
+    }
+  }
+  it->node = node;
+  it->p = lp_seek(node->lp, index);
+  return true;
+}
+
+// ql_next moves the iterator to the next element. Returns false at the end.
+bool ql_next(struct ql_iter* it) {
+  it->p = lp_next(it->node->lp, it->p);
+  while (!it->p) {
+    it->node = it->node->next;
+    if (!it->node) {
+      return false;
+    }
+    it->p = lp_first(it->node->lp);
+  }
+  return true;
+}
+
+// ql_prev moves the iterator to the previous element. Returns false at the
+// start.
+bool ql_prev(struct ql_iter* it) {
+  it->p = lp_prev(it->node->lp, it->p);
+  while (!it->p) {
+    it->node = it->node->prev;
+    if (!it->node) {
+      return false;
+    }
+    it->p = lp_last(it->node->lp);
+  }
+  return true;
+}
+
+const char* ql_get(struct ql_iter* it, size_t* len) {
+  return lp_get(it->p, len);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A quicklist is a doubly linked list of listpack nodes. Pushing and popping
+// at either end only touches the end node, and elements are allocated in
+// blocks of a node rather than one at a time.
+
+struct ql_node {
+  struct ql_node* prev;
+  struct ql_node* next;
+  unsigned char* lp;
+};
+
+struct quicklist {
+  struct ql_node* head;
+  struct ql_node* tail;
+  size_t count;
+  size_t nnodes;
+  size_t bytes;
+  int fill;
+};
+
+struct ql_iter {
+  struct ql_node* node;
+  unsigned char* p;
+};
+
+struct quicklist* ql_new(int fill);
+void ql_free(struct quicklist* ql);
+size_t ql_memory(struct quicklist* ql);
+bool ql_push(struct quicklist* ql, const void* data, size_t len, bool head);
+void ql_delete_range(struct quicklist* ql, long start, long n);
+bool ql_index(struct quicklist* ql, long index, struct ql_iter* it);
+bool ql_next(struct ql_iter* it);
+bool ql_prev(struct ql_iter* it);
+const char* ql_get(struct ql_iter* it, size_t* len);
@@ -0,0 +1,206 @@
+#include "radix.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Inner nodes are tagged with the low bit of their pointer, leaves are not.
+struct radix_node {
+  void* child[2];
+  uint32_t bit;  // 0 is the most significant bit of the first byte
+};
+
+#define IS_INNER(p) ((uintptr_t)(p) & 1)
+#define INNER(p) ((struct radix_node*)((uintptr_t)(p) - 1))
+#define TAG(n) ((void*)((uintptr_t)(n) + 1))
+
+static int key_bit(const unsigned char* key, uint32_t bit) {
+  return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+struct radix* radix_new(void) {
+  struct radix* radix = calloc(1, sizeof(struct radix));
+  if (radix) {
+    radix->bytes = sizeof(struct radix);
+  }
+  return radix;
+}
+
+static void free_node(void* p, void (*free_value)(void* value)) {
+  if (IS_INNER(p)) {
+    free_node(INNER(p)->child[0], free_value);
+    free_node(INNER(p)->child[1], free_value);
+    free(INNER(p));
+  } else if (p) {
+    if (free_value) {
+      free_value(((struct radix_leaf*)p)->value);
+    }
+    free(p);
+  }
+}
+
+void radix_free(struct radix* radix, void (*free_value)(void* value)) {
+  free_node(radix->root, free_value);
+  free(radix);
+}
+
+// best_match returns the leaf reached by following the bits of the key,
+// which shares the longest prefix with it among all leaves.
+static struct radix_leaf* best_match(struct radix* radix,
+                                     const unsigned char* key) {
+  void* p = radix->root;
+  while (IS_INNER(p)) {
+    p = INNER(p)->child[key_bit(key, INNER(p)->bit)];
+  }
+  return p;
+}
+
+static struct radix_leaf* edge_leaf(void* p, int dir) {
+  while (IS_INNER(p)) {
+    p = INNER(p)->child[dir];
+  }
+  return p;
+}
+
+// first_diff returns the first bit where the keys differ, or -1.
+static int first_diff(const unsigned char* a, const unsigned char* b) {
+  for (int i = 0; i < RADIX_KEYLEN; i++) {
+    if (a[i] != b[i]) {
+      return i * 8 + __builtin_clz((unsigned)(a[i] ^ b[i])) - 24;
+    }
+  }
+  return -1;
+}
+
+// subtree returns the link to the highest subtree whose leaves all agree with
+// the key up to the bit, which is the bit where the key and the best match
+// differ.
+static void** subtree(struct radix* radix, const unsigned char* key,
+                      uint32_t bit) {
+  void** link = &radix->root;
+  while (IS_INNER(*link) && INNER(*link)->bit < bit) {
+    link = &INNER(*link)->child[key_bit(key, INNER(*link)->bit)];
+  }
+  return link;
+}
+
+struct radix_leaf* radix_find(struct radix* radix, const unsigned char* key) {
+  struct radix_leaf* leaf = best_match(radix, key);
+  return leaf && memcmp(leaf->key, key, RADIX_KEYLEN) == 0 ? leaf : NULL;
+}
+
+// radix_floor returns the leaf with the largest key not above the key, or
+// NULL.
+struct radix_leaf* radix_floor(struct radix* radix, const unsigned char* key) {
+  struct radix_leaf* leaf = best_match(radix, key);
+  if (!leaf) {
+    return NULL;
+  }
+  int bit = first_diff(key, leaf->key);
+  if (bit < 0) {
+    return leaf;
+  }
+  // the leaves of the subtree all compare to the key like the best match
+  void* sub = *subtree(radix, key, bit);
+  if (key_bit(key, bit)) {
+    return edge_leaf(sub, 1);
+  }
+  return edge_leaf(sub, 0)->prev;
+}
+
+// radix_ceil returns the leaf with the smallest key not below the key, or
+// NULL.
+struct radix_leaf* radix_ceil(struct radix* radix, const unsigned char* key) {
+  struct radix_leaf* leaf = radix_floor(radix, key);
+  if (!leaf) {
+    return radix->first;
+  }
+  return memcmp(leaf->key, key, RADIX_KEYLEN) == 0 ? leaf : leaf->next;
+}
+
+// radix_insert adds the key with the value, or replaces the value if the key
+// exists. Returns its leaf, or NULL when out of memory.
+struct radix_leaf* radix_insert(struct radix* radix, const unsigned char* key,
+                                void* value) {
+  struct radix_leaf* match = best_match(radix, key);
+  int bit = match ? first_diff(key, match->key) : 0;
+  if (match && bit < 0) {
+    match->value = value;
+    return match;
+  }
+  struct radix_leaf* leaf = malloc(sizeof(struct radix_leaf));
+  if (!leaf) {
+    return NULL;
+  }
+  memcpy(leaf->key, key, RADIX_KEYLEN);
+  leaf->value = value;
+  if (!match) {
+    leaf->prev = leaf->next = NULL;
+    radix->root = radix->first = radix->last = leaf;
+  } else {
+    struct radix_node* node = malloc(sizeof(struct radix_node));
+    if (!node) {
+      free(leaf);
+      return NULL;
+    }
+    void** link = subtree(radix, key, bit);
+    int dir = key_bit(key, bit);
+    node->bit = bit;
+    node->child[dir] = leaf;
+    node->child[!dir] = *link;
+    // the leaf goes right after or before all the leaves it splits from
+    if (dir) {
+      leaf->prev = edge_leaf(*link, 1);
+      leaf->next = leaf->prev->next;
+    } else {
+      leaf->next = edge_leaf(*link, 0);
+      leaf->prev = leaf->next->prev;
+    }
+    *link = TAG(node);
+    radix->bytes += sizeof(struct radix_node);
+  }
+  if (leaf->prev) {
+    leaf->prev->next = leaf;
+  } else {
+    radix->first = leaf;
+  }
+  if (leaf->next) {
+    leaf->next->prev = leaf;
+  } else {
+    radix->last = leaf;
+  }
+  radix->count++;
+  radix->bytes += sizeof(struct radix_leaf);
+  return leaf;
+}
+
+// radix_delete removes the leaf and frees it, but not its value.
+void radix_delete(struct radix* radix, struct radix_leaf* leaf) {
+  void** link = &radix->root;
+  void** parent = NULL;
+  while (IS_INNER(*link)) {
+    parent = link;
+    link = &INNER(*link)->child[key_bit(leaf->key, INNER(*link)->bit)];
+  }
+  if (parent) {
+    struct radix_node* node = INNER(*parent);
+    *parent = node->child[node->child[0] == leaf];
+    free(node);
+    radix->bytes -= sizeof(struct radix_node);
+  } else {
+    radix->root = NULL;
+  }
+  if (leaf->prev) {
+    leaf->prev->next = leaf->next;
+  } else {
+    radix->first = leaf->next;
+  }
+  if (leaf->next) {
+    leaf->next->prev = leaf->prev;
+  } else {
+    radix->last = leaf->prev;
+  }
+  radix->count--;
+  radix->bytes -= sizeof(struct radix_leaf);
+  free(leaf);
+}
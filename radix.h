@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A radix tree maps fixed 16-byte keys, such as big-endian stream IDs, to
+// values in key order. It is a binary (crit-bit) tree: each inner node tests
+// the first bit where the keys below it differ, so lookups take at most one
+// step per differing bit and the leaves need no balancing. The leaves are
+// also linked in key order for iteration.
+
+#define RADIX_KEYLEN 16
+
+struct radix_leaf {
+  struct radix_leaf* prev;
+  struct radix_leaf* next;
+  void* value;
+  unsigned char key[RADIX_KEYLEN];
+};
+
+struct radix {
+  void* root;
+  struct radix_leaf* first;
+  struct radix_leaf* last;
+  size_t count;
+  size_t bytes;
+};
+
+struct radix* radix_new(void);
+void radix_free(struct radix* radix, void (*free_value)(void* value));
+struct radix_leaf* radix_insert(struct radix* radix, const unsigned char* key,
+                                void* value);
+struct radix_leaf* radix_find(struct radix* radix, const unsigned char* key);
+struct radix_leaf* radix_floor(struct radix* radix, const unsigned char* key);
+struct radix_leaf* radix_ceil(struct radix* radix, const unsigned char* key);
+void radix_delete(struct radix* radix, struct radix_leaf* leaf);
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "miniredis.h"
+
+// The state of the server, shared by cli.c, which runs the commands and
+// holds the keyspace, and by the files with the commands of each type,
+// cmdhash.c and the like.
+
+enum {
+  MAXMEMORY_NOEVICTION,
+  MAXMEMORY_ALLKEYS_LRU,
+  MAXMEMORY_ALLKEYS_LFU,
+  MAXMEMORY_VOLATILE_TTL,
+};
+
+enum {
+  CLIENT_NORMAL,
+  CLIENT_PUBSUB,
+  CLIENT_CLASSES,
+};
+
+// obuf_limit is the client-output-buffer-limit of a client class.
+struct obuf_limit {
+  int64_t hard;
+  int64_t soft;
+  int64_t soft_seconds;
+};
+
+// Value types. Values other than strings are stored in the pair as a pointer
+// to an object, which has a compact encoding while small and is converted to
+// its full encoding once it grows past the configured limits.
+enum {
+  TYPE_STRING,
+  TYPE_HASH,
+  TYPE_LIST,
+  TYPE_SET,
+  TYPE_ZSET,
+  TYPE_STREAM,
+};
+
+enum {
+  ENC_COMPACT,
+  ENC_FULL,
+};
+
+// Latency monitor events, whose latencies above latency-monitor-threshold
+// are kept for LATENCY LATEST and LATENCY HISTORY.
+enum {
+  LATENCY_COMMAND,
+  LATENCY_EVENT_LOOP,
+  LATENCY_EVENTS,
+};
+
+#define LATENCY_SAMPLES 160
+
+struct latency_sample {
+  int64_t time;  // unix seconds
+  int64_t ms;
+};
+
+// latency_event is a ring of the worst latency of each of the last seconds in
+// which the event exceeded the threshold.
+struct latency_event {
+  struct latency_sample samples[LATENCY_SAMPLES];
+  int len;
+  int next;
+  int64_t max;
+};
+
+// slowlog_entry is a command that took longer than slowlog-log-slower-than,
+// with its arguments kept as a truncated RESP array ready to be replied.
+struct slowlog_entry {
+  uint64_t id;
+  int64_t time;  // unix seconds
+  int64_t usec;
+  char* argv;
+  size_t argvlen;
+  char* addr;
+  char* name;
+};
+
+// reader is the state of a thread that serves GETs ahead of the main
+// thread: its record with the epoch of the keyspace, and what the main
+// thread accounts for in read_done, since the thread may not touch the
+// server.
+struct reader {
+  struct epoch_reader* epoch;
+  struct command* cmd;  // GET
+  uint64_t calls;
+  uint64_t ns;
+  int64_t maxns;
+  struct histogram* latency;  // allocated on the first call tracked
+  struct slowlog_entry* slow;
+  size_t nslow;
+  size_t slowcap;
+  struct pair** touched;  // for their LRU or LFU clock
+  size_t ntouched;
+  size_t touchedcap;
+  struct reader* next;
+};
+
+#define EVPOOL_SIZE 16
+
+// evpool_entry is a candidate for eviction. Higher idle values are evicted
+// first. The key is copied because the pair may be gone by the time the entry
+// is used.
+struct evpool_entry {
+  uint64_t idle;
+  char* key;
+  int keylen;
+};
+
+struct server {
+  uint64_t next_check;
+  struct cmap* pairs;    // the keyspace, searched without locks
+  struct epoch* epoch;  // frees the pairs removed from the keyspace
+  struct reader* readers;  // of the threads that served GETs ahead
+  pthread_mutex_t readers_lock;
+  uint64_t read_ahead_calls;
+  struct hashmap* commands;
+  double now;       // monotonic time of the current command, for durations
+  double unixtime;  // wall clock of the current command, for timestamps
+  uint64_t clock_tsc;  // ticks at the last reading of the clocks
+  double clock_now;    // and the clocks then
+  double clock_unix;
+  uint64_t rand;
+  struct cluster* cluster;
+  struct pair** slotkeys;
+  uint32_t* slotcounts;
+  size_t used_memory;
+  struct evpool_entry evpool[EVPOOL_SIZE];
+  uint64_t evicted_keys;
+  struct dict* blocking;   // keys with blocked clients, to their waitq
+  struct dict* ready;      // keys with blocked clients that were pushed to
+  struct client* blocked;  // all blocked clients
+  double next_timeout;     // earliest deadline of a blocked client, or zero
+  struct pubsub* pubsub;
+  uint64_t* versions;  // WATCH version of each key bucket, or NULL
+  size_t watching;     // clients with watched keys
+  size_t pubsub_clients;
+  struct command* command_table;
+  uint64_t* calls;  // calls of each command, by position in the table
+  uint64_t* ns;     // time spent in each command, by position
+  struct histogram** latency;  // by position, allocated on the first call
+  struct latency_event latency_events[LATENCY_EVENTS];
+  struct slowlog_entry* slowlog;  // ring of slowlog_cap entries
+  size_t slowlog_cap;
+  size_t slowlog_len;
+  size_t slowlog_next;
+  uint64_t slowlog_id;
+  int port;
+  int64_t start;  // ns
+  uint64_t client_id;  // of the last client
+  struct hashmap* clients;  // by id
+  struct client* current;   // running a command, or NULL
+  struct hashmap* tracking;  // keys read by tracking clients
+  struct tracking_prefix* prefixes;  // of BCAST tracking clients
+  size_t nprefixes;
+  size_t tracking_clients;
+
+  // configuration
+  bool cluster_enabled;
+  char* cluster_config_file;
+  char* cluster_announce_ip;
+  int64_t maxmemory;
+  int64_t maxmemory_policy;
+  int64_t maxmemory_samples;
+  int64_t lfu_log_factor;
+  int64_t lfu_decay_time;
+  struct obuf_limit obuf_limits[CLIENT_CLASSES];
+  int64_t client_output_buffer_pause;
+  int64_t hash_max_listpack_entries;
+  int64_t hash_max_listpack_value;
+  int64_t list_max_listpack_size;
+  int64_t set_max_intset_entries;
+  int64_t zset_max_listpack_entries;
+  int64_t zset_max_listpack_value;
+  int64_t hll_sparse_max_bytes;
+  int64_t stream_node_max_entries;
+  int64_t stream_node_max_bytes;
+  int64_t slowlog_log_slower_than;  // us
+  int64_t slowlog_max_len;
+  int64_t latency_monitor_threshold;  // ms
+  bool latency_tracking;
+  bool edge_triggered;
+  char* unixsocket;
+  int64_t unixsocketperm;
+  int64_t tracking_table_max_keys;
+  int64_t io_threads;
+  uint64_t config_epoch;
+};
+
+struct client {
+  uint64_t id;
+  char* name;  // set by HELLO SETNAME, or NULL
+  bool asking;
+  int class;
+  uint64_t config_epoch;
+  struct miniredis_conn* conn;
+  struct bpop* bpop;  // set while blocked by BLPOP, BRPOP, BLMOVE or XREAD
+  struct dict* channels;  // subscribed channels and patterns, or NULL
+  struct dict* patterns;
+  bool multi;        // queuing commands for EXEC
+  bool multi_dirty;  // a command failed to queue, EXEC aborts
+  bool exec;         // running EXEC, blocking commands don't block
+  struct txcmd* queue;
+  int nqueued;
+  int queuecap;
+  struct watch* watched;
+  int nwatched;
+  double watch_expire;  // earliest expiry of a watched key, or zero
+  bool tracking;        // CLIENT TRACKING ON
+  bool tracking_bcast;  // invalidated by key prefix, not by the keys read
+  bool tracking_optin;  // only track after CLIENT CACHING yes
+  bool tracking_optout;
+  bool tracking_noloop;  // not invalidated by its own writes
+  bool caching;          // CLIENT CACHING, for the next command only
+  uint64_t redirect;     // client id receiving the invalidations, or zero
+};
+
+// txcmd is a command queued by MULTI.
+struct txcmd {
+  struct command* cmd;
+  struct miniredis_args* args;
+};
+
+// tracking_entry is a key read by clients in the default tracking mode,
+// known by the hash of its name only, with the sorted ids of the clients.
+struct tracking_entry {
+  uint64_t hash;
+  uint64_t* ids;
+  int nids;
+  int cap;
+};
+
+// tracking_prefix is a key prefix a client in the BCAST tracking mode is
+// invalidated for.
+struct tracking_prefix {
+  uint64_t id;
+  char* prefix;
+  size_t len;
+};
+
+#define WATCH_BUCKETS 65536
+
+// watch is a key bucket watched by WATCH, with its version at that time.
+struct watch {
+  uint32_t bucket;
+  uint64_t version;
+};
+
+struct pair {
+  unsigned hasex : 1;
+  unsigned onstack : 1;
+  unsigned inslot : 1;
+  unsigned type : 3;
+  unsigned enc : 1;
+  // LRU clock in seconds, or with the LFU policies the last decrement time in
+  // minutes (16 bits) followed by a logarithmic access counter (8 bits).
+  unsigned lru : 24;
+  int keylen;
+  int vallen;
+};
+
+// slotlinks chains together all pairs that hash to the same cluster slot.
+// They are stored pointer-aligned at the tail of the pair, and only for pairs
+// created while cluster mode is enabled.
+struct slotlinks {
+  struct pair* prev;
+  struct pair* next;
+};
+
+#define WRONGTYPE_ERR \
+  "WRONGTYPE Operation against a key holding the wrong kind of value"
+
+// pairs
+struct pair* pair_new(const char* key, int keylen, const char* val, int vallen,
+                      double expires, bool inslot);
+const char* pair_key(struct pair* pair);
+const char* pair_val(struct pair* pair);
+void* pair_obj(struct pair* pair);
+void pair_set_obj(struct pair* pair, void* obj);
+double pair_expire(struct pair* pair);
+size_t pair_memory(struct pair* pair);
+
+// keyspace
+bool db_set(struct server* server, struct pair* pair);
+struct pair* db_delete(struct server* server, const char* key, size_t keylen);
+void db_retire(struct server* server, struct pair* pair);
+struct pair* db_get(struct server* server, const char* key, size_t keylen);
+struct pair* db_create(struct server* server, const char* key, size_t keylen,
+                       int type);
+void db_remove(struct server* server, struct pair* pair);
+void db_modified(struct server* server, struct pair* pair, size_t oldmem);
+uint32_t watch_bucket(const char* key, size_t keylen);
+
+// clients
+size_t client_subscriptions(struct client* client);
+void client_update_class(struct server* server, struct client* client);
+
+// commands
+struct command;
+void command_run(struct server* server, struct miniredis_conn* conn,
+                 struct client* client, struct command* cmd,
+                 struct miniredis_args* args);
+
+// arguments
+bool parse_int(const char* str, size_t len, int64_t* x);
+bool argtoint(struct miniredis_args* args, int index, int64_t* x);
+bool lookup_key(struct miniredis_conn* conn, struct server* server,
+                struct miniredis_args* args, int index, int type,
+                struct pair** ppair);
+bool lookup_or_create(struct miniredis_conn* conn, struct server* server,
+                      struct miniredis_args* args, int index, int type,
+                      struct pair** ppair);
@@ -0,0 +1,297 @@
+#include "skiplist.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int member_compare(const char* a, size_t alen, const char* b,
+                          size_t blen) {
+  int cmp = memcmp(a, b, alen < blen ? alen : blen);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return alen < blen ? -1 : alen > blen;
+}
+
+// zsl_compare orders by score, then by member.
+int zsl_compare(double a, const char* amember, size_t alen, double b,
+                const char* bmember, size_t blen) {
+  if (a != b) {
+    return a < b ? -1 : 1;
+  }
+  return member_compare(amember, alen, bmember, blen);
+}
+
+bool zrange_gte_min(double score, const struct zrange* range) {
+  return range->minex ? score > range->min : score >= range->min;
+}
+
+bool zrange_lte_max(double score, const struct zrange* range) {
+  return range->maxex ? score < range->max : score <= range->max;
+}
+
+bool zlex_gte_min(const char* member, size_t len,
+                  const struct zlexrange* range) {
+  if (range->mininf) {
+    return range->mininf < 0;
+  }
+  int cmp = member_compare(member, len, range->min, range->minlen);
+  return range->minex ? cmp > 0 : cmp >= 0;
+}
+
+bool zlex_lte_max(const char* member, size_t len,
+                  const struct zlexrange* range) {
+  if (range->maxinf) {
+    return range->maxinf > 0;
+  }
+  int cmp = member_compare(member, len, range->max, range->maxlen);
+  return range->maxex ? cmp < 0 : cmp <= 0;
+}
+
+static size_t node_size(int level, size_t len) {
+  return sizeof(struct zsl_node) + level * sizeof(struct zsl_level) + len + 1;
+}
+
+static struct zsl_node* node_new(int level, double score, const char* member,
+                                 size_t len) {
+  struct zsl_node* node = malloc(node_size(level, len));
+  if (!node) {
+    return NULL;
+  }
+  node->score = score;
+  node->backward = NULL;
+  node->len = len;
+  node->member = (char*)&node->level[level];
+  memcpy(node->member, member, len);
+  node->member[len] = '\0';
+  for (int i = 0; i < level; i++) {
+    node->level[i].forward = NULL;
+    node->level[i].span = 0;
+  }
+  return node;
+}
+
+// random_level returns a level where each level is a quarter as likely as
+// the one below.
+static int random_level(void) {
+  static uint64_t state = 0x9E3779B97F4A7C15;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  int level = 1;
+  uint64_t bits = state;
+  while (level < ZSL_MAXLEVEL && (bits & 3) == 0) {
+    level++;
+    bits >>= 2;
+  }
+  return level;
+}
+
+struct skiplist* zsl_new(void) {
+  struct skiplist* zsl = malloc(sizeof(struct skiplist));
+  if (!zsl) {
+    return NULL;
+  }
+  zsl->header = node_new(ZSL_MAXLEVEL, 0, "", 0);
+  if (!zsl->header) {
+    free(zsl);
+    return NULL;
+  }
+  zsl->tail = NULL;
+  zsl->len = 0;
+  zsl->level = 1;
+  zsl->bytes = sizeof(struct skiplist) + node_size(ZSL_MAXLEVEL, 0);
+  return zsl;
+}
+
+void zsl_free(struct skiplist* zsl) {
+  struct zsl_node* node = zsl->header;
+  while (node) {
+    struct zsl_node* next = node->level[0].forward;
+    free(node);
+    node = next;
+  }
+  free(zsl);
+}
+
+// zsl_insert inserts a member that is not in the skiplist yet. Returns NULL
+// when out of memory.
+struct zsl_node* zsl_insert(struct skiplist* zsl, double score,
+                            const char* member, size_t len) {
+  struct zsl_node* update[ZSL_MAXLEVEL];
+  size_t rank[ZSL_MAXLEVEL];
+  struct zsl_node* x = zsl->header;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    rank[i] = i == zsl->level - 1 ? 0 : rank[i + 1];
+    while (x->level[i].forward &&
+           zsl_compare(x->level[i].forward->score, x->level[i].forward->member,
+                       x->level[i].forward->len, score, member, len) < 0) {
+      rank[i] += x->level[i].span;
+      x = x->level[i].forward;
+    }
+    update[i] = x;
+  }
+  int level = random_level();
+  x = node_new(level, score, member, len);
+  if (!x) {
+    return NULL;
+  }
+  if (level > zsl->level) {
+    for (int i = zsl->level; i < level; i++) {
+      rank[i] = 0;
+      update[i] = zsl->header;
+      update[i]->level[i].span = zsl->len;
+    }
+    zsl->level = level;
+  }
+  for (int i = 0; i < level; i++) {
+    x->level[i].forward = update[i]->level[i].forward;
+    update[i]->level[i].forward = x;
+    x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+    update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+  }
+  // links above the new node's level span one more node
+  for (int i = level; i < zsl->level; i++) {
+    update[i]->level[i].span++;
+  }
+  x->backward = update[0] == zsl->header ? NULL : update[0];
+  if (x->level[0].forward) {
+    x->level[0].forward->backward = x;
+  } else {
+    zsl->tail = x;
+  }
+  zsl->len++;
+  zsl->bytes += node_size(level, len);
+  return x;
+}
+
+bool zsl_delete(struct skiplist* zsl, double score, const char* member,
+                size_t len) {
+  struct zsl_node* update[ZSL_MAXLEVEL];
+  struct zsl_node* x = zsl->header;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward &&
+           zsl_compare(x->level[i].forward->score, x->level[i].forward->member,
+                       x->level[i].forward->len, score, member, len) < 0) {
+      x = x->level[i].forward;
+    }
+    update[i] = x;
+  }
+  x = x->level[0].forward;
+  if (!x || zsl_compare(x->score, x->member, x->len, score, member, len)) {
+    return false;
+  }
+  int level = 0;
+  for (int i = 0; i < zsl->level; i++) {
+    if (update[i]->level[i].forward == x) {
+      update[i]->level[i].span += x->level[i].span - 1;
+      update[i]->level[i].forward = x->level[i].forward;
+      level++;
+    } else {
+      update[i]->level[i].span--;
+    }
+  }
+  if (x->level[0].forward) {
+    x->level[0].forward->backward = x->backward;
+  } else {
+    zsl->tail = x->backward;
+  }
+  while (zsl->level > 1 && !zsl->header->level[zsl->level - 1].forward) {
+    zsl->level--;
+  }
+  zsl->len--;
+  zsl->bytes -= node_size(level, x->len);
+  free(x);
+  return true;
+}
+
+// zsl_rank returns the 1-based rank of the member, or zero if not found.
+size_t zsl_rank(struct skiplist* zsl, double score, const char* member,
+                size_t len) {
+  struct zsl_node* x = zsl->header;
+  size_t rank = 0;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward &&
+           zsl_compare(x->level[i].forward->score, x->level[i].forward->member,
+                       x->level[i].forward->len, score, member, len) <= 0) {
+      rank += x->level[i].span;
+      x = x->level[i].forward;
+    }
+    if (x != zsl->header && x->len == len && x->score == score &&
+        memcmp(x->member, member, len) == 0) {
+      return rank;
+    }
+  }
+  return 0;
+}
+
+// zsl_by_rank returns the node at the 1-based rank, or NULL.
+struct zsl_node* zsl_by_rank(struct skiplist* zsl, size_t rank) {
+  struct zsl_node* x = zsl->header;
+  size_t traversed = 0;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward && traversed + x->level[i].span <= rank) {
+      traversed += x->level[i].span;
+      x = x->level[i].forward;
+    }
+    if (traversed == rank) {
+      return x == zsl->header ? NULL : x;
+    }
+  }
+  return NULL;
+}
+
+// zsl_first_in_range returns the first node in the range, or NULL.
+struct zsl_node* zsl_first_in_range(struct skiplist* zsl,
+                                    const struct zrange* range) {
+  struct zsl_node* x = zsl->header;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward &&
+           !zrange_gte_min(x->level[i].forward->score, range)) {
+      x = x->level[i].forward;
+    }
+  }
+  x = x->level[0].forward;
+  return x && zrange_lte_max(x->score, range) ? x : NULL;
+}
+
+// zsl_last_in_range returns the last node in the range, or NULL.
+struct zsl_node* zsl_last_in_range(struct skiplist* zsl,
+                                   const struct zrange* range) {
+  struct zsl_node* x = zsl->header;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward &&
+           zrange_lte_max(x->level[i].forward->score, range)) {
+      x = x->level[i].forward;
+    }
+  }
+  return x != zsl->header && zrange_gte_min(x->score, range) ? x : NULL;
+}
+
+struct zsl_node* zsl_first_in_lex(struct skiplist* zsl,
+                                  const struct zlexrange* range) {
+  struct zsl_node* x = zsl->header;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward &&
+           !zlex_gte_min(x->level[i].forward->member,
+                         x->level[i].forward->len, range)) {
+      x = x->level[i].forward;
+    }
+  }
+  x = x->level[0].forward;
+  return x && zlex_lte_max(x->member, x->len, range) ? x : NULL;
+}
+
+struct zsl_node* zsl_last_in_lex(struct skiplist* zsl,
+                                 const struct zlexrange* range) {
+  struct zsl_node* x = zsl->header;
+  for (int i = zsl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward &&
+           zlex_lte_max(x->level[i].forward->member, x->level[i].forward->len,
+                        range)) {
+      x = x->level[i].forward;
+    }
+  }
+  return x != zsl->header && zlex_gte_min(x->member, x->len, range) ? x
+                                                                     : NULL;
+}
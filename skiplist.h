@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A skiplist keeps members ordered by score, then by member. Each link
+// records how many nodes it spans, so that ranks are found in O(log n) along
+// with the members themselves.
+
+#define ZSL_MAXLEVEL 32
+
+struct zsl_node;
+
+struct zsl_level {
+  struct zsl_node* forward;
+  size_t span;
+};
+
+struct zsl_node {
+  double score;
+  struct zsl_node* backward;
+  size_t len;
+  char* member;  // null-terminated, stored after the levels
+  struct zsl_level level[];
+};
+
+struct skiplist {
+  struct zsl_node* header;
+  struct zsl_node* tail;
+  size_t len;
+  int level;
+  size_t bytes;
+};
+
+// zrange is a score range, with exclusive ends if minex or maxex.
+struct zrange {
+  double min;
+  double max;
+  bool minex;
+  bool maxex;
+};
+
+// zlexrange is a member range for members of the same score. An infinite end
+// has inf set to -1 for "-" or 1 for "+", and no data.
+struct zlexrange {
+  const char* min;
+  size_t minlen;
+  const char* max;
+  size_t maxlen;
+  bool minex;
+  bool maxex;
+  int mininf;
+  int maxinf;
+};
+
+int zsl_compare(double a, const char* amember, size_t alen, double b,
+                const char* bmember, size_t blen);
+bool zrange_gte_min(double score, const struct zrange* range);
+bool zrange_lte_max(double score, const struct zrange* range);
+bool zlex_gte_min(const char* member, size_t len,
+                  const struct zlexrange* range);
+bool zlex_lte_max(const char* member, size_t len,
+                  const struct zlexrange* range);
+
+struct skiplist* zsl_new(void);
+void zsl_free(struct skiplist* zsl);
+struct zsl_node* zsl_insert(struct skiplist* zsl, double score,
+                            const char* member, size_t len);
+bool zsl_delete(struct skiplist* zsl, double score, const char* member,
+                size_t len);
+size_t zsl_rank(struct skiplist* zsl, double score, const char* member,
+                size_t len);
+struct zsl_node* zsl_by_rank(struct skiplist* zsl, size_t rank);
+struct zsl_node* zsl_first_in_range(struct skiplist* zsl,
+                                    const struct zrange* range);
+struct zsl_node* zsl_last_in_range(struct skiplist* zsl,
+                                   const struct zrange* range);
+struct zsl_node* zsl_first_in_lex(struct skiplist* zsl,
+                                  const struct zlexrange* range);
+struct zsl_node* zsl_last_in_lex(struct skiplist* zsl,
+                                 const struct zlexrange* range);
@@ -0,0 +1,690 @@
+#include "stream.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "listpack.h"
+
+// Node layout, as listpack entries:
+//
+//   <nmaster> <master field>...
+//   [<header> <field value>... | <value>... <trailer>]...
+//
+// The header holds a flags byte and the ID deltas from the master ID, then
+// for entries whose fields differ from the master fields, their number.
+// Entries with the master fields store only their values. The trailer holds
+// the number of listpack entries of the entry, so the node can be walked
+// backwards. Numbers are varints.
+
+#define ENTRY_SAMEFIELDS 1
+
+static int varint_put(unsigned char* p, uint64_t x) {
+  int n = 0;
+  while (x >= 0x80) {
+    p[n++] = (x & 0x7f) | 0x80;
+    x >>= 7;
+  }
+  p[n++] = x;
+  return n;
+}
+
+static const unsigned char* varint_get(const unsigned char* p, uint64_t* x) {
+  uint64_t v = 0;
+  int shift = 0;
+  do {
+    v |= (uint64_t)(*p & 0x7f) << shift;
+    shift += 7;
+  } while (*p++ & 0x80);
+  *x = v;
+  return p;
+}
+
+static uint64_t lp_varint(unsigned char* p) {
+  size_t len;
+  uint64_t x;
+  varint_get((const unsigned char*)lp_get(p, &len), &x);
+  return x;
+}
+
+int stream_id_cmp(struct stream_id a, struct stream_id b) {
+  if (a.ms != b.ms) {
+    return a.ms < b.ms ? -1 : 1;
+  }
+  return a.seq < b.seq ? -1 : a.seq > b.seq;
+}
+
+// stream_id_incr sets the ID to the next one. Returns false if it is the
+// largest.
+bool stream_id_incr(struct stream_id* id) {
+  if (id->seq < UINT64_MAX) {
+    id->seq++;
+  } else if (id->ms < UINT64_MAX) {
+    id->ms++;
+    id->seq = 0;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool stream_id_decr(struct stream_id* id) {
+  if (id->seq > 0) {
+    id->seq--;
+  } else if (id->ms > 0) {
+    id->ms--;
+    id->seq = UINT64_MAX;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool parse_u64(const char* str, size_t len, uint64_t* x) {
+  if (len == 0 || len > 20) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (str[i] < '0' || str[i] > '9') return false;
+    uint64_t d = str[i] - '0';
+    if (v > (UINT64_MAX - d) / 10) return false;
+    v = v * 10 + d;
+  }
+  *x = v;
+  return true;
+}
+
+// stream_parse_id parses "ms-seq", or "ms" with seq as the sequence number.
+bool stream_parse_id(const char* str, size_t len, uint64_t seq,
+                     struct stream_id* id, bool* seqgiven) {
+  const char* dash = memchr(str, '-', len);
+  *seqgiven = dash != NULL;
+  if (!dash) {
+    id->seq = seq;
+    return parse_u64(str, len, &id->ms);
+  }
+  return parse_u64(str, dash - str, &id->ms) &&
+         parse_u64(dash + 1, len - (dash - str) - 1, &id->seq);
+}
+
+int stream_format_id(char str[44], struct stream_id id) {
+  return snprintf(str, 44, "%" PRIu64 "-%" PRIu64, id.ms, id.seq);
+}
+
+// stream_id_key writes the ID big-endian, so that keys sort like IDs.
+void stream_id_key(struct stream_id id, unsigned char key[RADIX_KEYLEN]) {
+  for (int i = 0; i < 8; i++) {
+    key[i] = id.ms >> (56 - 8 * i);
+    key[8 + i] = id.seq >> (56 - 8 * i);
+  }
+}
+
+struct stream_id stream_key_id(const unsigned char* key) {
+  struct stream_id id = {0};
+  for (int i = 0; i < 8; i++) {
+    id.ms = (id.ms << 8) | key[i];
+    id.seq = (id.seq << 8) | key[8 + i];
+  }
+  return id;
+}
+
+struct stream* stream_new(void) {
+  struct stream* s = calloc(1, sizeof(struct stream));
+  if (!s) {
+    return NULL;
+  }
+  s->nodes = radix_new();
+  s->groups = dict_new();
+  if (!s->nodes || !s->groups) {
+    stream_free(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void node_free(void* value) {
+  struct stream_node* node = value;
+  lp_free(node->lp);
+  free(node);
+}
+
+static struct stream_group* group_at(struct dict_entry* entry) {
+  struct stream_group* g;
+  memcpy(&g, dict_entry_val(entry), sizeof(g));
+  return g;
+}
+
+static struct stream_consumer* consumer_at(struct dict_entry* entry) {
+  struct stream_consumer* c;
+  memcpy(&c, dict_entry_val(entry), sizeof(c));
+  return c;
+}
+
+static void group_free(struct stream_group* g) {
+  struct dict_entry* entry;
+  size_t i = 0;
+  while (dict_iter(g->consumers, &i, &entry)) {
+    struct stream_consumer* c = consumer_at(entry);
+    radix_free(c->pel, NULL);
+    free(c->name);
+    free(c);
+  }
+  dict_free(g->consumers);
+  radix_free(g->pel, free);
+  free(g);
+}
+
+void stream_free(struct stream* s) {
+  if (s->nodes) {
+    radix_free(s->nodes, node_free);
+  }
+  if (s->groups) {
+    struct dict_entry* entry;
+    size_t i = 0;
+    while (dict_iter(s->groups, &i, &entry)) {
+      group_free(group_at(entry));
+    }
+    dict_free(s->groups);
+  }
+  free(s);
+}
+
+size_t stream_memory(struct stream* s) {
+  size_t bytes = sizeof(struct stream) + s->bytes + s->nodes->bytes +
+                 dict_memory(s->groups);
+  struct dict_entry* entry;
+  size_t i = 0;
+  while (dict_iter(s->groups, &i, &entry)) {
+    bytes += dict_memory(group_at(entry)->consumers);
+  }
+  return bytes;
+}
+
+// node_new starts a node with the fields as its master fields.
+static struct stream_node* node_new(const char** fields, const size_t* lens,
+                                    uint64_t n) {
+  struct stream_node* node = malloc(sizeof(struct stream_node));
+  unsigned char* lp = lp_new();
+  if (!node || !lp) {
+    goto fail;
+  }
+  unsigned char num[10];
+  lp = lp_append(lp, num, varint_put(num, n));
+  for (uint64_t i = 0; lp && i < n; i++) {
+    unsigned char* nlp = lp_append(lp, fields[2 * i], lens[2 * i]);
+    if (!nlp) {
+      lp_free(lp);
+    }
+    lp = nlp;
+  }
+  if (!lp) {
+    goto fail;
+  }
+  node->lp = lp;
+  node->count = 0;
+  return node;
+fail:
+  free(node);
+  lp_free(lp);
+  return NULL;
+}
+
+// same_fields returns true if the fields are the master fields of the node.
+static bool same_fields(unsigned char* lp, const char** fields,
+                        const size_t* lens, uint64_t n) {
+  unsigned char* p = lp_first(lp);
+  if (lp_varint(p) != n) {
+    return false;
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    p = lp_next(lp, p);
+    size_t len;
+    const char* field = lp_get(p, &len);
+    if (len != lens[2 * i] || memcmp(field, fields[2 * i], len) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// stream_append adds an entry with the n field-value pairs, with an ID that
+// must be larger than the last one. Returns false when out of memory.
+bool stream_append(struct stream* s, struct stream_id id,
+                   const char** fields, const size_t* lens, uint64_t n,
+                   int64_t max_entries, int64_t max_bytes) {
+  struct radix_leaf* leaf = s->nodes->last;
+  struct stream_node* node = leaf ? leaf->value : NULL;
+  bool created = false;
+  if (!node || (max_entries > 0 && node->count >= max_entries) ||
+      (max_bytes > 0 && lp_bytes(node->lp) >= (size_t)max_bytes)) {
+    unsigned char key[RADIX_KEYLEN];
+    stream_id_key(id, key);
+    node = node_new(fields, lens, n);
+    leaf = node ? radix_insert(s->nodes, key, node) : NULL;
+    if (!leaf) {
+      if (node) node_free(node);
+      return false;
+    }
+    created = true;
+    s->bytes += sizeof(struct stream_node) + lp_bytes(node->lp);
+  }
+  struct stream_id master = stream_key_id(leaf->key);
+  unsigned char* lp = node->lp;
+  size_t oldbytes = lp_bytes(lp);
+  uint32_t oldcount = lp_count(lp);
+  bool same = same_fields(lp, fields, lens, n);
+  unsigned char hdr[31];
+  int hlen = 0;
+  hdr[hlen++] = same ? ENTRY_SAMEFIELDS : 0;
+  hlen += varint_put(hdr + hlen, id.ms - master.ms);
+  hlen += varint_put(hdr + hlen, id.ms == master.ms ? id.seq - master.seq
+                                                    : id.seq);
+  if (!same) {
+    hlen += varint_put(hdr + hlen, n);
+  }
+  uint64_t nelems = 2 + (same ? n : 2 * n);
+  unsigned char* nlp = lp_append(lp, hdr, hlen);
+  for (uint64_t i = 0; nlp && i < n; i++) {
+    lp = nlp;
+    if (!same) {
+      nlp = lp_append(lp, fields[2 * i], lens[2 * i]);
+      if (!nlp) break;
+      lp = nlp;
+    }
+    nlp = lp_append(lp, fields[2 * i + 1], lens[2 * i + 1]);
+  }
+  if (nlp) {
+    lp = nlp;
+    unsigned char num[10];
+    nlp = lp_append(lp, num, varint_put(num, nelems));
+  }
+  if (!nlp) {
+    // drop the partial entry
+    node->lp = lp_delete(lp, lp + oldbytes, lp_count(lp) - oldcount);
+    if (created) {
+      s->bytes -= sizeof(struct stream_node) + lp_bytes(node->lp);
+      radix_delete(s->nodes, leaf);
+      node_free(node);
+    }
+    return false;
+  }
+  node->lp = nlp;
+  node->count++;
+  s->bytes += lp_bytes(nlp) - oldbytes;
+  s->len++;
+  s->last_id = id;
+  s->entries_added++;
+  return true;
+}
+
+// entry_elems returns the number of listpack entries of the entry with the
+// header at p.
+static uint64_t entry_elems(unsigned char* p, uint64_t nmaster) {
+  size_t len;
+  const unsigned char* h = (const unsigned char*)lp_get(p, &len);
+  if (h[0] & ENTRY_SAMEFIELDS) {
+    return 2 + nmaster;
+  }
+  uint64_t x;
+  h = varint_get(h + 1, &x);
+  h = varint_get(h, &x);
+  varint_get(h, &x);
+  return 2 + 2 * x;
+}
+
+// node_enter positions the iterator at the first or last entry of the node
+// of the leaf.
+static void node_enter(struct stream_iter* it, struct radix_leaf* leaf,
+                       bool last) {
+  struct stream_node* node = leaf->value;
+  unsigned char* lp = node->lp;
+  it->leaf = leaf;
+  it->master = stream_key_id(leaf->key);
+  unsigned char* p = lp_first(lp);
+  it->nmaster = lp_varint(p);
+  it->mp = lp_next(lp, p);
+  p = it->mp;
+  for (uint64_t i = 0; p && i < it->nmaster; i++) {
+    p = lp_next(lp, p);
+  }
+  it->first = p;
+  if (last && p) {
+    p = lp_last(lp);
+    for (uint64_t n = lp_varint(p); n > 1; n--) {
+      p = lp_prev(lp, p);
+    }
+  }
+  it->p = p;
+}
+
+void stream_iter_start(struct stream_iter* it, struct stream* s,
+                       struct stream_id start, struct stream_id end,
+                       bool rev) {
+  memset(it, 0, sizeof(*it));
+  it->s = s;
+  it->start = start;
+  it->end = end;
+  it->rev = rev;
+  unsigned char key[RADIX_KEYLEN];
+  stream_id_key(rev ? end : start, key);
+  struct radix_leaf* leaf = radix_floor(s->nodes, key);
+  if (!leaf && !rev) {
+    leaf = s->nodes->first;
+  }
+  if (leaf) {
+    node_enter(it, leaf, rev);
+  }
+}
+
+// stream_iter_next moves to the next entry in the range and sets its ID and
+// number of fields, which are then read with stream_iter_field.
+bool stream_iter_next(struct stream_iter* it, struct stream_id* id,
+                      uint64_t* nfields) {
+  while (it->leaf) {
+    if (!it->p) {
+      struct radix_leaf* leaf = it->rev ? it->leaf->prev : it->leaf->next;
+      if (!leaf) {
+        it->leaf = NULL;
+        return false;
+      }
+      node_enter(it, leaf, it->rev);
+      continue;
+    }
+    unsigned char* lp = ((struct stream_node*)it->leaf->value)->lp;
+    unsigned char* p = it->p;
+    size_t len;
+    const unsigned char* h = (const unsigned char*)lp_get(p, &len);
+    it->same = h[0] & ENTRY_SAMEFIELDS;
+    uint64_t dms, dseq;
+    h = varint_get(h + 1, &dms);
+    h = varint_get(h, &dseq);
+    id->ms = it->master.ms + dms;
+    id->seq = dms == 0 ? it->master.seq + dseq : dseq;
+    it->nfields = it->nmaster;
+    if (!it->same) {
+      varint_get(h, &it->nfields);
+    }
+    it->fp = lp_next(lp, p);
+    it->mp = lp_next(lp, lp_first(lp));
+    // step over the entry, or back to the previous one
+    if (!it->rev) {
+      uint64_t n = 2 + (it->same ? it->nfields : 2 * it->nfields);
+      for (; p && n > 0; n--) {
+        p = lp_next(lp, p);
+      }
+    } else if (p == it->first) {
+      p = NULL;
+    } else {
+      p = lp_prev(lp, p);
+      for (uint64_t n = lp_varint(p); n > 1; n--) p = lp_prev(lp, p);
+    }
+    it->p = p;
+    if (it->rev ? stream_id_cmp(*id, it->end) > 0
+                : stream_id_cmp(*id, it->start) < 0) {
+      continue;
+    }
+    if (it->rev ? stream_id_cmp(*id, it->start) < 0
+                : stream_id_cmp(*id, it->end) > 0) {
+      it->leaf = NULL;
+      return false;
+    }
+    *nfields = it->nfields;
+    return true;
+  }
+  return false;
+}
+
+// stream_iter_field reads the next field and value of the current entry.
+void stream_iter_field(struct stream_iter* it, const char** field,
+                       size_t* flen, const char** val, size_t* vlen) {
+  unsigned char* lp = ((struct stream_node*)it->leaf->value)->lp;
+  if (it->same) {
+    *field = lp_get(it->mp, flen);
+    it->mp = lp_next(lp, it->mp);
+  } else {
+    *field = lp_get(it->fp, flen);
+    it->fp = lp_next(lp, it->fp);
+  }
+  *val = lp_get(it->fp, vlen);
+  it->fp = lp_next(lp, it->fp);
+}
+
+struct stream_id stream_first_id(struct stream* s) {
+  struct stream_iter it;
+  struct stream_id id = {0};
+  uint64_t n;
+  stream_iter_start(&it, s, id, STREAM_ID_MAX, false);
+  stream_iter_next(&it, &id, &n);
+  return id;
+}
+
+// stream_trim removes entries from the start of the stream while it holds
+// more than maxlen entries or entries below minid, and returns how many. An
+// approximate trim only removes whole nodes. A positive limit caps the
+// number of entries removed.
+int64_t stream_trim(struct stream* s, uint64_t maxlen, struct stream_id minid,
+                    bool approx, int64_t limit) {
+  int64_t removed = 0;
+  struct radix_leaf* leaf;
+  while ((leaf = s->nodes->first)) {
+    struct stream_node* node = leaf->value;
+    struct radix_leaf* next = leaf->next;
+    struct stream_id last;
+    if (next) {
+      last = stream_key_id(next->key);
+      stream_id_decr(&last);
+    } else {
+      last = node->count ? s->last_id : minid;
+    }
+    if (node->count == 0 ||
+        ((s->len - node->count >= maxlen || stream_id_cmp(last, minid) < 0) &&
+         (limit <= 0 || removed + node->count <= limit))) {
+      removed += node->count;
+      s->len -= node->count;
+      s->bytes -= sizeof(struct stream_node) + lp_bytes(node->lp);
+      radix_delete(s->nodes, leaf);
+      node_free(node);
+      continue;
+    }
+    if (approx) {
+      break;
+    }
+    // remove entries one at a time from the start of the node
+    struct stream_iter it = {.s = s, .end = STREAM_ID_MAX};
+    size_t oldbytes = lp_bytes(node->lp);
+    struct stream_id id;
+    uint64_t n;
+    node_enter(&it, leaf, false);
+    while (node->count > 0 &&
+           (s->len > maxlen || (stream_iter_next(&it, &id, &n) &&
+                                stream_id_cmp(id, minid) < 0))) {
+      node->lp = lp_delete(node->lp, it.first,
+                           entry_elems(it.first, it.nmaster));
+      node->count--;
+      s->len--;
+      removed++;
+      node_enter(&it, leaf, false);
+    }
+    s->bytes -= oldbytes - lp_bytes(node->lp);
+    if (node->count > 0) {
+      break;
+    }
+  }
+  return removed;
+}
+
+struct stream_group* stream_group_get(struct stream* s, const char* name,
+                                      size_t len) {
+  struct dict_entry* entry = dict_get(s->groups, name, len);
+  return entry ? group_at(entry) : NULL;
+}
+
+// stream_group_create adds a group that has been delivered entries up to
+// the ID. Returns NULL when out of memory.
+struct stream_group* stream_group_create(struct stream* s, const char* name,
+                                         size_t len, struct stream_id id) {
+  struct stream_group* g = calloc(1, sizeof(struct stream_group));
+  if (!g) {
+    return NULL;
+  }
+  g->last_id = id;
+  g->pel = radix_new();
+  g->consumers = dict_new();
+  if (!g->pel || !g->consumers ||
+      dict_set(s->groups, name, len, (char*)&g, sizeof(g)) == -1) {
+    if (g->pel) radix_free(g->pel, NULL);
+    if (g->consumers) dict_free(g->consumers);
+    free(g);
+    return NULL;
+  }
+  s->bytes += sizeof(struct stream_group) + g->pel->bytes;
+  return g;
+}
+
+// group_bytes returns the memory of the group that is accounted in
+// s->bytes.
+static size_t group_bytes(struct stream_group* g) {
+  size_t bytes = sizeof(struct stream_group) + g->pel->bytes +
+                 g->pel->count * sizeof(struct stream_nack);
+  struct dict_entry* entry;
+  size_t i = 0;
+  while (dict_iter(g->consumers, &i, &entry)) {
+    struct stream_consumer* c = consumer_at(entry);
+    bytes += sizeof(struct stream_consumer) + c->namelen + c->pel->bytes;
+  }
+  return bytes;
+}
+
+bool stream_group_destroy(struct stream* s, const char* name, size_t len) {
+  struct stream_group* g = stream_group_get(s, name, len);
+  if (!g) {
+    return false;
+  }
+  s->bytes -= group_bytes(g);
+  dict_delete(s->groups, name, len);
+  group_free(g);
+  return true;
+}
+
+struct stream_consumer* stream_consumer_get(struct stream_group* g,
+                                            const char* name, size_t len) {
+  struct dict_entry* entry = dict_get(g->consumers, name, len);
+  return entry ? consumer_at(entry) : NULL;
+}
+
+// stream_consumer_create adds a consumer to the group. Returns NULL when out
+// of memory.
+struct stream_consumer* stream_consumer_create(struct stream* s,
+                                               struct stream_group* g,
+                                               const char* name, size_t len,
+                                               int64_t now) {
+  struct stream_consumer* c = calloc(1, sizeof(struct stream_consumer));
+  if (!c) {
+    return NULL;
+  }
+  c->name = malloc(len + 1);
+  c->pel = radix_new();
+  if (!c->name || !c->pel ||
+      dict_set(g->consumers, name, len, (char*)&c, sizeof(c)) == -1) {
+    free(c->name);
+    if (c->pel) radix_free(c->pel, NULL);
+    free(c);
+    return NULL;
+  }
+  memcpy(c->name, name, len);
+  c->name[len] = '\0';
+  c->namelen = len;
+  c->seen_time = now;
+  s->bytes += sizeof(struct stream_consumer) + len + c->pel->bytes;
+  return c;
+}
+
+// stream_consumer_delete deletes the consumer along with its pending
+// entries, and returns how many it had.
+uint64_t stream_consumer_delete(struct stream* s, struct stream_group* g,
+                                const char* name, size_t len) {
+  struct stream_consumer* c = stream_consumer_get(g, name, len);
+  if (!c) {
+    return 0;
+  }
+  size_t before = group_bytes(g);
+  uint64_t pending = c->pel->count;
+  for (struct radix_leaf* leaf = c->pel->first; leaf; leaf = leaf->next) {
+    struct radix_leaf* gleaf = radix_find(g->pel, leaf->key);
+    free(gleaf->value);
+    radix_delete(g->pel, gleaf);
+  }
+  dict_delete(g->consumers, name, len);
+  radix_free(c->pel, NULL);
+  free(c->name);
+  free(c);
+  s->bytes -= before - group_bytes(g);
+  return pending;
+}
+
+// stream_nack_add records the entry as delivered to the consumer, taking it
+// over from another consumer if it was pending there. Returns false when out
+// of memory.
+bool stream_nack_add(struct stream* s, struct stream_group* g,
+                     struct stream_consumer* c, struct stream_id id,
+                     int64_t now) {
+  unsigned char key[RADIX_KEYLEN];
+  stream_id_key(id, key);
+  size_t before = g->pel->bytes + c->pel->bytes;
+  struct radix_leaf* leaf = radix_find(g->pel, key);
+  struct stream_nack* nack;
+  if (leaf) {
+    nack = leaf->value;
+    if (nack->consumer != c) {
+      if (!radix_insert(c->pel, key, nack)) {
+        return false;
+      }
+      size_t obefore = nack->consumer->pel->bytes;
+      radix_delete(nack->consumer->pel,
+                   radix_find(nack->consumer->pel, key));
+      s->bytes -= obefore - nack->consumer->pel->bytes;
+      nack->consumer = c;
+    }
+    nack->delivery_count++;
+  } else {
+    nack = malloc(sizeof(struct stream_nack));
+    if (!nack || !radix_insert(g->pel, key, nack)) {
+      free(nack);
+      return false;
+    }
+    if (!radix_insert(c->pel, key, nack)) {
+      radix_delete(g->pel, radix_find(g->pel, key));
+      free(nack);
+      return false;
+    }
+    nack->consumer = c;
+    nack->delivery_count = 1;
+    s->bytes += sizeof(struct stream_nack);
+  }
+  nack->delivery_time = now;
+  s->bytes += g->pel->bytes + c->pel->bytes - before;
+  return true;
+}
+
+// stream_ack removes the entry from the PEL of the group. Returns false if
+// it was not pending.
+bool stream_ack(struct stream* s, struct stream_group* g,
+                struct stream_id id) {
+  unsigned char key[RADIX_KEYLEN];
+  stream_id_key(id, key);
+  struct radix_leaf* leaf = radix_find(g->pel, key);
+  if (!leaf) {
+    return false;
+  }
+  struct stream_nack* nack = leaf->value;
+  struct stream_consumer* c = nack->consumer;
+  size_t before = g->pel->bytes + c->pel->bytes;
+  radix_delete(c->pel, radix_find(c->pel, key));
+  radix_delete(g->pel, leaf);
+  free(nack);
+  s->bytes -= before - g->pel->bytes - c->pel->bytes;
+  s->bytes -= sizeof(struct stream_nack);
+  return true;
+}
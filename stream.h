@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict.h"
+#include "radix.h"
+
+// A stream is a log of entries, each a list of field-value pairs under an ID
+// of a millisecond time and a sequence number that only grows. Entries are
+// packed into listpack nodes of up to a configured number of entries or
+// bytes, indexed by a radix tree on the ID of the first entry they were
+// created with, their master ID. Each entry stores its ID as a delta from the
+// master ID, and only the values when its fields match those of the first
+// entry of the node, so entries of a log with a fixed schema cost a few bytes
+// over their values.
+
+struct stream_id {
+  uint64_t ms;
+  uint64_t seq;
+};
+
+struct stream {
+  struct radix* nodes;  // master ID to struct stream_node
+  uint64_t len;
+  struct stream_id last_id;
+  uint64_t entries_added;
+  struct dict* groups;  // name to struct stream_group*
+  size_t bytes;         // memory of the nodes and groups, not of the index
+};
+
+struct stream_node {
+  unsigned char* lp;
+  uint32_t count;
+};
+
+// stream_nack is an entry delivered to a consumer of a group that was not
+// acknowledged yet. It is in the PEL (pending entries list) of both.
+struct stream_nack {
+  struct stream_consumer* consumer;
+  int64_t delivery_time;  // ms
+  uint64_t delivery_count;
+};
+
+struct stream_consumer {
+  char* name;
+  size_t namelen;
+  int64_t seen_time;  // ms
+  struct radix* pel;  // ID to struct stream_nack, shared with the group
+};
+
+struct stream_group {
+  struct stream_id last_id;  // last entry delivered to the group
+  int64_t entries_read;
+  struct radix* pel;
+  struct dict* consumers;  // name to struct stream_consumer*
+};
+
+// stream_iter walks the entries between two IDs, in either direction.
+struct stream_iter {
+  struct stream* s;
+  struct stream_id start;
+  struct stream_id end;
+  bool rev;
+  struct radix_leaf* leaf;
+  unsigned char* p;  // header of the current entry
+  unsigned char* first;
+  struct stream_id master;
+  uint64_t nmaster;
+  // fields of the current entry
+  bool same;
+  uint64_t nfields;
+  unsigned char* fp;
+  unsigned char* mp;
+};
+
+#define STREAM_ID_MAX ((struct stream_id){UINT64_MAX, UINT64_MAX})
+
+int stream_id_cmp(struct stream_id a, struct stream_id b);
+bool stream_id_incr(struct stream_id* id);
+bool stream_id_decr(struct stream_id* id);
+bool stream_parse_id(const char* str, size_t len, uint64_t seq,
+                     struct stream_id* id, bool* seqgiven);
+int stream_format_id(char str[44], struct stream_id id);
+void stream_id_key(struct stream_id id, unsigned char key[RADIX_KEYLEN]);
+struct stream_id stream_key_id(const unsigned char* key);
+
+struct stream* stream_new(void);
+void stream_free(struct stream* s);
+size_t stream_memory(struct stream* s);
+bool stream_append(struct stream* s, struct stream_id id,
+                   const char** fields, const size_t* lens, uint64_t n,
+                   int64_t max_entries, int64_t max_bytes);
+struct stream_id stream_first_id(struct stream* s);
+int64_t stream_trim(struct stream* s, uint64_t maxlen, struct stream_id minid,
+                    bool approx, int64_t limit);
+
+void stream_iter_start(struct stream_iter* it, struct stream* s,
+                       struct stream_id start, struct stream_id end,
+                       bool rev);
+bool stream_iter_next(struct stream_iter* it, struct stream_id* id,
+                      uint64_t* nfields);
+void stream_iter_field(struct stream_iter* it, const char** field,
+                       size_t* flen, const char** val, size_t* vlen);
+
+struct stream_group* stream_group_get(struct stream* s, const char* name,
+                                      size_t len);
+struct stream_group* stream_group_create(struct stream* s, const char* name,
+                                         size_t len, struct stream_id id);
+bool stream_group_destroy(struct stream* s, const char* name, size_t len);
+struct stream_consumer* stream_consumer_get(struct stream_group* g,
+                                            const char* name, size_t len);
+struct stream_consumer* stream_consumer_create(struct stream* s,
+                                               struct stream_group* g,
+                                               const char* name, size_t len,
+                                               int64_t now);
+uint64_t stream_consumer_delete(struct stream* s, struct stream_group* g,
+                                const char* name, size_t len);
+bool stream_nack_add(struct stream* s, struct stream_group* g,
+                     struct stream_consumer* c, struct stream_id id,
+                     int64_t now);
+bool stream_ack(struct stream* s, struct stream_group* g,
+                struct stream_id id);
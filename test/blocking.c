@@ -0,0 +1,105 @@
+// blocking checks that clients blocked on keys are woken by the commands
+// that feed those keys, once each and in the order they blocked. Run with
+// the server binary, which it starts on a port of its own.
+
+#include "client.h"
+
+#define PORT 17491
+
+static void test_lists(int port) {
+  struct client* a = client_new(port);
+  struct client* b = client_new(port);
+  struct client* c = client_new(port);
+  client_send(a, "BLPOP l1 l2 0");
+  check_reply(a, NULL);
+  check(b, "RPUSH l2 x y", "2");
+  check_reply(a, "[l2 x]");
+  check(b, "LRANGE l2 0 -1", "[y]");
+
+  client_send(a, "BRPOP l3 0");
+  check_reply(a, NULL);
+  check(b, "RPUSH l3 x y", "2");
+  check_reply(a, "[l3 y]");
+
+  // clients blocked on a key are served in the order they blocked
+  client_send(a, "BLPOP l4 0");
+  client_send(c, "BLPOP l4 0");
+  check_reply(a, NULL);
+  check(b, "RPUSH l4 x", "1");
+  check_reply(a, "[l4 x]");
+  check_reply(c, NULL);
+  check(b, "RPUSH l4 y", "1");
+  check_reply(c, "[l4 y]");
+
+  // a key given twice is popped once
+  client_send(a, "BLPOP l5 l5 0");
+  check_reply(a, NULL);
+  check(b, "RPUSH l5 x y", "2");
+  check_reply(a, "[l5 x]");
+  check(b, "LLEN l5", "1");
+  check(a, "PING", "PONG");
+  check(b, "RPUSH l5 z", "2");
+  check_reply(a, NULL);
+
+  // the element moved by BLMOVE serves the clients blocked on its target
+  client_send(a, "BLMOVE l6 l7 LEFT RIGHT 0");
+  client_send(c, "BLPOP l7 0");
+  check_reply(a, NULL);
+  check(b, "RPUSH l6 x", "1");
+  check_reply(a, "x");
+  check_reply(c, "[l7 x]");
+  check(b, "LLEN l6", "0");
+  check(b, "LLEN l7", "0");
+
+  // a transaction serves the clients once it is done, with what it left
+  client_send(a, "BLPOP l8 0");
+  check_reply(a, NULL);
+  check(b, "MULTI", "OK");
+  check(b, "RPUSH l8 x", "QUEUED");
+  check(b, "DEL l8", "QUEUED");
+  check(b, "RPUSH l8 y", "QUEUED");
+  check(b, "EXEC", "[1 1 1]");
+  check_reply(a, "[l8 y]");
+
+  client_send(a, "BLPOP l9 0.1");
+  check_reply(a, "(nil)");
+  client_free(a);
+  client_free(b);
+  client_free(c);
+}
+
+static void test_xread(int port) {
+  struct client* a = client_new(port);
+  struct client* b = client_new(port);
+  client_send(a, "XREAD BLOCK 0 STREAMS s1 $");
+  check_reply(a, NULL);
+  check(b, "XADD s1 1-0 f v", "1-0");
+  check_reply(a, "[[s1 [[1-0 [f v]]]]]");
+
+  // a stream given twice is served once
+  client_send(a, "XREAD BLOCK 0 STREAMS s2 s2 $ $");
+  check_reply(a, NULL);
+  check(b, "XADD s2 1-0 x 1", "1-0");
+  check_reply(a, "[[s2 [[1-0 [x 1]]]]]");
+  check(a, "PING", "PONG");
+  check(b, "XADD s2 2-0 x 2", "2-0");
+  check_reply(a, NULL);
+  client_free(a);
+  client_free(b);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s server\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  pid_t pid = server_start(argv[1], PORT, NULL);
+  test_lists(PORT);
+  test_xread(PORT);
+  server_stop(pid);
+  if (failures) {
+    return EXIT_FAILURE;
+  }
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,267 @@
+// client.h holds the helpers of the tests that run against a server: they
+// start the server binary on a port, connect clients to it, and compare the
+// replies to commands with their rendering as text. Replies render as their
+// value, simple strings, errors and integers included, a null as "(nil)",
+// arrays as "[a b]", maps as "{k v}" and pushes as ">[a b]".
+
+// memmem
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../buf.h"
+
+#define REPLY_TIMEOUT 5000  // ms
+
+static int failures;
+
+struct client {
+  int fd;
+  char in[65536];
+  size_t len;
+  size_t start;
+};
+
+static void fatal(const char* what) {
+  fprintf(stderr, "%s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+static int dial_port(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    fatal("socket");
+  }
+  struct sockaddr_in sin = {.sin_family = AF_INET, .sin_port = htons(port)};
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) == -1) {
+    close(fd);
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+  return fd;
+}
+
+// server_start runs the server binary on the port with the options given
+// after it, NULL terminated, and waits until it accepts connections.
+static pid_t server_start(const char* bin, int port, ...) {
+  char sport[16];
+  snprintf(sport, sizeof(sport), "%d", port);
+  const char* argv[32] = {bin, sport};
+  int argc = 2;
+  va_list ap;
+  va_start(ap, port);
+  const char* arg;
+  while (argc < 31 && (arg = va_arg(ap, const char*))) {
+    argv[argc++] = arg;
+  }
+  va_end(ap);
+  pid_t pid = fork();
+  if (pid == -1) {
+    fatal("fork");
+  }
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    execv(bin, (char**)argv);
+    fatal(bin);
+  }
+  for (int i = 0; i < 500; i++) {
+    int fd = dial_port(port);
+    if (fd != -1) {
+      close(fd);
+      return pid;
+    }
+    usleep(10000);
+  }
+  fprintf(stderr, "%s did not start on port %d\n", bin, port);
+  kill(pid, SIGKILL);
+  exit(1);
+}
+
+static void server_stop(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+static struct client* client_new(int port) {
+  struct client* c = calloc(1, sizeof(struct client));
+  if (!c) {
+    fatal("calloc");
+  }
+  c->fd = dial_port(port);
+  if (c->fd == -1) {
+    fatal("connect");
+  }
+  return c;
+}
+
+static void client_free(struct client* c) {
+  close(c->fd);
+  free(c);
+}
+
+// client_send sends the command, whose arguments are separated by spaces.
+static void client_send(struct client* c, const char* cmd) {
+  struct buf out = {0};
+  struct buf args = {0};
+  int nargs = 0;
+  char hdr[32];
+  for (const char* p = cmd; *p;) {
+    while (*p == ' ') p++;
+    if (!*p) break;
+    size_t n = strcspn(p, " ");
+    snprintf(hdr, sizeof(hdr), "$%zu\r\n", n);
+    buf_append(&args, hdr, -1);
+    buf_append(&args, p, n);
+    buf_append(&args, "\r\n", 2);
+    nargs++;
+    p += n;
+  }
+  snprintf(hdr, sizeof(hdr), "*%d\r\n", nargs);
+  buf_append(&out, hdr, -1);
+  buf_append(&out, args.data, args.len);
+  for (size_t sent = 0; sent < out.len;) {
+    ssize_t n = write(c->fd, out.data + sent, out.len - sent);
+    if (n == -1) {
+      fatal("write");
+    }
+    sent += n;
+  }
+  buf_clear(&out);
+  buf_clear(&args);
+}
+
+// fill reads more input, waiting up to ms. Returns false on timeout.
+static bool fill(struct client* c, int ms) {
+  if (c->start > 0) {
+    memmove(c->in, c->in + c->start, c->len - c->start);
+    c->len -= c->start;
+    c->start = 0;
+  }
+  struct pollfd pfd = {.fd = c->fd, .events = POLLIN};
+  if (poll(&pfd, 1, ms) <= 0) {
+    return false;
+  }
+  ssize_t n = read(c->fd, c->in + c->len, sizeof(c->in) - c->len);
+  if (n <= 0) {
+    return false;
+  }
+  c->len += n;
+  return true;
+}
+
+// line returns the next line of input without its CRLF, or NULL on timeout.
+static char* line(struct client* c, int ms) {
+  for (;;) {
+    char* end = memmem(c->in + c->start, c->len - c->start, "\r\n", 2);
+    if (end) {
+      *end = '\0';
+      char* str = c->in + c->start;
+      c->start = end + 2 - c->in;
+      return str;
+    }
+    if (!fill(c, ms)) {
+      return NULL;
+    }
+  }
+}
+
+// render appends the next reply to out. Returns false on timeout.
+static bool render(struct client* c, struct buf* out, int ms) {
+  char* str = line(c, ms);
+  if (!str) {
+    return false;
+  }
+  char type = str[0];
+  long n = strtol(str + 1, NULL, 10);
+  switch (type) {
+    case '$':
+      if (n < 0) {
+        buf_append(out, "(nil)", -1);
+        return true;
+      }
+      while (c->len - c->start < (size_t)n + 2) {
+        if (!fill(c, ms)) {
+          return false;
+        }
+      }
+      buf_append(out, c->in + c->start, n);
+      c->start += n + 2;
+      return true;
+    case '*':
+    case '>':
+    case '%':
+    case '~': {
+      if (n < 0) {
+        buf_append(out, "(nil)", -1);
+        return true;
+      }
+      const char* open = type == '%' ? "{" : type == '>' ? ">[" : "[";
+      buf_append(out, open, -1);
+      long nelems = type == '%' ? n * 2 : n;
+      for (long i = 0; i < nelems; i++) {
+        if (i > 0) {
+          buf_append(out, " ", 1);
+        }
+        if (!render(c, out, ms)) {
+          return false;
+        }
+      }
+      buf_append(out, type == '%' ? "}" : "]", 1);
+      return true;
+    }
+    case '_':
+      buf_append(out, "(nil)", -1);
+      return true;
+    default:
+      buf_append(out, str + 1, -1);
+      return true;
+  }
+}
+
+// client_reply returns the rendering of the next reply, waiting up to ms,
+// or NULL if none came. The string is valid until the next call.
+static const char* client_reply(struct client* c, int ms) {
+  static struct buf out;
+  out.len = 0;
+  if (!render(c, &out, ms)) {
+    return NULL;
+  }
+  buf_append(&out, "", 1);
+  return out.data;
+}
+
+// check_reply compares the next reply of the client with want, or with no
+// reply at all when want is NULL, in which case it waits only briefly.
+#define check_reply(c, want) check_reply_at(c, want, __FILE__, __LINE__)
+
+static void check_reply_at(struct client* c, const char* want,
+                           const char* file, int lineno) {
+  const char* got = client_reply(c, want ? REPLY_TIMEOUT : 100);
+  if ((!got && !want) || (got && want && strcmp(got, want) == 0)) {
+    return;
+  }
+  fprintf(stderr, "%s:%d: got %s, want %s\n", file, lineno,
+          got ? got : "no reply", want ? want : "no reply");
+  failures++;
+}
+
+// check sends the command and compares its reply with want.
+#define check(c, cmd, want)  \
+  do {                       \
+    client_send(c, cmd);     \
+    check_reply(c, want);    \
+  } while (0)
@@ -0,0 +1,188 @@
+// cmap checks that readers searching a map without locks, while a writer
+// replaces and deletes its items and the map grows and shrinks, only find
+// items the epoch has not released, and that a reader inside a section holds
+// back the release of what was retired meanwhile. Released items are
+// poisoned rather than freed, so that a premature release is seen without a
+// sanitizer; the nodes and tables of the map are freed, for one to catch.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../cmap.h"
+#include "../epoch.h"
+
+#define NREADERS 4
+#define NKEYS 4096
+#define NWRITES 400000
+
+struct item {
+  uint64_t key;
+  _Atomic bool released;
+  struct item* next;  // in the graveyard
+};
+
+static struct epoch* epoch;
+static struct cmap* map;
+static _Atomic bool done;
+static _Atomic int failures;
+static struct item* graveyard;
+static pthread_mutex_t graveyard_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t item_hash(const void* item) {
+  uint64_t x = ((const struct item*)item)->key;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccd;
+  x ^= x >> 33;
+  return x;
+}
+
+static int item_compare(const void* a, const void* b) {
+  uint64_t ka = ((const struct item*)a)->key;
+  uint64_t kb = ((const struct item*)b)->key;
+  return ka < kb ? -1 : ka > kb;
+}
+
+static void item_release(void* ptr) {
+  struct item* item = ptr;
+  atomic_store(&item->released, true);
+  pthread_mutex_lock(&graveyard_lock);
+  item->next = graveyard;
+  graveyard = item;
+  pthread_mutex_unlock(&graveyard_lock);
+}
+
+static struct item* item_new(uint64_t key) {
+  struct item* item = calloc(1, sizeof(struct item));
+  if (!item) {
+    perror("calloc");
+    exit(1);
+  }
+  item->key = key;
+  return item;
+}
+
+static uint64_t rnd(uint64_t* seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  return *seed;
+}
+
+static void* reader_main(void* arg) {
+  uint64_t seed = (uintptr_t)arg * 0x9e3779b97f4a7c15 + 1;
+  struct epoch_reader* reader = epoch_register(epoch);
+  while (!atomic_load(&done)) {
+    epoch_enter(reader);
+    for (int i = 0; i < 64; i++) {
+      struct item key = {.key = rnd(&seed) % NKEYS};
+      struct item* item = cmap_get(map, &key);
+      if (!item) continue;
+      if (item->key != key.key || atomic_load(&item->released)) {
+        atomic_fetch_add(&failures, 1);
+      }
+    }
+    epoch_exit(reader);
+  }
+  return NULL;
+}
+
+// test_concurrent runs the readers against a writer that keeps replacing,
+// deleting and inserting items, and now and then empties most of the map so
+// that it shrinks and grows again.
+static void test_concurrent(void) {
+  pthread_t readers[NREADERS];
+  for (uintptr_t i = 0; i < NREADERS; i++) {
+    pthread_create(&readers[i], NULL, reader_main, (void*)i);
+  }
+  uint64_t seed = 42;
+  for (int i = 0; i < NWRITES; i++) {
+    uint64_t key = rnd(&seed) % NKEYS;
+    if (i % 50000 == 49999) {
+      for (uint64_t k = 0; k < NKEYS - 16; k++) {
+        struct item del = {.key = k};
+        epoch_retire(epoch, cmap_delete(map, &del), item_release);
+      }
+    } else if (rnd(&seed) % 4 == 0) {
+      struct item del = {.key = key};
+      epoch_retire(epoch, cmap_delete(map, &del), item_release);
+    } else {
+      void* prev;
+      if (!cmap_set(map, item_new(key), &prev)) {
+        perror("cmap_set");
+        exit(1);
+      }
+      epoch_retire(epoch, prev, item_release);
+    }
+    if (i % 64 == 0) {
+      epoch_collect(epoch);
+    }
+  }
+  atomic_store(&done, true);
+  for (int i = 0; i < NREADERS; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  if (atomic_load(&failures)) {
+    fprintf(stderr, "concurrent: readers found %d released items\n",
+            atomic_load(&failures));
+  }
+}
+
+// test_stalled checks that memory retired while a reader is inside a
+// section is released only once it leaves it.
+static void test_stalled(void) {
+  struct epoch_reader* reader = epoch_register(epoch);
+  for (int i = 0; i < 3; i++) {
+    epoch_collect(epoch);
+  }
+  epoch_enter(reader);
+  struct item* item = item_new(NKEYS);
+  epoch_retire(epoch, item, item_release);
+  for (int i = 0; i < 5; i++) {
+    epoch_collect(epoch);
+  }
+  if (atomic_load(&item->released)) {
+    fprintf(stderr, "stalled: released while a reader was inside\n");
+    atomic_fetch_add(&failures, 1);
+  }
+  epoch_exit(reader);
+  for (int i = 0; i < 3; i++) {
+    epoch_collect(epoch);
+  }
+  if (!atomic_load(&item->released) || epoch_pending(epoch) != 0) {
+    fprintf(stderr, "stalled: %zu pending once the reader left\n",
+            epoch_pending(epoch));
+    atomic_fetch_add(&failures, 1);
+  }
+}
+
+static bool free_item(void* item, void* udata) {
+  (void)udata;
+  free(item);
+  return true;
+}
+
+int main(void) {
+  epoch = epoch_new();
+  map = cmap_new(epoch, item_hash, item_compare);
+  if (!epoch || !map) {
+    perror("new");
+    return EXIT_FAILURE;
+  }
+  test_concurrent();
+  test_stalled();
+  cmap_scan(map, free_item, NULL);
+  cmap_free(map);
+  epoch_free(epoch);
+  while (graveyard) {
+    struct item* next = graveyard->next;
+    free(graveyard);
+    graveyard = next;
+  }
+  if (atomic_load(&failures)) {
+    return EXIT_FAILURE;
+  }
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+// intset checks the intersection of intsets, whichever of the SIMD, scalar
+// and galloping paths serves it, against the integers of one intset found in
+// the other. The paths are static, so intset.c is compiled into this program.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../intset.c"
+
+static int failures;
+static uint64_t seed = 0x9e3779b97f4a7c15;
+
+static uint64_t rnd(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+// fill returns an intset of len integers of the width, drawn from a range
+// of span integers, so that a small span makes intsets overlap.
+static struct intset* fill(uint32_t width, uint32_t len, uint32_t span) {
+  int64_t lo = width == 2 ? INT16_MIN : width == 4 ? INT32_MIN : INT64_MIN;
+  struct intset* is = is_new();
+  bool added;
+  while (is->len < len) {
+    int64_t value = (int64_t)(rnd() % span) - (int64_t)span / 2;
+    is = is_add(is, value, &added);
+  }
+  // the smallest integer of the width gives the intset that width
+  if (width > 2) {
+    is = is_add(is, lo, &added);
+  }
+  return is;
+}
+
+static void check(const char* name, const struct intset* a,
+                  const struct intset* b) {
+  struct intset* got = is_intersect(a, b);
+  const struct intset* small = a->len <= b->len ? a : b;
+  const struct intset* large = a->len <= b->len ? b : a;
+  uint32_t n = 0;
+  bool ok = got->width == (a->width < b->width ? a->width : b->width);
+  for (uint32_t i = 0; ok && i < small->len; i++) {
+    int64_t x = is_get(small, i);
+    if (is_find(large, x)) {
+      ok = n < got->len && is_get(got, n) == x;
+      n++;
+    }
+  }
+  if (!ok || n != got->len) {
+    fprintf(stderr, "%s: %u of %u and %u of %u: got %u of %u, want %u\n",
+            name, a->len, a->width, b->len, b->width, got->len, got->width,
+            n);
+    failures++;
+  }
+  is_free(got);
+}
+
+int main(void) {
+  const uint32_t widths[] = {2, 4, 8};
+  // lengths around the vector blocks and around the gallop threshold
+  const uint32_t lens[] = {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 100};
+  for (int round = 0; round < 20; round++) {
+    for (int wa = 0; wa < 3; wa++) {
+      for (int wb = 0; wb < 3; wb++) {
+        for (size_t la = 0; la < sizeof(lens) / sizeof(lens[0]); la++) {
+          for (size_t lb = 0; lb < sizeof(lens) / sizeof(lens[0]); lb++) {
+            uint32_t span = 2 * (lens[la] + lens[lb]) + 1;
+            struct intset* a = fill(widths[wa], lens[la], span);
+            struct intset* b = fill(widths[wb], lens[lb], span);
+            check("mixed", a, b);
+            is_free(a);
+            is_free(b);
+          }
+        }
+      }
+    }
+  }
+  for (int wa = 0; wa < 3; wa++) {
+    for (int wb = 0; wb < 3; wb++) {
+      for (uint32_t ratio = GALLOP_RATIO - 1; ratio <= GALLOP_RATIO + 1;
+           ratio++) {
+        struct intset* a = fill(widths[wa], 40, 4000);
+        struct intset* b = fill(widths[wb], 40 * ratio, 4000);
+        check("gallop", a, b);
+        check("gallop swapped", b, a);
+        is_free(a);
+        is_free(b);
+      }
+    }
+  }
+  // equal and disjoint intsets, and runs that end a block together
+  struct intset* a = fill(2, 1000, 30000);
+  check("same", a, a);
+  struct intset* b = is_new();
+  struct intset* c = is_new();
+  bool added;
+  for (int i = 0; i < 64; i++) {
+    b = is_add(b, 2 * i, &added);
+    c = is_add(c, 2 * i + 1, &added);
+  }
+  check("disjoint", b, c);
+  c = is_add(c, 14, &added);
+  c = is_add(c, 126, &added);
+  check("sparse", b, c);
+  is_free(a);
+  is_free(b);
+  is_free(c);
+  if (failures) {
+    return EXIT_FAILURE;
+  }
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+// iothreads checks that the I/O threads hand every connection back when more
+// of them are ready at once than their rings hold. Connections that keep
+// input in their sockets stay on the ready list of the edge-triggered loop,
+// so hundreds are ready in each iteration. It then checks the GETs the I/O
+// threads serve themselves, in order with the commands left to the main
+// thread. Run with a server binary built with a small SPSC_SIZE, which it
+// starts on a port of its own.
+
+#include "client.h"
+
+#define PORT 17493
+#define NCONNS 1000
+#define WRONGTYPE \
+  "WRONGTYPE Operation against a key holding the wrong kind of value"
+#define PIPELINE 160  // commands each, more than a 16kb read takes in
+
+// info_stat returns the field of INFO stats, or -1.
+static long long info_stat(struct client* c, const char* field) {
+  client_send(c, "INFO stats");
+  const char* info = client_reply(c, REPLY_TIMEOUT);
+  const char* p = info ? strstr(info, field) : NULL;
+  return p ? atoll(p + strlen(field)) : -1;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s server\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  pid_t pid = server_start(argv[1], PORT, "--io-threads", "4",
+                           "--edge-triggered", "yes", NULL);
+  struct client** conns = calloc(NCONNS, sizeof(struct client*));
+  for (int i = 0; i < NCONNS; i++) {
+    conns[i] = client_new(PORT);
+  }
+  char val[101];
+  memset(val, 'v', 100);
+  val[100] = '\0';
+  char cmd[160];
+  for (int i = 0; i < NCONNS; i++) {
+    for (int j = 0; j < PIPELINE; j++) {
+      snprintf(cmd, sizeof(cmd), "SET k:%d:%d %s", i, j, val);
+      client_send(conns[i], cmd);
+    }
+  }
+  for (int i = 0; i < NCONNS; i++) {
+    for (int j = 0; j < PIPELINE; j++) {
+      check_reply(conns[i], "OK");
+    }
+  }
+  char want[32];
+  snprintf(want, sizeof(want), "%d", NCONNS * PIPELINE);
+  check(conns[0], "DBSIZE", want);
+  if (info_stat(conns[0], "io_threaded_reads_processed:") <= 0) {
+    fprintf(stderr, "no reads were done by the I/O threads\n");
+    failures++;
+  }
+
+  // GETs of strings, of missing keys and of keys of another type, between
+  // writes that the main thread runs
+  check(conns[0], "RPUSH list x", "1");
+  for (int i = 0; i < NCONNS; i++) {
+    for (int j = 0; j < PIPELINE; j++) {
+      if (j % 8 == 5) {
+        snprintf(cmd, sizeof(cmd), "GET list");
+      } else if (j % 8 == 6) {
+        snprintf(cmd, sizeof(cmd), "GET k:%d:%d", i + NCONNS, j);
+      } else if (j % 8 == 7) {
+        snprintf(cmd, sizeof(cmd), "SET k:%d:%d new", i, j);
+      } else {
+        snprintf(cmd, sizeof(cmd), "GET k:%d:%d", i, j);
+      }
+      client_send(conns[i], cmd);
+    }
+  }
+  for (int i = 0; i < NCONNS; i++) {
+    for (int j = 0; j < PIPELINE; j++) {
+      check_reply(conns[i], j % 8 == 5   ? WRONGTYPE
+                            : j % 8 == 6 ? "(nil)"
+                            : j % 8 == 7 ? "OK"
+                                         : val);
+    }
+    snprintf(cmd, sizeof(cmd), "GET k:%d:7", i);
+    check(conns[i], cmd, "new");
+  }
+  if (info_stat(conns[0], "io_threaded_commands_processed:") <= 0) {
+    fprintf(stderr, "no GETs were served by the I/O threads\n");
+    failures++;
+  }
+  for (int i = 0; i < NCONNS; i++) {
+    client_free(conns[i]);
+  }
+  free(conns);
+  server_stop(pid);
+  if (failures) {
+    return EXIT_FAILURE;
+  }
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
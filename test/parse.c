@@ -0,0 +1,51 @@
+// parse checks the RESP parser against well-formed, incomplete and malformed
+// commands. The parser is static, so miniredis.c is compiled into this
+// program. Exits non-zero on the first failure.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../miniredis.c"
+
+static int failures;
+
+// check parses cmd and compares the result to want, the parsed length, 0 if
+// incomplete or -1 on error, and on success the number of arguments.
+static void check(const char* name, const char* cmd, size_t want,
+                  int nargs) {
+  struct miniredis_args args = {0};
+  size_t len = strlen(cmd);
+  char* data = malloc(len);
+  memcpy(data, cmd, len);
+  size_t got = resp_parse(data, len, NULL, &args);
+  if (got != want || (got != 0 && got != (size_t)-1 && args.len != nargs)) {
+    fprintf(stderr, "%s: parsed %zd (%d args), want %zd (%d args)\n", name,
+            (ssize_t)got, args.len, (ssize_t)want, nargs);
+    failures++;
+  }
+  for (int i = 0; i < args.cap; i++) {
+    buf_clear(&args.bufs[i]);
+  }
+  free(args.bufs);
+  free(args.items);
+  free(data);
+}
+
+int main(void) {
+  const char* get = "*2\r\n$3\r\nGET\r\n$1\r\nk\r\n";
+  check("get", get, strlen(get), 2);
+  check("empty bulk", "*1\r\n$0\r\n\r\n", 10, 1);
+  check("incomplete bulk", "*2\r\n$3\r\nGET\r\n$5\r\nab", 0, 0);
+  check("incomplete length", "*2\r\n$3\r\nGET\r\n$", 0, 0);
+  check("negative bulk length", "*2\r\n$3\r\nGET\r\n$-3\r\n", -1, 0);
+  check("null bulk", "*1\r\n$-1\r\n", -1, 0);
+  check("oversized bulk", "*1\r\n$99999999999\r\n", -1, 0);
+  check("missing dollar", "*1\r\n:1\r\n", -1, 0);
+  check("bad multibulk", "*x\r\n", -1, 0);
+  if (failures) {
+    return EXIT_FAILURE;
+  }
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
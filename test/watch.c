@@ -0,0 +1,139 @@
+// watch checks that the commands writing a key, in place or not, abort the
+// transactions watching it and invalidate it for the clients tracking it,
+// and that those which leave it as it was do neither. Run with the server
+// binary, which it starts on a port of its own.
+
+#include "client.h"
+
+#define PORT 17492
+
+static struct client* watcher;
+static struct client* tracker;
+static struct client* writer;
+
+// check_write runs the setup commands, separated by semicolons, then has
+// the watcher watch the key and the tracker run the read, and checks that
+// the write aborts the transaction and invalidates the key, or when changed
+// is false, that it does neither.
+#define check_write(key, setup, read, write, changed) \
+  check_write_at(key, setup, read, write, changed, __LINE__)
+
+static void check_write_at(const char* key, const char* setup,
+                           const char* read, const char* write, bool changed,
+                           int lineno) {
+  char cmd[256];
+  for (const char* p = setup; *p;) {
+    size_t n = strcspn(p, ";");
+    snprintf(cmd, sizeof(cmd), "%.*s", (int)n, p);
+    client_send(writer, cmd);
+    client_reply(writer, REPLY_TIMEOUT);
+    p += n + (p[n] == ';');
+  }
+  snprintf(cmd, sizeof(cmd), "WATCH %s", key);
+  check(watcher, cmd, "OK");
+  client_send(tracker, read);
+  client_reply(tracker, REPLY_TIMEOUT);
+  client_send(writer, write);
+  client_reply(writer, REPLY_TIMEOUT);
+  check(watcher, "MULTI", "OK");
+  check(watcher, "PING", "QUEUED");
+  client_send(watcher, "EXEC");
+  const char* got = client_reply(watcher, REPLY_TIMEOUT);
+  const char* want = changed ? "(nil)" : "[PONG]";
+  if (!got || strcmp(got, want) != 0) {
+    fprintf(stderr, "%s:%d: %s: EXEC got %s, want %s\n", __FILE__, lineno,
+            write, got ? got : "no reply", want);
+    failures++;
+  }
+  snprintf(cmd, sizeof(cmd), ">[invalidate [%s]]", key);
+  got = client_reply(tracker, changed ? REPLY_TIMEOUT : 100);
+  if (changed ? !got || strcmp(got, cmd) != 0 : got != NULL) {
+    fprintf(stderr, "%s:%d: %s: tracker got %s, want %s\n", __FILE__,
+            lineno, write, got ? got : "no push", changed ? cmd : "none");
+    failures++;
+  }
+  // the key is tracked again by the next read
+  check(writer, "FLUSHDB", "OK");
+  client_reply(tracker, 100);
+}
+
+static void test_collections(void) {
+  check_write("h", "HSET h f v", "HGET h f", "HDEL h f", true);
+  check_write("h", "HSET h f v;HSET h g v", "HGET h f", "HDEL h x", false);
+  check_write("s", "SADD s a b", "SCARD s", "SREM s a", true);
+  check_write("s", "SADD s a b", "SCARD s", "SREM s x", false);
+  check_write("s", "SADD s a b", "SCARD s", "SADD s c", true);
+  check_write("s", "SADD s a b", "SCARD s", "SADD s a", false);
+  check_write("z", "ZADD z 1 a 2 b", "ZCARD z", "ZREM z a", true);
+  check_write("z", "ZADD z 1 a 2 b", "ZCARD z", "ZREM z x", false);
+  check_write("z", "ZADD z 1 a", "ZCARD z", "ZADD z 2 a", true);
+  check_write("z", "ZADD z 1 a", "ZCARD z", "ZADD z 1 a", false);
+  check_write("z", "ZADD z 1 a", "ZCARD z", "ZADD z XX 1 b", false);
+}
+
+static void test_bitmaps(void) {
+  check_write("b", "SETBIT b 100 0", "GET b", "SETBIT b 3 1", true);
+  check_write("b", "SETBIT b 100 0", "GET b", "SETBIT b 200 1", true);
+  check_write("b", "SETBIT b 100 0", "GET b", "BITFIELD b SET u8 0 255",
+              true);
+  check_write("b", "SETBIT b 100 0", "GET b", "BITFIELD b INCRBY u8 8 1",
+              true);
+  check_write("b", "SETBIT b 100 0", "GET b", "BITFIELD b GET u8 0", false);
+}
+
+static void test_hyperloglogs(void) {
+  check_write("h", "PFADD h a", "GET h", "PFADD h b", true);
+  check_write("h", "PFADD h a;PFCOUNT h", "GET h", "PFADD h a", false);
+  // dense HyperLogLogs are updated in place
+  check_write("h", "CONFIG SET hll-sparse-max-bytes 0;PFADD h a;PFCOUNT h",
+              "GET h", "PFADD h b", true);
+  check_write("h", "PFADD h a;PFCOUNT h", "GET h", "PFADD h a", false);
+  // so is the cached cardinality
+  check_write("h", "PFADD h a", "GET h", "PFCOUNT h", true);
+  check_write("h", "PFADD h a;PFCOUNT h", "GET h", "PFCOUNT h", false);
+  check(writer, "CONFIG SET hll-sparse-max-bytes 3000", "OK");
+}
+
+static void test_streams(void) {
+  check_write("s", "XADD s 1-0 f v", "XLEN s", "XREAD STREAMS s 0", false);
+  check_write("s", "XADD s 1-0 f v;XGROUP CREATE s g 0", "XLEN s",
+              "XREADGROUP GROUP g c STREAMS s >", true);
+  check_write("s", "XADD s 1-0 f v;XGROUP CREATE s g $", "XLEN s",
+              "XREADGROUP GROUP g c STREAMS s >", false);
+  check_write("s", "XADD s 1-0 f v;XADD s 2-0 f v", "XLEN s",
+              "XTRIM s MAXLEN 1", true);
+  check_write("s", "XADD s 1-0 f v", "XLEN s", "XTRIM s MAXLEN 1", false);
+  check_write("s",
+              "XADD s 1-0 f v;XGROUP CREATE s g 0;"
+              "XREADGROUP GROUP g c STREAMS s >",
+              "XLEN s", "XACK s g 1-0", true);
+  check_write("s", "XADD s 1-0 f v;XGROUP CREATE s g 0", "XLEN s",
+              "XACK s g 1-0", false);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s server\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  pid_t pid = server_start(argv[1], PORT, NULL);
+  watcher = client_new(PORT);
+  tracker = client_new(PORT);
+  writer = client_new(PORT);
+  client_send(tracker, "HELLO 3");
+  client_reply(tracker, REPLY_TIMEOUT);
+  check(tracker, "CLIENT TRACKING on", "OK");
+  test_collections();
+  test_bitmaps();
+  test_hyperloglogs();
+  test_streams();
+  client_free(watcher);
+  client_free(tracker);
+  client_free(writer);
+  server_stop(pid);
+  if (failures) {
+    return EXIT_FAILURE;
+  }
+  printf("ok\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#include "tsc.h"
+
+#include <stdbool.h>
+#include <time.h>
+#ifdef __x86_64__
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#define CALIBRATE_NS 10000000
+
+static bool usetsc;
+static double ns_per_tick = 1;
+
+static uint64_t monotonic_ns(void) {
+  struct timespec tm;
+  clock_gettime(CLOCK_MONOTONIC, &tm);
+  return (uint64_t)tm.tv_sec * 1000000000 + tm.tv_nsec;
+}
+
+// tsc_init checks that the timestamp counter ticks at a constant rate,
+// whatever the frequency and sleep states of the core, and measures that rate
+// against CLOCK_MONOTONIC.
+void tsc_init(void) {
+#ifdef __x86_64__
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+    return;
+  }
+  uint64_t ns0 = monotonic_ns();
+  uint64_t t0 = __rdtsc();
+  struct timespec ts = {0, CALIBRATE_NS};
+  nanosleep(&ts, NULL);
+  uint64_t ns1 = monotonic_ns();
+  uint64_t t1 = __rdtsc();
+  if (t1 <= t0 || ns1 <= ns0) {
+    return;
+  }
+  ns_per_tick = (double)(ns1 - ns0) / (t1 - t0);
+  usetsc = true;
+#endif
+}
+
+uint64_t tsc_now(void) {
+#ifdef __x86_64__
+  if (usetsc) {
+    return __rdtsc();
+  }
+#endif
+  return monotonic_ns();
+}
+
+// tsc_ns converts an interval in ticks to nanoseconds.
+int64_t tsc_ns(uint64_t ticks) { return ticks * ns_per_tick; }
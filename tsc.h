@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// tsc is a cheap clock for timing short intervals. On x86-64 CPUs with an
+// invariant timestamp counter it reads the counter with rdtsc, which takes a
+// few nanoseconds and no system call, and converts ticks to nanoseconds with
+// a rate calibrated at startup. Elsewhere ticks are CLOCK_MONOTONIC
+// nanoseconds.
+
+void tsc_init(void);
+uint64_t tsc_now(void);
+int64_t tsc_ns(uint64_t ticks);